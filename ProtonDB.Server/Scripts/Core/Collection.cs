@@ -23,6 +23,7 @@
 //
 //  Usage Example:
 //      var collections = Collection.List("myDatabase", session);
+//      var created = Collection.Create("events, lsm", session);
 // -------------------------------------------------------------------------------------------------
 
 namespace ProtonDB.Server {
@@ -33,11 +34,20 @@ namespace ProtonDB.Server {
         public static class Collection {
             /// <summary>
             /// Creates a new collection in the current database.
+            /// An optional storage name after a comma selects how its documents are stored,
+            /// e.g. "logs, lsm" for a log-structured collection suited to heavy inserts.
             /// </summary>
-            /// <param name="name">The name of the collection to create.</param>
+            /// <param name="argument">The name of the collection to create, optionally followed by its storage.</param>
             /// <param name="session">The current query session.</param>
             /// <returns>Result messages from the operation.</returns>
-            public static string[] Create(string name, QuerySession session) => Linker(name, StorageEngine.create_collection, session);
+            public static string[] Create(string argument, QuerySession session) {
+                var args = (argument ?? string.Empty).Split(',').Select(s => s.Trim().Trim('"')).ToArray();
+                if (args.Length > 2) {
+                    return ["Invalid Argument"];
+                }
+
+                return Linker(args[0], StorageEngine.create_collection, session, (args.Length == 2) ? args[1] : null);
+            }
 
             /// <summary>
             /// Drops an existing collection from the current database.
@@ -89,8 +99,9 @@ namespace ProtonDB.Server {
             /// <param name="name">The collection name.</param>
             /// <param name="func">The StorageEngine function to execute.</param>
             /// <param name="session">The current query session.</param>
+            /// <param name="data">Optional data passed along with the collection name.</param>
             /// <returns>Result messages from the operation.</returns>
-            private static string[] Linker(string name, Func<QueryConfig, Output> func, QuerySession session) {
+            private static string[] Linker(string name, Func<QueryConfig, Output> func, QuerySession session, string? data = null) {
                 if (string.IsNullOrEmpty(name)) {
                     return ["fatal: Collection name cannot be empty"];
                 }
@@ -98,6 +109,7 @@ namespace ProtonDB.Server {
                     new QueryConfig {
                         databaseName = session.CurrentDatabase,
                         collectionName = name,
+                        data = data,
                     },
                     func
                 );
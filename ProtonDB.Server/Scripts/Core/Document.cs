@@ -10,15 +10,34 @@
 //  Public Methods:
 //      - Insert: Inserts a document into a collection.
 //      - Remove: Removes documents from a collection, with optional condition support.
-//      - Print: Retrieves documents from a collection, with optional condition support.
+//      - Print: Retrieves documents from a collection, with optional condition support and an
+//        optional field list that limits the fields printed.
 //      - Update: Updates documents in a collection, supporting actions (add, drop, alter)
 //        and optional conditions.
+//      - PrintById: Retrieves the document with the given engine-assigned _id.
+//      - RemoveById: Removes the document with the given _id.
+//      - UpdateById: Updates the document with the given _id, supporting actions (add, drop, alter).
+//      - Index: Creates a hash index on a document key, used by equality conditions.
+//      - DropIndex: Drops the hash index on a document key.
+//      - RangeIndex: Creates an ordered index on a numeric document key, used by range conditions.
+//      - DropRangeIndex: Drops the ordered index on a document key.
+//      - BloomFilter: Keeps Bloom filters on a document key in the segments of an LSM collection.
+//      - DropBloomFilter: Drops the Bloom filters on a document key.
+//      - ZoneMap: Keeps per-block bounds of a numeric document key, used to skip blocks in range scans.
+//      - DropZoneMap: Drops the zone map on a document key.
+//      - Column: Keeps a numeric document key in a shadow column that filters on the key run over.
+//      - DropColumn: Drops the shadow column on a document key.
 //
 //  Internal Methods:
 //      - ParseUpdateArgument: Parses update command arguments into action, data, and condition.
-//      - ConditionParser: Parses a condition string into key, value, and condition operator.
+//      - ProjectionParser: Splits a leading field list, e.g. [name, address.city], off a print argument.
+//      - ConditionParser: Parses a filter expression into a single condition or a filter tree.
+//        Conditions combine with && (and), || (or), ! (not) and parentheses, and keys may be
+//        dotted paths into nested objects, e.g. age>30 && (address.city=Paris || !vip=true).
+//      - ReadOr, ReadAnd, ReadUnary, ReadTerm: Recursive descent over a filter expression.
 //      - GetAction: Maps string to Action enum.
 //      - GetCondition: Maps string to Condition enum.
+//      - Linker: Runs a StorageEngine operation on the document key given as the argument.
 //
 //  Dependencies:
 //      - Query: Represents a parsed user query (object, argument, etc.).
@@ -33,6 +52,7 @@
 
 using Kisetsu.Utils;
 using System.Text;
+using System.Text.Json.Nodes;
 using System.Text.RegularExpressions;
 using static ProtonDB.Server.Core.Parser;
 
@@ -97,6 +117,7 @@ namespace ProtonDB.Server {
                             collectionName = query.Object,
                             key = condition.Value.key,
                             value = condition.Value.value,
+                            filter = condition.Value.filter,
                             condition = condition.Value.condition
                         },
                         StorageEngine.remove_documents
@@ -107,24 +128,31 @@ namespace ProtonDB.Server {
             /// <summary>
             /// Retrieves documents from the specified collection.
             /// If no argument is provided, prints all documents; otherwise, prints documents matching the condition.
+            /// A leading field list, e.g. [name, address.city], prints only those fields of each document.
             /// </summary>
-            /// <param name="query">The query containing the collection and optional condition.</param>
+            /// <param name="query">The query containing the collection, optional field list and optional condition.</param>
             /// <param name="session">The current query session.</param>
             /// <returns>Document data or error messages.</returns>
             public static string[] Print(Query query, QuerySession session) {
                 Result result = new();
-                if (query.Argument == null) {
+                var argument = ProjectionParser(query.Argument);
+                if (argument == null) {
+                    return ["Invalid field list format. Use: [key, key] or [key, key], condition "];
+                }
+
+                if (argument.Value.condition == null) {
                     result = StorageEngine.Link(
                         new QueryConfig {
                             databaseName = session.CurrentDatabase,
-                            collectionName = query.Object
+                            collectionName = query.Object,
+                            projection = argument.Value.projection
                         },
-                        StorageEngine.print_all_documents
+                        StorageEngine.print_packed_documents
                     );
                     return result.GetOutput();
                 }
 
-                var condition = ConditionParser(query.Argument);
+                var condition = ConditionParser(argument.Value.condition);
                 if (condition == null) {
                     return ["Invalid condition format. Use: key<condition>value "];
                 }
@@ -135,9 +163,11 @@ namespace ProtonDB.Server {
                             collectionName = query.Object,
                             key = condition.Value.key,
                             value = condition.Value.value,
+                            filter = condition.Value.filter,
+                            projection = argument.Value.projection,
                             condition = condition.Value.condition
                         },
-                        StorageEngine.print_documents
+                        StorageEngine.print_packed_documents
                     );
                 return result.GetOutput();
             }
@@ -186,6 +216,7 @@ namespace ProtonDB.Server {
                         collectionName = query.Object,
                         key = condition.Value.key,
                         value = condition.Value.value,
+                        filter = condition.Value.filter,
                         condition = condition.Value.condition,
                         action = action,
                         data = data
@@ -195,6 +226,166 @@ namespace ProtonDB.Server {
                 return result.GetOutput();
             }
 
+            /// <summary>
+            /// Retrieves the document with the given _id from the specified collection.
+            /// Ids are assigned by the engine on insert and located through the collection's id index.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the document id.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Document data or error messages.</returns>
+            public static string[] PrintById(Query query, QuerySession session) {
+                if (query.Argument == null) {
+                    return ["PrintById requires an id argument"];
+                }
+
+                Result result = StorageEngine.Link(
+                    new QueryConfig {
+                        databaseName = session.CurrentDatabase,
+                        collectionName = query.Object,
+                        value = query.Argument.Strip(' ')
+                    },
+                    StorageEngine.print_packed_document_by_id
+                );
+                return result.GetOutput();
+            }
+
+            /// <summary>
+            /// Removes the document with the given _id from the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the document id.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] RemoveById(Query query, QuerySession session) {
+                if (query.Argument == null) {
+                    return ["RemoveById requires an id argument"];
+                }
+
+                Result result = StorageEngine.Link(
+                    new QueryConfig {
+                        databaseName = session.CurrentDatabase,
+                        collectionName = query.Object,
+                        value = query.Argument.Strip(' ')
+                    },
+                    StorageEngine.remove_document_by_id
+                );
+                return result.GetOutput();
+            }
+
+            /// <summary>
+            /// Updates the document with the given _id in the specified collection.
+            /// Takes the same arguments as Update, with the id in place of the condition.
+            /// </summary>
+            /// <param name="query">The query containing the collection, update data, and document id.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] UpdateById(Query query, QuerySession session) {
+                if (query.Argument == null) {
+                    return ["UpdateById requires a document argument"];
+                }
+                var component = ParseUpdateArgument(query.Argument, out string[] error);
+                if (component == null) return error;
+                if (component.Value.condition == null) {
+                    return ["Invalid update format. Use: action,data,id"];
+                }
+
+                Result result = StorageEngine.Link(
+                    new QueryConfig {
+                        databaseName = session.CurrentDatabase,
+                        collectionName = query.Object,
+                        value = component.Value.condition,
+                        action = component.Value.action,
+                        data = component.Value.data
+                    },
+                    StorageEngine.update_document_by_id
+                );
+                return result.GetOutput();
+            }
+
+            /// <summary>
+            /// Creates a hash index on a document key of the specified collection.
+            /// Equality conditions on the key are then answered from the index instead of a full scan.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the key to index.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] Index(Query query, QuerySession session) => Linker("Index", StorageEngine.create_index, query, session);
+
+            /// <summary>
+            /// Drops the hash index on a document key of the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the indexed key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] DropIndex(Query query, QuerySession session) => Linker("DropIndex", StorageEngine.drop_index, query, session);
+
+            /// <summary>
+            /// Creates an ordered index on the numeric values of a document key of the specified collection.
+            /// Range conditions (&lt;, &lt;=, &gt;, &gt;=) on the key then read only the matching documents.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the key to index.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] RangeIndex(Query query, QuerySession session) => Linker("RangeIndex", StorageEngine.create_range_index, query, session);
+
+            /// <summary>
+            /// Drops the ordered index on a document key of the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the indexed key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] DropRangeIndex(Query query, QuerySession session) => Linker("DropRangeIndex", StorageEngine.drop_range_index, query, session);
+
+            /// <summary>
+            /// Keeps Bloom filters on the values of a document key in the segments of the specified
+            /// LSM collection. Equality conditions on the key then skip segments that cannot match.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the key to filter.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] BloomFilter(Query query, QuerySession session) => Linker("BloomFilter", StorageEngine.create_bloom_filter, query, session);
+
+            /// <summary>
+            /// Drops the Bloom filters on a document key of the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the filtered key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] DropBloomFilter(Query query, QuerySession session) => Linker("DropBloomFilter", StorageEngine.drop_bloom_filter, query, session);
+
+            /// <summary>
+            /// Keeps the smallest and largest value of a numeric document key per block of the
+            /// specified collection. Range conditions on the key then skip blocks that cannot match.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the key to map.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] ZoneMap(Query query, QuerySession session) => Linker("ZoneMap", StorageEngine.create_zone_map, query, session);
+
+            /// <summary>
+            /// Drops the zone map on a document key of the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the mapped key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] DropZoneMap(Query query, QuerySession session) => Linker("DropZoneMap", StorageEngine.drop_zone_map, query, session);
+
+            /// <summary>
+            /// Keeps the numbers of a document key in a shadow column of the specified collection.
+            /// Range and not-equal conditions on the key then run over the column.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the key to store.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] Column(Query query, QuerySession session) => Linker("Column", StorageEngine.create_column, query, session);
+
+            /// <summary>
+            /// Drops the shadow column on a document key of the specified collection.
+            /// </summary>
+            /// <param name="query">The query containing the collection and the stored key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            public static string[] DropColumn(Query query, QuerySession session) => Linker("DropColumn", StorageEngine.drop_column, query, session);
+
             /// <summary>
             /// Represents the parsing state for update arguments.
             /// </summary>
@@ -277,22 +468,133 @@ namespace ProtonDB.Server {
             }
 
             /// <summary>
-            /// Parses a condition string into key, value, and condition operator.
+            /// Splits a leading field list off a print argument, e.g. [name, address.city], age>30.
+            /// The fields are passed to the storage engine, which builds only those of each document.
             /// </summary>
-            /// <param name="argument">The condition string.</param>
-            /// <returns>Tuple of key, value, and condition; or null if invalid.</returns>
-            private static (string key, string value, Condition condition)? ConditionParser(string argument) {
-                argument = argument.Strip(' ');
-                var match = Regex.Match(argument, @"^(?<key>\w+)(?<condition>>=|<=|=|>|<|!=)(?<value>.+)$");
+            /// <param name="argument">The print argument, if any.</param>
+            /// <returns>Tuple of comma-separated fields and the remaining condition; or null if invalid.</returns>
+            private static (string? projection, string? condition)? ProjectionParser(string? argument) {
+                string text = argument?.Trim() ?? "";
+                if (!text.StartsWith('[')) return (null, argument);
 
-                if (!match.Success)
+                int end = text.IndexOf(']');
+                if (end < 0) return null;
+                string projection = text[1..end].Trim();
+                string condition = text[(end + 1)..].Trim();
+                if (condition.StartsWith(',')) {
+                    condition = condition[1..].Trim();
+                    if (condition.Length == 0) return null;
+                } else if (condition.Length > 0) {
                     return null;
+                }
+
+                return (projection.Length > 0 ? projection : null, condition.Length > 0 ? condition : null);
+            }
+
+            /// <summary>
+            /// Parses a filter expression into key, value, and condition operator, or into a filter tree.
+            /// A single condition is passed to the storage engine as is; conditions combined with
+            /// &&, ||, ! and parentheses are passed as a JSON filter tree for the engine to evaluate.
+            /// </summary>
+            /// <param name="argument">The filter expression.</param>
+            /// <returns>Tuple of key, value, condition, and filter tree; or null if invalid.</returns>
+            private static (string? key, string? value, Condition condition, string? filter)? ConditionParser(string argument) {
+                argument = argument.Strip(' ');
+                int position = 0;
+                var node = ReadOr(argument, ref position);
+                if (node == null || position != argument.Length) return null;
+
+                if (node["key"] != null) {
+                    return ((string)node["key"]!, (string)node["value"]!, (Condition)(int)node["condition"]!, null);
+                }
+                return (null, null, Condition.all, node.ToJsonString());
+            }
+
+            /// <summary>
+            /// Reads conditions joined by || into an "or" node.
+            /// </summary>
+            /// <param name="text">The filter expression.</param>
+            /// <param name="position">The position to read from; advanced past what was read.</param>
+            /// <returns>The filter node, or null if the expression is invalid.</returns>
+            private static JsonObject? ReadOr(string text, ref int position) {
+                List<JsonNode> terms = [];
+                do {
+                    var term = ReadAnd(text, ref position);
+                    if (term == null) return null;
+                    terms.Add(term);
+                } while (Accept(text, "||", ref position));
+
+                return terms.Count == 1 ? (JsonObject)terms[0] : new JsonObject { ["or"] = new JsonArray([.. terms]) };
+            }
+
+            /// <summary>
+            /// Reads conditions joined by && into an "and" node.
+            /// </summary>
+            /// <param name="text">The filter expression.</param>
+            /// <param name="position">The position to read from; advanced past what was read.</param>
+            /// <returns>The filter node, or null if the expression is invalid.</returns>
+            private static JsonObject? ReadAnd(string text, ref int position) {
+                List<JsonNode> terms = [];
+                do {
+                    var term = ReadUnary(text, ref position);
+                    if (term == null) return null;
+                    terms.Add(term);
+                } while (Accept(text, "&&", ref position));
+
+                return terms.Count == 1 ? (JsonObject)terms[0] : new JsonObject { ["and"] = new JsonArray([.. terms]) };
+            }
+
+            /// <summary>
+            /// Reads a negated condition, a parenthesized expression, or a single condition.
+            /// </summary>
+            /// <param name="text">The filter expression.</param>
+            /// <param name="position">The position to read from; advanced past what was read.</param>
+            /// <returns>The filter node, or null if the expression is invalid.</returns>
+            private static JsonObject? ReadUnary(string text, ref int position) {
+                if (Accept(text, "!", ref position)) {
+                    var term = ReadUnary(text, ref position);
+                    return term == null ? null : new JsonObject { ["not"] = term };
+                }
+                if (Accept(text, "(", ref position)) {
+                    var inner = ReadOr(text, ref position);
+                    return inner != null && Accept(text, ")", ref position) ? inner : null;
+                }
+                return ReadTerm(text, ref position);
+            }
+
+            /// <summary>
+            /// Reads a single key<condition>value comparison. Values end at &&, || or a closing
+            /// parenthesis unless they are quoted.
+            /// </summary>
+            /// <param name="text">The filter expression.</param>
+            /// <param name="position">The position to read from; advanced past what was read.</param>
+            /// <returns>The filter node, or null if the comparison is invalid.</returns>
+            private static JsonObject? ReadTerm(string text, ref int position) {
+                var match = Regex.Match(text[position..], @"^(?<key>\w+(\.\w+)*)(?<condition>>=|<=|!=|=|>|<)(?<value>""[^""]*""|((?!&&|\|\||\)).)+)");
+                if (!match.Success) return null;
 
-                var key = match.Groups["key"].Value;
-                var value = match.Groups["value"].Value.Trim('"');
                 var condition = GetCondition(match.Groups["condition"].Value);
                 if (condition == Condition.invalid) return null;
-                return (key, value, condition);
+
+                position += match.Length;
+                return new JsonObject {
+                    ["key"] = match.Groups["key"].Value,
+                    ["condition"] = (int)condition,
+                    ["value"] = match.Groups["value"].Value.Trim('"')
+                };
+            }
+
+            /// <summary>
+            /// Advances past a token if the expression continues with it.
+            /// </summary>
+            /// <param name="text">The filter expression.</param>
+            /// <param name="token">The expected token.</param>
+            /// <param name="position">The position to read from; advanced past the token if present.</param>
+            /// <returns>True if the token was present.</returns>
+            private static bool Accept(string text, string token, ref int position) {
+                if (string.CompareOrdinal(text, position, token, 0, token.Length) != 0) return false;
+                position += token.Length;
+                return true;
             }
 
             /// <summary>
@@ -322,6 +624,30 @@ namespace ProtonDB.Server {
                 _ => Condition.invalid,
             };
 
+            /// <summary>
+            /// Helper method to invoke a StorageEngine operation on the document key given as the argument.
+            /// </summary>
+            /// <param name="command">The command name, used in the error for a missing key.</param>
+            /// <param name="func">The StorageEngine function to execute.</param>
+            /// <param name="query">The query containing the collection and the key.</param>
+            /// <param name="session">The current query session.</param>
+            /// <returns>Status or error messages.</returns>
+            private static string[] Linker(string command, Func<QueryConfig, Output> func, Query query, QuerySession session) {
+                if (query.Argument == null) {
+                    return [$"{command} requires a key argument"];
+                }
+
+                Result result = StorageEngine.Link(
+                    new QueryConfig {
+                        databaseName = session.CurrentDatabase,
+                        collectionName = query.Object,
+                        key = query.Argument.Strip(' ')
+                    },
+                    func
+                );
+                return result.GetOutput();
+            }
+
         }
     }
 }
\ No newline at end of file
@@ -17,7 +17,9 @@
 //      - Parse: Uses regular expressions to extract the object, operation, and argument from the input string.
 //      - ExecuteDatabaseCommand: Handles database-level commands (use, create, drop, list).
 //      - ExecuteCollectionCommand: Handles collection-level commands (create, drop, list).
-//      - ExecuteDocumentCommand: Handles document-level commands (insert, remove, update, print).
+//      - ExecuteDocumentCommand: Handles document-level commands (insert, remove, update, print,
+//        printById, removeById, updateById, index, dropIndex, rangeIndex, dropRangeIndex,
+//        bloomFilter, dropBloomFilter, zoneMap, dropZoneMap, column, dropColumn).
 //      - ExecuteProfileCommand: Handles profile-level commands (create, delete, grant, revoke, list).
 //
 //  Dependencies:
@@ -125,6 +127,19 @@ namespace ProtonDB.Server {
                     Token.remove => Document.Remove(query, s),
                     Token.update => Document.Update(query, s),
                     Token.print => Document.Print(query, s),
+                    Token.printById => Document.PrintById(query, s),
+                    Token.removeById => Document.RemoveById(query, s),
+                    Token.updateById => Document.UpdateById(query, s),
+                    Token.index => Document.Index(query, s),
+                    Token.dropIndex => Document.DropIndex(query, s),
+                    Token.rangeIndex => Document.RangeIndex(query, s),
+                    Token.dropRangeIndex => Document.DropRangeIndex(query, s),
+                    Token.bloomFilter => Document.BloomFilter(query, s),
+                    Token.dropBloomFilter => Document.DropBloomFilter(query, s),
+                    Token.zoneMap => Document.ZoneMap(query, s),
+                    Token.dropZoneMap => Document.DropZoneMap(query, s),
+                    Token.column => Document.Column(query, s),
+                    Token.dropColumn => Document.DropColumn(query, s),
                     _ => ["Invalid document command"]
                 };
             }
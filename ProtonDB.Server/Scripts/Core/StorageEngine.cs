@@ -13,22 +13,33 @@
 //      - Action: Specifies actions for document updates (add, drop, alter).
 //
 //  Public Structs:
-//      - QueryConfig: Configuration for storage engine operations (database, collection, key, etc.).
-//      - Result: Encapsulates the result of a storage operation, including success, data, and error.
+//      - QueryConfig: Configuration for storage engine operations (database, collection, key, filter, projection, paging, etc.).
+//      - Result: Encapsulates the result of a storage operation, including success, data, error, and
+//        the resume token of a paged read.
 //      - Output: Marshaled output from native storage engine functions (single result).
 //      - ArrayOut: Marshaled output for array results from native storage engine functions.
+//      - PackedOut: Marshaled output for documents printed into a single native block.
+//      - BufferPoolStats: Counters of the native page buffer pool.
+//
+//  Public Delegates:
+//      - DocumentVisitor: Receives each matching document of visit_documents as compact JSON.
 //
 //  Public Methods:
-//      - Link: Executes a storage engine operation and returns a Result (overloads for Output/ArrayOut).
+//      - Link: Executes a storage engine operation and returns a Result (overloads for Output/ArrayOut/PackedOut).
 //      - ListDatabase: Returns a list of all databases from the storage engine.
 //
 //  Native Methods (DllImport):
 //      - create_database, drop_database, list_database, create_collection, drop_collection, list_collection
-//      - insert_document, remove_all_documents, remove_documents, print_all_documents, print_documents
-//      - update_all_documents, update_documents, free_list
+//      - insert_document, remove_all_documents, remove_documents, print_all_documents, print_documents, visit_documents
+//      - print_packed_documents, print_packed_document_by_id
+//      - update_all_documents, update_documents, print_document_by_id, remove_document_by_id
+//      - update_document_by_id, create_index, drop_index, create_range_index, drop_range_index
+//      - create_bloom_filter, drop_bloom_filter, create_zone_map, drop_zone_map, create_column, drop_column
+//      - configure_cache, configure_buffer_pool, buffer_pool_stats, configure_compaction, free_list, free_packed
 //
 //  Internal Methods:
 //      - GetArray: Converts unmanaged array pointers to managed string arrays.
+//      - GetPacked: Converts a packed block of documents to a managed string array.
 //
 //  Dependencies:
 //      - Kisetsu.Utils: Utility extensions.
@@ -77,6 +88,11 @@ namespace ProtonDB.Server {
             public string? collectionName;
             public string? key;
             public string? value;
+            public string? filter;
+            public string? projection;
+            public string? resume;
+            public int limit;
+            public int offset;
             public string? data;
             public Condition condition;
             public Action action;
@@ -89,6 +105,7 @@ namespace ProtonDB.Server {
             public bool success;
             public string[] data;
             public string? error;
+            public string? resume;
 
             /// <summary>
             /// Returns the output data or error message, optionally appending a custom message.
@@ -124,8 +141,47 @@ namespace ProtonDB.Server {
             [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 384)]
             public string? message;
             public IntPtr list;
+            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+            public string? resume;
         }
 
+        /// <summary>
+        /// Marshaled output for documents printed into a single native block: their compact JSON
+        /// one after another, then a table of an offset and a length (two uint32) per document.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct PackedOut {
+            public int size;
+            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 384)]
+            public string? message;
+            public IntPtr block;
+            public IntPtr entries;
+            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+            public string? resume;
+        }
+
+        /// <summary>
+        /// Counters of the native page buffer pool, for sizing it to the working set.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct BufferPoolStats {
+            public long hits;
+            public long misses;
+            public long evictions;
+            public long writeBacks;
+            public long usedBytes;
+            public long limitBytes;
+        }
+
+        /// <summary>
+        /// Receives each matching document of visit_documents as compact JSON. The text lives in a
+        /// native buffer reused for the next document, so copy what is needed before returning.
+        /// </summary>
+        /// <returns>False to end the query.</returns>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        [return: MarshalAs(UnmanagedType.I1)]
+        public delegate bool DocumentVisitor(IntPtr document, nuint length, IntPtr context);
+
         /// <summary>
         /// Provides interop bindings and utility methods for the native storage engine.
         /// </summary>
@@ -168,7 +224,28 @@ namespace ProtonDB.Server {
                 return new Result {
                     success = arrayOut.size > 0,
                     data = data,
-                    error = arrayOut.size > 0 ? null : arrayOut.message
+                    error = arrayOut.size > 0 ? null : arrayOut.message,
+                    resume = string.IsNullOrEmpty(arrayOut.resume) ? null : arrayOut.resume
+                };
+            }
+
+            /// <summary>
+            /// Executes a storage engine operation returning PackedOut and wraps the result.
+            /// </summary>
+            /// <param name="config">The query configuration.</param>
+            /// <param name="func">The storage engine function to call.</param>
+            /// <returns>A Result object with operation outcome.</returns>
+            public static Result Link(QueryConfig config, Func<QueryConfig, PackedOut> func) {
+                if ((config.databaseName == null && config.collectionName == null) || config.databaseName == null) return nullConfig;
+                PackedOut packedOut = func(config);
+                string[] data = packedOut.size > 0 && packedOut.block != IntPtr.Zero
+                    ? GetPacked(packedOut)
+                    : [];
+                return new Result {
+                    success = packedOut.size > 0,
+                    data = data,
+                    error = packedOut.size > 0 ? null : packedOut.message,
+                    resume = string.IsNullOrEmpty(packedOut.resume) ? null : packedOut.resume
                 };
             }
 
@@ -201,6 +278,23 @@ namespace ProtonDB.Server {
                 return array;
             }
 
+            /// <summary>
+            /// Converts a packed block of documents to a managed string array and frees the block.
+            /// Each document is decoded straight from the block, with no native call per document.
+            /// </summary>
+            /// <param name="packedOut">The packed output holding the block and its table.</param>
+            /// <returns>Managed string array.</returns>
+            private static string[] GetPacked(PackedOut packedOut) {
+                string[] array = new string[packedOut.size];
+                for (int i = 0; i < packedOut.size; i++) {
+                    uint offset = (uint)Marshal.ReadInt32(packedOut.entries, i * 8);
+                    int length = Marshal.ReadInt32(packedOut.entries, i * 8 + 4);
+                    array[i] = Marshal.PtrToStringUTF8(packedOut.block + (nint)offset, length);
+                }
+                free_packed(packedOut.block);
+                return array;
+            }
+
             // Native storage engine function bindings
             [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
             public static extern Output create_database(QueryConfig queryConfig);
@@ -225,11 +319,53 @@ namespace ProtonDB.Server {
             [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
             public static extern ArrayOut print_documents(QueryConfig queryConfig);
             [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern ArrayOut visit_documents(QueryConfig queryConfig, DocumentVisitor visitor, IntPtr context);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern PackedOut print_packed_documents(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
             public static extern Output update_all_documents(QueryConfig queryConfig);
             [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
             public static extern Output update_documents(QueryConfig queryConfig);
             [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern ArrayOut print_document_by_id(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern PackedOut print_packed_document_by_id(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output remove_document_by_id(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output update_document_by_id(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output create_index(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output drop_index(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output create_range_index(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output drop_range_index(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output create_bloom_filter(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output drop_bloom_filter(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output create_zone_map(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output drop_zone_map(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output create_column(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern Output drop_column(QueryConfig queryConfig);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern void configure_cache(long limitBytes);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern void configure_buffer_pool(long limitBytes);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern BufferPoolStats buffer_pool_stats();
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            public static extern void configure_compaction(double freeRatio, long bytesPerSecond);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
             private static extern void free_list(IntPtr list, int size);
+            [DllImport(STORAGE_ENGINE_PATH, CallingConvention = CallingConvention.Cdecl)]
+            private static extern void free_packed(IntPtr block);
         }
     }
 }
\ No newline at end of file
@@ -38,6 +38,19 @@ namespace ProtonDB.Server {
             public const string remove = "remove";
             public const string update = "update";
             public const string print = "print";
+            public const string printById = "printById";
+            public const string removeById = "removeById";
+            public const string updateById = "updateById";
+            public const string index = "index";
+            public const string dropIndex = "dropIndex";
+            public const string rangeIndex = "rangeIndex";
+            public const string dropRangeIndex = "dropRangeIndex";
+            public const string bloomFilter = "bloomFilter";
+            public const string dropBloomFilter = "dropBloomFilter";
+            public const string zoneMap = "zoneMap";
+            public const string dropZoneMap = "dropZoneMap";
+            public const string column = "column";
+            public const string dropColumn = "dropColumn";
             public const string grant = "grant";
             public const string revoke = "revoke";
             public const string delete = "delete";
@@ -17,6 +17,7 @@
 //  Dependencies:
 //      - Meta: Handles initialization of core directories, files, and admin profile.
 //      - ConfigLoader: Loads server configuration (e.g., port) from JSON file.
+//      - StorageEngine: Receives the configured cache, buffer pool and compaction settings.
 //      - QueryServer: Manages network listening and client command processing.
 // -------------------------------------------------------------------------------------------------
 
@@ -35,6 +36,9 @@ namespace ProtonDB.Server {
         public static async Task Main() {
             Meta.Initialize();
             var config = ConfigLoader.Load();
+            StorageEngine.configure_cache(config.CacheLimitMB * 1024L * 1024L);
+            StorageEngine.configure_buffer_pool(config.BufferPoolMB * 1024L * 1024L);
+            StorageEngine.configure_compaction(config.CompactionRatio, config.CompactionMBps * 1024L * 1024L);
             var server = new QueryServer(config.Port);
             await server.StartAsync();
         }
@@ -26,5 +26,29 @@ namespace ProtonDB.Server {
         /// Default is 100.
         /// </summary>
         public int MaxConnections { get; set; } = 100;
+
+        /// <summary>
+        /// Gets or sets the memory cap, in megabytes, of the storage engine's parsed-collection cache.
+        /// Default is 64.
+        /// </summary>
+        public int CacheLimitMB { get; set; } = 64;
+
+        /// <summary>
+        /// Gets or sets the memory cap, in megabytes, of the storage engine's page buffer pool.
+        /// Default is 32.
+        /// </summary>
+        public int BufferPoolMB { get; set; } = 32;
+
+        /// <summary>
+        /// Gets or sets the share of free space in a collection's pages (0 to 1) at which the storage
+        /// engine compacts it in the background. 0 turns compaction off. Default is 0.5.
+        /// </summary>
+        public double CompactionRatio { get; set; } = 0.5;
+
+        /// <summary>
+        /// Gets or sets the disk bandwidth, in megabytes per second, that background compaction may use.
+        /// 0 means no limit. Default is 8.
+        /// </summary>
+        public int CompactionMBps { get; set; } = 8;
     }
 }
\ No newline at end of file
@@ -74,12 +74,15 @@ namespace ProtonDB.Shell {
             Terminal.WriteLine("  remove(condition)                 Remove documents matching the condition from collection");
             Terminal.WriteLine("  print()                           Print all documents in collection");
             Terminal.WriteLine("  print(condition)                  Print documents matching the condition from collection");
+            Terminal.WriteLine("  print([key, ...])                 Print only the given fields of all documents");
+            Terminal.WriteLine("  print([key, ...], condition)      Print only the given fields of documents matching the condition");
             Terminal.WriteLine("  update(action, data)              Update all documents in collection");
             Terminal.WriteLine("  update(action, data, condition)   Update documents matching the condition in collection");
 
             Terminal.WriteLine("\n  action    - [ add | drop | alter ]");
             Terminal.WriteLine("  data      -  {\"key\": value}");
             Terminal.WriteLine("  condition - key <operator> value");
+            Terminal.WriteLine("              conditions combine with && || ! and ( ); keys may be dotted paths (address.city)");
             Terminal.WriteLine("  operators - [ < | <= | > | >= | = ]");
             Terminal.WriteLine("*Note*: data is {\"key\"} for update(drop, data, condition)\n");
 
@@ -0,0 +1,153 @@
+// Include standard and platform headers
+#include <stdint.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "Arena.h"
+#include "cJSON/cJSON.h"
+
+// The cJSON nodes and strings of a read come from an arena of the reading thread rather than
+// from the heap. Allocating is a bump of a pointer, freeing memory of the arena does nothing,
+// and the trees of a document are dropped together by resetting the arena instead of being
+// walked node by node. The cJSON hooks are installed once for every thread and go to malloc
+// and free outside a read, so trees that outlive a read, such as those of the collection
+// cache, are never in an arena. Nothing built during a read may outlive it; reads do not nest.
+//
+// Custom hooks cost every cJSON print one thing: cJSON only grows and trims its print buffer
+// with realloc when its hooks are malloc and free, so with these installed a print ends with
+// a copy of its text into a buffer of the exact size, and a buffer that grows is copied too.
+// bench_arena finds no difference for a write-ahead log record and up to 7% on the print of a
+// 1.3 MB meta file, which is followed by writing and syncing that file.
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+// A block the arena hands out memory from, followed by that memory. Chunks are chained
+// newest first, and each is at least twice the size of the one before.
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+} ArenaChunk;
+
+#define CHUNK_HEADER ((sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static _Thread_local ArenaChunk* chunks = NULL;
+static _Thread_local bool active = false;
+// Lowest and highest address of the memory of this thread's chunks
+static _Thread_local uintptr_t lowest = 0;
+static _Thread_local uintptr_t highest = 0;
+static INIT_ONCE hooksOnce = INIT_ONCE_STATIC_INIT;
+static volatile bool arenaEnabled = true;
+
+// Local helper functions
+void* arena_allocate(size_t size);
+void arena_free(void* pointer);
+BOOL CALLBACK arena_install(PINIT_ONCE once, PVOID parameter, PVOID* context);
+bool arena_owns(const void* pointer);
+void arena_span(void);
+
+
+// Start a read on this thread: cJSON allocations come from the arena until arena_end. The
+// hooks are installed exactly once, before any thread's first read, and both sets of hooks
+// work on heap memory outside a read, so a thread inside cJSON meanwhile is not affected.
+void arena_begin(void) {
+    InitOnceExecuteOnce(&hooksOnce, arena_install, NULL, NULL);
+    active = arenaEnabled;
+}
+
+// Turn arenas on or off for reads that start afterwards, so that a benchmark can compare reads
+// that build their trees on the heap
+void arena_enable(const bool enabled) {
+    arenaEnabled = enabled;
+}
+
+// End the read on this thread, releasing everything built during it at once
+void arena_end(void) {
+    while (chunks) {
+        ArenaChunk* _next = chunks->next;
+        free(chunks);
+        chunks = _next;
+    }
+    lowest = highest = 0;
+    active = false;
+}
+
+// Drop everything built since the read started or was last reset, keeping the largest chunk
+// for what comes next. Returns false outside a read, where trees are freed as usual.
+bool arena_reset(void) {
+    if (!active) return false;
+    if (chunks) {
+        ArenaChunk* _stale = chunks->next;
+        while (_stale) {
+            ArenaChunk* _next = _stale->next;
+            free(_stale);
+            _stale = _next;
+        }
+        chunks->next = NULL;
+        chunks->used = 0;
+        arena_span();
+    }
+    return true;
+}
+
+void* arena_allocate(const size_t size) {
+    if (!active) return malloc(size);
+
+    const size_t _size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (!chunks || chunks->size - chunks->used < _size) {
+        size_t _chunkSize = chunks ? chunks->size * 2 : ARENA_CHUNK_SIZE;
+        while (_chunkSize < _size) _chunkSize *= 2;
+
+        ArenaChunk* _chunk = malloc(CHUNK_HEADER + _chunkSize);
+        if (!_chunk) return NULL;
+        _chunk->next = chunks;
+        _chunk->size = _chunkSize;
+        _chunk->used = 0;
+        chunks = _chunk;
+        arena_span();
+    }
+
+    void* _pointer = (uint8_t*)chunks + CHUNK_HEADER + chunks->used;
+    chunks->used += _size;
+    return _pointer;
+}
+
+// Memory of the arena goes with the arena; anything else, such as a tree of the collection
+// cache, goes back to the heap
+void arena_free(void* pointer) {
+    if (active && arena_owns(pointer)) return;
+    free(pointer);
+}
+
+BOOL CALLBACK arena_install(PINIT_ONCE once, PVOID parameter, PVOID* context) {
+    (void)once;
+    (void)parameter;
+    (void)context;
+    cJSON_Hooks _hooks = { arena_allocate, arena_free };
+    cJSON_InitHooks(&_hooks);
+    return TRUE;
+}
+
+// Whether memory belongs to this thread's arena. Memory outside the span of its chunks, as a
+// freed heap pointer nearly always is, is told apart without walking them; the walk starts at
+// the newest chunk, which holds at least half the memory of the arena.
+bool arena_owns(const void* pointer) {
+    const uintptr_t _address = (uintptr_t)pointer;
+    if (_address < lowest || _address >= highest) return false;
+    for (const ArenaChunk* _chunk = chunks; _chunk; _chunk = _chunk->next) {
+        const uintptr_t _start = (uintptr_t)_chunk + CHUNK_HEADER;
+        if (_address >= _start && _address < _start + _chunk->size) return true;
+    }
+    return false;
+}
+
+// Recompute the span of this thread's chunks after one is added or dropped
+void arena_span(void) {
+    lowest = UINTPTR_MAX;
+    highest = 0;
+    for (const ArenaChunk* _chunk = chunks; _chunk; _chunk = _chunk->next) {
+        const uintptr_t _start = (uintptr_t)_chunk + CHUNK_HEADER;
+        if (_start < lowest) lowest = _start;
+        if (_start + _chunk->size > highest) highest = _start + _chunk->size;
+    }
+}
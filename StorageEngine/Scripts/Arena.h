@@ -0,0 +1,11 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+
+void arena_begin(void);
+void arena_enable(bool enabled);
+void arena_end(void);
+bool arena_reset(void);
+
+#endif //ARENA_H
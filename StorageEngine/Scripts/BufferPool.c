@@ -0,0 +1,368 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BufferPool.h"
+#include "PageStore.h"
+
+// Pages of paged collection files, shared by every reader and writer in the process. A page
+// is pinned while it is in use and never evicted then; unpinned pages are evicted by a CLOCK
+// sweep that gives each page used since the hand last passed it a second chance. Written
+// pages stay dirty in the pool until a checkpoint flushes them or they are evicted. Their
+// checkpoint-time images are in the rollback journal before they are first written, so a
+// page may reach the file at any time before the checkpoint.
+//
+// The pool only protects its own bookkeeping: the pages of a file are read and written
+// under its database lock, so no page is changed by one thread while another reads it.
+
+// A file whose pages are in the pool, kept until the file is discarded
+struct PoolFile {
+    char fileName[MAX_PATH_LEN];
+    PoolFile* next;
+};
+
+// A page-sized buffer. A frame without a file is either empty (no data) or was discarded
+// while pinned and is emptied by its last unpin.
+struct PoolFrame {
+    PoolFile* file;
+    uint32_t page;
+    int pins;
+    bool referenced;
+    bool dirty;
+    uint8_t* data;
+
+    // Next frame in the same hash bucket, or in the list of empty frames
+    PoolFrame* chain;
+};
+
+static PoolFile* poolFiles = NULL;
+static PoolFrame** frames = NULL;
+static uint32_t frameCount = 0;
+static uint32_t frameCapacity = 0;
+static PoolFrame* emptyFrames = NULL;
+static PoolFrame** buckets = NULL;
+static uint32_t bucketCount = 0;
+static uint32_t clockHand = 0;
+static uint32_t residentFrames = 0;
+static uint32_t frameLimit = (uint32_t)(POOL_DEFAULT_LIMIT / COLLECTION_PAGE_SIZE);
+static BufferPoolStats counters = { 0 };
+static SRWLOCK poolLock = SRWLOCK_INIT;
+
+// Local helper functions
+uint32_t bucket_of(const PoolFile* file, uint32_t page);
+PoolFrame* claim_frame(void);
+PoolFrame* clock_victim(void);
+int compare_frames(const void* left, const void* right);
+PoolFrame* find_frame(const PoolFile* file, uint32_t page);
+bool grow_buckets(void);
+void link_frame(PoolFrame* frame, PoolFile* file, uint32_t page);
+void release_frame(PoolFrame* frame);
+void trim_frames(void);
+void unlink_frame(PoolFrame* frame);
+bool write_frames(PoolFrame** list, uint32_t count);
+
+// Register a file whose pages are read through the pool. The returned handle stays valid
+// until the file is discarded.
+PoolFile* pool_file(const char* fileName) {
+    AcquireSRWLockExclusive(&poolLock);
+    PoolFile* _file = poolFiles;
+    while (_file && strcmp(_file->fileName, fileName) != 0) _file = _file->next;
+    if (!_file && (_file = calloc(1, sizeof(PoolFile)))) {
+        snprintf(_file->fileName, sizeof(_file->fileName), "%s", fileName);
+        _file->next = poolFiles;
+        poolFiles = _file;
+    }
+    ReleaseSRWLockExclusive(&poolLock);
+    return _file;
+}
+
+// Pin a page of a file, reading it from source on a miss. data receives the page, which
+// stays valid and unchanged by other threads until pool_unpin. Returns NULL on failure.
+PoolFrame* pool_pin(PoolFile* file, FILE* source, const uint32_t page, const uint8_t** data) {
+    AcquireSRWLockExclusive(&poolLock);
+    PoolFrame* _frame = find_frame(file, page);
+    if (_frame) {
+        _frame->pins++;
+        _frame->referenced = true;
+        counters.hits++;
+        *data = _frame->data;
+        ReleaseSRWLockExclusive(&poolLock);
+        return _frame;
+    }
+    counters.misses++;
+    ReleaseSRWLockExclusive(&poolLock);
+
+    // Read outside the lock; a reader that loaded the same page meanwhile keeps its copy
+    uint8_t* _image = malloc(COLLECTION_PAGE_SIZE);
+    if (!_image || fseek(source, (long)page * COLLECTION_PAGE_SIZE, SEEK_SET) != 0 ||
+        fread(_image, COLLECTION_PAGE_SIZE, 1, source) != 1) {
+        free(_image);
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&poolLock);
+    _frame = find_frame(file, page);
+    if (!_frame && (_frame = claim_frame())) {
+        memcpy(_frame->data, _image, COLLECTION_PAGE_SIZE);
+        link_frame(_frame, file, page);
+    }
+    if (_frame) {
+        _frame->pins++;
+        _frame->referenced = true;
+        *data = _frame->data;
+    }
+    ReleaseSRWLockExclusive(&poolLock);
+
+    free(_image);
+    return _frame;
+}
+
+void pool_unpin(PoolFrame* frame) {
+    if (!frame) return;
+
+    AcquireSRWLockExclusive(&poolLock);
+    frame->pins--;
+    if (frame->pins == 0 && !frame->file) release_frame(frame);
+    trim_frames();
+    ReleaseSRWLockExclusive(&poolLock);
+}
+
+// Store a written page in the pool as dirty. Returns false if no frame could be found for
+// it, in which case the caller writes the page to the file itself.
+bool pool_put(PoolFile* file, const uint32_t page, const uint8_t* data) {
+    AcquireSRWLockExclusive(&poolLock);
+    PoolFrame* _frame = find_frame(file, page);
+    if (!_frame && (_frame = claim_frame())) link_frame(_frame, file, page);
+    if (_frame) {
+        memcpy(_frame->data, data, COLLECTION_PAGE_SIZE);
+        _frame->dirty = true;
+        _frame->referenced = true;
+    }
+    trim_frames();
+    ReleaseSRWLockExclusive(&poolLock);
+    return _frame != NULL;
+}
+
+// Write the dirty pages of a file back to it, in page order
+bool pool_flush(const char* fileName, char* error) {
+    AcquireSRWLockExclusive(&poolLock);
+    PoolFrame** _dirty = NULL;
+    uint32_t _count = 0;
+    bool _status = true;
+
+    for (uint32_t i = 0; i < frameCount; i++) {
+        if (!frames[i]->dirty || !frames[i]->file || strcmp(frames[i]->file->fileName, fileName) != 0) continue;
+        if (!_dirty && !(_dirty = malloc(frameCount * sizeof(PoolFrame*)))) {
+            _status = false;
+            break;
+        }
+        _dirty[_count++] = frames[i];
+    }
+
+    if (_count > 0) {
+        qsort(_dirty, _count, sizeof(PoolFrame*), compare_frames);
+        _status = write_frames(_dirty, _count);
+    }
+    ReleaseSRWLockExclusive(&poolLock);
+
+    free(_dirty);
+    if (!_status) get_error(error, "fatal: Could not write back pages of '%s'", fileName);
+    return _status;
+}
+
+// Drop the pages of a file, or of every file in a directory, without writing them back
+void pool_discard(const char* path) {
+    const size_t _length = strlen(path);
+
+    AcquireSRWLockExclusive(&poolLock);
+    for (uint32_t i = 0; i < frameCount; i++) {
+        PoolFrame* _frame = frames[i];
+        if (!_frame->file || strncmp(_frame->file->fileName, path, _length) != 0) continue;
+        const char _next = _frame->file->fileName[_length];
+        if (_next != '\0' && _next != '/' && _next != '\\') continue;
+
+        unlink_frame(_frame);
+        _frame->file = NULL;
+        _frame->dirty = false;
+        if (_frame->pins == 0) release_frame(_frame);
+    }
+
+    PoolFile** _link = &poolFiles;
+    while (*_link) {
+        PoolFile* _file = *_link;
+        if (strncmp(_file->fileName, path, _length) == 0 &&
+            (_file->fileName[_length] == '\0' || _file->fileName[_length] == '/' || _file->fileName[_length] == '\\')) {
+            *_link = _file->next;
+            free(_file);
+        } else {
+            _link = &_file->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&poolLock);
+}
+
+// Change the memory budget, evicting pages (and writing back dirty ones) to fit it
+void pool_set_limit(const long long limitBytes) {
+    AcquireSRWLockExclusive(&poolLock);
+    const long long _frames = limitBytes > 0 ? limitBytes / COLLECTION_PAGE_SIZE : 0;
+    frameLimit = _frames > UINT32_MAX ? UINT32_MAX : (uint32_t)_frames;
+    trim_frames();
+    ReleaseSRWLockExclusive(&poolLock);
+}
+
+BufferPoolStats pool_stats(void) {
+    AcquireSRWLockShared(&poolLock);
+    BufferPoolStats _stats = counters;
+    _stats.usedBytes = (long long)residentFrames * COLLECTION_PAGE_SIZE;
+    _stats.limitBytes = (long long)frameLimit * COLLECTION_PAGE_SIZE;
+    ReleaseSRWLockShared(&poolLock);
+    return _stats;
+}
+
+// Take a frame for a new page: an evicted one once the budget is used up, otherwise an
+// empty or new one. The budget is only exceeded while every frame is pinned.
+PoolFrame* claim_frame(void) {
+    PoolFrame* _frame = residentFrames >= frameLimit ? clock_victim() : NULL;
+    if (_frame) {
+        unlink_frame(_frame);
+        _frame->file = NULL;
+        _frame->referenced = false;
+        counters.evictions++;
+        return _frame;
+    }
+
+    if (emptyFrames) {
+        _frame = emptyFrames;
+        emptyFrames = _frame->chain;
+        _frame->chain = NULL;
+    } else {
+        if (frameCount == frameCapacity) {
+            const uint32_t _capacity = frameCapacity ? frameCapacity * 2 : 64;
+            PoolFrame** _grown = realloc(frames, _capacity * sizeof(PoolFrame*));
+            if (!_grown) return NULL;
+            frames = _grown;
+            frameCapacity = _capacity;
+        }
+        if ((frameCount + 1) * 2 > bucketCount && !grow_buckets()) return NULL;
+        if (!(_frame = calloc(1, sizeof(PoolFrame)))) return NULL;
+        frames[frameCount++] = _frame;
+    }
+
+    if (!(_frame->data = malloc(COLLECTION_PAGE_SIZE))) {
+        _frame->chain = emptyFrames;
+        emptyFrames = _frame;
+        return NULL;
+    }
+    residentFrames++;
+    return _frame;
+}
+
+// Sweep the clock for an unpinned page not used since the hand last passed it, writing it
+// back first if it is dirty. NULL if every page is pinned or cannot be written.
+PoolFrame* clock_victim(void) {
+    for (uint32_t i = 0; i < 2 * frameCount; i++) {
+        PoolFrame* _frame = frames[clockHand];
+        clockHand = (clockHand + 1) % frameCount;
+        if (!_frame->file || _frame->pins > 0) continue;
+        if (_frame->referenced) {
+            _frame->referenced = false;
+            continue;
+        }
+        if (_frame->dirty && !write_frames(&_frame, 1)) continue;
+        return _frame;
+    }
+    return NULL;
+}
+
+// Evict unpinned pages until the pool is back within its budget
+void trim_frames(void) {
+    while (residentFrames > frameLimit) {
+        PoolFrame* _frame = clock_victim();
+        if (!_frame) return;
+        unlink_frame(_frame);
+        _frame->file = NULL;
+        release_frame(_frame);
+        counters.evictions++;
+    }
+}
+
+// Free the buffer of a frame that no longer holds a page
+void release_frame(PoolFrame* frame) {
+    free(frame->data);
+    frame->data = NULL;
+    frame->referenced = false;
+    frame->chain = emptyFrames;
+    emptyFrames = frame;
+    residentFrames--;
+}
+
+// Write pages of one file back to it. The file is opened with delete sharing, like a mapped
+// view, so that a collection can be replaced or dropped while a page is being evicted.
+bool write_frames(PoolFrame** list, const uint32_t count) {
+    HANDLE _handle = CreateFileA(list[0]->file->fileName, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (_handle == INVALID_HANDLE_VALUE) return false;
+
+    bool _status = true;
+    for (uint32_t i = 0; _status && i < count; i++) {
+        LARGE_INTEGER _offset;
+        DWORD _written = 0;
+        _offset.QuadPart = (LONGLONG)list[i]->page * COLLECTION_PAGE_SIZE;
+        _status = SetFilePointerEx(_handle, _offset, NULL, FILE_BEGIN) &&
+                  WriteFile(_handle, list[i]->data, COLLECTION_PAGE_SIZE, &_written, NULL) && _written == COLLECTION_PAGE_SIZE;
+        if (_status) {
+            list[i]->dirty = false;
+            counters.writeBacks++;
+        }
+    }
+
+    CloseHandle(_handle);
+    return _status;
+}
+
+PoolFrame* find_frame(const PoolFile* file, const uint32_t page) {
+    if (bucketCount == 0) return NULL;
+    PoolFrame* _frame = buckets[bucket_of(file, page)];
+    while (_frame && (_frame->file != file || _frame->page != page)) _frame = _frame->chain;
+    return _frame;
+}
+
+void link_frame(PoolFrame* frame, PoolFile* file, const uint32_t page) {
+    const uint32_t _bucket = bucket_of(file, page);
+    frame->file = file;
+    frame->page = page;
+    frame->chain = buckets[_bucket];
+    buckets[_bucket] = frame;
+}
+
+void unlink_frame(PoolFrame* frame) {
+    PoolFrame** _link = &buckets[bucket_of(frame->file, frame->page)];
+    while (*_link && *_link != frame) _link = &(*_link)->chain;
+    if (*_link) *_link = frame->chain;
+    frame->chain = NULL;
+}
+
+// Double the hash table, keeping it at least twice as large as the number of frames
+bool grow_buckets(void) {
+    const uint32_t _count = bucketCount ? bucketCount * 2 : 128;
+    PoolFrame** _buckets = calloc(_count, sizeof(PoolFrame*));
+    if (!_buckets) return false;
+
+    free(buckets);
+    buckets = _buckets;
+    bucketCount = _count;
+    for (uint32_t i = 0; i < frameCount; i++) {
+        if (frames[i]->file) link_frame(frames[i], frames[i]->file, frames[i]->page);
+    }
+    return true;
+}
+
+uint32_t bucket_of(const PoolFile* file, const uint32_t page) {
+    return ((uint32_t)((uintptr_t)file >> 4) ^ page * 2654435761u) & (bucketCount - 1);
+}
+
+int compare_frames(const void* left, const void* right) {
+    const uint32_t _left = (*(PoolFrame* const*)left)->page, _right = (*(PoolFrame* const*)right)->page;
+    return (_left > _right) - (_left < _right);
+}
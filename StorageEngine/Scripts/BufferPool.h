@@ -0,0 +1,22 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define POOL_DEFAULT_LIMIT (32LL * 1024 * 1024)
+
+typedef struct PoolFile PoolFile;
+typedef struct PoolFrame PoolFrame;
+
+void pool_discard(const char* path);
+PoolFile* pool_file(const char* fileName);
+bool pool_flush(const char* fileName, char* error);
+PoolFrame* pool_pin(PoolFile* file, FILE* source, uint32_t page, const uint8_t** data);
+bool pool_put(PoolFile* file, uint32_t page, const uint8_t* data);
+void pool_set_limit(long long limitBytes);
+BufferPoolStats pool_stats(void);
+void pool_unpin(PoolFrame* frame);
+
+#endif //BUFFER_POOL_H
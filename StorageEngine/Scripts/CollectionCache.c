@@ -0,0 +1,262 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CollectionCache.h"
+
+// A parsed collection kept in memory between calls. Entries are read under the shared
+// database lock and modified under the exclusive one, so the cache only has to protect
+// its own bookkeeping. A pinned entry is never freed; an entry dropped while pinned is
+// detached and freed by its last release.
+struct CacheEntry {
+    char databaseName[MAX_PATH_LEN];
+    char collectionName[MAX_PATH_LEN];
+    cJSON* collection;
+    size_t size;
+    int pins;
+    bool detached;
+
+    // Most recently used entries are at the head of the list
+    CacheEntry* previous;
+    CacheEntry* next;
+};
+
+static CacheEntry* head = NULL;
+static CacheEntry* tail = NULL;
+static size_t usedBytes = 0;
+static size_t cacheLimit = (size_t)CACHE_DEFAULT_LIMIT;
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+
+// Local helper functions
+void detach_entry(CacheEntry* entry);
+size_t estimate_size(const cJSON* item);
+void evict_entries(void);
+CacheEntry* find_entry(const char* databaseName, const char* collectionName);
+void free_entry(CacheEntry* entry);
+void move_to_front(CacheEntry* entry);
+
+
+// Pin the cached collection, loading it from disk on a miss. The returned tree stays valid
+// until cache_release; collections larger than the cache limit are returned uncached.
+CacheEntry* cache_acquire(const char* databaseName, const char* collectionName, cJSON** collection, char* error) {
+    AcquireSRWLockExclusive(&cacheLock);
+    CacheEntry* _entry = find_entry(databaseName, collectionName);
+    if (_entry) {
+        _entry->pins++;
+        move_to_front(_entry);
+        *collection = _entry->collection;
+        ReleaseSRWLockExclusive(&cacheLock);
+        return _entry;
+    }
+    ReleaseSRWLockExclusive(&cacheLock);
+
+    char _filePath[MAX_PATH_LEN];
+    get_col_file(_filePath, databaseName, collectionName);
+    cJSON* _loaded = load_binary(_filePath, error);
+    if (!_loaded) {
+        *collection = NULL;
+        return NULL;
+    }
+
+    CacheEntry* _created = calloc(1, sizeof(CacheEntry));
+    if (!_created) {
+        get_error(error, "fatal: Memory allocation failed for collection cache");
+        cJSON_Delete(_loaded);
+        *collection = NULL;
+        return NULL;
+    }
+
+    snprintf(_created->databaseName, sizeof(_created->databaseName), "%s", databaseName);
+    snprintf(_created->collectionName, sizeof(_created->collectionName), "%s", collectionName);
+    _created->collection = _loaded;
+    _created->size = estimate_size(_loaded);
+    _created->pins = 1;
+
+    AcquireSRWLockExclusive(&cacheLock);
+    // Concurrent readers may have loaded the same collection; keep the first copy
+    _entry = find_entry(databaseName, collectionName);
+    if (_entry) {
+        _entry->pins++;
+        move_to_front(_entry);
+        free_entry(_created);
+    } else if (_created->size > cacheLimit) {
+        _created->detached = true;
+        _entry = _created;
+    } else {
+        _entry = _created;
+        _entry->next = head;
+        if (head) head->previous = _entry;
+        head = _entry;
+        if (!tail) tail = _entry;
+        usedBytes += _entry->size;
+        evict_entries();
+    }
+
+    *collection = _entry->collection;
+    ReleaseSRWLockExclusive(&cacheLock);
+    return _entry;
+}
+
+// Pin a collection only if it is already resident (NULL on a miss)
+CacheEntry* cache_find(const char* databaseName, const char* collectionName, cJSON** collection) {
+    AcquireSRWLockExclusive(&cacheLock);
+    CacheEntry* _entry = find_entry(databaseName, collectionName);
+    if (_entry) {
+        _entry->pins++;
+        move_to_front(_entry);
+    }
+    *collection = _entry ? _entry->collection : NULL;
+    ReleaseSRWLockExclusive(&cacheLock);
+    return _entry;
+}
+
+// Whether a collection file of the given size could be kept once parsed; the parsed tree
+// is always larger than its file, so a file above the limit is never worth loading
+bool cache_admits(const long long fileBytes) {
+    AcquireSRWLockShared(&cacheLock);
+    const bool _admits = fileBytes >= 0 && (size_t)fileBytes <= cacheLimit;
+    ReleaseSRWLockShared(&cacheLock);
+    return _admits;
+}
+
+// Unpin a collection. Pass modified after changing the tree so its size is re-estimated.
+void cache_release(CacheEntry* entry, const bool modified) {
+    if (!entry) return;
+
+    const size_t _size = modified && !entry->detached ? estimate_size(entry->collection) : entry->size;
+
+    AcquireSRWLockExclusive(&cacheLock);
+    if (!entry->detached && _size != entry->size) {
+        usedBytes = usedBytes - entry->size + _size;
+        entry->size = _size;
+        if (_size > cacheLimit) detach_entry(entry);
+    }
+
+    entry->pins--;
+    if (entry->detached && entry->pins == 0) {
+        free_entry(entry);
+    } else {
+        evict_entries();
+    }
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+// Add freshly inserted documents to a cached collection so it stays current
+void cache_append(const char* databaseName, const char* collectionName, const cJSON* documents) {
+    AcquireSRWLockExclusive(&cacheLock);
+    CacheEntry* _entry = find_entry(databaseName, collectionName);
+    if (!_entry) {
+        ReleaseSRWLockExclusive(&cacheLock);
+        return;
+    }
+
+    // A copy that fails leaves the tree behind the file, so it can no longer be served
+    bool _complete = true;
+    size_t _added = 0;
+    cJSON* _single = cJSON_IsArray(documents) ? NULL : cJSON_CreateArrayReference(documents);
+    const cJSON* _documents = _single ? _single : documents;
+    const cJSON* _item = NULL;
+
+    cJSON_ArrayForEach(_item, _documents) {
+        cJSON* _copy = cJSON_Duplicate(_item, 1);
+        if (!_copy) {
+            _complete = false;
+            break;
+        }
+        _added += estimate_size(_copy);
+        cJSON_AddItemToArray(_entry->collection, _copy);
+    }
+    cJSON_Delete(_single);
+
+    _entry->size += _added;
+    usedBytes += _added;
+    if (!_complete || _entry->size > cacheLimit) detach_entry(_entry);
+
+    evict_entries();
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+// Drop a collection from the cache (all collections of the database if collectionName is NULL)
+void cache_invalidate(const char* databaseName, const char* collectionName) {
+    AcquireSRWLockExclusive(&cacheLock);
+    CacheEntry* _entry = head;
+    while (_entry) {
+        CacheEntry* _next = _entry->next;
+        if (strcmp(_entry->databaseName, databaseName) == 0 &&
+            (!collectionName || strcmp(_entry->collectionName, collectionName) == 0)) {
+            detach_entry(_entry);
+        }
+        _entry = _next;
+    }
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+// Change the memory cap, evicting least recently used collections as needed
+void cache_set_limit(const long long limitBytes) {
+    AcquireSRWLockExclusive(&cacheLock);
+    cacheLimit = limitBytes > 0 ? (size_t)limitBytes : 0;
+    evict_entries();
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+// Evict least recently used, unpinned collections until usage fits the limit
+void evict_entries(void) {
+    CacheEntry* _entry = tail;
+    while (_entry && usedBytes > cacheLimit) {
+        CacheEntry* _previous = _entry->previous;
+        if (_entry->pins == 0) detach_entry(_entry);
+        _entry = _previous;
+    }
+}
+
+// Unlink an entry from the cache; it is freed now or by its last release
+void detach_entry(CacheEntry* entry) {
+    if (entry->previous) entry->previous->next = entry->next;
+    else head = entry->next;
+    if (entry->next) entry->next->previous = entry->previous;
+    else tail = entry->previous;
+
+    entry->previous = entry->next = NULL;
+    entry->detached = true;
+    usedBytes -= entry->size;
+    if (entry->pins == 0) free_entry(entry);
+}
+
+CacheEntry* find_entry(const char* databaseName, const char* collectionName) {
+    for (CacheEntry* _entry = head; _entry; _entry = _entry->next) {
+        if (strcmp(_entry->collectionName, collectionName) == 0 &&
+            strcmp(_entry->databaseName, databaseName) == 0) return _entry;
+    }
+    return NULL;
+}
+
+void move_to_front(CacheEntry* entry) {
+    if (entry == head) return;
+
+    entry->previous->next = entry->next;
+    if (entry->next) entry->next->previous = entry->previous;
+    else tail = entry->previous;
+
+    entry->previous = NULL;
+    entry->next = head;
+    head->previous = entry;
+    head = entry;
+}
+
+void free_entry(CacheEntry* entry) {
+    cJSON_Delete(entry->collection);
+    free(entry);
+}
+
+// Approximate heap footprint of a parsed JSON tree
+size_t estimate_size(const cJSON* item) {
+    size_t _size = 0;
+    for (; item; item = item->next) {
+        _size += sizeof(cJSON);
+        if (item->string) _size += strlen(item->string) + 1;
+        if (item->valuestring) _size += strlen(item->valuestring) + 1;
+        if (item->child) _size += estimate_size(item->child);
+    }
+    return _size;
+}
@@ -0,0 +1,19 @@
+#ifndef COLLECTION_CACHE_H
+#define COLLECTION_CACHE_H
+
+#include <stddef.h>
+#include "DatabaseUtils.h"
+
+#define CACHE_DEFAULT_LIMIT (64LL * 1024 * 1024)
+
+typedef struct CacheEntry CacheEntry;
+
+CacheEntry* cache_acquire(const char* databaseName, const char* collectionName, cJSON** collection, char* error);
+bool cache_admits(long long fileBytes);
+void cache_append(const char* databaseName, const char* collectionName, const cJSON* documents);
+CacheEntry* cache_find(const char* databaseName, const char* collectionName, cJSON** collection);
+void cache_invalidate(const char* databaseName, const char* collectionName);
+void cache_release(CacheEntry* entry, bool modified);
+void cache_set_limit(long long limitBytes);
+
+#endif //COLLECTION_CACHE_H
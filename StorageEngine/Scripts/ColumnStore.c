@@ -0,0 +1,520 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ColumnStore.h"
+#include "DocumentCodec.h"
+#include "FilterKernels.h"
+#include "RangeIndex.h"
+
+// A shadow column of the numeric values of one key of a collection. In memory it is a
+// contiguous array of doubles with a bitmap marking the rows that hold no number, and the
+// record id of each row; filters on the key run the comparison kernels over the array
+// instead of reading the documents. A map from record id to row lets updates overwrite a
+// row in place. The column is backed by an append-only file of rows that records the
+// collection LSN and length it covers, like the hash indexes: inserts and updates append a
+// row for each document they store, removes leave their rows behind for the filter check on
+// every candidate to weed out, and rewrites of the collection rebuild the column. A file
+// holding many replaced rows is written anew.
+typedef struct ShadowColumn ShadowColumn;
+struct ShadowColumn {
+    char databaseName[MAX_PATH_LEN];
+    char collectionName[MAX_PATH_LEN];
+    char* key;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    double* values;
+    uint64_t* nulls;
+    uint64_t* recordIds;
+    size_t count;
+    size_t capacity;
+    uint32_t* rows;
+    size_t rowCapacity;
+    uint64_t fileRows;
+    ShadowColumn* next;
+};
+
+// State shared with collect_row while walking a collection
+typedef struct {
+    ShadowColumn* column;
+    ByteBuffer* appended;
+    bool failed;
+} ColumnBuild;
+
+#define COLUMN_CHUNK 4096
+
+static ShadowColumn* columns = NULL;
+static SRWLOCK columnLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool append_rows(ShadowColumn* column, const char* fileName, const uint64_t* recordIds, int count);
+bool build_column(ShadowColumn* column, const char* fileName);
+bool collect_row(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+bool current_column(const ShadowColumn* column, const char* fileName);
+void discard_column(ShadowColumn* column);
+ShadowColumn* find_column(const char* databaseName, const char* collectionName, const char* key);
+void free_column(ShadowColumn* column);
+ShadowColumn* open_column(const char* databaseName, const char* collectionName, const char* key, const char* fileName);
+bool read_column(ShadowColumn* column, const char* fileName);
+void reset_column(ShadowColumn* column);
+size_t row_slot(const ShadowColumn* column, uint64_t recordId);
+bool save_column(ShadowColumn* column);
+bool set_row(ShadowColumn* column, uint64_t recordId, double value);
+
+
+// Register a shadow column on a key and build it from the collection. The database lock must be held exclusively.
+bool column_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error) {
+    if (has_key_entry(databaseName, COLUMN_META, collectionName, key)) {
+        get_error(error, "warning: Column on '%s' already exists", key);
+        return false;
+    }
+
+    // A file left behind by an earlier column on the same key must not be picked up
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, databaseName, collectionName, key, COLUMN_SUFFIX);
+    remove(_columnFile);
+
+    AcquireSRWLockExclusive(&columnLock);
+    const bool _built = open_column(databaseName, collectionName, key, fileName) != NULL;
+    ReleaseSRWLockExclusive(&columnLock);
+
+    if (!_built) {
+        get_error(error, "fatal: Could not build column on '%s'", key);
+        return false;
+    }
+    return append_key_entry(databaseName, COLUMN_META, collectionName, key, error);
+}
+
+// Unregister a shadow column and delete its file. The database lock must be held exclusively.
+bool column_drop(const char* databaseName, const char* collectionName, const char* key, char* error) {
+    if (!has_key_entry(databaseName, COLUMN_META, collectionName, key)) {
+        get_error(error, "fatal: Column on '%s' not found", key);
+        return false;
+    }
+    const bool _status = remove_key_entry(databaseName, COLUMN_META, collectionName, key, error);
+
+    AcquireSRWLockExclusive(&columnLock);
+    ShadowColumn* _column = find_column(databaseName, collectionName, key);
+    if (_column) discard_column(_column);
+    ReleaseSRWLockExclusive(&columnLock);
+
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, databaseName, collectionName, key, COLUMN_SUFFIX);
+    remove(_columnFile);
+    return _status;
+}
+
+// Delete every shadow column of a dropped collection
+void column_drop_collection(const char* databaseName, const char* collectionName) {
+    char _columnFile[MAX_PATH_LEN], _error[MAX_ERROR_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, COLUMN_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_columnFile, databaseName, collectionName, _key->valuestring, COLUMN_SUFFIX);
+        remove(_columnFile);
+    }
+
+    cJSON_Delete(_meta);
+    remove_key_entry(databaseName, COLUMN_META, collectionName, NULL, _error);
+    column_invalidate(databaseName, collectionName);
+}
+
+// Forget in-memory columns whose files are being deleted (all of the database if collectionName is NULL)
+void column_invalidate(const char* databaseName, const char* collectionName) {
+    AcquireSRWLockExclusive(&columnLock);
+    ShadowColumn** _link = &columns;
+    while (*_link) {
+        ShadowColumn* _column = *_link;
+        if (strcmp(_column->databaseName, databaseName) == 0 &&
+            (!collectionName || strcmp(_column->collectionName, collectionName) == 0)) {
+            *_link = _column->next;
+            free_column(_column);
+        } else {
+            _link = &_column->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&columnLock);
+}
+
+// Load every shadow column of a collection before a mutation, so that it can be extended in place
+void column_prepare(const char* databaseName, const char* collectionName, const char* fileName) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, COLUMN_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&columnLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (cJSON_IsString(_key)) open_column(databaseName, collectionName, _key->valuestring, fileName);
+    }
+    ReleaseSRWLockExclusive(&columnLock);
+    cJSON_Delete(_meta);
+}
+
+// Store the values of the documents a mutation stored at recordIds in every shadow column of a collection
+void column_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, const int count) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, COLUMN_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&columnLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        ShadowColumn* _column = find_column(databaseName, collectionName, _key->valuestring);
+
+        // A column that cannot be extended is rebuilt when next used
+        if (_column && !append_rows(_column, fileName, recordIds, count)) discard_column(_column);
+    }
+    ReleaseSRWLockExclusive(&columnLock);
+    cJSON_Delete(_meta);
+}
+
+// Rebuild every shadow column of a collection after its file was rewritten
+void column_rebuild(const char* databaseName, const char* collectionName, const char* fileName) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, COLUMN_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&columnLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        ShadowColumn* _column = find_column(databaseName, collectionName, _key->valuestring);
+        if (_column && (!build_column(_column, fileName) || !save_column(_column))) discard_column(_column);
+        else if (!_column) open_column(databaseName, collectionName, _key->valuestring, fileName);
+    }
+    ReleaseSRWLockExclusive(&columnLock);
+    cJSON_Delete(_meta);
+}
+
+// Find the record ids of documents whose number for key satisfies a condition, in collection
+// order. Only conditions that match numbers alone are answered: equality also matches strings
+// and booleans, which the column does not hold. Returns -1 if no column answers the condition.
+int column_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, const Condition condition, const char* fileName, uint64_t** recordIds) {
+    *recordIds = NULL;
+    if (!key || !value || condition == equal || condition > notEqual) return -1;
+
+    AcquireSRWLockExclusive(&columnLock);
+    ShadowColumn* _column = find_column(databaseName, collectionName, key);
+    if (!_column) {
+        // Not loaded yet: only open columns that are registered for the collection
+        if (has_key_entry(databaseName, COLUMN_META, collectionName, key)) _column = open_column(databaseName, collectionName, key, fileName);
+    } else if (!current_column(_column, fileName) && (!build_column(_column, fileName) || !save_column(_column))) {
+        discard_column(_column);
+        _column = NULL;
+    }
+
+    if (!_column) {
+        ReleaseSRWLockExclusive(&columnLock);
+        return -1;
+    }
+
+    // Rows are compared a chunk at a time; null rows are masked out of the selection
+    const double _limit = atof(value);
+    uint64_t _selection[COLUMN_CHUNK / SELECTION_BITS];
+    size_t _count = 0, _capacity = 0;
+    uint64_t* _ids = NULL;
+
+    for (size_t _chunk = 0; _chunk < _column->count; _chunk += COLUMN_CHUNK) {
+        const size_t _rows = _column->count - _chunk < COLUMN_CHUNK ? _column->count - _chunk : COLUMN_CHUNK;
+        select_numbers(_column->values + _chunk, _rows, _limit, condition, _selection);
+
+        for (size_t w = 0; w < (_rows + SELECTION_BITS - 1) / SELECTION_BITS; w++) {
+            for (uint64_t _word = _selection[w] & ~_column->nulls[_chunk / SELECTION_BITS + w]; _word; _word &= _word - 1) {
+                if (_count == _capacity) {
+                    _capacity = _capacity ? _capacity * 2 : 64;
+                    uint64_t* _grown = realloc(_ids, _capacity * sizeof(uint64_t));
+                    if (!_grown) {
+                        free(_ids);
+                        ReleaseSRWLockExclusive(&columnLock);
+                        return -1;
+                    }
+                    _ids = _grown;
+                }
+                _ids[_count++] = _column->recordIds[_chunk + w * SELECTION_BITS + lowest_bit(_word)];
+            }
+        }
+    }
+    ReleaseSRWLockExclusive(&columnLock);
+
+    *recordIds = _ids;
+    return sort_record_ids(_ids, (int)_count);
+}
+
+// Return a current in-memory column, loading or rebuilding it as needed. columnLock must be held.
+ShadowColumn* open_column(const char* databaseName, const char* collectionName, const char* key, const char* fileName) {
+    ShadowColumn* _column = find_column(databaseName, collectionName, key);
+    if (_column) {
+        if (current_column(_column, fileName)) return _column;
+        if (build_column(_column, fileName) && save_column(_column)) return _column;
+        discard_column(_column);
+        return NULL;
+    }
+
+    _column = calloc(1, sizeof(ShadowColumn));
+    if (!_column) return NULL;
+    snprintf(_column->databaseName, sizeof(_column->databaseName), "%s", databaseName);
+    snprintf(_column->collectionName, sizeof(_column->collectionName), "%s", collectionName);
+    _column->key = _strdup(key);
+
+    if (!_column->key || (!read_column(_column, fileName) && !(build_column(_column, fileName) && save_column(_column)))) {
+        free_column(_column);
+        return NULL;
+    }
+
+    _column->next = columns;
+    columns = _column;
+    return _column;
+}
+
+// Load a column file, provided it covers the collection exactly as it is now
+bool read_column(ShadowColumn* column, const char* fileName) {
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, column->databaseName, column->collectionName, column->key, COLUMN_SUFFIX);
+    FILE* _file = fopen(_columnFile, "rb");
+    if (!_file) return false;
+
+    ColumnHeader _header;
+    const size_t _keyLength = strlen(column->key);
+    char* _key = malloc(_keyLength + 1);
+    bool _status = _key && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, COLUMN_MAGIC, sizeof(_header.magic)) == 0 &&
+                   _header.version == COLUMN_VERSION && _header.keyLength == _keyLength &&
+                   fread(_key, 1, _keyLength, _file) == _keyLength && memcmp(_key, column->key, _keyLength) == 0 &&
+                   _header.appliedLsn == get_applied_lsn(fileName) &&
+                   (long long)_header.coveredLength == get_file_size(fileName);
+    free(_key);
+
+    ColumnRow _row;
+    reset_column(column);
+    for (uint64_t i = 0; _status && i < _header.rowCount; i++) {
+        _status = fread(&_row, sizeof(_row), 1, _file) == 1 && set_row(column, _row.recordId, _row.value);
+    }
+    fclose(_file);
+
+    if (_status) {
+        column->appliedLsn = _header.appliedLsn;
+        column->coveredLength = _header.coveredLength;
+        column->fileRows = _header.rowCount;
+    }
+    return _status;
+}
+
+// Rebuild the column from every document of the collection
+bool build_column(ShadowColumn* column, const char* fileName) {
+    ColumnBuild _build = { column, NULL, false };
+    const long long _size = get_file_size(fileName);
+    reset_column(column);
+    if (_size < 0 || !walk_frames(fileName, collect_row, &_build) || _build.failed) return false;
+
+    column->appliedLsn = get_applied_lsn(fileName);
+    column->coveredLength = (uint64_t)_size;
+    return true;
+}
+
+// Store the documents at recordIds in the column and at the end of its file. A file holding
+// more than twice the rows of the column is written anew instead.
+bool append_rows(ShadowColumn* column, const char* fileName, const uint64_t* recordIds, const int count) {
+    ByteBuffer _appended = { 0 };
+    ColumnBuild _build = { column, &_appended, false };
+    const long long _size = get_file_size(fileName);
+    if (_size < 0 || !visit_records(fileName, recordIds, count, collect_row, &_build) || _build.failed) {
+        free(_appended.data);
+        return false;
+    }
+
+    const uint64_t _rows = _appended.size / sizeof(ColumnRow);
+    column->appliedLsn = get_applied_lsn(fileName);
+    column->coveredLength = (uint64_t)_size;
+    if (column->fileRows + _rows > 2 * (uint64_t)column->count + 1024) {
+        free(_appended.data);
+        return save_column(column);
+    }
+
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, column->databaseName, column->collectionName, column->key, COLUMN_SUFFIX);
+    FILE* _file = fopen(_columnFile, "rb+");
+    ColumnHeader _header;
+    bool _status = _file && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, COLUMN_MAGIC, sizeof(_header.magic)) == 0;
+
+    // Rows go first; the header that makes them valid is stamped afterwards
+    if (_status && _appended.size > 0) {
+        _status = fseek(_file, 0, SEEK_END) == 0 && fwrite(_appended.data, 1, _appended.size, _file) == _appended.size;
+    }
+    if (_status) {
+        _header.appliedLsn = column->appliedLsn;
+        _header.coveredLength = column->coveredLength;
+        _header.rowCount += _rows;
+        _status = fseek(_file, 0, SEEK_SET) == 0 && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    }
+    if (_file && fclose(_file) != 0) _status = false;
+    free(_appended.data);
+
+    if (_status) column->fileRows = _header.rowCount;
+    return _status;
+}
+
+// Write one row per document of the column to its file, replacing the previous one
+bool save_column(ShadowColumn* column) {
+    char _columnFile[MAX_PATH_LEN], _tempName[MAX_PATH_LEN + 4];
+    get_key_file(_columnFile, column->databaseName, column->collectionName, column->key, COLUMN_SUFFIX);
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", _columnFile);
+
+    FILE* _file = fopen(_tempName, "wb");
+    if (!_file) return false;
+
+    const ColumnHeader _header = { COLUMN_MAGIC, COLUMN_VERSION, column->appliedLsn, column->coveredLength,
+                                   column->count, (uint32_t)strlen(column->key), 0 };
+    bool _status = fwrite(&_header, sizeof(_header), 1, _file) == 1 &&
+                   fwrite(column->key, 1, _header.keyLength, _file) == _header.keyLength;
+
+    for (size_t i = 0; _status && i < column->count; i++) {
+        const bool _null = column->nulls[i / SELECTION_BITS] >> (i % SELECTION_BITS) & 1;
+        const ColumnRow _row = { column->recordIds[i], _null ? NAN : column->values[i] };
+        _status = fwrite(&_row, sizeof(_row), 1, _file) == 1;
+    }
+    if (fclose(_file) != 0) _status = false;
+
+    if (!_status || !MoveFileExA(_tempName, _columnFile, MOVEFILE_REPLACE_EXISTING)) {
+        remove(_tempName);
+        return false;
+    }
+    column->fileRows = column->count;
+    return true;
+}
+
+// Frame visitor: store the number a document holds for the key, or a null row if it holds none
+bool collect_row(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    ColumnBuild* _build = context;
+    double _number;
+    if (!document_number(header, frame, length, _build->column->key, &_number)) _number = NAN;
+
+    // A document updated without changing its number is stored already
+    const ShadowColumn* _column = _build->column;
+    const uint32_t _stored = _column->rowCapacity > 0 ? _column->rows[row_slot(_column, recordId)] : 0;
+    if (_stored != 0) {
+        const size_t i = _stored - 1;
+        const bool _null = _column->nulls[i / SELECTION_BITS] >> (i % SELECTION_BITS) & 1;
+        if (_null ? isnan(_number) : _column->values[i] == _number) return true;
+    }
+
+    const ColumnRow _row = { recordId, _number };
+    if (!set_row(_build->column, recordId, _number) || (_build->appended && !buffer_reserve(_build->appended, sizeof(_row)))) {
+        _build->failed = true;
+        return false;
+    }
+
+    if (_build->appended) {
+        memcpy(_build->appended->data + _build->appended->size, &_row, sizeof(_row));
+        _build->appended->size += sizeof(_row);
+    }
+    return true;
+}
+
+// Set the row of a record id, adding one at the end of the column if it has none. NaN
+// marks the row null.
+bool set_row(ShadowColumn* column, const uint64_t recordId, const double value) {
+    if (column->rowCapacity > 0) {
+        const uint32_t _row = column->rows[row_slot(column, recordId)];
+        if (_row != 0) {
+            const size_t i = _row - 1;
+            if (isnan(value)) column->nulls[i / SELECTION_BITS] |= 1ull << (i % SELECTION_BITS);
+            else column->nulls[i / SELECTION_BITS] &= ~(1ull << (i % SELECTION_BITS));
+            column->values[i] = isnan(value) ? 0 : value;
+            return true;
+        }
+    }
+    if (column->count >= UINT32_MAX - 1) return false;
+
+    if (column->count == column->capacity) {
+        const size_t _capacity = column->capacity ? column->capacity * 2 : 256;
+        double* _values = realloc(column->values, _capacity * sizeof(double));
+        if (_values) column->values = _values;
+        uint64_t* _recordIds = realloc(column->recordIds, _capacity * sizeof(uint64_t));
+        if (_recordIds) column->recordIds = _recordIds;
+        uint64_t* _nulls = realloc(column->nulls, _capacity / SELECTION_BITS * sizeof(uint64_t));
+        if (_nulls) column->nulls = _nulls;
+        if (!_values || !_recordIds || !_nulls) return false;
+        column->capacity = _capacity;
+    }
+
+    // Keep the map at most half full, so that probe runs stay short
+    if ((column->count + 1) * 2 > column->rowCapacity) {
+        const size_t _capacity = column->rowCapacity ? column->rowCapacity * 2 : 512;
+        uint32_t* _rows = calloc(_capacity, sizeof(uint32_t));
+        if (!_rows) return false;
+
+        free(column->rows);
+        column->rows = _rows;
+        column->rowCapacity = _capacity;
+        for (size_t i = 0; i < column->count; i++) column->rows[row_slot(column, column->recordIds[i])] = (uint32_t)i + 1;
+    }
+
+    const size_t i = column->count++;
+    if (i % SELECTION_BITS == 0) column->nulls[i / SELECTION_BITS] = 0;
+    if (isnan(value)) column->nulls[i / SELECTION_BITS] |= 1ull << (i % SELECTION_BITS);
+    column->values[i] = isnan(value) ? 0 : value;
+    column->recordIds[i] = recordId;
+    column->rows[row_slot(column, recordId)] = (uint32_t)i + 1;
+    return true;
+}
+
+// Slot of the map that holds the row of a record id, or the free slot where it would go
+size_t row_slot(const ShadowColumn* column, const uint64_t recordId) {
+    const size_t _mask = column->rowCapacity - 1;
+    size_t _slot = (size_t)((recordId * 0x9E3779B97F4A7C15ull) >> 32) & _mask;
+    while (column->rows[_slot] != 0 && column->recordIds[column->rows[_slot] - 1] != recordId) _slot = (_slot + 1) & _mask;
+    return _slot;
+}
+
+// Empty the column and its map
+void reset_column(ShadowColumn* column) {
+    free(column->values);
+    free(column->nulls);
+    free(column->recordIds);
+    free(column->rows);
+    column->values = NULL;
+    column->nulls = NULL;
+    column->recordIds = NULL;
+    column->rows = NULL;
+    column->count = column->capacity = column->rowCapacity = 0;
+}
+
+// Whether a column still describes the collection file as it is on disk
+bool current_column(const ShadowColumn* column, const char* fileName) {
+    return column->appliedLsn == get_applied_lsn(fileName) &&
+           (long long)column->coveredLength == get_file_size(fileName);
+}
+
+ShadowColumn* find_column(const char* databaseName, const char* collectionName, const char* key) {
+    for (ShadowColumn* _column = columns; _column; _column = _column->next) {
+        if (strcmp(_column->key, key) == 0 && strcmp(_column->collectionName, collectionName) == 0 &&
+            strcmp(_column->databaseName, databaseName) == 0) return _column;
+    }
+    return NULL;
+}
+
+// Unlink and free a column; its file is removed so that the next use rebuilds it
+void discard_column(ShadowColumn* column) {
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, column->databaseName, column->collectionName, column->key, COLUMN_SUFFIX);
+    remove(_columnFile);
+
+    for (ShadowColumn** _link = &columns; *_link; _link = &(*_link)->next) {
+        if (*_link == column) {
+            *_link = column->next;
+            break;
+        }
+    }
+    free_column(column);
+}
+
+void free_column(ShadowColumn* column) {
+    reset_column(column);
+    free(column->key);
+    free(column);
+}
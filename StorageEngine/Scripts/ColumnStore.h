@@ -0,0 +1,37 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define COLUMN_MAGIC "PDBV"
+#define COLUMN_VERSION 1
+
+// Header at the start of every column file, followed by the key and the rows
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    uint64_t rowCount;
+    uint32_t keyLength;
+    uint32_t reserved;
+} ColumnHeader;
+
+// The number a document holds for the key, NaN if it holds none. Rows are appended as
+// documents change; a later row for the same record id replaces the earlier one.
+typedef struct {
+    uint64_t recordId;
+    double value;
+} ColumnRow;
+
+void column_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, int count);
+bool column_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error);
+bool column_drop(const char* databaseName, const char* collectionName, const char* key, char* error);
+void column_drop_collection(const char* databaseName, const char* collectionName);
+void column_invalidate(const char* databaseName, const char* collectionName);
+int column_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, Condition condition, const char* fileName, uint64_t** recordIds);
+void column_prepare(const char* databaseName, const char* collectionName, const char* fileName);
+void column_rebuild(const char* databaseName, const char* collectionName, const char* fileName);
+
+#endif //COLUMN_STORE_H
@@ -0,0 +1,155 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Compactor.h"
+#include "PageStore.h"
+
+// Background compaction of collections. Removes and updates free space inside the pages of
+// a collection, where only documents that fit it can use it again. A worker thread looks at
+// every collection changed that way and, once free space makes up more than the configured
+// share of its pages, copies its documents into a fresh file and swaps that in.
+//
+// The copy runs a few pages at a time under the shared database lock, so readers carry on
+// and writers wait for one step at most. A change applied between steps makes the copy
+// stale; it is dropped and tried again after the next change. The swap, and the rebuild of
+// the indexes that point into the old file, take the exclusive lock. Steps are paced to the
+// configured bandwidth so that foreground requests keep most of the disk.
+
+// A collection changed by a remove or an update since the worker last looked at it
+typedef struct Candidate Candidate;
+struct Candidate {
+    char databaseName[MAX_PATH_LEN];
+    char collectionName[MAX_PATH_LEN];
+    Candidate* next;
+};
+
+static Candidate* candidates = NULL;
+static double freeRatio = 0;
+static long long bandwidth = COMPACTION_DEFAULT_BANDWIDTH;
+static WalReplay replayMutation = NULL;
+static CompactionSwapped swapCollection = NULL;
+static bool workerStarted = false;
+static SRWLOCK compactionLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE compactionWake = CONDITION_VARIABLE_INIT;
+
+// Local helper functions
+void compact_collection(const char* databaseName, const char* collectionName);
+DWORD WINAPI compaction_worker(void* parameter);
+void pace_step(ULONGLONG started, long long bytesPerSecond);
+
+
+// Set the share of free space that makes a collection worth compacting (0 turns compaction
+// off) and the bandwidth the copy may use (0 for no limit). The worker starts on first use.
+void compaction_configure(const double ratio, const long long bytesPerSecond, const WalReplay replay, const CompactionSwapped swapped) {
+    AcquireSRWLockExclusive(&compactionLock);
+    freeRatio = ratio > 0 ? ratio : 0;
+    bandwidth = bytesPerSecond > 0 ? bytesPerSecond : 0;
+    replayMutation = replay;
+    swapCollection = swapped;
+
+    if (freeRatio > 0 && !workerStarted) {
+        HANDLE _thread = CreateThread(NULL, 0, compaction_worker, NULL, 0, NULL);
+        if (_thread) {
+            CloseHandle(_thread);
+            workerStarted = true;
+        }
+    }
+    WakeAllConditionVariable(&compactionWake);
+    ReleaseSRWLockExclusive(&compactionLock);
+}
+
+// Remember that a collection has freed space in its pages
+void compaction_note(const char* databaseName, const char* collectionName) {
+    AcquireSRWLockExclusive(&compactionLock);
+    Candidate* _candidate = candidates;
+    while (_candidate && (strcmp(_candidate->databaseName, databaseName) != 0 ||
+                          strcmp(_candidate->collectionName, collectionName) != 0)) _candidate = _candidate->next;
+
+    if (freeRatio > 0 && !_candidate && (_candidate = calloc(1, sizeof(Candidate)))) {
+        snprintf(_candidate->databaseName, sizeof(_candidate->databaseName), "%s", databaseName);
+        snprintf(_candidate->collectionName, sizeof(_candidate->collectionName), "%s", collectionName);
+        _candidate->next = candidates;
+        candidates = _candidate;
+        WakeAllConditionVariable(&compactionWake);
+    }
+    ReleaseSRWLockExclusive(&compactionLock);
+}
+
+// Take the collections noted so far and compact those that are due, then wait a while so
+// that a burst of changes is looked at once
+DWORD WINAPI compaction_worker(void* parameter) {
+    (void)parameter;
+    for (;;) {
+        AcquireSRWLockExclusive(&compactionLock);
+        while (!candidates || freeRatio <= 0) SleepConditionVariableSRW(&compactionWake, &compactionLock, INFINITE, 0);
+        Candidate* _candidate = candidates;
+        candidates = NULL;
+        ReleaseSRWLockExclusive(&compactionLock);
+
+        while (_candidate) {
+            Candidate* _next = _candidate->next;
+            compact_collection(_candidate->databaseName, _candidate->collectionName);
+            free(_candidate);
+            _candidate = _next;
+        }
+        Sleep(COMPACTION_INTERVAL_MS);
+    }
+}
+
+// Compact one collection if free space has grown past the configured share of its pages.
+// Failures leave the collection as it was; it is looked at again after its next change.
+void compact_collection(const char* databaseName, const char* collectionName) {
+    char _filePath[MAX_PATH_LEN];
+    char _error[MAX_ERROR_LEN] = "";
+
+    AcquireSRWLockShared(&compactionLock);
+    const double _ratio = freeRatio;
+    const long long _bandwidth = bandwidth;
+    const WalReplay _replay = replayMutation;
+    const CompactionSwapped _swapped = swapCollection;
+    ReleaseSRWLockShared(&compactionLock);
+
+    WalDatabase* _wal = _ratio > 0 ? wal_open(databaseName, _replay, _error) : NULL;
+    if (!_wal) return;
+    get_col_file(_filePath, databaseName, collectionName);
+
+    // Small collections are not worth a rewrite
+    uint64_t _freeBytes, _dataBytes;
+    wal_acquire(_wal, false);
+    const bool _due = page_free_space(_filePath, &_freeBytes, &_dataBytes) &&
+                      _dataBytes >= COMPACTION_MIN_BYTES && (double)_freeBytes > _ratio * (double)_dataBytes;
+    PageCopy* _copy = _due ? page_copy_begin(_filePath, _error) : NULL;
+    wal_release(_wal, false);
+    if (!_copy) return;
+
+    bool _done = false, _status = true;
+    while (_status && !_done) {
+        const ULONGLONG _started = GetTickCount64();
+        wal_acquire(_wal, false);
+        _status = page_copy_step(_copy, COMPACTION_STEP_PAGES, &_done, _error);
+        wal_release(_wal, false);
+        pace_step(_started, _bandwidth);
+    }
+
+    if (!_status) {
+        page_copy_abort(_copy);
+        return;
+    }
+
+    wal_acquire(_wal, true);
+    if (page_copy_finish(_copy, _error) && _swapped) {
+        const QueryConfig _config = { .databaseName = databaseName, .collectionName = collectionName };
+        _swapped(_config);
+    }
+    wal_release(_wal, true);
+}
+
+// Sleep off what is left of the time a step may take at the configured bandwidth
+void pace_step(const ULONGLONG started, const long long bytesPerSecond) {
+    if (bytesPerSecond <= 0) return;
+    const ULONGLONG _budget = (ULONGLONG)COMPACTION_STEP_PAGES * COLLECTION_PAGE_SIZE * 1000 / (ULONGLONG)bytesPerSecond;
+    const ULONGLONG _spent = GetTickCount64() - started;
+    if (_spent < _budget) Sleep((DWORD)(_budget - _spent));
+}
@@ -0,0 +1,18 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include "DatabaseUtils.h"
+#include "WriteAheadLog.h"
+
+#define COMPACTION_DEFAULT_BANDWIDTH (8LL * 1024 * 1024)
+#define COMPACTION_INTERVAL_MS 1000
+#define COMPACTION_MIN_BYTES (256LL * 1024)
+#define COMPACTION_STEP_PAGES 64
+
+// Called under the exclusive database lock once a compacted collection has replaced the old one
+typedef void (*CompactionSwapped)(QueryConfig config);
+
+void compaction_configure(double freeRatio, long long bytesPerSecond, WalReplay replay, CompactionSwapped swapped);
+void compaction_note(const char* databaseName, const char* collectionName);
+
+#endif //COMPACTOR_H
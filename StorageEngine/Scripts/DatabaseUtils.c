@@ -1,20 +1,81 @@
 // Include standard and utility headers
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <io.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
 #include "DatabaseUtils.h"
-
-// Global buffers for returning names and documents
-char** names;
-char** document;
+#include "Arena.h"
+#include "BufferPool.h"
+#include "DocumentCodec.h"
+#include "LsmStore.h"
+#include "PageStore.h"
+#include "Predicate.h"
+#include "Projection.h"
+
+// Matching documents collected by a streaming scan, or handed one at a time to a visitor
+// through a text buffer reused for every document
+typedef struct {
+    char** document;
+    int count;
+    int capacity;
+    const Projection* projection;
+    ResultPage* page;
+    int skip;
+    DocumentVisitor visitor;
+    void* context;
+    ByteBuffer text;
+    bool stopped;
+    // Set when a match could not be kept for want of memory, which ends the scan
+    bool outOfMemory;
+} ScanResult;
+
+// Changes being made to a collection: to its pages, or to the memtable of its LSM tree
+typedef struct {
+    PageWriter* pages;
+    LsmWriter* tree;
+} CollectionWriter;
 
 // Local helper functions
-void print_item(char** document, int index, const cJSON* item);
-bool is_related(double value1, double value2, Condition condition);
+void abort_writer(CollectionWriter* writer);
+bool apply_action(cJSON* item, Action action, const cJSON* change, const char* data, char* error);
+CollectionWriter* begin_writer(const char* fileName, CollectionHeader* header, char* error);
+bool changes_id(Action action, const cJSON* change);
+bool commit_writer(CollectionWriter* writer, const CollectionHeader* header, char* error);
+void drop_item(cJSON* item);
+bool collect_matches(ScanResult* result, const MappedFile* view, const CollectionHeader* header, const uint64_t* recordIds, int count, const RecordSpan* spans, int spanCount, const Predicate* predicate);
+bool frame_matches(const CollectionHeader* header, const char* document, size_t length, const Predicate* predicate);
+bool find_record(const MappedFile* view, const CollectionHeader* header, uint64_t recordId, const char** document, size_t* length);
+bool keep_item(ScanResult* result, const cJSON* item, const Projection* projection);
+bool next_candidate(const MappedFile* view, const CollectionHeader* header, const uint64_t* recordIds, int count, uint64_t* cursor, uint64_t* recordId, const char** document, size_t* length);
+bool next_record(const MappedFile* view, const CollectionHeader* header, uint64_t* cursor, uint64_t* recordId, const char** document, size_t* length);
+bool open_collection(const char* fileName, MappedFile* view, CollectionHeader* header);
+uint64_t next_free_id(const cJSON* data, uint64_t floor);
+bool page_full(const ScanResult* result);
+bool print_item(char** document, int index, const cJSON* item, const Projection* projection);
 const char* file_type_string(FileType fileType);
+cJSON* find_key_entry(const cJSON* keys, const char* key);
+size_t header_size(const CollectionHeader* header);
+void free_result(ScanResult* result);
+int next_element(const char* data, size_t length, size_t* offset, const char** element, size_t* elementLength);
+int compare_ids(const void* left, const void* right);
+bool parse_header(const char* data, size_t length, CollectionHeader* header);
+cJSON* parse_frame(const CollectionHeader* header, const char* document, size_t length);
+bool read_current_header(const char* fileName, CollectionHeader* header);
+bool read_header(FILE* file, CollectionHeader* header);
+bool scan_document(ScanResult* result, cJSON* item, bool matched, const Predicate* predicate);
+bool visit_encoded(ScanResult* result, const uint8_t* document, size_t length);
+bool visit_item(ScanResult* result, const cJSON* item);
+long valid_log_length(FILE* file, const CollectionHeader* header);
+bool writer_delete(CollectionWriter* writer, uint64_t recordId);
+bool writer_insert(CollectionWriter* writer, const cJSON* item, const char* record, size_t length, uint64_t* recordId, bool* inOrder);
+bool writer_replace(CollectionWriter* writer, uint64_t recordId, const char* record, size_t length);
 
 
 // Check if a database exists in the metadata file
@@ -90,6 +151,68 @@ bool append_entry(const char* metaFile, const char* name, const char* path, cons
     return _status;
 }
 
+// Key entries: a meta file of the database (INDEX_META, RANGE_META, ZONE_META or COLUMN_META)
+// lists, per collection, the keys that carry one kind of index
+
+// Read the keys registered on a collection; the array belongs to *meta, which the caller frees
+cJSON* load_key_entries(const char* databaseName, const char* metaName, const char* collectionName, cJSON** meta) {
+    char _metaFile[MAX_PATH_LEN];
+    get_key_meta(_metaFile, databaseName, metaName);
+    *meta = load_json(_metaFile);
+    return cJSON_GetObjectItemCaseSensitive(*meta, collectionName);
+}
+
+bool has_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key) {
+    cJSON* _meta = NULL;
+    const bool _found = find_key_entry(load_key_entries(databaseName, metaName, collectionName, &_meta), key) != NULL;
+    cJSON_Delete(_meta);
+    return _found;
+}
+
+// Register a key on a collection
+bool append_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key, char* error) {
+    char _metaFile[MAX_PATH_LEN];
+    get_key_meta(_metaFile, databaseName, metaName);
+    cJSON* _meta = load_json(_metaFile);
+    if (!_meta) _meta = cJSON_CreateObject();
+
+    cJSON* _keys = cJSON_GetObjectItemCaseSensitive(_meta, collectionName);
+    if (!_keys) _keys = cJSON_AddArrayToObject(_meta, collectionName);
+    cJSON_AddItemToArray(_keys, cJSON_CreateString(key));
+
+    const bool _status = save_json(_metaFile, _meta, error);
+    cJSON_Delete(_meta);
+    return _status;
+}
+
+// Unregister a key, or every key of the collection if key is NULL
+bool remove_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key, char* error) {
+    char _metaFile[MAX_PATH_LEN];
+    get_key_meta(_metaFile, databaseName, metaName);
+    cJSON* _meta = load_json(_metaFile);
+    cJSON* _keys = cJSON_GetObjectItemCaseSensitive(_meta, collectionName);
+    if (!_keys) {
+        cJSON_Delete(_meta);
+        return true;
+    }
+
+    cJSON* _key = key ? find_key_entry(_keys, key) : NULL;
+    if (_key) cJSON_Delete(cJSON_DetachItemViaPointer(_keys, _key));
+    if (!key || cJSON_GetArraySize(_keys) == 0) cJSON_DeleteItemFromObjectCaseSensitive(_meta, collectionName);
+
+    const bool _status = save_json(_metaFile, _meta, error);
+    cJSON_Delete(_meta);
+    return _status;
+}
+
+cJSON* find_key_entry(const cJSON* keys, const char* key) {
+    cJSON* _key = NULL;
+    cJSON_ArrayForEach(_key, keys) {
+        if (cJSON_IsString(_key) && strcmp(_key->valuestring, key) == 0) break;
+    }
+    return _key;
+}
+
 // Return string representation of file type enum
 const char* file_type_string(const FileType fileType) {
     switch (fileType) {
@@ -99,68 +222,670 @@ const char* file_type_string(const FileType fileType) {
     }
 }
 
-// Serialize JSON and write to disk
-bool dump_binary(const char* fileName, const cJSON* data, char* error) {
+// Serialize a collection and atomically replace it on disk as a new generation of pages.
+// The new file is synced before it replaces the old one: the write-ahead log only holds
+// mutations since the last checkpoint, so it cannot rebuild a collection lost mid-rewrite.
+bool dump_binary(const char* fileName, const cJSON* data, const uint64_t lsn, char* error) {
     if (!data || !cJSON_IsArray(data)) {
         get_error(error, "fatal: Invalid JSON object");
         return false;
     }
 
-    char* _dataString = cJSON_PrintUnformatted(data);
-    if (!_dataString) {
-        get_error(error, "fatal: Failed to convert JSON to string");
-        return false;
-    }
+    char _tempName[MAX_PATH_LEN + 4];
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", fileName);
 
-    FILE* _file = fopen(fileName, "wb");
+    FILE* _file = fopen(_tempName, "wb");
     if (!_file) {
         get_error(error, "fatal: Could not open file '%s' for writing", fileName);
-        free(_dataString);
         return false;
     }
 
-    fwrite(_dataString, sizeof(char), strlen(_dataString), _file);
-    fclose(_file);
-    free(_dataString);
+    // A journal left without its collection file belongs to no generation that can come back
+    char _journalName[MAX_PATH_LEN + 8];
+    snprintf(_journalName, sizeof(_journalName), "%s%s", fileName, JOURNAL_SUFFIX);
+    CollectionHeader _previous;
+    FILE* _old = fopen(fileName, "rb");
+    const uint64_t _generation = _old && read_header(_old, &_previous) ? _previous.generation + 1 : 1;
+    if (_old) fclose(_old);
+    else remove(_journalName);
+
+    // Ids of removed documents are never handed out again
+    const uint64_t _nextId = next_free_id(data, get_next_id(fileName));
+    const CollectionHeader _header = { COLLECTION_MAGIC, COLLECTION_VERSION, lsn, _nextId, _generation, COLLECTION_PAGE_SIZE, 0 };
+    static const char _padding[COLLECTION_PAGE_SIZE - sizeof(CollectionHeader)];
+    bool _status = fwrite(&_header, sizeof(_header), 1, _file) == 1 && fwrite(_padding, sizeof(_padding), 1, _file) == 1 &&
+                   page_write_all(_file, data, error) && fflush(_file) == 0 && _commit(_fileno(_file)) == 0;
+    if (fclose(_file) != 0) _status = false;
+
+    // Pages the pool holds for the old file must not be written back into the new one
+    _status = _status && pool_flush(fileName, error);
+    if (!_status || !MoveFileExA(_tempName, fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        get_error(error, "fatal: Failed to write collection '%s'", fileName);
+        remove(_tempName);
+        return false;
+    }
+
+    // The journal of the previous generation can no longer be rolled back onto the file
+    remove(_journalName);
+    page_invalidate(fileName);
     return true;
 }
 
-// Load and parse JSON file from disk (binary file)
-cJSON* load_binary(const char* fileName, char* error) {
-    FILE* _file = fopen(fileName, "rb");
-    if (!_file) {
-        return NULL;
+// Store one document (or each item of an array) in a collection, in free space left by
+// removed documents where there is room and at the end otherwise. recordIds receives the
+// record id of each stored document, and inOrder whether all of them landed after every
+// document already in the collection. Returns the number stored, or -1 on failure.
+int append_binary(const char* fileName, const cJSON* data, const uint64_t lsn, uint64_t** recordIds, bool* inOrder, char* error) {
+    *recordIds = NULL;
+    *inOrder = true;
+    if (!data) {
+        get_error(error, "fatal: Invalid JSON object");
+        return -1;
     }
 
-    fseek(_file, 0, SEEK_END);
-    const long _len = ftell(_file);
-    if (_len <= 0) {
-        fclose(_file);
+    // Missing, legacy text and older log files are rewritten in the current format first
+    if (get_collection_version(fileName) != COLLECTION_VERSION) {
+        cJSON* _collection = get_file_size(fileName) > 0 ? load_binary(fileName, error) : NULL;
+        if (!_collection) _collection = cJSON_CreateArray();
+
+        const bool _converted = dump_binary(fileName, _collection, lsn, error);
+        cJSON_Delete(_collection);
+        if (!_converted) return -1;
+    }
+
+    CollectionHeader _header;
+    CollectionWriter* _writer = begin_writer(fileName, &_header, error);
+    if (!_writer) return -1;
+
+    cJSON* _single = cJSON_IsArray(data) ? NULL : cJSON_CreateArrayReference(data);
+    const cJSON* _documents = _single ? _single : data;
+    const int _size = cJSON_GetArraySize(_documents);
+    uint64_t* _ids = malloc((_size > 0 ? (size_t)_size : 1) * sizeof(uint64_t));
+    ByteBuffer _document = { 0 };
+    const cJSON* _item = NULL;
+    int _count = 0;
+    bool _status = _ids != NULL;
+
+    cJSON_ArrayForEach(_item, _documents) {
+        if (!_status) break;
+        _document.size = 0;
+        _status = encode_value(&_document, _item) &&
+                  writer_insert(_writer, _item, (const char*)_document.data, _document.size, &_ids[_count], inOrder);
+        if (_status) _count++;
+    }
+    free(_document.data);
+    cJSON_Delete(_single);
+
+    // The header is stamped only once the pages are written
+    if (_status) {
+        _header.appliedLsn = lsn;
+        _header.nextId = next_free_id(data, _header.nextId);
+        _status = commit_writer(_writer, &_header, error);
+    } else {
+        abort_writer(_writer);
+        get_error(error, "fatal: Failed to append to collection '%s'", fileName);
+    }
+
+    if (!_status) {
+        free(_ids);
+        return -1;
+    }
+    *recordIds = _ids;
+    return _count;
+}
+
+// Remove the documents matching a filter from a collection, freeing their slots in place.
+// Only the documents at recordIds are read when they are given (NULL reads every document).
+// Returns the number removed, or -1 on failure.
+int remove_binary(const char* fileName, const uint64_t* recordIds, const int count, const Predicate* predicate, const uint64_t lsn, char* error) {
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header) || _header.version != COLLECTION_VERSION) {
+        if (_view.data || _view.pages || _view.tree) unmap_file(&_view);
         get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        return -1;
+    }
+
+    CollectionWriter* _writer = NULL;
+    uint64_t _cursor = 0, _recordId;
+    const char* _document;
+    size_t _length;
+    int _removed = 0;
+    bool _status = true;
+
+    // Pages are only read for writing once a document matches
+    while (_status && next_candidate(&_view, &_header, recordIds, count, &_cursor, &_recordId, &_document, &_length)) {
+        if (!predicate_matches_encoded(predicate, (const uint8_t*)_document, _length)) continue;
+        if (!_writer && !(_writer = begin_writer(fileName, &_header, error))) _status = false;
+        else if (!writer_delete(_writer, _recordId)) _status = false;
+        else _removed++;
+    }
+    unmap_file(&_view);
+
+    if (_status && _writer) {
+        _header.appliedLsn = lsn;
+        _status = commit_writer(_writer, &_header, error);
+    } else if (_writer) {
+        abort_writer(_writer);
+        get_error(error, "fatal: Failed to remove documents from '%s'", fileName);
+    }
+    return _status ? _removed : -1;
+}
+
+// Apply an update action to the documents matching a filter, rewriting each one in place
+// where its page has room for it. Only the documents at recordIds are read when they are
+// given (NULL reads every document). updated receives the record ids of the documents
+// changed. Returns the number updated, or -1 on failure.
+int update_binary(const char* fileName, const uint64_t* recordIds, const int count, const Predicate* predicate, const Action action, const char* data, const uint64_t lsn, uint64_t** updated, char* error) {
+    *updated = NULL;
+
+    // Ids are assigned by the engine and address documents for their whole life
+    cJSON* _change = cJSON_Parse(data);
+    if (changes_id(action, _change)) {
+        get_error(error, "fatal: Field '%s' cannot be updated", ID_KEY);
+        cJSON_Delete(_change);
+        return -1;
+    }
+
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header) || _header.version != COLLECTION_VERSION) {
+        if (_view.data || _view.pages || _view.tree) unmap_file(&_view);
+        get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        cJSON_Delete(_change);
+        return -1;
+    }
+
+    CollectionWriter* _writer = NULL;
+    ByteBuffer _encoded = { 0 };
+    uint64_t* _ids = NULL;
+    uint64_t _cursor = 0, _recordId;
+    const char* _document;
+    size_t _length;
+    int _updated = 0, _capacity = 0;
+    bool _status = true;
+
+    while (_status && next_candidate(&_view, &_header, recordIds, count, &_cursor, &_recordId, &_document, &_length)) {
+        if (!predicate_matches_encoded(predicate, (const uint8_t*)_document, _length)) continue;
+
+        cJSON* _item = decode_value((const uint8_t*)_document, _length);
+        _encoded.size = 0;
+        if (!_item) get_error(error, "fatal: Failed to parse document in '%s'", fileName);
+        _status = _item && apply_action(_item, action, _change, data, error) && encode_value(&_encoded, _item);
+        cJSON_Delete(_item);
+
+        if (_status && _updated == _capacity) {
+            _capacity = _capacity ? _capacity * 2 : 16;
+            uint64_t* _grown = realloc(_ids, (size_t)_capacity * sizeof(uint64_t));
+            if (_grown) _ids = _grown;
+            else _status = false;
+        }
+        if (_status && !_writer && !(_writer = begin_writer(fileName, &_header, error))) {
+            _status = false;
+        } else if (_status && !writer_replace(_writer, _recordId, (const char*)_encoded.data, _encoded.size)) {
+            get_error(error, "fatal: Failed to update documents in '%s'", fileName);
+            _status = false;
+        } else if (_status) {
+            _ids[_updated++] = _recordId;
+        }
+    }
+    unmap_file(&_view);
+    free(_encoded.data);
+    cJSON_Delete(_change);
+
+    if (_status && _writer) {
+        _header.appliedLsn = lsn;
+        _status = commit_writer(_writer, &_header, error);
+    } else {
+        abort_writer(_writer);
+    }
+
+    if (!_status) {
+        free(_ids);
+        return -1;
+    }
+    *updated = _ids;
+    return _updated;
+}
+
+// Start changing a version 5 collection, in its pages or in the memtable of its LSM tree
+CollectionWriter* begin_writer(const char* fileName, CollectionHeader* header, char* error) {
+    CollectionWriter* _writer = calloc(1, sizeof(CollectionWriter));
+    if (!_writer) {
+        get_error(error, "fatal: Could not open collection '%s' for writing", fileName);
         return NULL;
     }
 
-    rewind(_file);
-    char* _buffer = malloc(_len + 1);
-    if (!_buffer) {
+    if (get_collection_storage(fileName) == storageLsm) _writer->tree = lsm_begin(fileName, header, error);
+    else _writer->pages = page_begin(fileName, header, error);
+    if (_writer->pages || _writer->tree) return _writer;
+    free(_writer);
+    return NULL;
+}
+
+// Store a new document. An LSM tree files it under its id, which is also its record id.
+bool writer_insert(CollectionWriter* writer, const cJSON* item, const char* record, const size_t length, uint64_t* recordId, bool* inOrder) {
+    if (writer->pages) return page_insert(writer->pages, record, length, recordId, inOrder);
+
+    const cJSON* _id = cJSON_GetObjectItem(item, ID_KEY);
+    *recordId = cJSON_IsNumber(_id) && _id->valuedouble >= 1 ? (uint64_t)_id->valuedouble : 0;
+    return lsm_put(writer->tree, *recordId, record, length);
+}
+
+bool writer_replace(CollectionWriter* writer, const uint64_t recordId, const char* record, const size_t length) {
+    return writer->pages ? page_replace(writer->pages, recordId, record, length) : lsm_put(writer->tree, recordId, record, length);
+}
+
+bool writer_delete(CollectionWriter* writer, const uint64_t recordId) {
+    return writer->pages ? page_delete(writer->pages, recordId) : lsm_delete(writer->tree, recordId);
+}
+
+bool commit_writer(CollectionWriter* writer, const CollectionHeader* header, char* error) {
+    const bool _status = writer->pages ? page_commit(writer->pages, header, error) : lsm_commit(writer->tree, header, error);
+    free(writer);
+    return _status;
+}
+
+void abort_writer(CollectionWriter* writer) {
+    if (!writer) return;
+    page_abort(writer->pages);
+    lsm_abort(writer->tree);
+    free(writer);
+}
+
+// Return the LSN of the last logged mutation applied to a collection file
+uint64_t get_applied_lsn(const char* fileName) {
+    CollectionHeader _header;
+    return read_current_header(fileName, &_header) ? _header.appliedLsn : 0;
+}
+
+// Return the id the next document inserted into a collection receives (0 before version 4)
+uint64_t get_next_id(const char* fileName) {
+    CollectionHeader _header;
+    return read_current_header(fileName, &_header) ? _header.nextId : 0;
+}
+
+// Rewrite a legacy or older collection file in the current format, keeping its applied LSN.
+// Ids are only assigned from version 4 onwards, so inserts upgrade the file first.
+bool upgrade_binary(const char* fileName, char* error) {
+    if (get_file_size(fileName) <= 0 || get_collection_version(fileName) == COLLECTION_VERSION) return true;
+
+    cJSON* _collection = load_binary(fileName, error);
+    const bool _status = _collection && dump_binary(fileName, _collection, get_applied_lsn(fileName), error);
+    cJSON_Delete(_collection);
+    return _status;
+}
+
+// Stamp each document (object or array of objects) with an "_id" counted up from nextId,
+// replacing any id the client supplied. Returns the id the next document receives.
+uint64_t assign_ids(cJSON* data, uint64_t nextId) {
+    cJSON* _single = cJSON_IsObject(data) ? cJSON_CreateArrayReference(data) : NULL;
+    const cJSON* _documents = _single ? _single : data;
+    cJSON* _item = NULL;
+
+    cJSON_ArrayForEach(_item, _documents) {
+        if (!cJSON_IsObject(_item)) continue;
+        while (cJSON_GetObjectItem(_item, ID_KEY)) cJSON_DeleteItemFromObject(_item, ID_KEY);
+
+        // The id goes first, so printed documents lead with it
+        cJSON* _id = cJSON_AddNumberToObject(_item, ID_KEY, (double)nextId++);
+        if (_id) cJSON_InsertItemInArray(_item, 0, cJSON_DetachItemViaPointer(_item, _id));
+    }
+
+    cJSON_Delete(_single);
+    return nextId;
+}
+
+// One past the largest "_id" among the documents, but at least floor and never below 1
+uint64_t next_free_id(const cJSON* data, const uint64_t floor) {
+    cJSON* _single = cJSON_IsObject(data) ? cJSON_CreateArrayReference(data) : NULL;
+    const cJSON* _documents = _single ? _single : data;
+    uint64_t _nextId = floor ? floor : 1;
+    const cJSON* _item = NULL;
+
+    cJSON_ArrayForEach(_item, _documents) {
+        const cJSON* _id = cJSON_GetObjectItem(_item, ID_KEY);
+        if (cJSON_IsNumber(_id) && _id->valuedouble >= (double)_nextId && _id->valuedouble < (double)MAX_DOCUMENT_ID) {
+            _nextId = (uint64_t)_id->valuedouble + 1;
+        }
+    }
+
+    cJSON_Delete(_single);
+    return _nextId;
+}
+
+// Return the log format version of a collection file (0 for legacy text or a missing file)
+uint32_t get_collection_version(const char* fileName) {
+    FILE* _file = fopen(fileName, "rb");
+    if (!_file) return 0;
+
+    CollectionHeader _header;
+    const uint32_t _version = read_header(_file, &_header) ? _header.version : 0;
+    fclose(_file);
+    return _version;
+}
+
+// Return how a collection file stores its documents (pages for anything but an LSM collection)
+CollectionStorage get_collection_storage(const char* fileName) {
+    FILE* _file = fopen(fileName, "rb");
+    if (!_file) return storagePages;
+
+    CollectionHeader _header;
+    const CollectionStorage _storage = read_header(_file, &_header) && _header.storage == storageLsm ? storageLsm : storagePages;
+    fclose(_file);
+    return _storage;
+}
+
+// Call visitor for each stored document of a collection, in collection order.
+// Returns false if the file is not a collection written by the engine.
+bool walk_frames(const char* fileName, const FrameVisitor visitor, void* context) {
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header)) return false;
+    if (_header.version == 0) {
+        unmap_file(&_view);
+        return false;
+    }
+
+    uint64_t _cursor = 0, _recordId;
+    const char* _document;
+    size_t _length;
+    while (next_record(&_view, &_header, &_cursor, &_recordId, &_document, &_length)) {
+        if (!visitor(context, &_header, _recordId, _document, _length)) break;
+    }
+
+    unmap_file(&_view);
+    return true;
+}
+
+// Call visitor for each of the documents at recordIds that is still stored. Record ids come
+// from indexes, so each one is checked before it is trusted.
+bool visit_records(const char* fileName, const uint64_t* recordIds, const int count, const FrameVisitor visitor, void* context) {
+    if (count <= 0) return true;
+
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header)) return false;
+    if (_header.version == 0) {
+        unmap_file(&_view);
+        return false;
+    }
+
+    const char* _document;
+    size_t _length;
+    for (int i = 0; i < count; i++) {
+        if (!find_record(&_view, &_header, recordIds[i], &_document, &_length)) continue;
+        if (!visitor(context, &_header, recordIds[i], _document, _length)) break;
+    }
+
+    unmap_file(&_view);
+    return true;
+}
+
+// Step to the next document of a mapped collection in collection order. cursor starts at 0;
+// recordId receives the record id (version 5) or frame offset (before) of the document.
+bool next_record(const MappedFile* view, const CollectionHeader* header, uint64_t* cursor, uint64_t* recordId, const char** document, size_t* length) {
+    if (view->tree) return lsm_next(view->tree, cursor, recordId, document, length);
+    if (header->version >= 5) return page_next(view->pages, cursor, recordId, document, length);
+
+    // A frame cut short or failing its checksum marks the end of the committed log
+    const uint64_t _offset = *cursor ? *cursor : header_size(header);
+    if (!find_record(view, header, _offset, document, length)) return false;
+    *recordId = _offset;
+    *cursor = _offset + sizeof(RecordHeader) + *length;
+    return true;
+}
+
+// Find the document a record id (or, before version 5, a frame offset) addresses
+bool find_record(const MappedFile* view, const CollectionHeader* header, const uint64_t recordId, const char** document, size_t* length) {
+    if (view->tree) return lsm_find(view->tree, recordId, document, length);
+    if (header->version >= 5) return page_find(view->pages, recordId, document, length);
+
+    RecordHeader _record;
+    if (recordId < header_size(header) || recordId + sizeof(_record) > view->length) return false;
+    memcpy(&_record, view->data + recordId, sizeof(_record));
+    const char* _frame = view->data + recordId + sizeof(_record);
+    if (_record.length > view->length - recordId - sizeof(_record) ||
+        checksum(_frame, _record.length) != _record.checksum) return false;
+
+    *document = _frame;
+    *length = _record.length;
+    return true;
+}
+
+// Next document of a pass over a collection: every document in turn, or when recordIds is
+// given only those it lists that are still stored (cursor then counts through the list)
+bool next_candidate(const MappedFile* view, const CollectionHeader* header, const uint64_t* recordIds, const int count, uint64_t* cursor, uint64_t* recordId, const char** document, size_t* length) {
+    if (!recordIds) return next_record(view, header, cursor, recordId, document, length);
+
+    while (*cursor < (uint64_t)count) {
+        *recordId = recordIds[(*cursor)++];
+        if (find_record(view, header, *recordId, document, length)) return true;
+    }
+    return false;
+}
+
+// Undo what a crash left half-written in a collection file: paged files are rolled back to
+// the last checkpoint through their journal, LSM collections to their last flush, and logs
+// lose a frame cut short at their end
+bool repair_binary(const char* fileName, char* error) {
+    FILE* _file = fopen(fileName, "rb+");
+    if (!_file) return true;
+
+    CollectionHeader _header;
+    bool _status = true;
+    const bool _framed = read_header(_file, &_header);
+    if (_framed && _header.version >= 5) {
         fclose(_file);
-        get_error(error, "fatal: Memory allocation failed for reading '%s'", fileName);
-        return NULL;
+        return _header.storage == storageLsm ? lsm_repair(fileName, error) : page_rollback(fileName, error);
+    }
+    if (_framed) {
+        const long _valid = valid_log_length(_file, &_header);
+        fseek(_file, 0, SEEK_END);
+        if (_valid < ftell(_file)) {
+            fflush(_file);
+            _status = _chsize_s(_fileno(_file), _valid) == 0;
+        }
     }
 
-    fread(_buffer, 1, _len, _file);
-    _buffer[_len] = '\0';
     fclose(_file);
+    if (!_status) get_error(error, "fatal: Could not repair collection '%s'", fileName);
+    return _status;
+}
+
+// Length of the log prefix made of complete frames with valid checksums
+long valid_log_length(FILE* file, const CollectionHeader* header) {
+    long _offset = (long)header_size(header);
+    char* _document = NULL;
+    size_t _capacity = 0;
+    RecordHeader _record;
+
+    fseek(file, _offset, SEEK_SET);
+    while (fread(&_record, sizeof(_record), 1, file) == 1) {
+        if (_record.length > _capacity) {
+            char* _grown = realloc(_document, _record.length);
+            if (!_grown) break;
+            _document = _grown;
+            _capacity = _record.length;
+        }
+        if (fread(_document, 1, _record.length, file) != _record.length ||
+            checksum(_document, _record.length) != _record.checksum) break;
+        _offset += (long)(sizeof(_record) + _record.length);
+    }
 
-    cJSON* _json = cJSON_Parse(_buffer);
-    free(_buffer);
+    free(_document);
+    return _offset;
+}
+
+// Make a collection file durable at a checkpoint, flushing the memtable of an LSM collection
+bool sync_binary(const char* fileName, char* error) {
+    return page_sync(fileName, error) && lsm_sync(fileName, error);
+}
+
+// Read and validate the collection header at the start of a file (any log version)
+bool read_header(FILE* file, CollectionHeader* header) {
+    char _bytes[sizeof(CollectionHeader)];
+    rewind(file);
+    const size_t _read = fread(_bytes, 1, sizeof(_bytes), file);
+    return parse_header(_bytes, _read, header);
+}
+
+// Validate a collection header held in memory
+bool parse_header(const char* data, const size_t length, CollectionHeader* header) {
+    memset(header, 0, sizeof(*header));
+    if (length < offsetof(CollectionHeader, appliedLsn)) return false;
+    memcpy(header, data, length < sizeof(*header) ? length : sizeof(*header));
+    if (memcmp(header->magic, COLLECTION_MAGIC, sizeof(header->magic)) != 0) return false;
+
+    // Version 1 logs carry no applied LSN and start their frames right after the version;
+    // logs before version 4 carry no id counter, and only paged files have a generation
+    if (header->version == 1) header->appliedLsn = 0;
+    if (header->version < 4) header->nextId = 0;
+    if (header->version < 5) header->generation = header->pageSize = header->storage = 0;
+    return header->version >= 1 && header->version <= COLLECTION_VERSION;
+}
+
+// Size of the header in front of the first frame (or page)
+size_t header_size(const CollectionHeader* header) {
+    if (header->version == 1) return offsetof(CollectionHeader, appliedLsn);
+    if (header->version >= 5) return header->pageSize;
+    return header->version < 4 ? offsetof(CollectionHeader, nextId) : offsetof(CollectionHeader, generation);
+}
 
-    if (!_json) {
-        get_error(error, "fatal: Failed to parse JSON from binary");
+// Read the header of a collection file; that of an LSM collection comes from its tree, which
+// is ahead of the file by the mutations its memtable holds
+bool read_current_header(const char* fileName, CollectionHeader* header) {
+    FILE* _file = fopen(fileName, "rb");
+    if (!_file) return false;
+
+    const bool _framed = read_header(_file, header);
+    fclose(_file);
+    return _framed && (header->storage != storageLsm || lsm_header(fileName, header));
+}
+
+// Load a collection from disk, reading its pages or document log (or parsing a legacy text file)
+cJSON* load_binary(const char* fileName, char* error) {
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header)) {
+        if (_view.file || _header.version) get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
         return NULL;
     }
 
-    return _json;
+    if (_header.version == 0) {
+        cJSON* _json = cJSON_ParseWithLength(_view.data, _view.length);
+        unmap_file(&_view);
+        if (!_json) {
+            get_error(error, "fatal: Failed to parse JSON from binary");
+            return NULL;
+        }
+        return _json;
+    }
+
+    cJSON* _collection = cJSON_CreateArray();
+    uint64_t _cursor = 0, _recordId;
+    const char* _document;
+    size_t _length;
+
+    while (next_record(&_view, &_header, &_cursor, &_recordId, &_document, &_length)) {
+        cJSON* _item = parse_frame(&_header, _document, _length);
+        if (!_item) {
+            get_error(error, "fatal: Failed to parse document in '%s'", fileName);
+            cJSON_Delete(_collection);
+            unmap_file(&_view);
+            return NULL;
+        }
+        cJSON_AddItemToArray(_collection, _item);
+    }
+
+    unmap_file(&_view);
+    return _collection;
+}
+
+// Turn one frame back into a document: binary since version 3, JSON text before
+cJSON* parse_frame(const CollectionHeader* header, const char* document, const size_t length) {
+    if (header->version >= 3) return decode_value((const uint8_t*)document, length);
+    return cJSON_ParseWithLength(document, length);
+}
+
+// Map a whole file read-only. On failure view->file is left set if the file exists but is
+// empty or could not be mapped, so callers can tell a missing file from an unreadable one.
+bool map_file(const char* fileName, MappedFile* view) {
+    memset(view, 0, sizeof(*view));
+    HANDLE _file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_file == INVALID_HANDLE_VALUE) return false;
+    view->file = _file;
+
+    LARGE_INTEGER _size;
+    if (!GetFileSizeEx(_file, &_size) || _size.QuadPart <= 0 || (unsigned long long)_size.QuadPart > SIZE_MAX) {
+        CloseHandle(_file);
+        return false;
+    }
+
+    HANDLE _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const char* _data = _mapping ? MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!_data) {
+        if (_mapping) CloseHandle(_mapping);
+        CloseHandle(_file);
+        return false;
+    }
+
+    view->data = _data;
+    view->length = (size_t)_size.QuadPart;
+    view->mapping = _mapping;
+    return true;
+}
+
+// Open a collection file for reading. A paged file is read through the buffer pool instead
+// of being mapped, so that pages it holds and pages written back by it are read alike, and
+// an LSM collection through its tree. header receives the collection header, with version 0
+// for legacy text. Fails as map_file does otherwise.
+bool open_collection(const char* fileName, MappedFile* view, CollectionHeader* header) {
+    memset(view, 0, sizeof(*view));
+    FILE* _file = fopen(fileName, "rb");
+    const bool _framed = _file && read_header(_file, header);
+    if (_file) fclose(_file);
+    if (!_framed) memset(header, 0, sizeof(*header));
+    if (header->version < 5) return map_file(fileName, view);
+    if (header->storage == storageLsm) {
+        view->tree = lsm_open(fileName);
+        return view->tree != NULL;
+    }
+
+    view->pages = page_open(fileName);
+    return view->pages != NULL;
+}
+
+// Release a view created by map_file or open_collection
+void unmap_file(MappedFile* view) {
+    if (view->pages) page_close(view->pages);
+    if (view->tree) lsm_close(view->tree);
+    if (view->data) UnmapViewOfFile(view->data);
+    if (view->mapping) CloseHandle(view->mapping);
+    if (view->file) CloseHandle(view->file);
+    memset(view, 0, sizeof(*view));
+}
+
+// Size of a file in bytes, or -1 if it cannot be opened
+long long get_file_size(const char* fileName) {
+    FILE* _file = fopen(fileName, "rb");
+    if (!_file) return -1;
+
+    fseek(_file, 0, SEEK_END);
+    const long long _size = ftell(_file);
+    fclose(_file);
+    return _size;
+}
+
+// 32-bit FNV-1a checksum of a document frame
+uint32_t checksum(const char* data, const size_t length) {
+    uint32_t _hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        _hash ^= (unsigned char)data[i];
+        _hash *= 16777619u;
+    }
+    return _hash;
 }
 
 // Load and parse JSON file from disk (text file)
@@ -214,65 +939,418 @@ bool save_json(const char* filename, cJSON* config, char* error) {
     return true;
 }
 
-// Print documents based on filter conditions
-int print_filtered_documents(cJSON* collection, const char* key, const char* value, const Condition condition, char*** list, char* error) {
-    if (condition > all) {
-        get_error(error, "fatal: Invalid condition specified");
-        *list = NULL;
-        return -1;
-    }
-
+// Print documents based on filter conditions, or hand them to a visitor when one is given
+int print_filtered_documents(cJSON* collection, const Predicate* predicate, const Projection* projection, const DocumentVisitor visitor, void* context, char*** list, char* error) {
+    *list = NULL;
     if (!collection || !cJSON_IsArray(collection)) {
         get_error(error, "fatal: Not a valid array format");
-        *list = NULL;
         return -1;
     }
 
+    ScanResult _result = { .visitor = visitor, .context = context };
     const cJSON* _item = NULL;
-    const int _size = cJSON_GetArraySize(collection);
-    if (_size == 0) *list = NULL;
-    document = malloc(_size * sizeof(char*));
-    int _index = 0;
 
     cJSON_ArrayForEach(_item, collection) {
-        if (condition == all || key == NULL || value == NULL) {
-            print_item(document, _index, _item);
+        if (!predicate_matches(predicate, _item)) continue;
+        if (!keep_item(&_result, _item, projection)) {
+            get_error(error, "fatal: Memory allocation failed");
+            free_result(&_result);
+            return -1;
+        }
+        if (_result.stopped) break;
+
+        // What printing built goes before the next document
+        arena_reset();
+    }
+
+    free(_result.text.data);
+    *list = _result.document;
+    return _result.count;
+}
+
+// Convert cJSON object to string and store it, with only the projected fields when given.
+// Fails when memory runs out, leaving nothing stored.
+bool print_item(char** document, const int index, const cJSON* item, const Projection* projection) {
+    const bool _projecting = projection && projection->fieldCount > 0;
+    cJSON* _projected = _projecting ? project_document(projection, item) : NULL;
+    char* str = !_projecting || _projected ? cJSON_Print(_projected ? _projected : item) : NULL;
+    cJSON_Delete(_projected);
+    if (!str) return false;
+
+    document[index] = _strdup(str);
+    cJSON_free(str);
+    return document[index] != NULL;
+}
+
+// Print documents based on filter conditions straight from a mapped collection file, one
+// document at a time. Binary logs are filtered through each document's field offset table;
+// text logs and legacy arrays are tokenized per document. Only matches are kept, so memory
+// is bounded by the result set and the largest document rather than by the collection.
+// When spans is given, only the record ids it lists are read. When page is given, only the
+// documents of that page are kept and the scan stops once it is full. With a visitor the
+// matches are handed to it instead of being kept, and binary documents go from their
+// encoding to its text without being decoded.
+int scan_filtered_documents(const char* fileName, const RecordSpan* spans, const int spanCount, const Predicate* predicate, const Projection* projection, ResultPage* page, const DocumentVisitor visitor, void* context, char*** list, char* error) {
+    *list = NULL;
+
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header)) {
+        get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        return -1;
+    }
+
+    // Tokens of binary collections hold record ids, those of legacy text collections offsets
+    if (page && page->from && (page->from == 't') != (_header.version == 0)) {
+        unmap_file(&_view);
+        get_error(error, "fatal: Resume token does not match collection '%s'", fileName);
+        return -1;
+    }
+
+    ScanResult _result = { .projection = projection, .page = page, .skip = page ? page->offset : 0, .visitor = visitor, .context = context };
+    bool _status = true;
+
+    // Segments whose Bloom filter rules the value out are not read
+    if (_view.tree && predicate->kind == predicateMatch && predicate->key && predicate->condition == equal) {
+        lsm_prune(_view.tree, predicate->key, predicate->value);
+    }
+
+    if (_header.version != 0) {
+        _status = collect_matches(&_result, &_view, &_header, NULL, 0, spans, spanCount, predicate);
+        if (!_status && _result.outOfMemory) get_error(error, "fatal: Memory allocation failed");
+        else if (!_status) get_error(error, "fatal: Failed to parse document in '%s'", fileName);
+    } else {
+        size_t _offset = 0;
+        const char* _element = NULL;
+        size_t _elementLength = 0;
+        int _next = 0;
+
+        // Legacy collections are a single JSON array; split it into its top-level documents.
+        // A resumed page starts at the element after the last one of the page before.
+        if (page && page->from == 't') {
+            _offset = (size_t)page->position;
+            _status = page->position <= _view.length;
         } else {
-            // Apply filter
-            bool _match = false;
-            cJSON* _field = cJSON_GetObjectItem(_item, key);
-            if (!_field) continue;
-
-            const bool isNumber = cJSON_IsNumber(_field);
-            if (!isNumber && condition != equal) continue;
-
-            if (isNumber) {
-                _match = is_related(_field->valuedouble, atof(value), condition);
-            } else if (cJSON_IsString(_field)) {
-                _match = strcmp(_field->valuestring, value) == 0;
-            } else if (cJSON_IsBool(_field)) {
-                _match = (strcmp(value, "true") == 0 && _field->valueint == 1) ||
-                        (strcmp(value, "false") == 0 && _field->valueint == 0);
-            }
+            while (_offset < _view.length && isspace((unsigned char)_view.data[_offset])) _offset++;
+            _status = _offset < _view.length && _view.data[_offset++] == '[';
+        }
+
+        while (_status && !page_full(&_result) && !_result.stopped && (_next = next_element(_view.data, _view.length, &_offset, &_element, &_elementLength)) > 0) {
+            _status = scan_document(&_result, cJSON_ParseWithLength(_element, _elementLength), false, predicate);
+        }
+
+        // As in collect_matches, a full page only hands out a token when a match follows it
+        const size_t _last = _offset;
+        bool _follows = false;
+        while (_status && page_full(&_result) && !_follows && (_next = next_element(_view.data, _view.length, &_offset, &_element, &_elementLength)) > 0) {
+            cJSON* _item = cJSON_ParseWithLength(_element, _elementLength);
+            _status = _item != NULL;
+            _follows = _status && predicate_matches(predicate, _item);
+            cJSON_Delete(_item);
+        }
+        if (_next < 0) _status = false;
+        if (!_status && _result.outOfMemory) get_error(error, "fatal: Memory allocation failed");
+        else if (!_status) get_error(error, "fatal: Failed to parse JSON from binary");
+        else if (_follows) snprintf(page->resume, sizeof(page->resume), "t%016llx", (unsigned long long)_last);
+    }
+
+    unmap_file(&_view);
+    if (!_status) {
+        free_result(&_result);
+        return -1;
+    }
+
+    free(_result.text.data);
+    *list = _result.document;
+    return _result.count;
+}
+
+// Print the documents at the given record ids that pass a filter, in collection order.
+// Record ids come from an index, so each document is checked before it is trusted.
+int fetch_filtered_documents(const char* fileName, const uint64_t* recordIds, const int count, const Predicate* predicate, const Projection* projection, ResultPage* page, const DocumentVisitor visitor, void* context, char*** list, char* error) {
+    *list = NULL;
+    if (count == 0) return 0;
+
+    MappedFile _view;
+    CollectionHeader _header;
+    if (!open_collection(fileName, &_view, &_header) || _header.version == 0) {
+        if (_view.data || _view.pages || _view.tree) unmap_file(&_view);
+        get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        return -1;
+    }
+    if (page && page->from == 't') {
+        unmap_file(&_view);
+        get_error(error, "fatal: Resume token does not match collection '%s'", fileName);
+        return -1;
+    }
+
+    ScanResult _result = { .projection = projection, .page = page, .skip = page ? page->offset : 0, .visitor = visitor, .context = context };
+    const bool _status = collect_matches(&_result, &_view, &_header, recordIds, count, NULL, 0, predicate);
+    unmap_file(&_view);
+    if (!_status) {
+        if (_result.outOfMemory) get_error(error, "fatal: Memory allocation failed");
+        else get_error(error, "fatal: Failed to parse document in '%s'", fileName);
+        free_result(&_result);
+        return -1;
+    }
+
+    free(_result.text.data);
+    *list = _result.document;
+    return _result.count;
+}
+
+// Sort record ids into collection order and drop duplicates; returns how many remain
+int sort_record_ids(uint64_t* recordIds, const int count) {
+    if (count <= 0) return 0;
+    qsort(recordIds, (size_t)count, sizeof(uint64_t), compare_ids);
+
+    int _unique = 1;
+    for (int i = 1; i < count; i++) {
+        if (recordIds[i] != recordIds[_unique - 1]) recordIds[_unique++] = recordIds[i];
+    }
+    return _unique;
+}
+
+int compare_ids(const void* left, const void* right) {
+    const uint64_t _left = *(const uint64_t*)left, _right = *(const uint64_t*)right;
+    return (_left > _right) - (_left < _right);
+}
 
-            if (_match) {
-                print_item(document, _index, _item);
+// Keep the documents of a mapped collection that pass a filter: every document, only those
+// at recordIds when they are given, or only those within spans. A walk leaving a span jumps
+// to the start of the next one. Record ids come in collection order, so a resumed page goes
+// on from the last record id of the page before. A full page walks on only until the next
+// match, and hands out a token only when there is one, so the last page ends without it.
+bool collect_matches(ScanResult* result, const MappedFile* view, const CollectionHeader* header, const uint64_t* recordIds, const int count, const RecordSpan* spans, const int spanCount, const Predicate* predicate) {
+    const bool _encoded = header->version >= 3;
+    const bool _resumed = result->page && result->page->from == 'r';
+    const uint64_t _after = _resumed ? result->page->position : 0;
+    uint64_t _cursor = spans && spanCount > 0 ? spans[0].start : 0, _recordId;
+    const char* _document;
+    size_t _length;
+    int _span = 0;
+    uint64_t _last = 0;
+    bool _full = false;
+    if (spans && spanCount <= 0) return true;
+
+    // A walk started at the last record id finds it first, if it is still stored
+    if (_resumed && recordIds) {
+        while (_cursor < (uint64_t)count && recordIds[_cursor] <= _after) _cursor++;
+    } else if (_resumed && _after > _cursor) {
+        _cursor = _after;
+    }
+
+    while (next_candidate(view, header, recordIds, count, &_cursor, &_recordId, &_document, &_length)) {
+        if (_resumed && _recordId <= _after) continue;
+        if (spans) {
+            while (_span < spanCount && _recordId >= spans[_span].end) _span++;
+            if (_span == spanCount) break;
+            if (_recordId < spans[_span].start) {
+                _cursor = spans[_span].start;
+                continue;
             }
         }
-        _index++;
+
+        if (_full) {
+            if (!frame_matches(header, _document, _length, predicate)) continue;
+            snprintf(result->page->resume, sizeof(result->page->resume), "r%016llx", (unsigned long long)_last);
+            break;
+        }
+
+        // Binary documents are tested before anything is decoded, then only their projected
+        // fields are; those the offset of a page skips are not decoded at all
+        if (_encoded && !predicate_matches_encoded(predicate, (const uint8_t*)_document, _length)) continue;
+        if (_encoded && result->skip > 0) {
+            result->skip--;
+            continue;
+        }
+        const bool _projected = result->projection && result->projection->fieldCount > 0;
+        if (_encoded && result->visitor && !_projected) {
+            if (!visit_encoded(result, (const uint8_t*)_document, _length)) return false;
+        } else {
+            cJSON* _item = _encoded && _projected ?
+                project_encoded(result->projection, (const uint8_t*)_document, _length) : parse_frame(header, _document, _length);
+            if (!scan_document(result, _item, _encoded, predicate)) return false;
+        }
+
+        if (result->stopped) break;
+        if (page_full(result)) {
+            _full = true;
+            _last = _recordId;
+        }
     }
+    return true;
+}
 
-    *list = document;
-    return _index;
+// Whether a frame of a collection passes a filter, decoding it only when it is JSON text
+bool frame_matches(const CollectionHeader* header, const char* document, const size_t length, const Predicate* predicate) {
+    if (header->version >= 3) return predicate_matches_encoded(predicate, (const uint8_t*)document, length);
+    cJSON* _item = parse_frame(header, document, length);
+    const bool _match = _item && predicate_matches(predicate, _item);
+    cJSON_Delete(_item);
+    return _match;
 }
 
-// Convert cJSON object to string and store it
-void print_item(char** document, const int index, const cJSON* item) {
-    char* str = cJSON_Print(item);
-    if (str && document != NULL) {
-        document[index] = _strdup(str);
-        free(str);
+// Keep one streamed document if it passes the filter, then free it. A matched document was
+// tested and projected as it was decoded.
+bool scan_document(ScanResult* result, cJSON* item, const bool matched, const Predicate* predicate) {
+    if (!item) return false;
+    const bool _match = matched || predicate_matches(predicate, item);
+
+    // Matches before the offset of a page are skipped
+    if (!_match || result->skip > 0) {
+        if (_match) result->skip--;
+        drop_item(item);
+        return true;
     }
+
+    const bool _kept = keep_item(result, item, matched ? NULL : result->projection);
+    drop_item(item);
+    return _kept;
+}
+
+// Free a streamed document; one built in the arena of a read goes with a reset of the arena,
+// along with everything else built for it, rather than node by node
+void drop_item(cJSON* item) {
+    if (!arena_reset()) cJSON_Delete(item);
+}
+
+// Add a matching document to the result of a scan, or hand it to the visitor of the scan.
+// Fails, marking the scan out of memory, when the document cannot be printed.
+bool keep_item(ScanResult* result, const cJSON* item, const Projection* projection) {
+    if (result->visitor) {
+        const bool _projected = projection && projection->fieldCount > 0;
+        cJSON* _projection = _projected ? project_document(projection, item) : NULL;
+        const bool _visited = (!_projected || _projection) && visit_item(result, _projection ? _projection : item);
+        cJSON_Delete(_projection);
+        result->outOfMemory = !_visited;
+        return _visited;
+    }
+
+    if (result->count == result->capacity) {
+        const int _capacity = result->capacity ? result->capacity * 2 : 64;
+        char** _grown = realloc(result->document, _capacity * sizeof(char*));
+        if (!_grown) {
+            result->outOfMemory = true;
+            return false;
+        }
+        result->document = _grown;
+        result->capacity = _capacity;
+    }
+
+    if (!print_item(result->document, result->count, item, projection)) {
+        result->outOfMemory = true;
+        return false;
+    }
+    result->count++;
+    return true;
+}
+
+// Hand a document to the visitor of a scan, printed into the text buffer of the scan; the
+// buffer doubles until the document fits and is then kept for the documents after it
+bool visit_item(ScanResult* result, const cJSON* item) {
+    ByteBuffer* _text = &result->text;
+    _text->size = 0;
+    while (_text->capacity == 0 || !cJSON_PrintPreallocated((cJSON*)item, (char*)_text->data, (int)_text->capacity, false)) {
+        if (_text->capacity > INT_MAX / 2 || !buffer_reserve(_text, _text->capacity ? _text->capacity * 2 : 4096)) return false;
+    }
+    _text->size = strlen((const char*)_text->data);
+
+    result->count++;
+    result->stopped = !result->visitor((const char*)_text->data, _text->size, result->context);
+    return true;
+}
+
+// Hand a binary document to the visitor of a scan, written from its encoding into the text
+// buffer of the scan without decoding it
+bool visit_encoded(ScanResult* result, const uint8_t* document, const size_t length) {
+    ByteBuffer* _text = &result->text;
+    _text->size = 0;
+    if (!write_json(_text, document, length) || !buffer_reserve(_text, 1)) return false;
+    _text->data[_text->size] = '\0';
+
+    result->count++;
+    result->stopped = !result->visitor((const char*)_text->data, _text->size, result->context);
+    return true;
+}
+
+// Whether a scan holds all the documents of its page
+bool page_full(const ScanResult* result) {
+    return result->page && result->page->limit > 0 && result->count >= result->page->limit;
+}
+
+// Read the paging of a query: its limit and offset, and where the resume token of the page
+// before says to go on from. Tokens are 'r' or 't' and a position in 16 hex digits.
+bool read_result_page(const QueryConfig* config, ResultPage* page, char* error) {
+    memset(page, 0, sizeof(*page));
+    if (config->limit < 0 || config->offset < 0) {
+        get_error(error, "fatal: Limit and offset cannot be negative");
+        return false;
+    }
+    page->limit = config->limit;
+    page->offset = config->offset;
+    if (!config->resume || !config->resume[0]) return true;
+
+    const char _from = config->resume[0];
+    char* _end = NULL;
+    if ((_from == 'r' || _from == 't') && isxdigit((unsigned char)config->resume[1])) {
+        page->position = strtoull(config->resume + 1, &_end, 16);
+    }
+    if (!_end || *_end != '\0') {
+        get_error(error, "fatal: Invalid resume token '%s'", config->resume);
+        return false;
+    }
+    page->from = _from;
+    return true;
+}
+
+void free_result(ScanResult* result) {
+    if (result->document) {
+        for (int i = 0; i < result->count; i++) free(result->document[i]);
+    }
+    free(result->document);
+    free(result->text.data);
+}
+
+// Find the next top-level element of a JSON array, starting after '[' or a previous element.
+// Returns 1 with the element's bounds, 0 at the closing ']', or -1 if the text is malformed.
+int next_element(const char* data, const size_t length, size_t* offset, const char** element, size_t* elementLength) {
+    size_t _at = *offset;
+    while (_at < length && (isspace((unsigned char)data[_at]) || data[_at] == ',')) _at++;
+    if (_at >= length) return -1;
+    if (data[_at] == ']') {
+        *offset = _at + 1;
+        return 0;
+    }
+
+    const size_t _start = _at;
+    int _depth = 0;
+    bool _inString = false;
+
+    for (; _at < length; _at++) {
+        const char _c = data[_at];
+        if (_inString) {
+            if (_c == '\\') _at++;
+            else if (_c == '"') _inString = false;
+            continue;
+        }
+
+        if (_c == '"') _inString = true;
+        else if (_c == '{' || _c == '[') _depth++;
+        else if (_c == '}' || _c == ']') {
+            if (_depth == 0) break;
+            if (--_depth == 0) {
+                _at++;
+                break;
+            }
+        } else if (_c == ',' && _depth == 0) break;
+    }
+
+    if (_depth != 0 || _inString) return -1;
+    *element = data + _start;
+    *elementLength = _at - _start;
+    *offset = _at;
+    return 1;
 }
 
 // Load and return key names from a metadata JSON file
@@ -289,7 +1367,7 @@ int load_list(const char* metaFile, char*** list, char* error) {
     cJSON* _item = NULL;
     cJSON_ArrayForEach(_item, _meta) _count++;
 
-    names = malloc(_count * sizeof(char*));
+    char** names = malloc(_count * sizeof(char*));
     int index = 0;
     cJSON_ArrayForEach(_item, _meta) {
         if (!_item->string) continue;
@@ -302,188 +1380,126 @@ int load_list(const char* metaFile, char*** list, char* error) {
     return _count;
 }
 
-// Remove documents from a collection based on filter condition
-int remove_filtered_documents(cJSON* collection, const char* key, const char* value, const Condition condition, char* error) {
+// Remove documents from a collection based on filter condition, unlinking matches in one pass
+int remove_filtered_documents(cJSON* collection, const Predicate* predicate, char* error) {
     if (!collection || !cJSON_IsArray(collection)) {
         get_error(error, "fatal: Not a valid array format");
         return -1;
     }
 
-    const bool _filterEnabled = !(condition == all || key == NULL || value == NULL);
-    const int _size = cJSON_GetArraySize(collection);
     int _deletedCount = 0;
 
-    // Iterate in reverse to avoid index shifting on deletion
-    for (int i = _size - 1; i >= 0; i--) {
-        bool _match = false;
-        if (_filterEnabled) {
-            cJSON* _item = cJSON_GetArrayItem(collection, i);
-            cJSON* _field = cJSON_GetObjectItem(_item, key);
-            if (!_field) continue;
-
-            const bool _isNumber = cJSON_IsNumber(_field);
-            if (!_isNumber && condition != equal) continue;
-
-            if (_isNumber) {
-                _match = is_related(_field->valuedouble, atof(value), condition);
-            } else if (cJSON_IsString(_field)) {
-                _match = strcmp(_field->valuestring, value) == 0;
-            } else if (cJSON_IsBool(_field)) {
-                _match = ((strcmp(value, "true") == 0 && _field->valueint == 1) ||
-                          (strcmp(value, "false") == 0 && _field->valueint == 0));
-            }
-        } else {
-            _match = true;
-        }
-
-        if (_match) {
-            cJSON_DeleteItemFromArray(collection, i);
+    cJSON* _item = collection->child;
+    while (_item) {
+        cJSON* _next = _item->next;
+        if (predicate_matches(predicate, _item)) {
+            cJSON_Delete(cJSON_DetachItemViaPointer(collection, _item));
             _deletedCount++;
         }
+        _item = _next;
     }
 
     return _deletedCount;
 }
 
 // Update documents in a collection based on filter and specified action (add, drop, alter)
-int update_filtered_documents(cJSON *collection, const char *key, const char* value, const Condition condition, const Action action, const char *data, char* error) {
+int update_filtered_documents(cJSON *collection, const Predicate* predicate, const Action action, const char *data, char* error) {
     if (!collection || !cJSON_IsArray(collection)) return -1;
 
-    const bool _filterEnabled = !(condition == all || key == NULL || value == NULL);
-    const int _size = cJSON_GetArraySize(collection);
     int _updatedCount = 0;
+    cJSON* _item = NULL;
 
-    for (int i = 0; i < _size; i++) {
-        cJSON* _item = cJSON_GetArrayItem(collection, i);
-        bool _match = false;
-
-        if (_filterEnabled) {
-            cJSON* _field = cJSON_GetObjectItem(_item, key);
-            if (!_field) continue;
-
-            if (cJSON_IsNumber(_field)) {
-                _match = is_related(_field->valuedouble, atof(value), condition);
-            } else if (cJSON_IsString(_field)) {
-                _match = strcmp(_field->valuestring, value) == 0;
-            } else if (cJSON_IsBool(_field)) {
-                _match = ((strcmp(value, "true") == 0 && _field->valueint == 1) ||
-                          (strcmp(value, "false") == 0 && _field->valueint == 0));
-            } else {
-                continue;
-            }
-        } else {
-            _match = true;
-        }
+    // Parse the change once for the whole pass rather than once per matching document
+    cJSON* _change = cJSON_Parse(data);
 
-        if (_match) {
-            _updatedCount++;
-            switch (action) {
-                case add:
-                    if (!add_action(_item, data, error)) return -1;
-                    break;
-                case drop:
-                    if (!drop_action(_item, data, error)) return -1;
-                    break;
-                case alter:
-                    if (!alter_action(_item, data, error)) return -1;
-                    break;
-                default:
-                    get_error(error, "fatal: Invalid action specified");
-                    return -1;
-            }
+    // Ids are assigned by the engine and address documents for their whole life
+    if (changes_id(action, _change)) {
+        get_error(error, "fatal: Field '%s' cannot be updated", ID_KEY);
+        cJSON_Delete(_change);
+        return -1;
+    }
+
+    cJSON_ArrayForEach(_item, collection) {
+        if (!predicate_matches(predicate, _item)) continue;
+        if (!apply_action(_item, action, _change, data, error)) {
+            cJSON_Delete(_change);
+            return -1;
         }
+        _updatedCount++;
     }
+
+    cJSON_Delete(_change);
     return _updatedCount;
 }
 
+// Apply one update action to a document
+bool apply_action(cJSON* item, const Action action, const cJSON* change, const char* data, char* error) {
+    switch (action) {
+        case add:   return add_action(item, change, data, error);
+        case drop:  return drop_action(item, change, data, error);
+        case alter: return alter_action(item, change, data, error);
+        default:
+            get_error(error, "fatal: Invalid action specified");
+            return false;
+    }
+}
+
+// Whether an update action would add, drop or alter the "_id" field
+bool changes_id(const Action action, const cJSON* change) {
+    if (action == drop) return cJSON_IsString(change) && _stricmp(change->valuestring, ID_KEY) == 0;
+
+    const cJSON* _field = NULL;
+    cJSON_ArrayForEach(_field, change) {
+        if (_field->string && _stricmp(_field->string, ID_KEY) == 0) return true;
+    }
+    return false;
+}
+
 // Add new key-value pairs to a document
-bool add_action(cJSON* item, const char* data, char* error) {
-    cJSON* _temp = cJSON_Parse(data);
-    if (!_temp || !cJSON_IsObject(_temp)) {
+bool add_action(cJSON* item, const cJSON* change, const char* data, char* error) {
+    if (!cJSON_IsObject(change)) {
         get_error(error, "fatal: Invalid data format '%s'", data);
-        if (_temp) cJSON_Delete(_temp);
         return false;
     }
 
     cJSON* _field = NULL;
-    cJSON_ArrayForEach(_field, _temp) {
+    cJSON_ArrayForEach(_field, change) {
         cJSON* copy = cJSON_Duplicate(_field, 1);
         cJSON_AddItemToObject(item, _field->string, copy);
     }
-
-    cJSON_Delete(_temp);
     return true;
 }
 
 // Drop a field from a document
-bool drop_action(cJSON* item, const char* data, char* error) {
-    cJSON* _temp = cJSON_Parse(data);
-    if (!_temp || !cJSON_IsString(_temp)) {
+bool drop_action(cJSON* item, const cJSON* change, const char* data, char* error) {
+    if (!cJSON_IsString(change)) {
         get_error(error, "fatal: Invalid data format '%s'", data);
-        if (_temp) cJSON_Delete(_temp);
         return false;
     }
 
-    cJSON_DeleteItemFromObject(item, _temp->valuestring);
-    cJSON_Delete(_temp);
+    cJSON_DeleteItemFromObject(item, change->valuestring);
     return true;
 }
 
 // Alter a field in a document
-bool alter_action(cJSON* item, const char* data, char* error) {
-    cJSON* _temp = cJSON_Parse(data);
-    if (!_temp || !cJSON_IsObject(_temp)) {
+bool alter_action(cJSON* item, const cJSON* change, const char* data, char* error) {
+    if (!cJSON_IsObject(change)) {
         get_error(error, "fatal: Invalid data format '%s'", data);
-        if (_temp) cJSON_Delete(_temp);
         return false;
     }
 
-    cJSON* _value = _temp->child;
-    if (!_value || !_value->string) {
-        cJSON_Delete(_temp);
-        return false;
-    }
+    const cJSON* _value = change->child;
+    if (!_value || !_value->string) return false;
 
-    bool _match = false;
-    cJSON* _newValue = NULL;
-
-    if (cJSON_IsString(_value)) {
-        _newValue = cJSON_CreateString(_value->valuestring);
-        _match = true;
-    } else if (cJSON_IsNumber(_value)) {
-        _newValue = cJSON_CreateNumber(_value->valuedouble);
-        _match = true;
-    } else if (cJSON_IsBool(_value)) {
-        _newValue = cJSON_CreateBool(_value->valueint);
-        _match = true;
-    } else if (cJSON_IsArray(_value) || cJSON_IsObject(_value)) {
-        _newValue = cJSON_Duplicate(_value, 1);
-        _match = true;
-    } else {
+    // Duplicating keeps valueint on booleans, which the document filters compare against
+    if (!cJSON_IsString(_value) && !cJSON_IsNumber(_value) && !cJSON_IsBool(_value) &&
+        !cJSON_IsArray(_value) && !cJSON_IsObject(_value)) {
         get_error(error, "fatal: Unsupported value type in data");
+        return false;
     }
 
-    if (_match) {
-        cJSON_ReplaceItemInObject(item, _value->string, _newValue);
-    } else {
-        cJSON_Delete(_newValue);
-    }
-
-    cJSON_Delete(_temp);
-    return _match;
-}
-
-// Compare two numeric values based on the provided condition
-bool is_related(const double value1, const double value2, const Condition condition) {
-    switch (condition) {
-        case greaterThan:      return value1 > value2;
-        case greaterThanEqual: return value1 >= value2;
-        case lessThan:         return value1 < value2;
-        case lessThanEqual:    return value1 <= value2;
-        case equal:            return value1 == value2;
-        case notEqual:         return value1 != value2;
-        default: return false;
-    }
+    cJSON_ReplaceItemInObject(item, _value->string, cJSON_Duplicate(_value, 1));
+    return true;
 }
 
 // Path setters: Compose full paths to meta and data files
@@ -508,6 +1524,28 @@ void get_database_dir(char* array, const char* databaseName) {
     snprintf(array, MAX_PATH_LEN, "%s/%s/%s/%s", _env, PROTON_DB, DB, databaseName);
 }
 
+// Path of the file that holds one kind of index on a key, named after a hash of the key
+void get_key_file(char* array, const char* databaseName, const char* collectionName, const char* key, const char* suffix) {
+    char* _env = getenv("APPDATA");
+    snprintf(array, MAX_PATH_LEN, "%s/%s/%s/%s/%s.%08x%s", _env, PROTON_DB, DB, databaseName, collectionName,
+             checksum(key, strlen(key)), suffix);
+}
+
+void get_key_meta(char* array, const char* databaseName, const char* metaName) {
+    char* _env = getenv("APPDATA");
+    snprintf(array, MAX_PATH_LEN, "%s/%s/%s/%s/%s", _env, PROTON_DB, DB, databaseName, metaName);
+}
+
+void get_primary_file(char* array, const char* databaseName, const char* collectionName) {
+    char* _env = getenv("APPDATA");
+    snprintf(array, MAX_PATH_LEN, "%s/%s/%s/%s/%s.ids", _env, PROTON_DB, DB, databaseName, collectionName);
+}
+
+void get_wal_file(char* array, const char* databaseName) {
+    char* _env = getenv("APPDATA");
+    snprintf(array, MAX_PATH_LEN, "%s/%s/%s/%s/%s", _env, PROTON_DB, DB, databaseName, WAL_FILE);
+}
+
 // Format a user-facing output message
 void get_message(char* buffer, const char* format, ...) {
     va_list args;
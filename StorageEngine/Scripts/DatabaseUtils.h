@@ -2,19 +2,36 @@
 #define DATABASE_UTILS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "cJSON/cJSON.h"
 
 #define MAX_PATH_LEN 512
 #define MAX_MESSAGE_LEN 384
 #define MAX_ERROR_LEN 256
+#define MAX_RESUME_LEN 32
 
 #define PROTON_DB "ProtonDB"
 #define DB "db"
 #define DATABASE_META "db/.database.meta"
 #define COLLECTION_META ".collection.meta"
 
+#define COLLECTION_MAGIC "PDBC"
+#define COLLECTION_VERSION 5
+#define ID_KEY "_id"
+#define MAX_DOCUMENT_ID 9007199254740992ULL // 2^53, the last integer a double holds exactly
+#define WAL_FILE ".wal"
+#define INDEX_META ".index.meta"
+#define RANGE_META ".range.meta"
+#define COLUMN_META ".column.meta"
+#define ZONE_META ".zone.meta"
+#define INDEX_SUFFIX ".idx"
+#define RANGE_SUFFIX ".bpt"
+#define COLUMN_SUFFIX ".vec"
+#define ZONE_SUFFIX ".zone"
+
 #define NEW_OUTPUT ((Output){0})
 #define NEW_ARRAY_OUT ((ArrayOut){0})
+#define NEW_PACKED_OUT ((PackedOut){0})
 
 typedef enum {
     collection,
@@ -46,41 +63,183 @@ typedef struct {
     int size;
     char message[MAX_MESSAGE_LEN];
     char** list;
+    // Token the next page of a paged print goes on from; empty once nothing is left
+    char resume[MAX_RESUME_LEN];
 } ArrayOut;
 
+// Where one document of a PackedOut lies in its block: length bytes of compact JSON from
+// offset, followed by a NUL
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} PackedEntry;
+
+// Printed documents in a single block: their text one after another, then the table of size
+// entries that entries points to. The whole block is released by one free_packed.
+typedef struct {
+    int size;
+    char message[MAX_MESSAGE_LEN];
+    char* block;
+    PackedEntry* entries;
+    char resume[MAX_RESUME_LEN];
+} PackedOut;
+
+// Counters of the page buffer pool, for sizing it to the working set
+typedef struct {
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long writeBacks;
+    long long usedBytes;
+    long long limitBytes;
+} BufferPoolStats;
+
+// How the documents of a version 5 collection are stored: in the pages of its file (see
+// PageStore.h) or in the segments of an LSM tree the file names (see LsmStore.h)
+typedef enum {
+    storagePages,
+    storageLsm
+} CollectionStorage;
+
+// Header at the start of every collection file. nextId (version 4 onwards) is the id the
+// next inserted document receives; it is stamped together with appliedLsn, so a mutation
+// replayed from the write-ahead log assigns the same ids again. Version 5 files are paged
+// unless their storage says otherwise; the generation of a paged file changes whenever it
+// is rewritten whole, which ties a rollback journal to the file it was taken from.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t nextId;
+    uint64_t generation;
+    uint32_t pageSize;
+    uint32_t storage;
+} CollectionHeader;
+
+// Frame preceding each document in a version 3 or 4 collection log (see DocumentCodec.h for the encoding)
+typedef struct {
+    uint32_t length;
+    uint32_t checksum;
+} RecordHeader;
+
+// Read-only view of a collection file: a document log or legacy text file is mapped into
+// memory whole, a paged file (version 5) is read page by page through the buffer pool and
+// an LSM collection through the runs of its tree
+typedef struct {
+    const char* data;
+    size_t length;
+    void* file;
+    void* mapping;
+    struct PageReader* pages;
+    struct LsmReader* tree;
+} MappedFile;
+
+// Called for each stored document of a collection with the record id it is addressed by;
+// return false to stop the walk
+typedef bool (*FrameVisitor)(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+
+// Called for each matching document of a visited query, printed as compact JSON. The text is
+// NUL-terminated and lives in a buffer the query reuses for the next document, so it is only
+// valid during the call; return false to end the query.
+typedef bool (*DocumentVisitor)(const char* document, size_t length, void* context);
+
+// Record ids [start, end) of a collection a scan reads; start is the record id of a document
+// that is or was stored there, so a walk can resume from it
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} RecordSpan;
+
+// One page of a print: the matching documents after the position a resume token saved, less
+// the first offset of them, up to limit (every one when 0). from is 'r' to go on after the
+// record id in position, 't' at the byte offset in position of a legacy text collection, or
+// 0 to start at the beginning. A scan stopped by the limit with matches left leaves the
+// token of where it stopped in resume.
+typedef struct {
+    int limit;
+    int offset;
+    char from;
+    uint64_t position;
+    char resume[MAX_RESUME_LEN];
+} ResultPage;
+
+// A filter compiled once per query and shared by every scan path (see Predicate.h)
+struct Predicate;
+// The fields a query prints, compiled once per query (see Projection.h)
+struct Projection;
+
 // Input struct
 typedef struct {
     const char* databaseName;
     const char* collectionName;
-    // Conditional arguments
+    // Conditional arguments; a filter tree (see Predicate.c) takes the place of the key,
+    // value and condition when given
     const char* key;
     const char* value;
+    const char* filter;
+    // Fields to print, as comma-separated dotted keys (see Projection.c); whole documents
+    // when not given
+    const char* projection;
+    // Paging (see ResultPage): the token of the page before, and at most limit documents
+    // (every one when 0) after skipping offset of them
+    const char* resume;
+    int limit;
+    int offset;
     // Data to store
     const char* data;
     Condition condition;
     Action action;
 } QueryConfig;
 
-bool add_action(cJSON* item, const char* data, char* error);
-bool alter_action(cJSON* item, const char* data, char* error);
+bool add_action(cJSON* item, const cJSON* change, const char* data, char* error);
+bool alter_action(cJSON* item, const cJSON* change, const char* data, char* error);
+int append_binary(const char* fileName, const cJSON* data, uint64_t lsn, uint64_t** recordIds, bool* inOrder, char* error);
 bool append_entry(const char* metaFile, const char* name, const char* path, FileType fileType, char* error);
+bool append_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key, char* error);
+uint64_t assign_ids(cJSON* data, uint64_t nextId);
 bool check_database(const char* databaseName);
+uint32_t checksum(const char* data, size_t length);
 void delete_dir_content(const char* directory);
-bool drop_action(cJSON* item, const char* data, char* error);
-bool dump_binary(const char* fileName, const cJSON* data, char* error);
+bool drop_action(cJSON* item, const cJSON* change, const char* data, char* error);
+bool dump_binary(const char* fileName, const cJSON* data, uint64_t lsn, char* error);
+int fetch_filtered_documents(const char* fileName, const uint64_t* recordIds, int count, const struct Predicate* predicate, const struct Projection* projection, ResultPage* page, DocumentVisitor visitor, void* context, char*** list, char* error);
+uint64_t get_applied_lsn(const char* fileName);
 void get_col_file(char* array, const char* databaseName, const char* collectionName);
 void get_col_meta(char* array, const char* databaseName);
+CollectionStorage get_collection_storage(const char* fileName);
+uint32_t get_collection_version(const char* fileName);
 void get_database_dir(char* array, const char* databaseName);
 void get_error(char* buffer, const char* format, ...);
+long long get_file_size(const char* fileName);
 void get_database_meta(char* array);
+void get_key_file(char* array, const char* databaseName, const char* collectionName, const char* key, const char* suffix);
+void get_key_meta(char* array, const char* databaseName, const char* metaName);
 void get_message(char* buffer, const char* format, ...);
+uint64_t get_next_id(const char* fileName);
+void get_primary_file(char* array, const char* databaseName, const char* collectionName);
+void get_wal_file(char* array, const char* databaseName);
+bool has_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key);
 cJSON* load_binary(const char* fileName, char* error);
 cJSON* load_json(const char* file_name);
+cJSON* load_key_entries(const char* databaseName, const char* metaName, const char* collectionName, cJSON** meta);
 int load_list(const char* metaFile, char*** list, char* error);
-int print_filtered_documents(cJSON* collection, const char* key, const char* value, Condition condition, char*** list, char* error);
-int remove_filtered_documents(cJSON* collection, const char* key, const char* value, Condition condition, char* error);
+bool map_file(const char* fileName, MappedFile* view);
+int print_filtered_documents(cJSON* collection, const struct Predicate* predicate, const struct Projection* projection, DocumentVisitor visitor, void* context, char*** list, char* error);
+bool read_result_page(const QueryConfig* config, ResultPage* page, char* error);
+int remove_binary(const char* fileName, const uint64_t* recordIds, int count, const struct Predicate* predicate, uint64_t lsn, char* error);
+int remove_filtered_documents(cJSON* collection, const struct Predicate* predicate, char* error);
 bool remove_entry(const char* metaFile, const char* name, FileType fileType, char* error);
+bool remove_key_entry(const char* databaseName, const char* metaName, const char* collectionName, const char* key, char* error);
+bool repair_binary(const char* fileName, char* error);
 bool save_json(const char* filename, cJSON* config, char* error);
-int update_filtered_documents(cJSON *collection, const char *key, const char *value, Condition condition, Action action, const char *data, char* error);
+bool sync_binary(const char* fileName, char* error);
+int sort_record_ids(uint64_t* recordIds, int count);
+int scan_filtered_documents(const char* fileName, const RecordSpan* spans, int spanCount, const struct Predicate* predicate, const struct Projection* projection, ResultPage* page, DocumentVisitor visitor, void* context, char*** list, char* error);
+void unmap_file(MappedFile* view);
+int update_binary(const char* fileName, const uint64_t* recordIds, int count, const struct Predicate* predicate, Action action, const char* data, uint64_t lsn, uint64_t** updated, char* error);
+int update_filtered_documents(cJSON *collection, const struct Predicate* predicate, Action action, const char *data, char* error);
+bool upgrade_binary(const char* fileName, char* error);
+bool visit_records(const char* fileName, const uint64_t* recordIds, int count, FrameVisitor visitor, void* context);
+bool walk_frames(const char* fileName, FrameVisitor visitor, void* context);
 
 #endif //DATABASE_UTILS_H
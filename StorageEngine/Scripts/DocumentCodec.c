@@ -0,0 +1,465 @@
+// Include standard and utility headers
+#include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DocumentCodec.h"
+
+// Encoded layout, all integers little-endian:
+//   value  : [u8 type][payload]
+//   number : f64
+//   string : [u32 length][bytes]
+//   array  : [u32 count][u32 byteLength][values...]
+//   object : [DocumentHeader][FieldEntry x fieldCount][per field: [u32 keyLength][key][value]]
+
+// Local helper functions
+char* copy_text(const uint8_t* data, uint32_t length);
+cJSON* decode_at(const uint8_t* data, size_t length, size_t* consumed);
+cJSON* decode_string(const uint8_t* data, uint32_t length);
+bool encode_object(ByteBuffer* buffer, const cJSON* item);
+bool keys_equal(const uint8_t* stored, const char* key, size_t length);
+bool read_value(const uint8_t* data, size_t length, DocumentValue* value);
+bool write_bytes(ByteBuffer* buffer, const void* data, size_t length);
+bool write_json_at(ByteBuffer* buffer, const uint8_t* data, size_t length, size_t* consumed);
+bool write_json_number(ByteBuffer* buffer, double number);
+bool write_json_string(ByteBuffer* buffer, const uint8_t* text, uint32_t length);
+
+
+// Grow a buffer so that it can take at least `additional` more bytes
+bool buffer_reserve(ByteBuffer* buffer, const size_t additional) {
+    if (buffer->size + additional <= buffer->capacity) return true;
+
+    size_t _capacity = buffer->capacity ? buffer->capacity : 256;
+    while (_capacity < buffer->size + additional) _capacity *= 2;
+
+    uint8_t* _grown = realloc(buffer->data, _capacity);
+    if (!_grown) return false;
+    buffer->data = _grown;
+    buffer->capacity = _capacity;
+    return true;
+}
+
+bool write_bytes(ByteBuffer* buffer, const void* data, const size_t length) {
+    if (!buffer_reserve(buffer, length)) return false;
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    return true;
+}
+
+// Append the binary encoding of any JSON value
+bool encode_value(ByteBuffer* buffer, const cJSON* item) {
+    uint8_t _type;
+    if (cJSON_IsObject(item)) _type = valueObject;
+    else if (cJSON_IsArray(item)) _type = valueArray;
+    else if (cJSON_IsString(item)) _type = valueString;
+    else if (cJSON_IsNumber(item)) _type = valueNumber;
+    else if (cJSON_IsTrue(item)) _type = valueTrue;
+    else if (cJSON_IsFalse(item)) _type = valueFalse;
+    else _type = valueNull;
+
+    if (!write_bytes(buffer, &_type, sizeof(_type))) return false;
+
+    switch (_type) {
+        case valueNumber:
+            return write_bytes(buffer, &item->valuedouble, sizeof(double));
+        case valueString: {
+            const uint32_t _length = (uint32_t)strlen(item->valuestring);
+            return write_bytes(buffer, &_length, sizeof(_length)) && write_bytes(buffer, item->valuestring, _length);
+        }
+        case valueArray: {
+            const uint32_t _count = (uint32_t)cJSON_GetArraySize(item);
+            const size_t _lengthAt = buffer->size + sizeof(_count);
+            uint32_t _byteLength = 0;
+            if (!write_bytes(buffer, &_count, sizeof(_count)) || !write_bytes(buffer, &_byteLength, sizeof(_byteLength))) return false;
+
+            const cJSON* _element = NULL;
+            cJSON_ArrayForEach(_element, item) {
+                if (!encode_value(buffer, _element)) return false;
+            }
+            _byteLength = (uint32_t)(buffer->size - _lengthAt - sizeof(_byteLength));
+            memcpy(buffer->data + _lengthAt, &_byteLength, sizeof(_byteLength));
+            return true;
+        }
+        case valueObject:
+            return encode_object(buffer, item);
+        default:
+            return true;
+    }
+}
+
+// Append an object: header, field offset table, then the keys and values it points to
+bool encode_object(ByteBuffer* buffer, const cJSON* item) {
+    const size_t _start = buffer->size;
+    DocumentHeader _header = { 0, (uint32_t)cJSON_GetArraySize(item) };
+    const size_t _tableSize = _header.fieldCount * sizeof(FieldEntry);
+
+    if (!buffer_reserve(buffer, sizeof(_header) + _tableSize)) return false;
+    buffer->size += sizeof(_header) + _tableSize;
+
+    uint32_t _index = 0;
+    const cJSON* _field = NULL;
+    cJSON_ArrayForEach(_field, item) {
+        const uint32_t _keyLength = (uint32_t)strlen(_field->string);
+        FieldEntry _entry = { key_hash(_field->string, _keyLength), (uint32_t)(buffer->size - _start), 0 };
+
+        if (!write_bytes(buffer, &_keyLength, sizeof(_keyLength)) || !write_bytes(buffer, _field->string, _keyLength)) return false;
+        _entry.valueOffset = (uint32_t)(buffer->size - _start);
+        if (!encode_value(buffer, _field)) return false;
+
+        memcpy(buffer->data + _start + sizeof(_header) + _index * sizeof(FieldEntry), &_entry, sizeof(_entry));
+        _index++;
+    }
+
+    _header.length = (uint32_t)(buffer->size - _start);
+    memcpy(buffer->data + _start, &_header, sizeof(_header));
+    return true;
+}
+
+// Decode an encoded value back into a JSON tree (NULL if the bytes are malformed)
+cJSON* decode_value(const uint8_t* data, const size_t length) {
+    size_t _consumed = 0;
+    return decode_at(data, length, &_consumed);
+}
+
+// Decode a value located by find_field, without going back over its type tag
+cJSON* decode_field_value(const DocumentValue* value) {
+    switch (value->type) {
+        case valueNull: return cJSON_CreateNull();
+        case valueFalse: return cJSON_CreateFalse();
+        case valueTrue: {
+            cJSON* _item = cJSON_CreateTrue();
+            if (_item) _item->valueint = 1;
+            return _item;
+        }
+        case valueNumber: return cJSON_CreateNumber(value->number);
+        case valueString: return decode_string(value->data, value->length);
+        default: return decode_value(value->data, value->length);
+    }
+}
+
+cJSON* decode_at(const uint8_t* data, const size_t length, size_t* consumed) {
+    if (length < 1) return NULL;
+    const uint8_t _type = data[0];
+    const uint8_t* _payload = data + 1;
+    const size_t _available = length - 1;
+
+    switch (_type) {
+        case valueNull: *consumed = 1; return cJSON_CreateNull();
+        case valueFalse: *consumed = 1; return cJSON_CreateFalse();
+        case valueTrue: {
+            // cJSON_Parse sets valueint on true values and the document filters rely on it
+            cJSON* _item = cJSON_CreateTrue();
+            if (_item) _item->valueint = 1;
+            *consumed = 1;
+            return _item;
+        }
+        case valueNumber: {
+            double _number;
+            if (_available < sizeof(_number)) return NULL;
+            memcpy(&_number, _payload, sizeof(_number));
+            *consumed = 1 + sizeof(_number);
+            return cJSON_CreateNumber(_number);
+        }
+        case valueString: {
+            uint32_t _length;
+            if (_available < sizeof(_length)) return NULL;
+            memcpy(&_length, _payload, sizeof(_length));
+            if (_length > _available - sizeof(_length)) return NULL;
+
+            *consumed = 1 + sizeof(_length) + _length;
+            return decode_string(_payload + sizeof(_length), _length);
+        }
+        case valueArray: {
+            uint32_t _count, _byteLength;
+            if (_available < 2 * sizeof(uint32_t)) return NULL;
+            memcpy(&_count, _payload, sizeof(_count));
+            memcpy(&_byteLength, _payload + sizeof(_count), sizeof(_byteLength));
+            if (_byteLength > _available - 2 * sizeof(uint32_t)) return NULL;
+
+            cJSON* _array = cJSON_CreateArray();
+            const uint8_t* _cursor = _payload + 2 * sizeof(uint32_t);
+            size_t _remaining = _byteLength;
+            for (uint32_t i = 0; i < _count && _array; i++) {
+                size_t _used = 0;
+                cJSON* _element = decode_at(_cursor, _remaining, &_used);
+                if (!_element) {
+                    cJSON_Delete(_array);
+                    return NULL;
+                }
+                cJSON_AddItemToArray(_array, _element);
+                _cursor += _used;
+                _remaining -= _used;
+            }
+            *consumed = 1 + 2 * sizeof(uint32_t) + _byteLength;
+            return _array;
+        }
+        case valueObject: {
+            DocumentHeader _header;
+            if (_available < sizeof(_header)) return NULL;
+            memcpy(&_header, _payload, sizeof(_header));
+            if (_header.length > _available ||
+                (size_t)_header.fieldCount * sizeof(FieldEntry) > _header.length - sizeof(_header)) return NULL;
+
+            cJSON* _object = cJSON_CreateObject();
+            for (uint32_t i = 0; i < _header.fieldCount && _object; i++) {
+                FieldEntry _entry;
+                memcpy(&_entry, _payload + sizeof(_header) + i * sizeof(FieldEntry), sizeof(_entry));
+
+                uint32_t _keyLength;
+                if (_entry.keyOffset + sizeof(_keyLength) > _header.length || _entry.valueOffset > _header.length) break;
+                memcpy(&_keyLength, _payload + _entry.keyOffset, sizeof(_keyLength));
+                if (_keyLength > _header.length - _entry.keyOffset - sizeof(_keyLength)) break;
+
+                size_t _used = 0;
+                cJSON* _value = decode_at(_payload + _entry.valueOffset, _header.length - _entry.valueOffset, &_used);
+                char* _key = _value ? copy_text(_payload + _entry.keyOffset + sizeof(_keyLength), _keyLength) : NULL;
+                if (!_key) {
+                    cJSON_Delete(_value);
+                    break;
+                }
+                _value->string = _key;
+                cJSON_AddItemToArray(_object, _value);
+            }
+
+            if (cJSON_GetArraySize(_object) != (int)_header.fieldCount) {
+                cJSON_Delete(_object);
+                return NULL;
+            }
+            *consumed = 1 + _header.length;
+            return _object;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// A string item holding a copy of the text. The text is allocated through the cJSON hooks,
+// like the item, so a read building it in an arena (see Arena.c) makes no heap allocation.
+cJSON* decode_string(const uint8_t* data, const uint32_t length) {
+    cJSON* _item = cJSON_CreateNull();
+    char* _text = _item ? copy_text(data, length) : NULL;
+    if (!_text) {
+        cJSON_Delete(_item);
+        return NULL;
+    }
+    _item->type = cJSON_String;
+    _item->valuestring = _text;
+    return _item;
+}
+
+// A NUL-terminated copy of the text, to be owned by a cJSON item
+char* copy_text(const uint8_t* data, const uint32_t length) {
+    char* _text = cJSON_malloc((size_t)length + 1);
+    if (!_text) return NULL;
+    memcpy(_text, data, length);
+    _text[length] = '\0';
+    return _text;
+}
+
+// Hash of a field name. Keys are folded to lower case because field lookups follow
+// cJSON_GetObjectItem, which matches names case-insensitively.
+uint32_t key_hash(const char* key, const size_t length) {
+    uint32_t _hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        _hash ^= (unsigned char)tolower((unsigned char)key[i]);
+        _hash *= 16777619u;
+    }
+    return _hash;
+}
+
+bool keys_equal(const uint8_t* stored, const char* key, const size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (tolower(stored[i]) != tolower((unsigned char)key[i])) return false;
+    }
+    return true;
+}
+
+// Locate a top-level field of an encoded object through its field offset table. Like
+// cJSON_GetObjectItem, the first field whose name matches regardless of case is returned.
+bool find_field(const uint8_t* data, const size_t length, const char* key, DocumentValue* value) {
+    const size_t _keyLength = strlen(key);
+    return find_hashed_field(data, length, key, _keyLength, key_hash(key, _keyLength), value);
+}
+
+// find_field with the length and key_hash of the key worked out by the caller, for filters
+// that look the same key up in every document
+bool find_hashed_field(const uint8_t* data, const size_t length, const char* key, const size_t keyLength, const uint32_t hash, DocumentValue* value) {
+    DocumentHeader _header;
+    if (length < 1 + sizeof(_header) || data[0] != valueObject) return false;
+
+    const uint8_t* _object = data + 1;
+    memcpy(&_header, _object, sizeof(_header));
+    if (_header.length > length - 1 ||
+        (size_t)_header.fieldCount * sizeof(FieldEntry) > _header.length - sizeof(_header)) return false;
+
+    for (uint32_t i = 0; i < _header.fieldCount; i++) {
+        FieldEntry _entry;
+        memcpy(&_entry, _object + sizeof(_header) + i * sizeof(FieldEntry), sizeof(_entry));
+        if (_entry.hash != hash) continue;
+
+        uint32_t _storedLength;
+        if (_entry.keyOffset + sizeof(_storedLength) > _header.length || _entry.valueOffset >= _header.length) return false;
+        memcpy(&_storedLength, _object + _entry.keyOffset, sizeof(_storedLength));
+        if (_storedLength != keyLength || !keys_equal(_object + _entry.keyOffset + sizeof(_storedLength), key, keyLength)) continue;
+
+        return read_value(_object + _entry.valueOffset, _header.length - _entry.valueOffset, value);
+    }
+    return false;
+}
+
+// Describe the encoded value at data without decoding it
+bool read_value(const uint8_t* data, const size_t length, DocumentValue* value) {
+    if (length < 1) return false;
+    memset(value, 0, sizeof(*value));
+    value->type = (ValueType)data[0];
+
+    switch (value->type) {
+        case valueNumber:
+            if (length < 1 + sizeof(double)) return false;
+            memcpy(&value->number, data + 1, sizeof(double));
+            return true;
+        case valueString:
+            if (length < 1 + sizeof(uint32_t)) return false;
+            memcpy(&value->length, data + 1, sizeof(uint32_t));
+            value->data = data + 1 + sizeof(uint32_t);
+            return value->length <= length - 1 - sizeof(uint32_t);
+        case valueArray:
+        case valueObject:
+            value->data = data;
+            value->length = (uint32_t)length;
+            return true;
+        default:
+            return value->type <= valueObject;
+    }
+}
+
+// Append an encoded value as compact JSON, the text cJSON_PrintUnformatted gives for its
+// decoded tree, without building the tree. The text is not NUL-terminated.
+bool write_json(ByteBuffer* buffer, const uint8_t* data, const size_t length) {
+    size_t _consumed = 0;
+    return write_json_at(buffer, data, length, &_consumed);
+}
+
+bool write_json_at(ByteBuffer* buffer, const uint8_t* data, const size_t length, size_t* consumed) {
+    if (length < 1) return false;
+    const uint8_t* _payload = data + 1;
+    const size_t _available = length - 1;
+
+    switch (data[0]) {
+        case valueNull: *consumed = 1; return write_bytes(buffer, "null", 4);
+        case valueFalse: *consumed = 1; return write_bytes(buffer, "false", 5);
+        case valueTrue: *consumed = 1; return write_bytes(buffer, "true", 4);
+        case valueNumber: {
+            double _number;
+            if (_available < sizeof(_number)) return false;
+            memcpy(&_number, _payload, sizeof(_number));
+            *consumed = 1 + sizeof(_number);
+            return write_json_number(buffer, _number);
+        }
+        case valueString: {
+            uint32_t _length;
+            if (_available < sizeof(_length)) return false;
+            memcpy(&_length, _payload, sizeof(_length));
+            if (_length > _available - sizeof(_length)) return false;
+            *consumed = 1 + sizeof(_length) + _length;
+            return write_json_string(buffer, _payload + sizeof(_length), _length);
+        }
+        case valueArray: {
+            uint32_t _count, _byteLength;
+            if (_available < 2 * sizeof(uint32_t)) return false;
+            memcpy(&_count, _payload, sizeof(_count));
+            memcpy(&_byteLength, _payload + sizeof(_count), sizeof(_byteLength));
+            if (_byteLength > _available - 2 * sizeof(uint32_t) || !write_bytes(buffer, "[", 1)) return false;
+
+            const uint8_t* _cursor = _payload + 2 * sizeof(uint32_t);
+            size_t _remaining = _byteLength;
+            for (uint32_t i = 0; i < _count; i++) {
+                size_t _used = 0;
+                if ((i > 0 && !write_bytes(buffer, ",", 1)) || !write_json_at(buffer, _cursor, _remaining, &_used)) return false;
+                _cursor += _used;
+                _remaining -= _used;
+            }
+            *consumed = 1 + 2 * sizeof(uint32_t) + _byteLength;
+            return write_bytes(buffer, "]", 1);
+        }
+        case valueObject: {
+            DocumentHeader _header;
+            if (_available < sizeof(_header)) return false;
+            memcpy(&_header, _payload, sizeof(_header));
+            if (_header.length > _available ||
+                (size_t)_header.fieldCount * sizeof(FieldEntry) > _header.length - sizeof(_header) ||
+                !write_bytes(buffer, "{", 1)) return false;
+
+            for (uint32_t i = 0; i < _header.fieldCount; i++) {
+                FieldEntry _entry;
+                memcpy(&_entry, _payload + sizeof(_header) + i * sizeof(FieldEntry), sizeof(_entry));
+
+                uint32_t _keyLength;
+                if (_entry.keyOffset + sizeof(_keyLength) > _header.length || _entry.valueOffset > _header.length) return false;
+                memcpy(&_keyLength, _payload + _entry.keyOffset, sizeof(_keyLength));
+                if (_keyLength > _header.length - _entry.keyOffset - sizeof(_keyLength)) return false;
+
+                size_t _used = 0;
+                if ((i > 0 && !write_bytes(buffer, ",", 1)) ||
+                    !write_json_string(buffer, _payload + _entry.keyOffset + sizeof(_keyLength), _keyLength) ||
+                    !write_bytes(buffer, ":", 1) ||
+                    !write_json_at(buffer, _payload + _entry.valueOffset, _header.length - _entry.valueOffset, &_used)) return false;
+            }
+            *consumed = 1 + _header.length;
+            return write_bytes(buffer, "}", 1);
+        }
+        default:
+            return false;
+    }
+}
+
+// Numbers print as cJSON prints them: whole numbers within the range of an int as integers,
+// others with 15 significant digits, or 17 when 15 do not read back as the same double
+bool write_json_number(ByteBuffer* buffer, const double number) {
+    char _text[26];
+    int _length;
+    if (isnan(number) || isinf(number)) {
+        _length = snprintf(_text, sizeof(_text), "null");
+    } else {
+        const int _whole = number >= INT_MAX ? INT_MAX : number <= (double)INT_MIN ? INT_MIN : (int)number;
+        if (number == (double)_whole) {
+            _length = snprintf(_text, sizeof(_text), "%d", _whole);
+        } else {
+            double _test = 0.0;
+            _length = snprintf(_text, sizeof(_text), "%1.15g", number);
+            if (sscanf(_text, "%lg", &_test) != 1 || fabs(_test - number) > fmax(fabs(_test), fabs(number)) * DBL_EPSILON) {
+                _length = snprintf(_text, sizeof(_text), "%1.17g", number);
+            }
+        }
+    }
+    return _length > 0 && _length < (int)sizeof(_text) && write_bytes(buffer, _text, (size_t)_length);
+}
+
+// Strings are quoted with the escapes cJSON uses; runs that need none are copied as they are
+bool write_json_string(ByteBuffer* buffer, const uint8_t* text, const uint32_t length) {
+    uint32_t _start = 0;
+    if (!write_bytes(buffer, "\"", 1)) return false;
+
+    for (uint32_t i = 0; i < length; i++) {
+        const uint8_t _byte = text[i];
+        if (_byte > 31 && _byte != '"' && _byte != '\\') continue;
+
+        char _escape[8];
+        switch (_byte) {
+            case '"': strcpy(_escape, "\\\""); break;
+            case '\\': strcpy(_escape, "\\\\"); break;
+            case '\b': strcpy(_escape, "\\b"); break;
+            case '\f': strcpy(_escape, "\\f"); break;
+            case '\n': strcpy(_escape, "\\n"); break;
+            case '\r': strcpy(_escape, "\\r"); break;
+            case '\t': strcpy(_escape, "\\t"); break;
+            default: snprintf(_escape, sizeof(_escape), "\\u%04x", _byte); break;
+        }
+        if (!write_bytes(buffer, text + _start, i - _start) || !write_bytes(buffer, _escape, strlen(_escape))) return false;
+        _start = i + 1;
+    }
+    return write_bytes(buffer, text + _start, length - _start) && write_bytes(buffer, "\"", 1);
+}
@@ -0,0 +1,57 @@
+#ifndef DOCUMENT_CODEC_H
+#define DOCUMENT_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON/cJSON.h"
+
+// Type tag stored in front of every encoded value
+typedef enum {
+    valueNull,
+    valueFalse,
+    valueTrue,
+    valueNumber,
+    valueString,
+    valueArray,
+    valueObject
+} ValueType;
+
+// Growable byte buffer used to build encoded documents and frames
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+// Header of an encoded object, followed by its field offset table
+typedef struct {
+    uint32_t length;
+    uint32_t fieldCount;
+} DocumentHeader;
+
+// Field offset table entry; offsets are relative to the start of the object
+typedef struct {
+    uint32_t hash;
+    uint32_t keyOffset;
+    uint32_t valueOffset;
+} FieldEntry;
+
+// A value located inside an encoded document, without decoding it
+typedef struct {
+    ValueType type;
+    double number;
+    const uint8_t* data;
+    uint32_t length;
+} DocumentValue;
+
+bool buffer_reserve(ByteBuffer* buffer, size_t additional);
+cJSON* decode_field_value(const DocumentValue* value);
+cJSON* decode_value(const uint8_t* data, size_t length);
+bool encode_value(ByteBuffer* buffer, const cJSON* item);
+bool find_field(const uint8_t* data, size_t length, const char* key, DocumentValue* value);
+bool find_hashed_field(const uint8_t* data, size_t length, const char* key, size_t keyLength, uint32_t hash, DocumentValue* value);
+uint32_t key_hash(const char* key, size_t length);
+bool write_json(ByteBuffer* buffer, const uint8_t* data, size_t length);
+
+#endif //DOCUMENT_CODEC_H
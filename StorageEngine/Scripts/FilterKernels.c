@@ -0,0 +1,209 @@
+// Include standard and platform headers
+#include <stdbool.h>
+#include "FilterKernels.h"
+
+// Comparison kernels that test a run of numbers against a filter value at once and set one
+// bit per number that passes. Each kernel handles one 64-bit word of the selection: up to
+// 64 numbers, compared two at a time with SSE2 or four at a time with AVX, with a scalar
+// loop for the tail and for CPUs without either. The kernel is picked on first use from
+// what the CPU and the operating system support. Comparisons follow C: every condition is
+// false against NaN except notEqual.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX_TARGET
+#define SSE2_TARGET
+#else
+#include <cpuid.h>
+#define AVX_TARGET __attribute__((target("avx")))
+#define SSE2_TARGET __attribute__((target("sse2")))
+#endif
+#endif
+
+typedef uint64_t (*SelectWord)(const double* numbers, size_t count, double limit, Condition condition);
+
+static volatile SelectWord selectWord = NULL;
+static volatile FilterKernel activeKernel = kernelScalar;
+
+// Local helper functions
+FilterKernel detect_kernel(void);
+SelectWord word_kernel(void);
+uint64_t select_word_scalar(const double* numbers, size_t count, double limit, Condition condition);
+#ifdef X86_KERNELS
+uint64_t select_word_avx(const double* numbers, size_t count, double limit, Condition condition);
+uint64_t select_word_sse2(const double* numbers, size_t count, double limit, Condition condition);
+#endif
+
+
+// Set bit i % 64 of selection[i / 64] for each of count numbers that satisfies condition
+// against limit, and clear the others
+void select_numbers(const double* numbers, const size_t count, const double limit, const Condition condition, uint64_t* selection) {
+    const SelectWord _select = word_kernel();
+    for (size_t i = 0; i < count; i += SELECTION_BITS) {
+        const size_t _take = count - i < SELECTION_BITS ? count - i : SELECTION_BITS;
+        selection[i / SELECTION_BITS] = _select(numbers + i, _take, limit, condition);
+    }
+}
+
+// The kernel select_numbers runs on this CPU
+FilterKernel filter_kernel(void) {
+    word_kernel();
+    return activeKernel;
+}
+
+// Index of the lowest set bit of a non-zero word
+uint32_t lowest_bit(const uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long _index;
+    _BitScanForward64(&_index, word);
+    return (uint32_t)_index;
+#elif defined(_MSC_VER)
+    unsigned long _index;
+    if (_BitScanForward(&_index, (unsigned long)word)) return (uint32_t)_index;
+    _BitScanForward(&_index, (unsigned long)(word >> 32));
+    return (uint32_t)_index + 32;
+#else
+    return (uint32_t)__builtin_ctzll(word);
+#endif
+}
+
+// Pick the widest kernel the CPU runs. Threads racing through here store the same choice.
+SelectWord word_kernel(void) {
+    SelectWord _select = selectWord;
+    if (_select) return _select;
+
+    const FilterKernel _kernel = detect_kernel();
+    _select = select_word_scalar;
+#ifdef X86_KERNELS
+    if (_kernel == kernelAvx) _select = select_word_avx;
+    else if (_kernel == kernelSse2) _select = select_word_sse2;
+#endif
+    activeKernel = _kernel;
+    selectWord = _select;
+    return _select;
+}
+
+// AVX needs the CPU to have it and the operating system to save the upper halves of the
+// registers (OSXSAVE set and XCR0 covering the SSE and AVX state)
+FilterKernel detect_kernel(void) {
+#ifdef X86_KERNELS
+    unsigned int _ecx, _edx;
+#if defined(_MSC_VER)
+    int _info[4];
+    __cpuid(_info, 1);
+    _ecx = (unsigned int)_info[2];
+    _edx = (unsigned int)_info[3];
+#else
+    unsigned int _eax, _ebx;
+    if (!__get_cpuid(1, &_eax, &_ebx, &_ecx, &_edx)) return kernelScalar;
+#endif
+
+    const bool _sse2 = (_edx >> 26) & 1;
+    bool _avx = ((_ecx >> 27) & 1) && ((_ecx >> 28) & 1);
+    if (_avx) {
+#if defined(_MSC_VER)
+        const unsigned long long _xcr0 = _xgetbv(0);
+#else
+        unsigned int _low, _high;
+        __asm__ volatile ("xgetbv" : "=a"(_low), "=d"(_high) : "c"(0));
+        const unsigned long long _xcr0 = ((unsigned long long)_high << 32) | _low;
+#endif
+        _avx = (_xcr0 & 6) == 6;
+    }
+
+    if (_avx) return kernelAvx;
+    if (_sse2) return kernelSse2;
+#endif
+    return kernelScalar;
+}
+
+// One number at a time; the condition is tested once per word
+uint64_t select_word_scalar(const double* numbers, const size_t count, const double limit, const Condition condition) {
+    uint64_t _word = 0;
+    switch (condition) {
+        case greaterThan:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] > limit) << i;
+            break;
+        case greaterThanEqual:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] >= limit) << i;
+            break;
+        case lessThan:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] < limit) << i;
+            break;
+        case lessThanEqual:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] <= limit) << i;
+            break;
+        case equal:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] == limit) << i;
+            break;
+        case notEqual:
+            for (size_t i = 0; i < count; i++) _word |= (uint64_t)(numbers[i] != limit) << i;
+            break;
+        default:
+            break;
+    }
+    return _word;
+}
+
+#ifdef X86_KERNELS
+// Compare a full word of numbers, step at a time, with one compare and movemask per step
+#define SELECT_WORD_LOOP(step, load, compare, movemask) \
+    for (size_t i = 0; i < SELECTION_BITS; i += (step)) \
+        _word |= (uint64_t)movemask(compare(load(numbers + i), _limit)) << i
+
+#define SSE2_GT(a, b) _mm_cmpgt_pd(a, b)
+#define SSE2_GE(a, b) _mm_cmpge_pd(a, b)
+#define SSE2_LT(a, b) _mm_cmplt_pd(a, b)
+#define SSE2_LE(a, b) _mm_cmple_pd(a, b)
+#define SSE2_EQ(a, b) _mm_cmpeq_pd(a, b)
+#define SSE2_NE(a, b) _mm_cmpneq_pd(a, b)
+
+// Ordered predicates are false against NaN and the unordered not-equal is true, as in C
+#define AVX_GT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define AVX_GE(a, b) _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define AVX_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define AVX_LE(a, b) _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+#define AVX_EQ(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#define AVX_NE(a, b) _mm256_cmp_pd(a, b, _CMP_NEQ_UQ)
+
+// Two numbers per compare; a partial word is left to the scalar loop
+SSE2_TARGET uint64_t select_word_sse2(const double* numbers, const size_t count, const double limit, const Condition condition) {
+    if (count < SELECTION_BITS) return select_word_scalar(numbers, count, limit, condition);
+
+    const __m128d _limit = _mm_set1_pd(limit);
+    uint64_t _word = 0;
+    switch (condition) {
+        case greaterThan:      SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_GT, _mm_movemask_pd); break;
+        case greaterThanEqual: SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_GE, _mm_movemask_pd); break;
+        case lessThan:         SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_LT, _mm_movemask_pd); break;
+        case lessThanEqual:    SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_LE, _mm_movemask_pd); break;
+        case equal:            SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_EQ, _mm_movemask_pd); break;
+        case notEqual:         SELECT_WORD_LOOP(2, _mm_loadu_pd, SSE2_NE, _mm_movemask_pd); break;
+        default:               break;
+    }
+    return _word;
+}
+
+// Four numbers per compare; a partial word is left to the scalar loop
+AVX_TARGET uint64_t select_word_avx(const double* numbers, const size_t count, const double limit, const Condition condition) {
+    if (count < SELECTION_BITS) return select_word_scalar(numbers, count, limit, condition);
+
+    const __m256d _limit = _mm256_set1_pd(limit);
+    uint64_t _word = 0;
+    switch (condition) {
+        case greaterThan:      SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_GT, _mm256_movemask_pd); break;
+        case greaterThanEqual: SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_GE, _mm256_movemask_pd); break;
+        case lessThan:         SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_LT, _mm256_movemask_pd); break;
+        case lessThanEqual:    SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_LE, _mm256_movemask_pd); break;
+        case equal:            SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_EQ, _mm256_movemask_pd); break;
+        case notEqual:         SELECT_WORD_LOOP(4, _mm256_loadu_pd, AVX_NE, _mm256_movemask_pd); break;
+        default:               break;
+    }
+    // Clear the upper halves so the SSE code of the caller does not pay for the transition
+    _mm256_zeroupper();
+    return _word;
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef FILTER_KERNELS_H
+#define FILTER_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define SELECTION_BITS 64
+
+// Instruction sets a kernel can use, picked once from what the CPU supports
+typedef enum {
+    kernelScalar,
+    kernelSse2,
+    kernelAvx
+} FilterKernel;
+
+FilterKernel filter_kernel(void);
+uint32_t lowest_bit(uint64_t word);
+void select_numbers(const double* numbers, size_t count, double limit, Condition condition, uint64_t* selection);
+
+#endif //FILTER_KERNELS_H
@@ -0,0 +1,535 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HashIndex.h"
+#include "DocumentCodec.h"
+
+// An equality index on one key of a collection. Entries map the hash of a document's value
+// to its record id and are kept in an open-addressing table in memory, backed by an
+// append-only file. The file records the collection LSN and length it covers; when they no
+// longer match the collection, the index is rebuilt from it. Record ids only move when the
+// collection is rewritten whole, which rebuilds the index; inserts and updates append an
+// entry for each document they store, and removes leave their entries behind. An entry can
+// thus point at a slot that holds another document by now, which the filter check on every
+// candidate weeds out.
+typedef struct HashIndex HashIndex;
+struct HashIndex {
+    char databaseName[MAX_PATH_LEN];
+    char collectionName[MAX_PATH_LEN];
+    char* key;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    IndexEntry* slots;
+    size_t capacity;
+    size_t count;
+    HashIndex* next;
+};
+
+// State shared with collect_entry while walking a collection
+typedef struct {
+    HashIndex* index;
+    ByteBuffer* appended;
+    bool failed;
+} IndexBuild;
+
+static HashIndex* indexes = NULL;
+static SRWLOCK indexLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool add_entry(HashIndex* index, IndexEntry entry);
+bool append_entries(HashIndex* index, const char* fileName, const uint64_t* recordIds, int count);
+bool build_index(HashIndex* index, const char* fileName);
+bool collect_entry(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+void discard_index(HashIndex* index);
+HashIndex* find_index(const char* databaseName, const char* collectionName, const char* key);
+void free_index(HashIndex* index);
+bool has_entry(const HashIndex* index, IndexEntry entry);
+bool is_current(const HashIndex* index, const char* fileName);
+HashIndex* open_index(const char* databaseName, const char* collectionName, const char* key, const char* fileName);
+bool read_index(HashIndex* index, const char* fileName);
+bool reset_table(HashIndex* index);
+bool save_index(const HashIndex* index);
+uint32_t value_hash(ValueType type, const void* data, size_t length);
+
+
+// Register an index on a key and build it from the collection. The database lock must be held exclusively.
+bool index_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error) {
+    if (has_key_entry(databaseName, INDEX_META, collectionName, key)) {
+        get_error(error, "warning: Index on '%s' already exists", key);
+        return false;
+    }
+
+    // A file left behind by an earlier index on the same key must not be picked up
+    char _indexFile[MAX_PATH_LEN];
+    get_key_file(_indexFile, databaseName, collectionName, key, INDEX_SUFFIX);
+    remove(_indexFile);
+
+    AcquireSRWLockExclusive(&indexLock);
+    const bool _built = open_index(databaseName, collectionName, key, fileName) != NULL;
+    ReleaseSRWLockExclusive(&indexLock);
+
+    if (!_built) {
+        get_error(error, "fatal: Could not build index on '%s'", key);
+        return false;
+    }
+    return append_key_entry(databaseName, INDEX_META, collectionName, key, error);
+}
+
+// Unregister an index and delete its file. The database lock must be held exclusively.
+bool index_drop(const char* databaseName, const char* collectionName, const char* key, char* error) {
+    if (!has_key_entry(databaseName, INDEX_META, collectionName, key)) {
+        get_error(error, "fatal: Index on '%s' not found", key);
+        return false;
+    }
+    const bool _status = remove_key_entry(databaseName, INDEX_META, collectionName, key, error);
+
+    AcquireSRWLockExclusive(&indexLock);
+    HashIndex* _index = find_index(databaseName, collectionName, key);
+    if (_index) discard_index(_index);
+    ReleaseSRWLockExclusive(&indexLock);
+
+    char _indexFile[MAX_PATH_LEN];
+    get_key_file(_indexFile, databaseName, collectionName, key, INDEX_SUFFIX);
+    remove(_indexFile);
+    return _status;
+}
+
+// Delete every index of a dropped collection
+void index_drop_collection(const char* databaseName, const char* collectionName) {
+    char _indexFile[MAX_PATH_LEN], _error[MAX_ERROR_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, INDEX_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_indexFile, databaseName, collectionName, _key->valuestring, INDEX_SUFFIX);
+        remove(_indexFile);
+    }
+
+    cJSON_Delete(_meta);
+    remove_key_entry(databaseName, INDEX_META, collectionName, NULL, _error);
+    index_invalidate(databaseName, collectionName);
+}
+
+// Forget in-memory indexes whose files are being deleted (all of the database if collectionName is NULL)
+void index_invalidate(const char* databaseName, const char* collectionName) {
+    AcquireSRWLockExclusive(&indexLock);
+    HashIndex** _link = &indexes;
+    while (*_link) {
+        HashIndex* _index = *_link;
+        if (strcmp(_index->databaseName, databaseName) == 0 &&
+            (!collectionName || strcmp(_index->collectionName, collectionName) == 0)) {
+            *_link = _index->next;
+            free_index(_index);
+        } else {
+            _link = &_index->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&indexLock);
+}
+
+// Load every index of a collection before a mutation, so that it can be extended in place
+void index_prepare(const char* databaseName, const char* collectionName, const char* fileName) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, INDEX_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&indexLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (cJSON_IsString(_key)) open_index(databaseName, collectionName, _key->valuestring, fileName);
+    }
+    ReleaseSRWLockExclusive(&indexLock);
+    cJSON_Delete(_meta);
+}
+
+// Index the documents a mutation stored at recordIds in every index of a collection
+void index_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, const int count, const uint64_t lsn) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, INDEX_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&indexLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        HashIndex* _index = find_index(databaseName, collectionName, _key->valuestring);
+
+        // An index that cannot be extended is rebuilt when next used
+        if (!_index) continue;
+        if (!append_entries(_index, fileName, recordIds, count)) {
+            discard_index(_index);
+            continue;
+        }
+        _index->appliedLsn = lsn;
+    }
+    ReleaseSRWLockExclusive(&indexLock);
+    cJSON_Delete(_meta);
+}
+
+// Rebuild every index of a collection after its file was rewritten
+void index_rebuild(const char* databaseName, const char* collectionName, const char* fileName) {
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, INDEX_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&indexLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        HashIndex* _index = find_index(databaseName, collectionName, _key->valuestring);
+        if (_index && (!build_index(_index, fileName) || !save_index(_index))) discard_index(_index);
+        else if (!_index) open_index(databaseName, collectionName, _key->valuestring, fileName);
+    }
+    ReleaseSRWLockExclusive(&indexLock);
+    cJSON_Delete(_meta);
+}
+
+// Find the record ids of documents whose key may equal value, in collection order.
+// Candidates share a value hash and still have to be checked against the filter.
+// Returns -1 if the key is not indexed.
+int index_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, const char* fileName, uint64_t** recordIds) {
+    *recordIds = NULL;
+    if (!key || !value) return -1;
+
+    AcquireSRWLockExclusive(&indexLock);
+    HashIndex* _index = find_index(databaseName, collectionName, key);
+    if (!_index) {
+        // Not loaded yet: only open indexes that are registered for the collection
+        if (has_key_entry(databaseName, INDEX_META, collectionName, key)) _index = open_index(databaseName, collectionName, key, fileName);
+    } else if (!is_current(_index, fileName) && (!build_index(_index, fileName) || !save_index(_index))) {
+        discard_index(_index);
+        _index = NULL;
+    }
+
+    if (!_index) {
+        ReleaseSRWLockExclusive(&indexLock);
+        return -1;
+    }
+
+    uint32_t _probes[3];
+    const int _probeCount = value_probes(value, _probes);
+
+    size_t _count = 0, _capacity = 0;
+    uint64_t* _ids = NULL;
+    const size_t _mask = _index->capacity - 1;
+
+    for (int p = 0; p < _probeCount; p++) {
+        for (size_t i = _probes[p] & _mask; _index->slots[i].recordId != 0; i = (i + 1) & _mask) {
+            if (_index->slots[i].hash != _probes[p]) continue;
+            if (_count == _capacity) {
+                _capacity = _capacity ? _capacity * 2 : 16;
+                uint64_t* _grown = realloc(_ids, _capacity * sizeof(uint64_t));
+                if (!_grown) {
+                    free(_ids);
+                    ReleaseSRWLockExclusive(&indexLock);
+                    return -1;
+                }
+                _ids = _grown;
+            }
+            _ids[_count++] = _index->slots[i].recordId;
+        }
+    }
+    ReleaseSRWLockExclusive(&indexLock);
+
+    *recordIds = _ids;
+    return sort_record_ids(_ids, (int)_count);
+}
+
+// Return a current in-memory index, loading or rebuilding it as needed. indexLock must be held.
+HashIndex* open_index(const char* databaseName, const char* collectionName, const char* key, const char* fileName) {
+    HashIndex* _index = find_index(databaseName, collectionName, key);
+    if (_index) {
+        if (is_current(_index, fileName)) return _index;
+        if (build_index(_index, fileName) && save_index(_index)) return _index;
+        discard_index(_index);
+        return NULL;
+    }
+
+    _index = calloc(1, sizeof(HashIndex));
+    if (!_index) return NULL;
+    snprintf(_index->databaseName, sizeof(_index->databaseName), "%s", databaseName);
+    snprintf(_index->collectionName, sizeof(_index->collectionName), "%s", collectionName);
+    _index->key = _strdup(key);
+
+    if (!_index->key || (!read_index(_index, fileName) && !(build_index(_index, fileName) && save_index(_index)))) {
+        free_index(_index);
+        return NULL;
+    }
+
+    _index->next = indexes;
+    indexes = _index;
+    return _index;
+}
+
+// Load an index file, provided it covers the collection exactly as it is now
+bool read_index(HashIndex* index, const char* fileName) {
+    char _indexFile[MAX_PATH_LEN];
+    get_key_file(_indexFile, index->databaseName, index->collectionName, index->key, INDEX_SUFFIX);
+    FILE* _file = fopen(_indexFile, "rb");
+    if (!_file) return false;
+
+    IndexHeader _header;
+    const size_t _keyLength = strlen(index->key);
+    char* _key = malloc(_keyLength + 1);
+    bool _status = _key && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, INDEX_MAGIC, sizeof(_header.magic)) == 0 &&
+                   _header.version == INDEX_VERSION && _header.keyLength == _keyLength &&
+                   fread(_key, 1, _keyLength, _file) == _keyLength && memcmp(_key, index->key, _keyLength) == 0 &&
+                   _header.appliedLsn == get_applied_lsn(fileName) &&
+                   (long long)_header.coveredLength == get_file_size(fileName);
+    free(_key);
+
+    IndexEntry _entry;
+    _status = _status && reset_table(index);
+    for (uint32_t i = 0; _status && i < _header.entryCount; i++) {
+        _status = fread(&_entry, sizeof(_entry), 1, _file) == 1 && _entry.recordId != 0 && add_entry(index, _entry);
+    }
+    fclose(_file);
+
+    if (_status) {
+        index->appliedLsn = _header.appliedLsn;
+        index->coveredLength = _header.coveredLength;
+    }
+    return _status;
+}
+
+// Rebuild the table from every document of the collection
+bool build_index(HashIndex* index, const char* fileName) {
+    IndexBuild _build = { index, NULL, false };
+    const long long _size = get_file_size(fileName);
+    if (!reset_table(index) || _size < 0 ||
+        !walk_frames(fileName, collect_entry, &_build) || _build.failed) return false;
+
+    index->appliedLsn = get_applied_lsn(fileName);
+    index->coveredLength = (uint64_t)_size;
+    return true;
+}
+
+// Add the documents at recordIds to the table and to the end of the index file
+bool append_entries(HashIndex* index, const char* fileName, const uint64_t* recordIds, const int count) {
+    ByteBuffer _appended = { 0 };
+    IndexBuild _build = { index, &_appended, false };
+    const long long _size = get_file_size(fileName);
+    if (_size < 0 || !visit_records(fileName, recordIds, count, collect_entry, &_build) || _build.failed) {
+        free(_appended.data);
+        return false;
+    }
+
+    char _indexFile[MAX_PATH_LEN];
+    get_key_file(_indexFile, index->databaseName, index->collectionName, index->key, INDEX_SUFFIX);
+    FILE* _file = fopen(_indexFile, "rb+");
+    IndexHeader _header;
+    bool _status = _file && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, INDEX_MAGIC, sizeof(_header.magic)) == 0;
+
+    // Entries go first; the header that makes them valid is stamped afterwards
+    if (_status && _appended.size > 0) {
+        _status = fseek(_file, 0, SEEK_END) == 0 && fwrite(_appended.data, 1, _appended.size, _file) == _appended.size;
+    }
+    if (_status) {
+        _header.appliedLsn = get_applied_lsn(fileName);
+        _header.coveredLength = (uint64_t)_size;
+        _header.entryCount += (uint32_t)(_appended.size / sizeof(IndexEntry));
+        _status = fseek(_file, 0, SEEK_SET) == 0 && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    }
+    if (_file && fclose(_file) != 0) _status = false;
+    free(_appended.data);
+
+    if (_status) index->coveredLength = (uint64_t)_size;
+    return _status;
+}
+
+// Write the whole index to its file, replacing the previous one
+bool save_index(const HashIndex* index) {
+    char _indexFile[MAX_PATH_LEN], _tempName[MAX_PATH_LEN + 4];
+    get_key_file(_indexFile, index->databaseName, index->collectionName, index->key, INDEX_SUFFIX);
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", _indexFile);
+
+    FILE* _file = fopen(_tempName, "wb");
+    if (!_file) return false;
+
+    IndexHeader _header = { INDEX_MAGIC, INDEX_VERSION, index->appliedLsn, index->coveredLength,
+                            (uint32_t)index->count, (uint32_t)strlen(index->key) };
+    bool _status = fwrite(&_header, sizeof(_header), 1, _file) == 1 &&
+                   fwrite(index->key, 1, _header.keyLength, _file) == _header.keyLength;
+
+    for (size_t i = 0; _status && i < index->capacity; i++) {
+        if (index->slots[i].recordId != 0) _status = fwrite(&index->slots[i], sizeof(IndexEntry), 1, _file) == 1;
+    }
+    if (fclose(_file) != 0) _status = false;
+
+    if (!_status || !MoveFileExA(_tempName, _indexFile, MOVEFILE_REPLACE_EXISTING)) {
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Frame visitor: index the key value of one document
+bool collect_entry(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    IndexBuild* _build = context;
+    uint32_t _hash;
+    if (!document_hash(header, frame, length, _build->index->key, &_hash)) return true;
+
+    // A document updated without changing its value is indexed already
+    const IndexEntry _entry = { _hash, 0, recordId };
+    if (_build->appended && has_entry(_build->index, _entry)) return true;
+    if (!add_entry(_build->index, _entry) || (_build->appended && !buffer_reserve(_build->appended, sizeof(_entry)))) {
+        _build->failed = true;
+        return false;
+    }
+
+    if (_build->appended) {
+        memcpy(_build->appended->data + _build->appended->size, &_entry, sizeof(_entry));
+        _build->appended->size += sizeof(_entry);
+    }
+    return true;
+}
+
+// Hash the value a document holds for key; false if it has none an equality filter can match
+bool document_hash(const CollectionHeader* header, const char* frame, const size_t length, const char* key, uint32_t* hash) {
+    if (header->version >= 3) {
+        DocumentValue _value;
+        if (!find_field((const uint8_t*)frame, length, key, &_value)) return false;
+
+        switch (_value.type) {
+            case valueNumber: {
+                const double _number = _value.number == 0 ? 0.0 : _value.number;
+                *hash = value_hash(valueNumber, &_number, sizeof(_number));
+                return true;
+            }
+            case valueString: *hash = value_hash(valueString, _value.data, _value.length); return true;
+            case valueTrue:
+            case valueFalse: *hash = value_hash(_value.type, NULL, 0); return true;
+            default: return false;
+        }
+    }
+
+    // Text frames predate the binary encoding and are parsed to find the field
+    cJSON* _document = cJSON_ParseWithLength(frame, length);
+    const cJSON* _field = cJSON_GetObjectItem(_document, key);
+    bool _indexed = true;
+
+    if (cJSON_IsNumber(_field)) {
+        const double _number = _field->valuedouble == 0 ? 0.0 : _field->valuedouble;
+        *hash = value_hash(valueNumber, &_number, sizeof(_number));
+    } else if (cJSON_IsString(_field)) {
+        *hash = value_hash(valueString, _field->valuestring, strlen(_field->valuestring));
+    } else if (cJSON_IsBool(_field)) {
+        *hash = value_hash(_field->valueint ? valueTrue : valueFalse, NULL, 0);
+    } else {
+        _indexed = false;
+    }
+
+    cJSON_Delete(_document);
+    return _indexed;
+}
+
+// Hashes of the field values an equality filter on value matches. The filter compares
+// numbers through atof and everything else as text, so a value can match a number, a string
+// or a boolean field.
+int value_probes(const char* value, uint32_t probes[3]) {
+    const double _number = atof(value);
+    const double _normalized = _number == 0 ? 0.0 : _number;
+    int _count = 0;
+    probes[_count++] = value_hash(valueNumber, &_normalized, sizeof(_normalized));
+    probes[_count++] = value_hash(valueString, value, strlen(value));
+    if (strcmp(value, "true") == 0) probes[_count++] = value_hash(valueTrue, NULL, 0);
+    if (strcmp(value, "false") == 0) probes[_count++] = value_hash(valueFalse, NULL, 0);
+    return _count;
+}
+
+// FNV-1a over a type tag and the value bytes, so equal bytes of different types differ
+uint32_t value_hash(const ValueType type, const void* data, const size_t length) {
+    uint32_t _hash = 2166136261u;
+    _hash ^= (uint8_t)type;
+    _hash *= 16777619u;
+
+    const uint8_t* _bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        _hash ^= _bytes[i];
+        _hash *= 16777619u;
+    }
+    return _hash;
+}
+
+// Empty the table, leaving room for a first batch of entries
+bool reset_table(HashIndex* index) {
+    free(index->slots);
+    index->count = 0;
+    index->capacity = 64;
+    index->slots = calloc(index->capacity, sizeof(IndexEntry));
+    if (!index->slots) index->capacity = 0;
+    return index->slots != NULL;
+}
+
+// Whether the table holds an entry already
+bool has_entry(const HashIndex* index, const IndexEntry entry) {
+    const size_t _mask = index->capacity - 1;
+    for (size_t i = entry.hash & _mask; index->slots[i].recordId != 0; i = (i + 1) & _mask) {
+        if (index->slots[i].hash == entry.hash && index->slots[i].recordId == entry.recordId) return true;
+    }
+    return false;
+}
+
+// Insert into the open-addressing table, growing it past 70% load. Slots with a zero
+// recordId are empty; record id 0 falls on the collection header and is never a document.
+bool add_entry(HashIndex* index, const IndexEntry entry) {
+    if ((index->count + 1) * 10 > index->capacity * 7) {
+        const size_t _capacity = index->capacity * 2;
+        IndexEntry* _slots = calloc(_capacity, sizeof(IndexEntry));
+        if (!_slots) return false;
+
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->slots[i].recordId == 0) continue;
+            size_t j = index->slots[i].hash & (_capacity - 1);
+            while (_slots[j].recordId != 0) j = (j + 1) & (_capacity - 1);
+            _slots[j] = index->slots[i];
+        }
+
+        free(index->slots);
+        index->slots = _slots;
+        index->capacity = _capacity;
+    }
+    size_t i = entry.hash & (index->capacity - 1);
+    while (index->slots[i].recordId != 0) i = (i + 1) & (index->capacity - 1);
+    index->slots[i] = entry;
+    index->count++;
+    return true;
+}
+
+// Whether an index still describes the collection file as it is on disk
+bool is_current(const HashIndex* index, const char* fileName) {
+    return index->appliedLsn == get_applied_lsn(fileName) &&
+           (long long)index->coveredLength == get_file_size(fileName);
+}
+
+HashIndex* find_index(const char* databaseName, const char* collectionName, const char* key) {
+    for (HashIndex* _index = indexes; _index; _index = _index->next) {
+        if (strcmp(_index->key, key) == 0 && strcmp(_index->collectionName, collectionName) == 0 &&
+            strcmp(_index->databaseName, databaseName) == 0) return _index;
+    }
+    return NULL;
+}
+
+// Unlink and free an index; its file is removed so that the next use rebuilds it
+void discard_index(HashIndex* index) {
+    char _indexFile[MAX_PATH_LEN];
+    get_key_file(_indexFile, index->databaseName, index->collectionName, index->key, INDEX_SUFFIX);
+    remove(_indexFile);
+
+    for (HashIndex** _link = &indexes; *_link; _link = &(*_link)->next) {
+        if (*_link == index) {
+            *_link = index->next;
+            break;
+        }
+    }
+    free_index(index);
+}
+
+void free_index(HashIndex* index) {
+    free(index->slots);
+    free(index->key);
+    free(index);
+}
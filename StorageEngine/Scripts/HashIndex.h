@@ -0,0 +1,38 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define INDEX_MAGIC "PDBI"
+#define INDEX_VERSION 1
+
+// Header at the start of every index file, followed by the indexed key and the entries
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    uint32_t entryCount;
+    uint32_t keyLength;
+} IndexHeader;
+
+// Hash of one document's key value and the record id of the document
+typedef struct {
+    uint32_t hash;
+    uint32_t reserved;
+    uint64_t recordId;
+} IndexEntry;
+
+bool document_hash(const CollectionHeader* header, const char* frame, size_t length, const char* key, uint32_t* hash);
+void index_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, int count, uint64_t lsn);
+bool index_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error);
+bool index_drop(const char* databaseName, const char* collectionName, const char* key, char* error);
+void index_drop_collection(const char* databaseName, const char* collectionName);
+void index_invalidate(const char* databaseName, const char* collectionName);
+int index_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, const char* fileName, uint64_t** recordIds);
+void index_prepare(const char* databaseName, const char* collectionName, const char* fileName);
+void index_rebuild(const char* databaseName, const char* collectionName, const char* fileName);
+int value_probes(const char* value, uint32_t probes[3]);
+
+#endif //HASH_INDEX_H
@@ -0,0 +1,1056 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <io.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LsmStore.h"
+#include "HashIndex.h"
+
+// Collections created with LSM storage keep their documents in a log-structured merge tree
+// rather than in pages. Inserts, updates and removes go into a memtable, an array in memory
+// sorted by "_id", where a remove is held as a tombstone. Once the memtable grows past its
+// limit, and at every checkpoint, it is written out as an immutable segment file sorted by
+// id, and the collection file, which only names the segments, is replaced. Until then the
+// write-ahead log covers the memtable: the applied LSN in the file is that of the last
+// flush, so recovery replays whatever the memtable held.
+//
+// Segments are merged by tiers. Once TIER_FANOUT segments of one tier exist they are merged
+// into a single segment of the next tier, keeping the newest version of every document; a
+// merge that takes in the oldest segment also drops tombstones, as nothing older is left
+// for them to hide. Merges run as part of a flush, under the exclusive database lock.
+//
+// A document is read from the newest run that holds its id: the memtable, then the segments
+// from newest to oldest. A scan merges all runs in id order, which is the order documents
+// were inserted in, as ids are handed out counting up. The record id of a document is its id.
+//
+// Segments can keep Bloom filters on the values of chosen keys, in a filter file next to the
+// segment that is written before the collection file names it. An equality scan on such a
+// key leaves out the segments whose filter rules the value out; a version found elsewhere
+// is still skipped when one of them holds a newer version of the document, which only takes
+// a search of their id tables.
+
+_Static_assert(sizeof(CollectionHeader) + sizeof(LsmManifest) <= 4096, "manifest must stay small");
+
+// A version of a document held in the memtable; a removal has no record and a length of TOMBSTONE
+typedef struct {
+    uint64_t id;
+    uint32_t length;
+    char* record;
+} MemEntry;
+
+// Bloom filter of a segment on the values one key holds, FILTER_HASHES bits set per value
+typedef struct {
+    char key[FILTER_KEY_LEN];
+    uint32_t wordCount;
+    uint64_t* words;
+} BloomFilter;
+
+// A segment file, mapped for as long as its tree is loaded, with the filters read next to it
+typedef struct {
+    SegmentRef ref;
+    SegmentHeader header;
+    MappedFile view;
+    BloomFilter filters[MAX_FILTER_KEYS];
+    uint32_t filterCount;
+} Segment;
+
+// LSM state of one collection file, kept for the lifetime of the process. header runs ahead
+// of stored, the header in the file, while the memtable holds mutations not yet flushed.
+typedef struct LsmTree LsmTree;
+struct LsmTree {
+    char fileName[MAX_PATH_LEN];
+    CollectionHeader header;
+    CollectionHeader stored;
+    LsmManifest manifest;
+    Segment segments[MAX_SEGMENTS];
+    MemEntry* memtable;
+    uint32_t memCount;
+    uint32_t memCapacity;
+    size_t memBytes;
+    bool changed;
+    LsmTree* next;
+};
+
+// One sorted run of document versions, the memtable or a segment, and a position in it.
+// A pruned run is left out of scans.
+typedef struct {
+    const MemEntry* entries;
+    const Segment* segment;
+    uint32_t count;
+    uint32_t at;
+    bool pruned;
+} Run;
+
+// The runs of a tree being read, newest first, and the id they are positioned at. Records
+// handed out stay valid as long as the database lock is held.
+struct LsmReader {
+    LsmTree* tree;
+    Run runs[MAX_SEGMENTS + 1];
+    uint32_t runCount;
+    uint64_t position;
+};
+
+// Versions staged by a mutation, moved into the memtable when it commits
+struct LsmWriter {
+    LsmTree* tree;
+    MemEntry* staged;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static LsmTree* trees = NULL;
+static SRWLOCK treeLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool build_filter(const LsmTree* tree, const Segment* segment, const char* key, BloomFilter* filter);
+void clear_memtable(LsmTree* tree);
+void discard_segment(const char* fileName, Segment* segment);
+bool filter_holds(const BloomFilter* filter, uint32_t hash);
+int filter_key_index(const LsmManifest* manifest, const char* key);
+void filter_name(char* array, const char* fileName, uint32_t sequence);
+void filter_set(BloomFilter* filter, uint32_t hash);
+uint32_t filter_words(uint64_t count);
+const BloomFilter* find_filter(const Segment* segment, const char* key);
+LsmTree* find_tree(const char* fileName, bool load);
+bool flush_tree(LsmTree* tree, char* error);
+void free_tree(LsmTree* tree);
+bool hidden_version(const LsmReader* reader, uint32_t newer, uint64_t id);
+bool load_segment(const char* fileName, const LsmManifest* manifest, Segment* segment);
+void memtable_put(LsmTree* tree, MemEntry entry);
+bool merge_segments(LsmTree* tree, uint32_t first, uint32_t tier, char* error);
+bool merge_tiers(LsmTree* tree, char* error);
+bool names_segment(const LsmManifest* manifest, uint32_t sequence);
+int next_version(Run* runs, uint32_t count, uint64_t* id, const char** record, uint32_t* length, uint32_t* from);
+bool parse_segment_name(const char* name, const char* base, uint32_t* sequence);
+void read_filters(const char* fileName, const LsmManifest* manifest, Segment* segment);
+bool read_manifest(const char* fileName, CollectionHeader* header, LsmManifest* manifest);
+void release_segment(Segment* segment);
+bool remove_filter(Segment* segment, const char* key);
+bool reserve_memtable(LsmTree* tree, uint32_t needed);
+uint64_t run_id(const Run* run, uint32_t index);
+uint32_t run_seek(const Run* run, uint64_t id);
+bool run_version(const Run* run, uint32_t index, const char** record, uint32_t* length);
+void segment_name(char* array, const char* fileName, uint32_t sequence);
+Run segment_run(const Segment* segment);
+bool stage_version(LsmWriter* writer, MemEntry entry);
+void sweep_segments(const char* fileName, const LsmManifest* keep);
+size_t version_bytes(const MemEntry* entry);
+bool write_filters(const char* fileName, const Segment* segment);
+bool write_manifest(const char* fileName, const CollectionHeader* header, const LsmManifest* manifest, char* error);
+bool write_segment(const LsmTree* tree, Run* runs, uint32_t count, bool dropRemoved, Segment* segment, char* error);
+
+
+// Write the collection file of a new, empty LSM collection, removing any segment files a
+// dropped collection of the same name left behind
+bool lsm_create(const char* fileName, char* error) {
+    lsm_invalidate(fileName);
+    sweep_segments(fileName, NULL);
+
+    const CollectionHeader _header = { COLLECTION_MAGIC, COLLECTION_VERSION, 0, 1, 1, 0, storageLsm };
+    LsmManifest _manifest;
+    memset(&_manifest, 0, sizeof(_manifest));
+    _manifest.nextSequence = 1;
+    return write_manifest(fileName, &_header, &_manifest, error);
+}
+
+// Open an LSM collection for reading
+LsmReader* lsm_open(const char* fileName) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, true);
+    ReleaseSRWLockExclusive(&treeLock);
+    LsmReader* _reader = _tree ? calloc(1, sizeof(LsmReader)) : NULL;
+    if (!_reader) return NULL;
+
+    _reader->tree = _tree;
+    _reader->runs[_reader->runCount++] = (Run){ _tree->memtable, NULL, _tree->memCount, 0, false };
+    for (uint32_t i = _tree->manifest.segmentCount; i > 0; i--) {
+        _reader->runs[_reader->runCount++] = segment_run(&_tree->segments[i - 1]);
+    }
+    return _reader;
+}
+
+void lsm_close(LsmReader* reader) {
+    free(reader);
+}
+
+// Find the newest version of the document with an id, unless it was removed
+bool lsm_find(LsmReader* reader, const uint64_t recordId, const char** record, size_t* length) {
+    for (uint32_t i = 0; i < reader->runCount; i++) {
+        const Run* _run = &reader->runs[i];
+        if (_run->segment && (recordId < _run->segment->header.minId || recordId > _run->segment->header.maxId)) continue;
+        const uint32_t _index = run_seek(_run, recordId);
+        if (_index >= _run->count || run_id(_run, _index) != recordId) continue;
+
+        uint32_t _length;
+        if (!run_version(_run, _index, record, &_length) || _length == TOMBSTONE) return false;
+        *length = _length;
+        return true;
+    }
+    return false;
+}
+
+// Step to the next document in id order. cursor starts at 0 and holds the id to go on from;
+// recordId receives the id of the document.
+bool lsm_next(LsmReader* reader, uint64_t* cursor, uint64_t* recordId, const char** record, size_t* length) {
+    // The runs are only searched when the walk does not go on from where it stopped
+    if (*cursor != reader->position) {
+        for (uint32_t i = 0; i < reader->runCount; i++) reader->runs[i].at = run_seek(&reader->runs[i], *cursor);
+        reader->position = *cursor;
+    }
+
+    uint64_t _id;
+    uint32_t _length, _from;
+    int _found;
+    while ((_found = next_version(reader->runs, reader->runCount, &_id, record, &_length, &_from)) != 0) {
+        if (_found < 0 || _length == TOMBSTONE || hidden_version(reader, _from, _id)) continue;
+        *recordId = _id;
+        *length = _length;
+        *cursor = reader->position = _id + 1;
+        return true;
+    }
+    return false;
+}
+
+// Leave the segments out of the scans of a reader whose filter on key rules out value, before
+// the first step. Returns the number of segments left out.
+uint32_t lsm_prune(LsmReader* reader, const char* key, const char* value) {
+    uint32_t _probes[3];
+    const int _probeCount = value_probes(value, _probes);
+    uint32_t _pruned = 0;
+
+    for (uint32_t i = 0; i < reader->runCount; i++) {
+        Run* _run = &reader->runs[i];
+        const BloomFilter* _filter = _run->segment ? find_filter(_run->segment, key) : NULL;
+        if (!_filter) continue;
+
+        bool _possible = false;
+        for (int p = 0; p < _probeCount && !_possible; p++) _possible = filter_holds(_filter, _probes[p]);
+        if (!_possible) {
+            _run->pruned = true;
+            _pruned++;
+        }
+    }
+    return _pruned;
+}
+
+// Whether a pruned run newer than the one a version came from holds a newer version of its
+// document, which the version must not stand in for
+bool hidden_version(const LsmReader* reader, const uint32_t newer, const uint64_t id) {
+    for (uint32_t i = 0; i < newer; i++) {
+        const Run* _run = &reader->runs[i];
+        if (!_run->pruned || id < _run->segment->header.minId || id > _run->segment->header.maxId) continue;
+        const uint32_t _index = run_seek(_run, id);
+        if (_index < _run->count && run_id(_run, _index) == id) return true;
+    }
+    return false;
+}
+
+// Start changing an LSM collection. header receives its current header, which the caller
+// updates and hands back to lsm_commit.
+LsmWriter* lsm_begin(const char* fileName, CollectionHeader* header, char* error) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, true);
+    ReleaseSRWLockExclusive(&treeLock);
+    LsmWriter* _writer = _tree ? calloc(1, sizeof(LsmWriter)) : NULL;
+    if (!_writer) {
+        get_error(error, "fatal: Could not open collection '%s' for writing", fileName);
+        return NULL;
+    }
+
+    _writer->tree = _tree;
+    *header = _tree->header;
+    return _writer;
+}
+
+// Stage a new version of the document with an id
+bool lsm_put(LsmWriter* writer, const uint64_t recordId, const char* record, const size_t length) {
+    if (recordId == 0 || length >= TOMBSTONE) return false;
+    char* _copy = malloc(length ? length : 1);
+    if (!_copy) return false;
+
+    memcpy(_copy, record, length);
+    if (stage_version(writer, (MemEntry){ recordId, (uint32_t)length, _copy })) return true;
+    free(_copy);
+    return false;
+}
+
+// Stage the removal of the document with an id
+bool lsm_delete(LsmWriter* writer, const uint64_t recordId) {
+    return recordId != 0 && stage_version(writer, (MemEntry){ recordId, TOMBSTONE, NULL });
+}
+
+// Move the staged versions into the memtable and take over the header the mutation stamped.
+// A memtable grown past its limit is flushed; if that fails the next checkpoint tries again
+// and reports it, as the mutation itself is applied either way.
+bool lsm_commit(LsmWriter* writer, const CollectionHeader* header, char* error) {
+    LsmTree* _tree = writer->tree;
+    if (!reserve_memtable(_tree, _tree->memCount + writer->count)) {
+        get_error(error, "fatal: Memory allocation failed for the memtable of '%s'", _tree->fileName);
+        lsm_abort(writer);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < writer->count; i++) memtable_put(_tree, writer->staged[i]);
+    _tree->header.appliedLsn = header->appliedLsn;
+    _tree->header.nextId = header->nextId;
+    _tree->changed = true;
+    free(writer->staged);
+    free(writer);
+
+    char _flushError[MAX_ERROR_LEN];
+    if (_tree->memBytes >= MEMTABLE_LIMIT) flush_tree(_tree, _flushError);
+    return true;
+}
+
+void lsm_abort(LsmWriter* writer) {
+    if (!writer) return;
+    for (uint32_t i = 0; i < writer->count; i++) free(writer->staged[i].record);
+    free(writer->staged);
+    free(writer);
+}
+
+// Header of an LSM collection as its memtable has it, ahead of the file until the next flush
+bool lsm_header(const char* fileName, CollectionHeader* header) {
+    AcquireSRWLockExclusive(&treeLock);
+    const LsmTree* _tree = find_tree(fileName, true);
+    if (_tree) *header = _tree->header;
+    ReleaseSRWLockExclusive(&treeLock);
+    return _tree != NULL;
+}
+
+// Flush the memtable of a collection at a checkpoint. Files that are not LSM collections, or
+// whose tree was never loaded, have nothing to flush.
+bool lsm_sync(const char* fileName, char* error) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, false);
+    ReleaseSRWLockExclusive(&treeLock);
+    return !_tree || flush_tree(_tree, error);
+}
+
+// Flush the memtable and merge all segments of an LSM collection into one, leaving out the
+// versions and tombstones that newer versions hide
+bool lsm_merge(const char* fileName, char* error) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, true);
+    ReleaseSRWLockExclusive(&treeLock);
+    if (!_tree) {
+        get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        return false;
+    }
+
+    return flush_tree(_tree, error) &&
+           (_tree->manifest.segmentCount == 0 || merge_segments(_tree, 0, _tree->manifest.segments[0].tier, error));
+}
+
+// Return an LSM collection to its last flush after a crash: the memtable is gone with the
+// process, and segment files that a flush or merge wrote but never named in the collection
+// file, or that a merge replaced, are removed
+bool lsm_repair(const char* fileName, char* error) {
+    lsm_invalidate(fileName);
+
+    CollectionHeader _header;
+    LsmManifest _manifest;
+    if (!read_manifest(fileName, &_header, &_manifest)) {
+        get_error(error, "fatal: Could not repair collection '%s'", fileName);
+        return false;
+    }
+
+    sweep_segments(fileName, &_manifest);
+    return true;
+}
+
+// Forget a collection that is being dropped and remove its segment files
+void lsm_drop(const char* fileName) {
+    lsm_invalidate(fileName);
+    sweep_segments(fileName, NULL);
+}
+
+// Keep a Bloom filter on the values of a key in every segment of an LSM collection, building
+// it for the segments there are before the collection file names the key for new ones
+bool lsm_create_filter(const char* fileName, const char* key, char* error) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, true);
+    ReleaseSRWLockExclusive(&treeLock);
+    if (!_tree) {
+        get_error(error, "fatal: File '%s' is empty or unreadable", fileName);
+        return false;
+    }
+    if (strlen(key) >= FILTER_KEY_LEN) {
+        get_error(error, "fatal: Key '%s' is too long for a Bloom filter", key);
+        return false;
+    }
+    if (filter_key_index(&_tree->manifest, key) >= 0) {
+        get_error(error, "warning: Bloom filter on '%s' already exists", key);
+        return false;
+    }
+    if (_tree->manifest.filterCount == MAX_FILTER_KEYS) {
+        get_error(error, "fatal: A collection can have at most %d Bloom filters", MAX_FILTER_KEYS);
+        return false;
+    }
+
+    LsmManifest _manifest = _tree->manifest;
+    snprintf(_manifest.filterKeys[_manifest.filterCount++], FILTER_KEY_LEN, "%s", key);
+    bool _status = true;
+    for (uint32_t i = 0; _status && i < _tree->manifest.segmentCount; i++) {
+        Segment* _segment = &_tree->segments[i];
+        if (find_filter(_segment, key)) continue;
+        _status = build_filter(_tree, _segment, key, &_segment->filters[_segment->filterCount]);
+        if (_status) _segment->filterCount++;
+        _status = _status && write_filters(fileName, _segment);
+    }
+    if (_status && write_manifest(fileName, &_tree->stored, &_manifest, error)) {
+        _tree->manifest = _manifest;
+        return true;
+    }
+
+    // Segments that got the filter keep a file that still answers right; only memory forgets it
+    for (uint32_t i = 0; i < _tree->manifest.segmentCount; i++) remove_filter(&_tree->segments[i], key);
+    if (!_status) get_error(error, "fatal: Could not build Bloom filter on '%s'", key);
+    return false;
+}
+
+// Stop keeping a Bloom filter on a key and remove it from the segments of an LSM collection
+bool lsm_drop_filter(const char* fileName, const char* key, char* error) {
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree* _tree = find_tree(fileName, true);
+    ReleaseSRWLockExclusive(&treeLock);
+    const int _at = _tree ? filter_key_index(&_tree->manifest, key) : -1;
+    if (_at < 0) {
+        get_error(error, "fatal: Bloom filter on '%s' not found", key);
+        return false;
+    }
+
+    LsmManifest _manifest = _tree->manifest;
+    memmove(_manifest.filterKeys[_at], _manifest.filterKeys[_at + 1], (size_t)(_manifest.filterCount - _at - 1) * FILTER_KEY_LEN);
+    memset(_manifest.filterKeys[--_manifest.filterCount], 0, FILTER_KEY_LEN);
+    if (!write_manifest(fileName, &_tree->stored, &_manifest, error)) return false;
+    _tree->manifest = _manifest;
+
+    // A filter file that cannot be rewritten only keeps a filter that is no longer read
+    for (uint32_t i = 0; i < _tree->manifest.segmentCount; i++) {
+        if (remove_filter(&_tree->segments[i], key)) write_filters(fileName, &_tree->segments[i]);
+    }
+    return true;
+}
+
+// Whether the segments of a collection keep Bloom filters on a key
+bool lsm_filtered(const char* fileName, const char* key) {
+    AcquireSRWLockExclusive(&treeLock);
+    const LsmTree* _tree = key ? find_tree(fileName, true) : NULL;
+    const bool _filtered = _tree && filter_key_index(&_tree->manifest, key) >= 0;
+    ReleaseSRWLockExclusive(&treeLock);
+    return _filtered;
+}
+
+// Forget the tree of a collection file, or of every file in a database directory, that is
+// being deleted or replaced, with whatever its memtable holds
+void lsm_invalidate(const char* path) {
+    const size_t _length = strlen(path);
+
+    AcquireSRWLockExclusive(&treeLock);
+    LsmTree** _link = &trees;
+    while (*_link) {
+        LsmTree* _tree = *_link;
+        if (strncmp(_tree->fileName, path, _length) == 0 &&
+            (_tree->fileName[_length] == '\0' || _tree->fileName[_length] == '/' || _tree->fileName[_length] == '\\')) {
+            *_link = _tree->next;
+            free_tree(_tree);
+        } else {
+            _link = &_tree->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&treeLock);
+}
+
+// Write the memtable out as a segment of tier 0 and name it, with the current header, in the
+// collection file, then merge the tiers that filled up
+bool flush_tree(LsmTree* tree, char* error) {
+    if (!tree->changed) return true;
+
+    // With tiers the manifest never fills up in practice, but it must not overflow either
+    if (tree->memCount > 0 && tree->manifest.segmentCount == MAX_SEGMENTS &&
+        !merge_segments(tree, 0, tree->manifest.segments[0].tier, error)) return false;
+
+    LsmManifest _manifest = tree->manifest;
+    Segment _segment = { 0 };
+    if (tree->memCount > 0) {
+        _segment.ref = (SegmentRef){ _manifest.nextSequence++, 0 };
+        Run _run = { tree->memtable, NULL, tree->memCount, 0, false };
+        if (!write_segment(tree, &_run, 1, _manifest.segmentCount == 0, &_segment, error)) return false;
+        if (_segment.header.count > 0) _manifest.segments[_manifest.segmentCount++] = _segment.ref;
+    }
+
+    if (!write_manifest(tree->fileName, &tree->header, &_manifest, error)) {
+        if (_segment.header.count > 0) discard_segment(tree->fileName, &_segment);
+        return false;
+    }
+
+    if (_segment.header.count > 0) tree->segments[tree->manifest.segmentCount] = _segment;
+    tree->manifest = _manifest;
+    tree->stored = tree->header;
+    tree->changed = false;
+    clear_memtable(tree);
+    return merge_tiers(tree, error);
+}
+
+// Merge the newest segments for as long as TIER_FANOUT of them share a tier
+bool merge_tiers(LsmTree* tree, char* error) {
+    for (;;) {
+        const uint32_t _count = tree->manifest.segmentCount;
+        if (_count == 0) return true;
+
+        const uint32_t _tier = tree->manifest.segments[_count - 1].tier;
+        uint32_t _first = _count;
+        while (_first > 0 && tree->manifest.segments[_first - 1].tier == _tier) _first--;
+        if (_count - _first < TIER_FANOUT) return true;
+        if (!merge_segments(tree, _first, _tier + 1, error)) return false;
+    }
+}
+
+// Merge the segments from first up to the newest into one segment of a tier. Tombstones are
+// left out when the oldest segment takes part, as no older version is left for them to hide.
+bool merge_segments(LsmTree* tree, const uint32_t first, const uint32_t tier, char* error) {
+    const uint32_t _count = tree->manifest.segmentCount;
+    Run _runs[MAX_SEGMENTS];
+    uint32_t _runCount = 0;
+    for (uint32_t i = _count; i > first; i--) _runs[_runCount++] = segment_run(&tree->segments[i - 1]);
+
+    LsmManifest _manifest = tree->manifest;
+    Segment _segment = { .ref = { _manifest.nextSequence++, tier } };
+    if (!write_segment(tree, _runs, _runCount, first == 0, &_segment, error)) return false;
+
+    _manifest.segmentCount = first;
+    if (_segment.header.count > 0) _manifest.segments[_manifest.segmentCount++] = _segment.ref;
+    if (!write_manifest(tree->fileName, &tree->stored, &_manifest, error)) {
+        if (_segment.header.count > 0) discard_segment(tree->fileName, &_segment);
+        return false;
+    }
+
+    // The merged segments are no longer named by the collection file
+    for (uint32_t i = first; i < _count; i++) discard_segment(tree->fileName, &tree->segments[i]);
+    if (_segment.header.count > 0) tree->segments[first] = _segment;
+    tree->manifest = _manifest;
+    return true;
+}
+
+// Write the newest version of every id in runs to a new segment file and map it, leaving out
+// removals when dropRemoved is set, then write the filters of the tree's keys next to it. A
+// segment left without versions is not kept.
+bool write_segment(const LsmTree* tree, Run* runs, const uint32_t count, const bool dropRemoved, Segment* segment, char* error) {
+    char _segmentName[MAX_PATH_LEN + 16];
+    segment_name(_segmentName, tree->fileName, segment->ref.sequence);
+
+    FILE* _file = fopen(_segmentName, "wb");
+    SegmentHeader _header = { SEGMENT_MAGIC, SEGMENT_VERSION, 0, 0, 0, 0 };
+    SegmentEntry* _table = NULL;
+    uint64_t _capacity = 0, _offset = sizeof(_header);
+    bool _status = _file && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+
+    uint64_t _id;
+    const char* _record;
+    uint32_t _length, _from;
+    int _found;
+    while (_status && (_found = next_version(runs, count, &_id, &_record, &_length, &_from)) != 0) {
+        if (_found < 0) {
+            _status = false;
+            break;
+        }
+        if (dropRemoved && _length == TOMBSTONE) continue;
+
+        if (_header.count == _capacity) {
+            _capacity = _capacity ? _capacity * 2 : 256;
+            SegmentEntry* _grown = realloc(_table, (size_t)_capacity * sizeof(SegmentEntry));
+            if (!_grown) {
+                _status = false;
+                break;
+            }
+            _table = _grown;
+        }
+
+        const uint32_t _stored = _length == TOMBSTONE ? 0 : _length;
+        const SegmentRecord _prefix = { _id, _length, checksum(_record, _stored) };
+        _status = fwrite(&_prefix, sizeof(_prefix), 1, _file) == 1 &&
+                  (_stored == 0 || fwrite(_record, 1, _stored, _file) == _stored);
+        _table[_header.count++] = (SegmentEntry){ _id, _offset };
+        _offset += sizeof(_prefix) + _stored;
+        if (_header.count == 1) _header.minId = _id;
+        _header.maxId = _id;
+    }
+
+    // The table starts on an 8-byte boundary
+    static const char _padding[8];
+    const size_t _pad = (size_t)((8 - _offset % 8) % 8);
+    _header.tableOffset = _offset + _pad;
+    _status = _status && (_pad == 0 || fwrite(_padding, 1, _pad, _file) == _pad) &&
+              (_header.count == 0 || fwrite(_table, sizeof(SegmentEntry), (size_t)_header.count, _file) == _header.count) &&
+              fseek(_file, 0, SEEK_SET) == 0 && fwrite(&_header, sizeof(_header), 1, _file) == 1 &&
+              fflush(_file) == 0 && _commit(_fileno(_file)) == 0;
+    if (_file && fclose(_file) != 0) _status = false;
+    free(_table);
+
+    segment->header = _header;
+    if (_status && _header.count == 0) {
+        remove(_segmentName);
+        return true;
+    }
+
+    _status = _status && load_segment(tree->fileName, NULL, segment);
+    for (uint32_t i = 0; _status && i < tree->manifest.filterCount; i++) {
+        _status = build_filter(tree, segment, tree->manifest.filterKeys[i], &segment->filters[i]);
+        if (_status) segment->filterCount++;
+    }
+    if (_status && segment->filterCount > 0) _status = write_filters(tree->fileName, segment);
+    if (!_status) {
+        char _filterName[MAX_PATH_LEN + 16];
+        filter_name(_filterName, tree->fileName, segment->ref.sequence);
+        release_segment(segment);
+        remove(_segmentName);
+        remove(_filterName);
+        get_error(error, "fatal: Failed to write a segment of collection '%s'", tree->fileName);
+        return false;
+    }
+    return true;
+}
+
+// Replace the collection file of a tree, synced before it takes the place of the old one
+bool write_manifest(const char* fileName, const CollectionHeader* header, const LsmManifest* manifest, char* error) {
+    char _tempName[MAX_PATH_LEN + 4];
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", fileName);
+
+    FILE* _file = fopen(_tempName, "wb");
+    bool _status = _file && fwrite(header, sizeof(*header), 1, _file) == 1 &&
+                   fwrite(manifest, sizeof(*manifest), 1, _file) == 1 &&
+                   fflush(_file) == 0 && _commit(_fileno(_file)) == 0;
+    if (_file && fclose(_file) != 0) _status = false;
+
+    if (!_status || !MoveFileExA(_tempName, fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        get_error(error, "fatal: Failed to write collection '%s'", fileName);
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Read the header and manifest of an LSM collection file. Files from before filter keys were
+// kept end after the segments; they read as having none.
+bool read_manifest(const char* fileName, CollectionHeader* header, LsmManifest* manifest) {
+    FILE* _file = fopen(fileName, "rb");
+    if (!_file) return false;
+
+    memset(manifest, 0, sizeof(*manifest));
+    const bool _status = fread(header, sizeof(*header), 1, _file) == 1 &&
+                         fread(manifest, 1, sizeof(*manifest), _file) >= offsetof(LsmManifest, filterCount) &&
+                         memcmp(header->magic, COLLECTION_MAGIC, sizeof(header->magic)) == 0 &&
+                         header->version == COLLECTION_VERSION && header->storage == storageLsm &&
+                         manifest->segmentCount <= MAX_SEGMENTS && manifest->filterCount <= MAX_FILTER_KEYS;
+    fclose(_file);
+    for (uint32_t i = 0; i < MAX_FILTER_KEYS; i++) manifest->filterKeys[i][FILTER_KEY_LEN - 1] = '\0';
+    return _status;
+}
+
+// Map a segment file and check that its table lies within it, then read the filters of the
+// manifest's keys from next to it, if given one
+bool load_segment(const char* fileName, const LsmManifest* manifest, Segment* segment) {
+    char _segmentName[MAX_PATH_LEN + 16];
+    segment_name(_segmentName, fileName, segment->ref.sequence);
+    segment->filterCount = 0;
+    if (!map_file(_segmentName, &segment->view)) {
+        memset(&segment->view, 0, sizeof(segment->view));
+        return false;
+    }
+
+    const size_t _length = segment->view.length;
+    if (_length >= sizeof(SegmentHeader)) memcpy(&segment->header, segment->view.data, sizeof(SegmentHeader));
+    if (_length < sizeof(SegmentHeader) || memcmp(segment->header.magic, SEGMENT_MAGIC, sizeof(segment->header.magic)) != 0 ||
+        segment->header.version != SEGMENT_VERSION || segment->header.tableOffset < sizeof(SegmentHeader) ||
+        segment->header.tableOffset > _length || segment->header.count > UINT32_MAX ||
+        segment->header.count > (_length - segment->header.tableOffset) / sizeof(SegmentEntry)) {
+        unmap_file(&segment->view);
+        return false;
+    }
+
+    if (manifest) read_filters(fileName, manifest, segment);
+    return true;
+}
+
+// Unmap a segment and remove its file and that of its filters
+void discard_segment(const char* fileName, Segment* segment) {
+    char _segmentName[MAX_PATH_LEN + 16], _filterName[MAX_PATH_LEN + 16];
+    segment_name(_segmentName, fileName, segment->ref.sequence);
+    filter_name(_filterName, fileName, segment->ref.sequence);
+    release_segment(segment);
+    remove(_segmentName);
+    remove(_filterName);
+}
+
+void release_segment(Segment* segment) {
+    unmap_file(&segment->view);
+    for (uint32_t i = 0; i < segment->filterCount; i++) free(segment->filters[i].words);
+    segment->filterCount = 0;
+}
+
+// Build the filter of a segment on a key from the values its documents hold for it
+bool build_filter(const LsmTree* tree, const Segment* segment, const char* key, BloomFilter* filter) {
+    const Run _run = segment_run(segment);
+    snprintf(filter->key, sizeof(filter->key), "%s", key);
+    filter->wordCount = filter_words(_run.count);
+    filter->words = calloc(filter->wordCount, sizeof(uint64_t));
+    if (!filter->words) return false;
+
+    for (uint32_t i = 0; i < _run.count; i++) {
+        const char* _record;
+        uint32_t _length, _hash;
+        if (!run_version(&_run, i, &_record, &_length)) {
+            free(filter->words);
+            return false;
+        }
+        if (_length != TOMBSTONE && document_hash(&tree->header, _record, _length, key, &_hash)) filter_set(filter, _hash);
+    }
+    return true;
+}
+
+// Bits for count values at FILTER_BITS_PER_KEY each, in whole words
+uint32_t filter_words(const uint64_t count) {
+    const uint64_t _words = (count * FILTER_BITS_PER_KEY + 63) / 64;
+    return _words ? (uint32_t)_words : 1;
+}
+
+// Set the bits of a value hash. Each bit after the first is the hash moved on by a rotation
+// of itself, so one hash yields every position.
+void filter_set(BloomFilter* filter, uint32_t hash) {
+    const uint64_t _bits = (uint64_t)filter->wordCount * 64;
+    const uint32_t _delta = (hash >> 17) | (hash << 15);
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        const uint64_t _bit = hash % _bits;
+        filter->words[_bit / 64] |= 1ULL << (_bit % 64);
+        hash += _delta;
+    }
+}
+
+// Whether a value hash may have been set; false means no document of the segment holds it
+bool filter_holds(const BloomFilter* filter, uint32_t hash) {
+    const uint64_t _bits = (uint64_t)filter->wordCount * 64;
+    const uint32_t _delta = (hash >> 17) | (hash << 15);
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        const uint64_t _bit = hash % _bits;
+        if (!(filter->words[_bit / 64] & (1ULL << (_bit % 64)))) return false;
+        hash += _delta;
+    }
+    return true;
+}
+
+const BloomFilter* find_filter(const Segment* segment, const char* key) {
+    for (uint32_t i = 0; i < segment->filterCount; i++) {
+        if (strcmp(segment->filters[i].key, key) == 0) return &segment->filters[i];
+    }
+    return NULL;
+}
+
+bool remove_filter(Segment* segment, const char* key) {
+    const BloomFilter* _filter = find_filter(segment, key);
+    if (!_filter) return false;
+
+    const uint32_t _at = (uint32_t)(_filter - segment->filters);
+    free(segment->filters[_at].words);
+    memmove(&segment->filters[_at], &segment->filters[_at + 1], (size_t)(segment->filterCount - _at - 1) * sizeof(BloomFilter));
+    segment->filterCount--;
+    return true;
+}
+
+int filter_key_index(const LsmManifest* manifest, const char* key) {
+    for (uint32_t i = 0; i < manifest->filterCount; i++) {
+        if (strcmp(manifest->filterKeys[i], key) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// Replace the filter file of a segment with its filters, synced before it takes the place of
+// the old one. A segment without filters has no file.
+bool write_filters(const char* fileName, const Segment* segment) {
+    char _filterName[MAX_PATH_LEN + 16], _tempName[MAX_PATH_LEN + 20];
+    filter_name(_filterName, fileName, segment->ref.sequence);
+    if (segment->filterCount == 0) {
+        remove(_filterName);
+        return true;
+    }
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", _filterName);
+
+    FILE* _file = fopen(_tempName, "wb");
+    const FilterHeader _header = { FILTER_MAGIC, FILTER_VERSION, segment->filterCount, 0 };
+    bool _status = _file && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    for (uint32_t i = 0; _status && i < segment->filterCount; i++) {
+        const BloomFilter* _filter = &segment->filters[i];
+        const size_t _bytes = (size_t)_filter->wordCount * sizeof(uint64_t);
+        FilterRecord _record = { { 0 }, _filter->wordCount, checksum((const char*)_filter->words, _bytes) };
+        memcpy(_record.key, _filter->key, sizeof(_record.key));
+        _status = fwrite(&_record, sizeof(_record), 1, _file) == 1 && fwrite(_filter->words, 1, _bytes, _file) == _bytes;
+    }
+    _status = _status && fflush(_file) == 0 && _commit(_fileno(_file)) == 0;
+    if (_file && fclose(_file) != 0) _status = false;
+
+    if (!_status || !MoveFileExA(_tempName, _filterName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Read the filters of a segment on the keys a manifest names. A filter that is missing or
+// damaged leaves its key unfiltered, which only costs reading the segment.
+void read_filters(const char* fileName, const LsmManifest* manifest, Segment* segment) {
+    char _filterName[MAX_PATH_LEN + 16];
+    filter_name(_filterName, fileName, segment->ref.sequence);
+    FILE* _file = fopen(_filterName, "rb");
+    if (!_file) return;
+
+    FilterHeader _header;
+    bool _status = fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, FILTER_MAGIC, sizeof(_header.magic)) == 0 && _header.version == FILTER_VERSION;
+    const uint32_t _words = filter_words(segment->header.count);
+
+    for (uint32_t i = 0; _status && i < _header.filterCount && segment->filterCount < MAX_FILTER_KEYS; i++) {
+        FilterRecord _record;
+        _status = fread(&_record, sizeof(_record), 1, _file) == 1 && _record.wordCount == _words &&
+                  _record.key[FILTER_KEY_LEN - 1] == '\0';
+        BloomFilter* _filter = &segment->filters[segment->filterCount];
+        _filter->words = _status ? malloc((size_t)_words * sizeof(uint64_t)) : NULL;
+        _status = _filter->words && fread(_filter->words, sizeof(uint64_t), _words, _file) == _words &&
+                  checksum((const char*)_filter->words, (size_t)_words * sizeof(uint64_t)) == _record.checksum;
+
+        if (_status && filter_key_index(manifest, _record.key) >= 0 && !find_filter(segment, _record.key)) {
+            memcpy(_filter->key, _record.key, sizeof(_filter->key));
+            _filter->wordCount = _words;
+            segment->filterCount++;
+        } else {
+            free(_filter->words);
+        }
+    }
+    fclose(_file);
+}
+
+// Remove the segment and filter files of a collection that a manifest does not name (all of
+// them without a manifest). They sit next to the collection file, named after it.
+void sweep_segments(const char* fileName, const LsmManifest* keep) {
+    const char* _base = fileName;
+    for (const char* _at = fileName; *_at; _at++) {
+        if (*_at == '/' || *_at == '\\') _base = _at + 1;
+    }
+    if (_base == fileName) return;
+
+    char _searchPath[MAX_PATH_LEN + 8];
+    snprintf(_searchPath, sizeof(_searchPath), "%.*s\\*.*", (int)(_base - fileName - 1), fileName);
+
+    struct _finddata_t _file;
+    const intptr_t _handle = _findfirst(_searchPath, &_file);
+    if (_handle == -1) return;
+
+    do {
+        uint32_t _sequence;
+        if (!parse_segment_name(_file.name, _base, &_sequence) || (keep && names_segment(keep, _sequence))) continue;
+        char _segmentName[MAX_PATH_LEN + 16], _filterName[MAX_PATH_LEN + 16];
+        segment_name(_segmentName, fileName, _sequence);
+        filter_name(_filterName, fileName, _sequence);
+        remove(_segmentName);
+        remove(_filterName);
+    } while (_findnext(_handle, &_file) == 0);
+
+    _findclose(_handle);
+}
+
+// Sequence of a segment or filter file of the collection file base, read from its name
+bool parse_segment_name(const char* name, const char* base, uint32_t* sequence) {
+    const size_t _baseLength = strlen(base);
+    if (strncmp(name, base, _baseLength) != 0 || name[_baseLength] != '.') return false;
+
+    const char* _digits = name + _baseLength + 1;
+    char* _end = NULL;
+    if (*_digits < '0' || *_digits > '9') return false;
+    const unsigned long _sequence = strtoul(_digits, &_end, 10);
+    if ((strcmp(_end, SEGMENT_SUFFIX) != 0 && strcmp(_end, FILTER_SUFFIX) != 0) || _sequence > UINT32_MAX) return false;
+
+    *sequence = (uint32_t)_sequence;
+    return true;
+}
+
+bool names_segment(const LsmManifest* manifest, const uint32_t sequence) {
+    for (uint32_t i = 0; i < manifest->segmentCount; i++) {
+        if (manifest->segments[i].sequence == sequence) return true;
+    }
+    return false;
+}
+
+// Take the lowest id any run that is not pruned is positioned at, with its version from the
+// newest such run that holds it, and move those runs past it. from receives that run.
+// Returns 1, 0 once the runs are exhausted, or -1 if that version is damaged.
+int next_version(Run* runs, const uint32_t count, uint64_t* id, const char** record, uint32_t* length, uint32_t* from) {
+    uint32_t _newest = count;
+    uint64_t _lowest = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (runs[i].pruned || runs[i].at >= runs[i].count) continue;
+        const uint64_t _id = run_id(&runs[i], runs[i].at);
+        if (_newest == count || _id < _lowest) {
+            _lowest = _id;
+            _newest = i;
+        }
+    }
+    if (_newest == count) return 0;
+
+    const bool _valid = run_version(&runs[_newest], runs[_newest].at, record, length);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!runs[i].pruned && runs[i].at < runs[i].count && run_id(&runs[i], runs[i].at) == _lowest) runs[i].at++;
+    }
+    *id = _lowest;
+    *from = _newest;
+    return _valid ? 1 : -1;
+}
+
+uint64_t run_id(const Run* run, const uint32_t index) {
+    if (!run->segment) return run->entries[index].id;
+
+    SegmentEntry _entry;
+    memcpy(&_entry, run->segment->view.data + run->segment->header.tableOffset + (size_t)index * sizeof(_entry), sizeof(_entry));
+    return _entry.id;
+}
+
+// Position of the first version in a run with an id of at least id
+uint32_t run_seek(const Run* run, const uint64_t id) {
+    uint32_t _low = 0, _high = run->count;
+    while (_low < _high) {
+        const uint32_t _middle = _low + (_high - _low) / 2;
+        if (run_id(run, _middle) < id) _low = _middle + 1;
+        else _high = _middle;
+    }
+    return _low;
+}
+
+// Read the version at a position of a run. A segment record is checked before it is trusted.
+bool run_version(const Run* run, const uint32_t index, const char** record, uint32_t* length) {
+    if (!run->segment) {
+        *record = run->entries[index].record;
+        *length = run->entries[index].length;
+        return true;
+    }
+
+    const Segment* _segment = run->segment;
+    const uint64_t _end = _segment->header.tableOffset;
+    SegmentEntry _entry;
+    SegmentRecord _prefix;
+    memcpy(&_entry, _segment->view.data + _end + (size_t)index * sizeof(_entry), sizeof(_entry));
+    if (_entry.offset < sizeof(SegmentHeader) || _entry.offset > _end || _end - _entry.offset < sizeof(_prefix)) return false;
+    memcpy(&_prefix, _segment->view.data + _entry.offset, sizeof(_prefix));
+    if (_prefix.id != _entry.id) return false;
+
+    *record = NULL;
+    *length = _prefix.length;
+    if (_prefix.length == TOMBSTONE) return true;
+
+    const char* _data = _segment->view.data + _entry.offset + sizeof(_prefix);
+    if (_prefix.length > _end - _entry.offset - sizeof(_prefix) || checksum(_data, _prefix.length) != _prefix.checksum) return false;
+    *record = _data;
+    return true;
+}
+
+Run segment_run(const Segment* segment) {
+    return (Run){ NULL, segment, (uint32_t)segment->header.count, 0, false };
+}
+
+// Put a version into the memtable in place of the one it holds for the same id. Room for it
+// must have been reserved.
+void memtable_put(LsmTree* tree, const MemEntry entry) {
+    uint32_t _at = tree->memCount;
+
+    // Inserted documents carry ids past every other, so most versions go at the end
+    if (_at > 0 && tree->memtable[_at - 1].id >= entry.id) {
+        const Run _run = { tree->memtable, NULL, tree->memCount, 0, false };
+        _at = run_seek(&_run, entry.id);
+    }
+
+    if (_at < tree->memCount && tree->memtable[_at].id == entry.id) {
+        tree->memBytes -= version_bytes(&tree->memtable[_at]);
+        free(tree->memtable[_at].record);
+        tree->memtable[_at] = entry;
+    } else {
+        memmove(&tree->memtable[_at + 1], &tree->memtable[_at], (size_t)(tree->memCount - _at) * sizeof(MemEntry));
+        tree->memtable[_at] = entry;
+        tree->memCount++;
+    }
+    tree->memBytes += version_bytes(&entry);
+}
+
+bool reserve_memtable(LsmTree* tree, const uint32_t needed) {
+    if (needed <= tree->memCapacity) return true;
+
+    uint32_t _capacity = tree->memCapacity ? tree->memCapacity : 1024;
+    while (_capacity < needed) _capacity *= 2;
+    MemEntry* _grown = realloc(tree->memtable, (size_t)_capacity * sizeof(MemEntry));
+    if (!_grown) return false;
+    tree->memtable = _grown;
+    tree->memCapacity = _capacity;
+    return true;
+}
+
+void clear_memtable(LsmTree* tree) {
+    for (uint32_t i = 0; i < tree->memCount; i++) free(tree->memtable[i].record);
+    tree->memCount = 0;
+    tree->memBytes = 0;
+}
+
+size_t version_bytes(const MemEntry* entry) {
+    return sizeof(MemEntry) + (entry->length == TOMBSTONE ? 0 : entry->length);
+}
+
+bool stage_version(LsmWriter* writer, const MemEntry entry) {
+    if (writer->count == writer->capacity) {
+        const uint32_t _capacity = writer->capacity ? writer->capacity * 2 : 16;
+        MemEntry* _grown = realloc(writer->staged, (size_t)_capacity * sizeof(MemEntry));
+        if (!_grown) return false;
+        writer->staged = _grown;
+        writer->capacity = _capacity;
+    }
+    writer->staged[writer->count++] = entry;
+    return true;
+}
+
+// Find the tree of a collection file, loading it if asked to. treeLock must be held.
+LsmTree* find_tree(const char* fileName, const bool load) {
+    for (LsmTree* _tree = trees; _tree; _tree = _tree->next) {
+        if (strcmp(_tree->fileName, fileName) == 0) return _tree;
+    }
+    if (!load) return NULL;
+
+    LsmTree* _tree = calloc(1, sizeof(LsmTree));
+    if (!_tree) return NULL;
+    snprintf(_tree->fileName, sizeof(_tree->fileName), "%s", fileName);
+
+    bool _status = read_manifest(fileName, &_tree->header, &_tree->manifest);
+    for (uint32_t i = 0; _status && i < _tree->manifest.segmentCount; i++) {
+        _tree->segments[i].ref = _tree->manifest.segments[i];
+        _status = load_segment(fileName, &_tree->manifest, &_tree->segments[i]);
+    }
+    if (!_status) {
+        free_tree(_tree);
+        return NULL;
+    }
+
+    _tree->stored = _tree->header;
+    _tree->next = trees;
+    trees = _tree;
+    return _tree;
+}
+
+void free_tree(LsmTree* tree) {
+    for (uint32_t i = 0; i < tree->manifest.segmentCount && i < MAX_SEGMENTS; i++) release_segment(&tree->segments[i]);
+    clear_memtable(tree);
+    free(tree->memtable);
+    free(tree);
+}
+
+void segment_name(char* array, const char* fileName, const uint32_t sequence) {
+    snprintf(array, MAX_PATH_LEN + 16, "%s.%u%s", fileName, sequence, SEGMENT_SUFFIX);
+}
+
+void filter_name(char* array, const char* fileName, const uint32_t sequence) {
+    snprintf(array, MAX_PATH_LEN + 16, "%s.%u%s", fileName, sequence, FILTER_SUFFIX);
+}
@@ -0,0 +1,105 @@
+#ifndef LSM_STORE_H
+#define LSM_STORE_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define LSM_STORAGE_NAME "lsm"
+#define SEGMENT_MAGIC "PDBS"
+#define SEGMENT_VERSION 1
+#define SEGMENT_SUFFIX ".seg"
+#define MEMTABLE_LIMIT (4LL * 1024 * 1024)
+#define TIER_FANOUT 4
+#define MAX_SEGMENTS 64
+#define TOMBSTONE UINT32_MAX
+#define FILTER_MAGIC "PDBB"
+#define FILTER_VERSION 1
+#define FILTER_SUFFIX ".bloom"
+#define MAX_FILTER_KEYS 4
+#define FILTER_KEY_LEN 64
+#define FILTER_BITS_PER_KEY 10
+#define FILTER_HASHES 7
+
+// A segment named by the manifest, with the tier it belongs to (0 for a flushed memtable,
+// one more for every merge it went through)
+typedef struct {
+    uint32_t sequence;
+    uint32_t tier;
+} SegmentRef;
+
+// Follows the collection header in the file of an LSM collection. The file holds no
+// documents itself; they are in the segment files it names, listed oldest first. Its size
+// never changes, so the length the indexes cover stays that of the collection file.
+// filterKeys are the keys every new segment gets a Bloom filter for.
+typedef struct {
+    uint32_t segmentCount;
+    uint32_t nextSequence;
+    SegmentRef segments[MAX_SEGMENTS];
+    uint32_t filterCount;
+    uint32_t reserved;
+    char filterKeys[MAX_FILTER_KEYS][FILTER_KEY_LEN];
+} LsmManifest;
+
+// Start of a segment file. Versions of documents follow, sorted by id and each preceded by
+// a SegmentRecord, then at tableOffset one SegmentEntry per version to search them by id.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    uint64_t tableOffset;
+    uint64_t minId;
+    uint64_t maxId;
+} SegmentHeader;
+
+// Precedes a document version in a segment; a length of TOMBSTONE marks a removal
+typedef struct {
+    uint64_t id;
+    uint32_t length;
+    uint32_t checksum;
+} SegmentRecord;
+
+typedef struct {
+    uint64_t id;
+    uint64_t offset;
+} SegmentEntry;
+
+// Start of the filter file kept next to a segment, followed by one FilterRecord and its bits
+// for each key
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t filterCount;
+    uint32_t reserved;
+} FilterHeader;
+
+typedef struct {
+    char key[FILTER_KEY_LEN];
+    uint32_t wordCount;
+    uint32_t checksum;
+} FilterRecord;
+
+typedef struct LsmReader LsmReader;
+typedef struct LsmWriter LsmWriter;
+
+void lsm_abort(LsmWriter* writer);
+LsmWriter* lsm_begin(const char* fileName, CollectionHeader* header, char* error);
+void lsm_close(LsmReader* reader);
+bool lsm_commit(LsmWriter* writer, const CollectionHeader* header, char* error);
+bool lsm_create(const char* fileName, char* error);
+bool lsm_create_filter(const char* fileName, const char* key, char* error);
+bool lsm_delete(LsmWriter* writer, uint64_t recordId);
+void lsm_drop(const char* fileName);
+bool lsm_drop_filter(const char* fileName, const char* key, char* error);
+bool lsm_filtered(const char* fileName, const char* key);
+bool lsm_find(LsmReader* reader, uint64_t recordId, const char** record, size_t* length);
+bool lsm_header(const char* fileName, CollectionHeader* header);
+void lsm_invalidate(const char* path);
+bool lsm_merge(const char* fileName, char* error);
+bool lsm_next(LsmReader* reader, uint64_t* cursor, uint64_t* recordId, const char** record, size_t* length);
+LsmReader* lsm_open(const char* fileName);
+uint32_t lsm_prune(LsmReader* reader, const char* key, const char* value);
+bool lsm_put(LsmWriter* writer, uint64_t recordId, const char* record, size_t length);
+bool lsm_repair(const char* fileName, char* error);
+bool lsm_sync(const char* fileName, char* error);
+
+#endif //LSM_STORE_H
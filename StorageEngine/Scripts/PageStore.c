@@ -0,0 +1,1330 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PageStore.h"
+#include "BufferPool.h"
+#include "DocumentCodec.h"
+
+// Collection files from version 5 onwards are made of fixed-size pages. Page 0 holds the
+// collection header; every other page starts with a PageHeader and a slot directory, and a
+// document is addressed by the position of its slot, which it keeps for its whole life. A
+// document rewritten no larger than before is overwritten where it is, one that still fits
+// its page is repacked within the page, and only one that outgrows its page moves, leaving a
+// forward in its slot. Space freed by removes is found again through a free-space map, which
+// is kept in memory and rebuilt from the page headers whenever it no longer matches the file.
+//
+// Pages are overwritten in place, so before a page is first written after a checkpoint its
+// image is saved to a rollback journal next to the file. Recovery copies the saved images
+// back, returning the file to its state at the checkpoint, and the write-ahead log is then
+// replayed over it. A checkpoint syncs the file and deletes the journal.
+//
+// Space freed in place is only reused by documents that fit it. A file whose pages are
+// mostly free is compacted by copying its documents into a fresh file a few pages at a
+// time, which then replaces it as a new generation (see Compactor.h).
+//
+// Pages are read and written through the buffer pool (see BufferPool.h). Committed pages
+// stay in the pool until a checkpoint or an eviction writes them back; only the header page
+// is written to the file at once, so that the applied LSN can be read without the pool.
+
+_Static_assert(sizeof(CollectionHeader) <= COLLECTION_PAGE_SIZE, "collection header must fit in a page");
+
+#define PAGE_START ((uint32_t)sizeof(PageHeader))
+#define SLOT_SIZE ((uint32_t)sizeof(PageSlot))
+#define FORWARD_SIZE ((uint32_t)sizeof(uint64_t))
+#define MAX_PAGE_SLOTS ((COLLECTION_PAGE_SIZE - PAGE_START) / SLOT_SIZE)
+#define MAX_PAGE_RECORD (COLLECTION_PAGE_SIZE - PAGE_START - SLOT_SIZE)
+#define FREE_MAP_FANOUT 64
+
+// Record id of a slot: the position of its directory entry in the file
+#define RECORD_ID(page, slot) ((uint64_t)(page) * COLLECTION_PAGE_SIZE + PAGE_START + (uint64_t)(slot) * SLOT_SIZE)
+
+// Page state of one collection file, kept for the lifetime of the process. The free-space
+// map holds the free bytes of each page, with the largest value of every block of pages and
+// of every group of blocks above it, so that a page with room is found without a full scan.
+typedef struct PagedFile PagedFile;
+struct PagedFile {
+    char fileName[MAX_PATH_LEN];
+    uint64_t generation;
+
+    // Free-space map, valid while the applied LSN and page count match the file
+    bool mapped;
+    uint64_t appliedLsn;
+    uint32_t pageCount;
+    uint32_t tailPage;
+    uint32_t capacity;
+    uint16_t* freeBytes;
+    uint16_t* blockFree;
+    uint16_t* groupFree;
+    uint64_t freeTotal;
+
+    // Pages of the file as it was at the last checkpoint, and which of them the journal holds
+    bool journalLoaded;
+    uint32_t journalPages;
+    uint8_t* saved;
+
+    PagedFile* next;
+};
+
+// A page, or a run of pages holding one large document, read into a writer
+typedef struct {
+    uint32_t page;
+    uint32_t span;
+    bool dirty;
+    uint8_t* data;
+} HeldPage;
+
+// Changes to one collection file, held in memory until they are committed together
+struct PageWriter {
+    PagedFile* file;
+    PoolFile* pool;
+    FILE* handle;
+    uint32_t basePages;
+    bool changed;
+    HeldPage** pages;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* table;
+    uint32_t tableSize;
+};
+
+// A page, or a run of pages copied together, that a reader is looking at
+typedef struct {
+    uint32_t page;
+    PoolFrame* frame;
+    const uint8_t* data;
+    uint8_t* run;
+    size_t runCapacity;
+} ReaderPlace;
+
+// Pages of a collection file being read. Records handed out point into the pages of the
+// reader and stay valid until its next call.
+struct PageReader {
+    PoolFile* pool;
+    FILE* handle;
+    uint32_t pageCount;
+    ReaderPlace home;
+    ReaderPlace moved;
+};
+
+// Documents being packed into new pages of a file written front to back
+typedef struct {
+    FILE* file;
+    uint8_t* page;
+} PagePacker;
+
+// A collection file being compacted into a fresh file next to it. Only the pages still to be
+// filled are kept in memory; the files are opened anew for every step.
+struct PageCopy {
+    char fileName[MAX_PATH_LEN];
+    char tempName[MAX_PATH_LEN + 8];
+    CollectionHeader header;
+    uint64_t cursor;
+    PagePacker packer;
+};
+
+static PagedFile* pagedFiles = NULL;
+static SRWLOCK pagedLock = SRWLOCK_INIT;
+
+// Local helper functions
+HeldPage* add_held(PageWriter* writer, uint32_t page, uint32_t span, uint8_t* data);
+bool allocate_map(PagedFile* file, uint32_t pageCount);
+int compare_held(const void* left, const void* right);
+bool copy_current(const PageCopy* copy);
+bool dissolve_run(PageWriter* writer, HeldPage* held);
+void free_copy(PageCopy* copy);
+void free_writer(PageWriter* writer);
+uint32_t find_free_page(const PagedFile* file, uint32_t needed, uint32_t exclude);
+HeldPage* hold_page(PageWriter* writer, uint32_t page);
+void journal_name(char* array, const char* fileName);
+bool journal_pages(PageWriter* writer);
+bool load_journal(PagedFile* file);
+bool map_free_space(PagedFile* file, uint64_t appliedLsn, uint32_t pageCount);
+HeldPage* new_run(PageWriter* writer, uint32_t span);
+bool pack_finish(PagePacker* packer);
+bool pack_record(PagePacker* packer, const char* record, uint32_t length);
+PagedFile* paged_file(const char* fileName);
+bool place_record(uint8_t* run, uint32_t slot, const char* record, uint32_t length, uint32_t state);
+uint32_t record_space(uint32_t length);
+void release_record(uint8_t* run, uint32_t slot);
+bool remove_slot(PageWriter* writer, HeldPage* held, uint32_t slot);
+bool repack_page(uint8_t* run);
+void reset_paged(PagedFile* file);
+const uint8_t* reader_page(PageReader* reader, ReaderPlace* place, uint32_t page);
+const PageSlot* reader_slot(PageReader* reader, ReaderPlace* place, uint64_t recordId, const uint8_t** run);
+void release_place(ReaderPlace* place);
+uint32_t run_free(const uint8_t* run);
+void set_free(PagedFile* file, uint32_t page, uint32_t bytes);
+bool split_record_id(uint64_t recordId, uint32_t* page, uint32_t* slot);
+bool start_packer(PagePacker* packer);
+bool store_record(PageWriter* writer, const char* record, uint32_t length, uint32_t state, uint32_t exclude, uint64_t* recordId, bool* inOrder);
+void trim_slots(uint8_t* run);
+
+
+// Open a paged collection file for reading through the buffer pool
+PageReader* page_open(const char* fileName) {
+    PageReader* _reader = calloc(1, sizeof(PageReader));
+    FILE* _handle = _reader ? fopen(fileName, "rb") : NULL;
+    PoolFile* _pool = _handle ? pool_file(fileName) : NULL;
+    if (!_pool) {
+        if (_handle) fclose(_handle);
+        free(_reader);
+        return NULL;
+    }
+
+    // Pages written back by the pool must never be served from a stale stdio buffer
+    setvbuf(_handle, NULL, _IONBF, 0);
+    fseek(_handle, 0, SEEK_END);
+    _reader->pool = _pool;
+    _reader->handle = _handle;
+    _reader->pageCount = (uint32_t)(ftell(_handle) / COLLECTION_PAGE_SIZE);
+    return _reader;
+}
+
+void page_close(PageReader* reader) {
+    if (!reader) return;
+    release_place(&reader->home);
+    release_place(&reader->moved);
+    free(reader->home.run);
+    free(reader->moved.run);
+    fclose(reader->handle);
+    free(reader);
+}
+
+// Find the document a record id addresses, following a forward if it moved
+bool page_find(PageReader* reader, const uint64_t recordId, const char** record, size_t* length) {
+    const uint8_t* _run = NULL;
+    const PageSlot* _slot = reader_slot(reader, &reader->home, recordId, &_run);
+    if (_slot && _slot->state == slotForward) {
+        uint64_t _target;
+        if (_slot->length != FORWARD_SIZE || checksum((const char*)_run + _slot->offset, FORWARD_SIZE) != _slot->checksum) return false;
+        memcpy(&_target, _run + _slot->offset, sizeof(_target));
+        _slot = reader_slot(reader, &reader->moved, _target, &_run);
+        if (!_slot || _slot->state != slotMoved) return false;
+    } else if (!_slot || _slot->state != slotLive) {
+        return false;
+    }
+
+    const char* _record = (const char*)_run + _slot->offset;
+    if (checksum(_record, _slot->length) != _slot->checksum) return false;
+    *record = _record;
+    *length = _slot->length;
+    return true;
+}
+
+// Step to the next document of a file in collection order, page by page and slot by slot.
+// cursor starts at 0; recordId receives the id the document is addressed by.
+bool page_next(PageReader* reader, uint64_t* cursor, uint64_t* recordId, const char** record, size_t* length) {
+    uint64_t _position = *cursor ? *cursor : RECORD_ID(1, 0);
+
+    while (_position / COLLECTION_PAGE_SIZE < reader->pageCount) {
+        const uint64_t _page = _position / COLLECTION_PAGE_SIZE;
+
+        // Past the last slot of a page (or on a page that makes no sense) go on with the next one
+        const uint8_t* _run = reader_page(reader, &reader->home, (uint32_t)_page);
+        const PageHeader* _header = (const PageHeader*)_run;
+        const uint64_t _slot = (_position % COLLECTION_PAGE_SIZE - PAGE_START) / SLOT_SIZE;
+        if (!_header || _header->span == 0 || _header->slotCount > MAX_PAGE_SLOTS || _slot >= _header->slotCount) {
+            _position = RECORD_ID(_page + (_header && _header->span ? _header->span : 1), 0);
+            continue;
+        }
+
+        _position += SLOT_SIZE;
+        if (page_find(reader, _position - SLOT_SIZE, record, length)) {
+            *recordId = _position - SLOT_SIZE;
+            *cursor = _position;
+            return true;
+        }
+    }
+
+    *cursor = _position;
+    return false;
+}
+
+// Write documents into new pages after the header page of a file being written whole,
+// filling each page before starting the next
+bool page_write_all(FILE* file, const cJSON* data, char* error) {
+    ByteBuffer _document = { 0 };
+    PagePacker _packer = { file, NULL };
+    const cJSON* _item = NULL;
+    bool _status = start_packer(&_packer);
+
+    cJSON_ArrayForEach(_item, data) {
+        if (!_status) break;
+        _document.size = 0;
+        if (!encode_value(&_document, _item)) {
+            get_error(error, "fatal: Failed to encode document");
+            _status = false;
+            break;
+        }
+        _status = pack_record(&_packer, (const char*)_document.data, (uint32_t)_document.size);
+    }
+
+    _status = _status && pack_finish(&_packer);
+    if (!_status && error[0] == '\0') get_error(error, "fatal: Failed to write collection pages");
+    free(_document.data);
+    free(_packer.page);
+    return _status;
+}
+
+// Start changing a paged collection file. header receives the collection header, which the
+// caller updates and hands back to page_commit.
+PageWriter* page_begin(const char* fileName, CollectionHeader* header, char* error) {
+    PageWriter* _writer = calloc(1, sizeof(PageWriter));
+    FILE* _handle = fopen(fileName, "rb+");
+    if (_handle) setvbuf(_handle, NULL, _IONBF, 0);
+    if (!_writer || !_handle || fread(header, sizeof(*header), 1, _handle) != 1 ||
+        memcmp(header->magic, COLLECTION_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != COLLECTION_VERSION || header->pageSize != COLLECTION_PAGE_SIZE) {
+        get_error(error, "fatal: Could not open collection '%s' for writing", fileName);
+        if (_handle) fclose(_handle);
+        free(_writer);
+        return NULL;
+    }
+
+    fseek(_handle, 0, SEEK_END);
+    const uint32_t _pageCount = (uint32_t)(ftell(_handle) / COLLECTION_PAGE_SIZE);
+
+    AcquireSRWLockExclusive(&pagedLock);
+    PagedFile* _file = paged_file(fileName);
+    if (_file && _file->generation != header->generation) {
+        reset_paged(_file);
+        _file->generation = header->generation;
+    }
+    const bool _ready = _file && (_file->journalLoaded || load_journal(_file)) &&
+                        ((_file->mapped && _file->appliedLsn == header->appliedLsn && _file->pageCount == _pageCount) ||
+                         map_free_space(_file, header->appliedLsn, _pageCount));
+    ReleaseSRWLockExclusive(&pagedLock);
+
+    _writer->pool = pool_file(fileName);
+    if (!_ready || !_writer->pool) {
+        get_error(error, "fatal: Could not read the pages of collection '%s'", fileName);
+        fclose(_handle);
+        free(_writer);
+        return NULL;
+    }
+
+    _writer->file = _file;
+    _writer->handle = _handle;
+    _writer->basePages = _pageCount;
+    return _writer;
+}
+
+// Store a new document and return its record id. inOrder is cleared unless the document
+// landed after every document already in the file.
+bool page_insert(PageWriter* writer, const char* record, const size_t length, uint64_t* recordId, bool* inOrder) {
+    return length <= UINT32_MAX - COLLECTION_PAGE_SIZE &&
+           store_record(writer, record, (uint32_t)length, slotLive, 0, recordId, inOrder);
+}
+
+// Rewrite the document a record id addresses, in place whenever its page has room for it
+bool page_replace(PageWriter* writer, const uint64_t recordId, const char* record, const size_t length) {
+    uint32_t _page, _slot;
+    HeldPage* _held = split_record_id(recordId, &_page, &_slot) ? hold_page(writer, _page) : NULL;
+    if (!_held || _slot >= ((PageHeader*)_held->data)->slotCount || length > UINT32_MAX - COLLECTION_PAGE_SIZE) return false;
+
+    PageSlot* _entry = (PageSlot*)(_held->data + PAGE_START) + _slot;
+    if (_entry->state != slotLive && _entry->state != slotForward) return false;
+
+    // A document that moved before is rewritten where it lives now
+    HeldPage* _home = _held;
+    uint32_t _homeSlot = _slot;
+    if (_entry->state == slotForward) {
+        uint64_t _target;
+        memcpy(&_target, _held->data + _entry->offset, sizeof(_target));
+        _home = split_record_id(_target, &_page, &_homeSlot) ? hold_page(writer, _page) : NULL;
+        if (!_home || _home == _held || _homeSlot >= ((PageHeader*)_home->data)->slotCount) return false;
+    }
+
+    PageSlot* _current = (PageSlot*)(_home->data + PAGE_START) + _homeSlot;
+    const uint32_t _length = (uint32_t)length;
+    writer->changed = true;
+    _home->dirty = true;
+
+    if (record_space(_length) <= record_space(_current->length)) {
+        // No larger than before: overwrite the document where it is
+        PageHeader* _header = (PageHeader*)_home->data;
+        _header->usedBytes -= record_space(_current->length) - record_space(_length);
+        memcpy(_home->data + _current->offset, record, _length);
+        _current->length = _length;
+        _current->checksum = checksum(record, _length);
+    } else if (run_free(_home->data) + record_space(_current->length) >= record_space(_length)) {
+        // Still fits its page once the page is repacked
+        const uint32_t _state = _current->state;
+        release_record(_home->data, _homeSlot);
+        if (!place_record(_home->data, _homeSlot, record, _length, _state)) return false;
+    } else if (_home != _held && _held->span == 1 &&
+               run_free(_held->data) + record_space(_entry->length) >= record_space(_length)) {
+        // Outgrown the page it moved to but fits its own page again: bring it back home. The
+        // free-space map could offer that page for a new copy, and a forward must never point
+        // into the page it is in.
+        if (!remove_slot(writer, _home, _homeSlot)) return false;
+        release_record(_held->data, _slot);
+        if (!place_record(_held->data, _slot, record, _length, slotLive)) return false;
+        _held->dirty = true;
+    } else {
+        // Outgrown its page: store it elsewhere and point the original slot at it
+        uint64_t _moved;
+        bool _inOrder;
+        if (!store_record(writer, record, _length, slotMoved, _home->page, &_moved, &_inOrder)) return false;
+        if (_home != _held) {
+            // Re-fetch the slot; storing may have read pages into the writer, not moved held ones
+            if (!remove_slot(writer, _home, _homeSlot)) return false;
+            _entry = (PageSlot*)(_held->data + PAGE_START) + _slot;
+            memcpy(_held->data + _entry->offset, &_moved, sizeof(_moved));
+            _entry->checksum = checksum((const char*)&_moved, sizeof(_moved));
+        } else {
+            if (((PageHeader*)_held->data)->span > 1) {
+                if (!dissolve_run(writer, _held)) return false;
+            } else {
+                release_record(_held->data, _slot);
+            }
+            if (!place_record(_held->data, _slot, (const char*)&_moved, sizeof(_moved), slotForward)) return false;
+        }
+        _held->dirty = true;
+    }
+
+    if (_home->span == 1) set_free(writer->file, _home->page, run_free(_home->data));
+    if (_held->span == 1) set_free(writer->file, _held->page, run_free(_held->data));
+    return true;
+}
+
+// Remove the document a record id addresses, together with the copy it moved to
+bool page_delete(PageWriter* writer, const uint64_t recordId) {
+    uint32_t _page, _slot;
+    HeldPage* _held = split_record_id(recordId, &_page, &_slot) ? hold_page(writer, _page) : NULL;
+    if (!_held || _slot >= ((PageHeader*)_held->data)->slotCount) return false;
+
+    const PageSlot* _entry = (const PageSlot*)(_held->data + PAGE_START) + _slot;
+    if (_entry->state == slotForward) {
+        uint64_t _target;
+        uint32_t _targetSlot;
+        memcpy(&_target, _held->data + _entry->offset, sizeof(_target));
+        HeldPage* _home = split_record_id(_target, &_page, &_targetSlot) ? hold_page(writer, _page) : NULL;
+        if (!_home || _home == _held || _targetSlot >= ((PageHeader*)_home->data)->slotCount ||
+            !remove_slot(writer, _home, _targetSlot)) return false;
+    } else if (_entry->state != slotLive) {
+        return false;
+    }
+    return remove_slot(writer, _held, _slot);
+}
+
+// Save the journal, hand every changed page to the buffer pool and finally stamp the header
+// page, then free the writer. The header makes the applied LSN visible only once the pages
+// are written; a page the pool has no room for is written to the file straight away.
+bool page_commit(PageWriter* writer, const CollectionHeader* header, char* error) {
+    PagedFile* _file = writer->file;
+    qsort(writer->pages, writer->count, sizeof(HeldPage*), compare_held);
+
+    bool _status = journal_pages(writer);
+    for (uint32_t i = 0; _status && i < writer->count; i++) {
+        const HeldPage* _held = writer->pages[i];
+        if (!_held->dirty) continue;
+        for (uint32_t p = 0; _status && p < _held->span; p++) {
+            const uint8_t* _image = _held->data + (size_t)p * COLLECTION_PAGE_SIZE;
+            if (pool_put(writer->pool, _held->page + p, _image)) continue;
+            _status = fseek(writer->handle, (long)(_held->page + p) * COLLECTION_PAGE_SIZE, SEEK_SET) == 0 &&
+                      fwrite(_image, COLLECTION_PAGE_SIZE, 1, writer->handle) == 1;
+        }
+    }
+
+    // New pages belong to the file from now on, even while only the pool holds them
+    if (_status && _file->pageCount > writer->basePages) {
+        _status = _chsize_s(_fileno(writer->handle), (long long)_file->pageCount * COLLECTION_PAGE_SIZE) == 0;
+    }
+    _status = _status && fseek(writer->handle, 0, SEEK_SET) == 0 &&
+              fwrite(header, sizeof(*header), 1, writer->handle) == 1 && fflush(writer->handle) == 0;
+
+    // A write that failed halfway leaves pages the map can no longer describe
+    if (_status) {
+        _file->appliedLsn = header->appliedLsn;
+    } else {
+        _file->mapped = false;
+        get_error(error, "fatal: Failed to write collection '%s'", _file->fileName);
+    }
+    free_writer(writer);
+    return _status;
+}
+
+// Drop the changes of a writer that will not be committed
+void page_abort(PageWriter* writer) {
+    if (!writer) return;
+    if (writer->changed) writer->file->mapped = false;
+    free_writer(writer);
+}
+
+// Return a collection file to its state at the last checkpoint by copying back the pages
+// saved in its journal, then delete the journal and any unfinished compaction. A journal
+// taken from an earlier generation of the file, before it was rewritten whole, is only
+// deleted.
+bool page_rollback(const char* fileName, char* error) {
+    char _journalName[MAX_PATH_LEN + 8];
+    char _copyName[MAX_PATH_LEN + 8];
+
+    // A compaction cut short leaves its fresh file behind; the old one is still whole
+    snprintf(_copyName, sizeof(_copyName), "%s%s", fileName, COMPACT_SUFFIX);
+    remove(_copyName);
+
+    journal_name(_journalName, fileName);
+    FILE* _journal = fopen(_journalName, "rb");
+    if (!_journal) return true;
+
+    // Pages the pool still holds were changed after the checkpoint and go with the rest
+    page_invalidate(fileName);
+
+    JournalHeader _header;
+    CollectionHeader _collection;
+    FILE* _file = fopen(fileName, "rb+");
+    bool _status = true;
+
+    if (_file && fread(&_header, sizeof(_header), 1, _journal) == 1 &&
+        memcmp(_header.magic, JOURNAL_MAGIC, sizeof(_header.magic)) == 0 && _header.version == JOURNAL_VERSION &&
+        fread(&_collection, sizeof(_collection), 1, _file) == 1 && _collection.generation == _header.generation) {
+        const uint32_t _pages = (uint32_t)(_header.originalSize / COLLECTION_PAGE_SIZE);
+        uint8_t* _restored = calloc(_pages / 8 + 1, 1);
+        uint8_t* _image = malloc(COLLECTION_PAGE_SIZE);
+        JournalEntry _entry;
+        _status = _restored && _image;
+
+        // An entry cut short was never synced, so the page it was saving was never overwritten
+        while (_status && fread(&_entry, sizeof(_entry), 1, _journal) == 1 &&
+               fread(_image, COLLECTION_PAGE_SIZE, 1, _journal) == 1 &&
+               checksum((const char*)_image, COLLECTION_PAGE_SIZE) == _entry.checksum) {
+            if (_entry.page >= _pages || _restored[_entry.page / 8] & (1u << (_entry.page % 8))) continue;
+            _restored[_entry.page / 8] |= (uint8_t)(1u << (_entry.page % 8));
+            _status = fseek(_file, (long)_entry.page * COLLECTION_PAGE_SIZE, SEEK_SET) == 0 &&
+                      fwrite(_image, COLLECTION_PAGE_SIZE, 1, _file) == 1;
+        }
+
+        // Pages added since the checkpoint are cut off again
+        _status = _status && fflush(_file) == 0 && _chsize_s(_fileno(_file), (long long)_header.originalSize) == 0 &&
+                  _commit(_fileno(_file)) == 0;
+        free(_restored);
+        free(_image);
+    }
+
+    fclose(_journal);
+    if (_file) fclose(_file);
+    if (!_status) {
+        get_error(error, "fatal: Could not roll back collection '%s'", fileName);
+        return false;
+    }
+
+    remove(_journalName);
+    return true;
+}
+
+// Write back the pages the pool holds for a collection file, make the file durable and end
+// the checkpoint interval of its journal
+bool page_sync(const char* fileName, char* error) {
+    if (!pool_flush(fileName, error)) return false;
+    FILE* _file = fopen(fileName, "rb+");
+    if (!_file) return true;
+
+    const bool _synced = _commit(_fileno(_file)) == 0;
+    fclose(_file);
+    if (!_synced) {
+        get_error(error, "fatal: Could not sync collection '%s'", fileName);
+        return false;
+    }
+
+    char _journalName[MAX_PATH_LEN + 8];
+    journal_name(_journalName, fileName);
+    remove(_journalName);
+
+    AcquireSRWLockExclusive(&pagedLock);
+    for (PagedFile* _paged = pagedFiles; _paged; _paged = _paged->next) {
+        if (strcmp(_paged->fileName, fileName) != 0) continue;
+        free(_paged->saved);
+        _paged->saved = NULL;
+        _paged->journalPages = 0;
+    }
+    ReleaseSRWLockExclusive(&pagedLock);
+    return true;
+}
+
+// Forget the page state of a collection file, or of every file in a database directory,
+// that is being deleted or rewritten
+void page_invalidate(const char* path) {
+    const size_t _length = strlen(path);
+
+    AcquireSRWLockExclusive(&pagedLock);
+    PagedFile** _link = &pagedFiles;
+    while (*_link) {
+        PagedFile* _paged = *_link;
+        if (strncmp(_paged->fileName, path, _length) == 0 &&
+            (_paged->fileName[_length] == '\0' || _paged->fileName[_length] == '/' || _paged->fileName[_length] == '\\')) {
+            *_link = _paged->next;
+            reset_paged(_paged);
+            free(_paged);
+        } else {
+            _link = &_paged->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&pagedLock);
+    pool_discard(path);
+}
+
+// Free bytes in the data pages of a collection file, as far as its free-space map knows
+// them. False if the map is not loaded, that is if the file was not written since it was
+// last opened or rewritten.
+bool page_free_space(const char* fileName, uint64_t* freeBytes, uint64_t* dataBytes) {
+    bool _known = false;
+
+    AcquireSRWLockExclusive(&pagedLock);
+    for (PagedFile* _paged = pagedFiles; _paged; _paged = _paged->next) {
+        if (strcmp(_paged->fileName, fileName) != 0 || !_paged->mapped || _paged->pageCount < 2) continue;
+        *freeBytes = _paged->freeTotal;
+        *dataBytes = (uint64_t)(_paged->pageCount - 1) * COLLECTION_PAGE_SIZE;
+        _known = true;
+    }
+    ReleaseSRWLockExclusive(&pagedLock);
+    return _known;
+}
+
+// Start compacting a paged collection file into a fresh file next to it
+PageCopy* page_copy_begin(const char* fileName, char* error) {
+    static const uint8_t _blank[COLLECTION_PAGE_SIZE];
+    PageCopy* _copy = calloc(1, sizeof(PageCopy));
+    FILE* _file = _copy ? fopen(fileName, "rb") : NULL;
+    bool _status = _file && fread(&_copy->header, sizeof(_copy->header), 1, _file) == 1 &&
+                   memcmp(_copy->header.magic, COLLECTION_MAGIC, sizeof(_copy->header.magic)) == 0 &&
+                   _copy->header.version == COLLECTION_VERSION && _copy->header.pageSize == COLLECTION_PAGE_SIZE;
+    if (_file) fclose(_file);
+
+    // The header page is stamped last, once every document is in place
+    FILE* _temp = NULL;
+    if (_status) {
+        snprintf(_copy->fileName, sizeof(_copy->fileName), "%s", fileName);
+        snprintf(_copy->tempName, sizeof(_copy->tempName), "%s%s", fileName, COMPACT_SUFFIX);
+        _temp = fopen(_copy->tempName, "wb");
+        _status = _temp && start_packer(&_copy->packer) && fwrite(_blank, sizeof(_blank), 1, _temp) == 1;
+        if (_temp && fclose(_temp) != 0) _status = false;
+    }
+
+    if (!_status) {
+        get_error(error, "fatal: Could not start compacting collection '%s'", fileName);
+        if (_temp) remove(_copy->tempName);
+        free_copy(_copy);
+        return NULL;
+    }
+    return _copy;
+}
+
+// Copy the documents of the next pages of the file into the fresh one, in collection order.
+// done is set once every document is copied. Fails if the file changed since the copy began.
+bool page_copy_step(PageCopy* copy, const uint32_t pages, bool* done, char* error) {
+    *done = false;
+    if (!copy_current(copy)) {
+        get_error(error, "fatal: Collection '%s' changed while it was compacted", copy->fileName);
+        return false;
+    }
+
+    PageReader* _reader = page_open(copy->fileName);
+    copy->packer.file = _reader ? fopen(copy->tempName, "ab") : NULL;
+    bool _status = copy->packer.file != NULL;
+
+    // A document past the pages of this step is left for the next one
+    const uint64_t _stop = (copy->cursor ? copy->cursor / COLLECTION_PAGE_SIZE : 1) + pages;
+    uint64_t _cursor = copy->cursor, _next, _recordId;
+    const char* _record;
+    size_t _length;
+    while (_status) {
+        _next = _cursor;
+        if (!page_next(_reader, &_next, &_recordId, &_record, &_length)) {
+            *done = true;
+            break;
+        }
+        if (_recordId / COLLECTION_PAGE_SIZE >= _stop) {
+            _cursor = _recordId;
+            break;
+        }
+        _status = pack_record(&copy->packer, _record, (uint32_t)_length);
+        _cursor = _next;
+    }
+
+    if (copy->packer.file && fclose(copy->packer.file) != 0) _status = false;
+    copy->packer.file = NULL;
+    page_close(_reader);
+    if (!_status) {
+        get_error(error, "fatal: Failed to compact collection '%s'", copy->fileName);
+        return false;
+    }
+
+    copy->cursor = _cursor;
+    return true;
+}
+
+// Finish a copy and swap it in as the next generation of the file, then free the copy.
+// Must run under the exclusive database lock, so that no change slips in between the
+// last check of the file and the swap.
+bool page_copy_finish(PageCopy* copy, char* error) {
+    CollectionHeader _header = copy->header;
+    _header.generation++;
+
+    FILE* _temp = copy_current(copy) ? fopen(copy->tempName, "rb+") : NULL;
+    copy->packer.file = _temp;
+    bool _status = _temp && fseek(_temp, 0, SEEK_END) == 0 && pack_finish(&copy->packer) &&
+                   fseek(_temp, 0, SEEK_SET) == 0 && fwrite(&_header, sizeof(_header), 1, _temp) == 1 &&
+                   fflush(_temp) == 0 && _commit(_fileno(_temp)) == 0;
+    if (_temp && fclose(_temp) != 0) _status = false;
+
+    // Pages the pool holds for the old file must not be written back into the new one
+    _status = _status && pool_flush(copy->fileName, error) &&
+              MoveFileExA(copy->tempName, copy->fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!_status) {
+        get_error(error, "fatal: Failed to compact collection '%s'", copy->fileName);
+        page_copy_abort(copy);
+        return false;
+    }
+
+    // The journal of the previous generation can no longer be rolled back onto the file
+    char _journalName[MAX_PATH_LEN + 8];
+    journal_name(_journalName, copy->fileName);
+    remove(_journalName);
+    page_invalidate(copy->fileName);
+    free_copy(copy);
+    return true;
+}
+
+// Give up a copy, deleting the fresh file
+void page_copy_abort(PageCopy* copy) {
+    if (!copy) return;
+    remove(copy->tempName);
+    free_copy(copy);
+}
+
+// Place a record in the first page with room for it, or at the end of the file, and return
+// its record id. Documents too large for a page get a run of new pages of their own.
+bool store_record(PageWriter* writer, const char* record, const uint32_t length, const uint32_t state, const uint32_t exclude, uint64_t* recordId, bool* inOrder) {
+    PagedFile* _file = writer->file;
+    writer->changed = true;
+
+    if (length > MAX_PAGE_RECORD) {
+        const uint32_t _span = (PAGE_START + SLOT_SIZE + length + COLLECTION_PAGE_SIZE - 1) / COLLECTION_PAGE_SIZE;
+        HeldPage* _run = new_run(writer, _span);
+        if (!_run || !place_record(_run->data, 0, record, length, state)) return false;
+        *recordId = RECORD_ID(_run->page, 0);
+        return true;
+    }
+
+    const uint32_t _page = find_free_page(_file, record_space(length) + SLOT_SIZE, exclude);
+    HeldPage* _held = _page ? hold_page(writer, _page) : new_run(writer, 1);
+    if (!_held) return false;
+
+    // Reuse a free slot before growing the directory
+    PageHeader* _header = (PageHeader*)_held->data;
+    const PageSlot* _slots = (const PageSlot*)(_held->data + PAGE_START);
+    uint32_t _slot = 0;
+    while (_slot < _header->slotCount && _slots[_slot].state != slotFree) _slot++;
+    if (_held->page != _file->tailPage || _slot < _header->slotCount) *inOrder = false;
+
+    if (!place_record(_held->data, _slot, record, length, state)) return false;
+    _held->dirty = true;
+    set_free(_file, _held->page, run_free(_held->data));
+    *recordId = RECORD_ID(_held->page, _slot);
+    return true;
+}
+
+// Free a slot of a held page, breaking up a run of pages once its document is gone
+bool remove_slot(PageWriter* writer, HeldPage* held, const uint32_t slot) {
+    writer->changed = true;
+    held->dirty = true;
+    if (held->span > 1) return dissolve_run(writer, held);
+
+    release_record(held->data, slot);
+    trim_slots(held->data);
+    set_free(writer->file, held->page, run_free(held->data));
+    return true;
+}
+
+// Turn a run of pages into as many empty pages
+bool dissolve_run(PageWriter* writer, HeldPage* held) {
+    PagedFile* _file = writer->file;
+    const PageHeader _empty = { 1, 0, COLLECTION_PAGE_SIZE, 0 };
+    const uint32_t _span = held->span;
+
+    for (uint32_t i = 1; i < _span; i++) {
+        uint8_t* _data = calloc(1, COLLECTION_PAGE_SIZE);
+        HeldPage* _added = _data ? add_held(writer, held->page + i, 1, _data) : NULL;
+        if (!_added) {
+            free(_data);
+            return false;
+        }
+        memcpy(_data, &_empty, sizeof(_empty));
+        _added->dirty = true;
+        set_free(_file, held->page + i, COLLECTION_PAGE_SIZE - PAGE_START);
+    }
+
+    memset(held->data, 0, COLLECTION_PAGE_SIZE);
+    memcpy(held->data, &_empty, sizeof(_empty));
+    held->span = 1;
+    held->dirty = true;
+    set_free(_file, held->page, COLLECTION_PAGE_SIZE - PAGE_START);
+    if (held->page + _span == _file->pageCount) _file->tailPage = _file->pageCount - 1;
+    return true;
+}
+
+// Read a page (with the rest of its run) into the writer, unless it already holds it
+HeldPage* hold_page(PageWriter* writer, const uint32_t page) {
+    if (page == 0 || page >= writer->file->pageCount) return NULL;
+    if (writer->tableSize) {
+        const uint32_t _mask = writer->tableSize - 1;
+        for (uint32_t i = (page * 2654435761u) & _mask; writer->table[i]; i = (i + 1) & _mask) {
+            HeldPage* _held = writer->pages[writer->table[i] - 1];
+            if (_held->page == page) return _held;
+        }
+    }
+
+    PageHeader _header;
+    const uint8_t* _page;
+    PoolFrame* _frame = pool_pin(writer->pool, writer->handle, page, &_page);
+    if (!_frame) return NULL;
+    memcpy(&_header, _page, sizeof(_header));
+    uint8_t* _data = NULL;
+    if (_header.span != 0 && _header.span <= writer->file->pageCount - page && _header.slotCount <= MAX_PAGE_SLOTS &&
+        _header.recordStart <= _header.span * COLLECTION_PAGE_SIZE &&
+        PAGE_START + _header.slotCount * SLOT_SIZE + _header.usedBytes <= _header.span * COLLECTION_PAGE_SIZE) {
+        _data = malloc((size_t)_header.span * COLLECTION_PAGE_SIZE);
+    }
+    if (_data) memcpy(_data, _page, COLLECTION_PAGE_SIZE);
+    pool_unpin(_frame);
+
+    // The rest of a run is copied page by page behind its first page
+    for (uint32_t p = 1; _data && p < _header.span; p++) {
+        if (!(_frame = pool_pin(writer->pool, writer->handle, page + p, &_page))) {
+            free(_data);
+            return NULL;
+        }
+        memcpy(_data + (size_t)p * COLLECTION_PAGE_SIZE, _page, COLLECTION_PAGE_SIZE);
+        pool_unpin(_frame);
+    }
+    if (!_data) return NULL;
+
+    HeldPage* _held = add_held(writer, page, _header.span, _data);
+    if (!_held) free(_data);
+    return _held;
+}
+
+// Add a run of empty pages at the end of the file
+HeldPage* new_run(PageWriter* writer, const uint32_t span) {
+    PagedFile* _file = writer->file;
+    const uint32_t _page = _file->pageCount;
+    uint8_t* _data = calloc(span, COLLECTION_PAGE_SIZE);
+    if (!_data || _page > UINT32_MAX - span || !allocate_map(_file, _page + span)) {
+        free(_data);
+        return NULL;
+    }
+
+    HeldPage* _held = add_held(writer, _page, span, _data);
+    if (!_held) {
+        free(_data);
+        return NULL;
+    }
+
+    const PageHeader _header = { span, 0, span * COLLECTION_PAGE_SIZE, 0 };
+    memcpy(_data, &_header, sizeof(_header));
+    _held->dirty = true;
+    _file->pageCount += span;
+    _file->tailPage = _page;
+    for (uint32_t i = 0; i < span; i++) set_free(_file, _page + i, span == 1 ? COLLECTION_PAGE_SIZE - PAGE_START : 0);
+    return _held;
+}
+
+// Track a page read into or created by a writer, in a table keyed by page number
+HeldPage* add_held(PageWriter* writer, const uint32_t page, const uint32_t span, uint8_t* data) {
+    if (writer->count == writer->capacity) {
+        const uint32_t _capacity = writer->capacity ? writer->capacity * 2 : 16;
+        HeldPage** _grown = realloc(writer->pages, _capacity * sizeof(HeldPage*));
+        if (!_grown) return NULL;
+        writer->pages = _grown;
+        writer->capacity = _capacity;
+    }
+
+    if ((writer->count + 1) * 2 > writer->tableSize) {
+        const uint32_t _size = writer->tableSize ? writer->tableSize * 2 : 64;
+        uint32_t* _table = calloc(_size, sizeof(uint32_t));
+        if (!_table) return NULL;
+        for (uint32_t i = 0; i < writer->count; i++) {
+            uint32_t j = (writer->pages[i]->page * 2654435761u) & (_size - 1);
+            while (_table[j]) j = (j + 1) & (_size - 1);
+            _table[j] = i + 1;
+        }
+        free(writer->table);
+        writer->table = _table;
+        writer->tableSize = _size;
+    }
+
+    HeldPage* _held = calloc(1, sizeof(HeldPage));
+    if (!_held) return NULL;
+    _held->page = page;
+    _held->span = span;
+    _held->data = data;
+
+    uint32_t i = (page * 2654435761u) & (writer->tableSize - 1);
+    while (writer->table[i]) i = (i + 1) & (writer->tableSize - 1);
+    writer->pages[writer->count++] = _held;
+    writer->table[i] = writer->count;
+    return _held;
+}
+
+// Save the checkpoint-time image of every page the writer is about to overwrite for the first
+// time since the checkpoint, and make the journal durable before any of them is touched.
+// Pages added after the checkpoint need no image; rolling back cuts them off.
+bool journal_pages(PageWriter* writer) {
+    PagedFile* _file = writer->file;
+    const bool _created = _file->journalPages == 0;
+    const uint32_t _pages = _created ? writer->basePages : _file->journalPages;
+    size_t _dirtyPages = 1;
+    for (uint32_t i = 0; i < writer->count; i++) {
+        if (writer->pages[i]->dirty) _dirtyPages += writer->pages[i]->span;
+    }
+    uint32_t* _pending = malloc(_dirtyPages * sizeof(uint32_t));
+    uint32_t _count = 0;
+    if (!_pending) return false;
+
+    // The header page is always rewritten; held pages come sorted by page number
+    _pending[_count++] = 0;
+    for (uint32_t i = 0; i < writer->count; i++) {
+        const HeldPage* _held = writer->pages[i];
+        if (!_held->dirty) continue;
+        for (uint32_t p = _held->page; p < _held->page + _held->span && p < _pages; p++) _pending[_count++] = p;
+    }
+    if (!_created) {
+        uint32_t _kept = 0;
+        for (uint32_t i = 0; i < _count; i++) {
+            if (!(_file->saved[_pending[i] / 8] & (1u << (_pending[i] % 8)))) _pending[_kept++] = _pending[i];
+        }
+        _count = _kept;
+    }
+    if (_count == 0) {
+        free(_pending);
+        return true;
+    }
+
+    char _journalName[MAX_PATH_LEN + 8];
+    journal_name(_journalName, _file->fileName);
+    uint8_t* _saved = _created ? calloc(_pages / 8 + 1, 1) : _file->saved;
+    uint8_t* _image = malloc(COLLECTION_PAGE_SIZE);
+    FILE* _journal = _saved && _image ? fopen(_journalName, _created ? "wb" : "ab") : NULL;
+    bool _status = _journal != NULL;
+
+    if (_status && _created) {
+        const JournalHeader _header = { JOURNAL_MAGIC, JOURNAL_VERSION, _file->generation, (uint64_t)_pages * COLLECTION_PAGE_SIZE };
+        _status = fwrite(&_header, sizeof(_header), 1, _journal) == 1;
+    }
+    for (uint32_t i = 0; _status && i < _count; i++) {
+        _status = fseek(writer->handle, (long)_pending[i] * COLLECTION_PAGE_SIZE, SEEK_SET) == 0 &&
+                  fread(_image, COLLECTION_PAGE_SIZE, 1, writer->handle) == 1;
+        const JournalEntry _entry = { _pending[i], _status ? checksum((const char*)_image, COLLECTION_PAGE_SIZE) : 0 };
+        _status = _status && fwrite(&_entry, sizeof(_entry), 1, _journal) == 1 &&
+                  fwrite(_image, COLLECTION_PAGE_SIZE, 1, _journal) == 1;
+    }
+    _status = _status && fflush(_journal) == 0 && _commit(_fileno(_journal)) == 0;
+    if (_journal && fclose(_journal) != 0) _status = false;
+
+    if (_status) {
+        for (uint32_t i = 0; i < _count; i++) _saved[_pending[i] / 8] |= (uint8_t)(1u << (_pending[i] % 8));
+        _file->saved = _saved;
+        _file->journalPages = _pages;
+    } else if (_created) {
+        free(_saved);
+        remove(_journalName);
+    }
+    free(_image);
+    free(_pending);
+    return _status;
+}
+
+// Pick up the journal an earlier writer left in this checkpoint interval. A journal of
+// another generation of the file is stale and deleted; an entry cut short is cut off.
+bool load_journal(PagedFile* file) {
+    char _journalName[MAX_PATH_LEN + 8];
+    journal_name(_journalName, file->fileName);
+    free(file->saved);
+    file->saved = NULL;
+    file->journalPages = 0;
+    file->journalLoaded = true;
+
+    FILE* _journal = fopen(_journalName, "rb+");
+    if (!_journal) return true;
+
+    JournalHeader _header;
+    if (fread(&_header, sizeof(_header), 1, _journal) != 1 || memcmp(_header.magic, JOURNAL_MAGIC, sizeof(_header.magic)) != 0 ||
+        _header.version != JOURNAL_VERSION || _header.generation != file->generation) {
+        fclose(_journal);
+        remove(_journalName);
+        return true;
+    }
+
+    const uint32_t _pages = (uint32_t)(_header.originalSize / COLLECTION_PAGE_SIZE);
+    uint8_t* _image = malloc(COLLECTION_PAGE_SIZE);
+    file->saved = calloc(_pages / 8 + 1, 1);
+    if (!_image || !file->saved) {
+        free(_image);
+        fclose(_journal);
+        file->journalLoaded = false;
+        return false;
+    }
+
+    long _valid = (long)sizeof(_header);
+    JournalEntry _entry;
+    while (fread(&_entry, sizeof(_entry), 1, _journal) == 1 && fread(_image, COLLECTION_PAGE_SIZE, 1, _journal) == 1 &&
+           checksum((const char*)_image, COLLECTION_PAGE_SIZE) == _entry.checksum) {
+        if (_entry.page < _pages) file->saved[_entry.page / 8] |= (uint8_t)(1u << (_entry.page % 8));
+        _valid += (long)(sizeof(_entry) + COLLECTION_PAGE_SIZE);
+    }
+
+    fflush(_journal);
+    const bool _status = _chsize_s(_fileno(_journal), _valid) == 0;
+    fclose(_journal);
+    free(_image);
+    file->journalPages = _pages;
+    file->journalLoaded = _status;
+    return _status;
+}
+
+// Rebuild the free-space map from the page headers of the file
+bool map_free_space(PagedFile* file, const uint64_t appliedLsn, const uint32_t pageCount) {
+    PageReader* _reader = page_open(file->fileName);
+    if (!_reader) return false;
+    if (!allocate_map(file, pageCount)) {
+        page_close(_reader);
+        return false;
+    }
+
+    memset(file->freeBytes, 0, file->capacity * sizeof(uint16_t));
+    memset(file->blockFree, 0, file->capacity / FREE_MAP_FANOUT * sizeof(uint16_t));
+    memset(file->groupFree, 0, file->capacity / FREE_MAP_FANOUT / FREE_MAP_FANOUT * sizeof(uint16_t));
+    file->pageCount = pageCount;
+    file->tailPage = 0;
+    file->freeTotal = 0;
+
+    // A page whose header makes no sense is left out of the map and never written to
+    for (uint32_t p = 1; p < pageCount;) {
+        const uint8_t* _run = reader_page(_reader, &_reader->home, p);
+        const PageHeader* _header = (const PageHeader*)_run;
+        if (!_header || _header->span == 0 || _header->span > pageCount - p || _header->slotCount > MAX_PAGE_SLOTS ||
+            PAGE_START + _header->slotCount * SLOT_SIZE + _header->usedBytes > _header->span * COLLECTION_PAGE_SIZE) {
+            p++;
+            continue;
+        }
+        if (_header->span == 1) set_free(file, p, run_free(_run));
+        file->tailPage = p;
+        p += _header->span;
+    }
+
+    page_close(_reader);
+    file->appliedLsn = appliedLsn;
+    file->mapped = true;
+    return true;
+}
+
+// Make room in the free-space map for pageCount pages; new pages start out full
+bool allocate_map(PagedFile* file, const uint32_t pageCount) {
+    if (pageCount <= file->capacity) return true;
+
+    const uint32_t _unit = FREE_MAP_FANOUT * FREE_MAP_FANOUT;
+    uint32_t _capacity = file->capacity ? file->capacity : _unit;
+    while (_capacity < pageCount) _capacity *= 2;
+
+    uint16_t* _freeBytes = realloc(file->freeBytes, _capacity * sizeof(uint16_t));
+    if (_freeBytes) file->freeBytes = _freeBytes;
+    uint16_t* _blockFree = realloc(file->blockFree, _capacity / FREE_MAP_FANOUT * sizeof(uint16_t));
+    if (_blockFree) file->blockFree = _blockFree;
+    uint16_t* _groupFree = realloc(file->groupFree, _capacity / _unit * sizeof(uint16_t));
+    if (_groupFree) file->groupFree = _groupFree;
+    if (!_freeBytes || !_blockFree || !_groupFree) return false;
+
+    memset(file->freeBytes + file->capacity, 0, (_capacity - file->capacity) * sizeof(uint16_t));
+    memset(file->blockFree + file->capacity / FREE_MAP_FANOUT, 0, (_capacity - file->capacity) / FREE_MAP_FANOUT * sizeof(uint16_t));
+    memset(file->groupFree + file->capacity / _unit, 0, (_capacity - file->capacity) / _unit * sizeof(uint16_t));
+    file->capacity = _capacity;
+    return true;
+}
+
+// Record the free bytes of a page and refresh the block and group maxima above it
+void set_free(PagedFile* file, const uint32_t page, const uint32_t bytes) {
+    file->freeTotal += (uint64_t)bytes - file->freeBytes[page];
+    file->freeBytes[page] = (uint16_t)bytes;
+
+    const uint32_t _block = page / FREE_MAP_FANOUT;
+    uint16_t _most = 0;
+    for (uint32_t i = _block * FREE_MAP_FANOUT; i < (_block + 1) * FREE_MAP_FANOUT; i++) {
+        if (file->freeBytes[i] > _most) _most = file->freeBytes[i];
+    }
+    file->blockFree[_block] = _most;
+
+    const uint32_t _group = _block / FREE_MAP_FANOUT;
+    _most = 0;
+    for (uint32_t i = _group * FREE_MAP_FANOUT; i < (_group + 1) * FREE_MAP_FANOUT; i++) {
+        if (file->blockFree[i] > _most) _most = file->blockFree[i];
+    }
+    file->groupFree[_group] = _most;
+}
+
+// First page other than exclude with at least needed free bytes, or 0 if there is none
+uint32_t find_free_page(const PagedFile* file, const uint32_t needed, const uint32_t exclude) {
+    const uint32_t _groups = (file->pageCount + FREE_MAP_FANOUT * FREE_MAP_FANOUT - 1) / (FREE_MAP_FANOUT * FREE_MAP_FANOUT);
+
+    for (uint32_t g = 0; g < _groups; g++) {
+        if (file->groupFree[g] < needed) continue;
+        for (uint32_t b = g * FREE_MAP_FANOUT; b < (g + 1) * FREE_MAP_FANOUT; b++) {
+            if (file->blockFree[b] < needed) continue;
+            for (uint32_t p = b * FREE_MAP_FANOUT; p < (b + 1) * FREE_MAP_FANOUT && p < file->pageCount; p++) {
+                if (p != exclude && file->freeBytes[p] >= needed) return p;
+            }
+        }
+    }
+    return 0;
+}
+
+// Put a record into a slot of a page with room for it; slot slotCount adds a slot
+bool place_record(uint8_t* run, const uint32_t slot, const char* record, const uint32_t length, const uint32_t state) {
+    PageHeader* _header = (PageHeader*)run;
+    PageSlot* _slots = (PageSlot*)(run + PAGE_START);
+    const uint32_t _space = record_space(length);
+    const uint32_t _slotCount = slot == _header->slotCount ? _header->slotCount + 1 : _header->slotCount;
+
+    // Repack before a new slot grows the directory over the lowest record
+    if (_slotCount > MAX_PAGE_SLOTS) return false;
+    if (_header->recordStart < PAGE_START + _slotCount * SLOT_SIZE + _space && !repack_page(run)) return false;
+    if (_header->recordStart < PAGE_START + _slotCount * SLOT_SIZE + _space) return false;
+
+    _header->slotCount = _slotCount;
+    _header->recordStart -= _space;
+    memcpy(run + _header->recordStart, record, length);
+    memset(run + _header->recordStart + length, 0, _space - length);
+    _slots[slot] = (PageSlot){ _header->recordStart, length, checksum(record, length), state };
+    _header->usedBytes += _space;
+    return true;
+}
+
+// Mark a slot free; its bytes are reclaimed when the page is next repacked
+void release_record(uint8_t* run, const uint32_t slot) {
+    PageHeader* _header = (PageHeader*)run;
+    PageSlot* _slots = (PageSlot*)(run + PAGE_START);
+    _header->usedBytes -= record_space(_slots[slot].length);
+    _slots[slot] = (PageSlot){ 0, 0, 0, slotFree };
+    if (_header->usedBytes == 0) _header->recordStart = _header->span * COLLECTION_PAGE_SIZE;
+}
+
+// Drop free slots from the end of the directory; no record id points at them
+void trim_slots(uint8_t* run) {
+    PageHeader* _header = (PageHeader*)run;
+    const PageSlot* _slots = (const PageSlot*)(run + PAGE_START);
+    while (_header->slotCount > 0 && _slots[_header->slotCount - 1].state == slotFree) _header->slotCount--;
+}
+
+// Move the records of a page together at its end, so that its free space is in one piece
+bool repack_page(uint8_t* run) {
+    PageHeader* _header = (PageHeader*)run;
+    PageSlot* _slots = (PageSlot*)(run + PAGE_START);
+    const uint32_t _size = _header->span * COLLECTION_PAGE_SIZE;
+    uint8_t* _copy = malloc(_size);
+    if (!_copy) return false;
+    memcpy(_copy, run, _size);
+
+    uint32_t _end = _size;
+    for (uint32_t i = 0; i < _header->slotCount; i++) {
+        if (_slots[i].state == slotFree) continue;
+        const uint32_t _space = record_space(_slots[i].length);
+        _end -= _space;
+        memcpy(run + _end, _copy + _slots[i].offset, _space);
+        _slots[i].offset = _end;
+    }
+
+    _header->recordStart = _end;
+    free(_copy);
+    return true;
+}
+
+// Start the first page of a packer
+bool start_packer(PagePacker* packer) {
+    const PageHeader _empty = { 1, 0, COLLECTION_PAGE_SIZE, 0 };
+    if (!(packer->page = calloc(1, COLLECTION_PAGE_SIZE))) return false;
+    memcpy(packer->page, &_empty, sizeof(_empty));
+    return true;
+}
+
+// Add a document to the page being filled, writing the page out first once it is full.
+// A document larger than a page gets a run of pages to itself.
+bool pack_record(PagePacker* packer, const char* record, const uint32_t length) {
+    const PageHeader _empty = { 1, 0, COLLECTION_PAGE_SIZE, 0 };
+    const bool _large = length > MAX_PAGE_RECORD;
+    if (((const PageHeader*)packer->page)->slotCount > 0 && (_large || run_free(packer->page) < record_space(length) + SLOT_SIZE)) {
+        if (fwrite(packer->page, COLLECTION_PAGE_SIZE, 1, packer->file) != 1) return false;
+        memset(packer->page, 0, COLLECTION_PAGE_SIZE);
+        memcpy(packer->page, &_empty, sizeof(_empty));
+    }
+    if (!_large) return place_record(packer->page, ((const PageHeader*)packer->page)->slotCount, record, length, slotLive);
+
+    const uint32_t _span = (PAGE_START + SLOT_SIZE + length + COLLECTION_PAGE_SIZE - 1) / COLLECTION_PAGE_SIZE;
+    uint8_t* _run = calloc(_span, COLLECTION_PAGE_SIZE);
+    const PageHeader _runHeader = { _span, 0, _span * COLLECTION_PAGE_SIZE, 0 };
+    if (_run) memcpy(_run, &_runHeader, sizeof(_runHeader));
+    const bool _status = _run && place_record(_run, 0, record, length, slotLive) &&
+                         fwrite(_run, COLLECTION_PAGE_SIZE, _span, packer->file) == _span;
+    free(_run);
+    return _status;
+}
+
+// Write out the page being filled, unless it is still empty
+bool pack_finish(PagePacker* packer) {
+    if (((const PageHeader*)packer->page)->slotCount == 0) return true;
+    return fwrite(packer->page, COLLECTION_PAGE_SIZE, 1, packer->file) == 1;
+}
+
+// Bytes a record takes up in its page. Every record leaves room for a forward, so that a
+// document that has to move can always leave one behind in its place.
+uint32_t record_space(const uint32_t length) {
+    return length > FORWARD_SIZE ? length : FORWARD_SIZE;
+}
+
+// Free bytes of a page, whether in one piece or scattered between its records
+uint32_t run_free(const uint8_t* run) {
+    const PageHeader* _header = (const PageHeader*)run;
+    return _header->span * COLLECTION_PAGE_SIZE - PAGE_START - _header->slotCount * SLOT_SIZE - _header->usedBytes;
+}
+
+// Locate the slot a record id names, checking the page around it
+const PageSlot* reader_slot(PageReader* reader, ReaderPlace* place, const uint64_t recordId, const uint8_t** run) {
+    uint32_t _page, _slot;
+    const uint8_t* _run = split_record_id(recordId, &_page, &_slot) ? reader_page(reader, place, _page) : NULL;
+    if (!_run) return NULL;
+
+    const PageHeader* _header = (const PageHeader*)_run;
+    if (_header->span == 0 || _header->span > reader->pageCount - _page ||
+        _header->slotCount > MAX_PAGE_SLOTS || _slot >= _header->slotCount) return NULL;
+
+    const PageSlot* _entry = (const PageSlot*)(_run + PAGE_START) + _slot;
+    if ((uint64_t)_entry->offset + _entry->length > (uint64_t)_header->span * COLLECTION_PAGE_SIZE) return NULL;
+    *run = _run;
+    return _entry;
+}
+
+// Bring a page into a place of a reader, unless it is already there. The pages of a run
+// are copied out of the pool together, so that their document can be read in one piece.
+const uint8_t* reader_page(PageReader* reader, ReaderPlace* place, const uint32_t page) {
+    if (place->data && place->page == page) return place->data;
+    release_place(place);
+    if (page == 0 || page >= reader->pageCount) return NULL;
+
+    const uint8_t* _data;
+    PoolFrame* _frame = pool_pin(reader->pool, reader->handle, page, &_data);
+    if (!_frame) return NULL;
+
+    // A span that does not fit the file is left for the caller to reject
+    const uint32_t _span = ((const PageHeader*)_data)->span;
+    if (_span <= 1 || _span > reader->pageCount - page) {
+        place->page = page;
+        place->frame = _frame;
+        place->data = _data;
+        return _data;
+    }
+
+    const size_t _size = (size_t)_span * COLLECTION_PAGE_SIZE;
+    if (_size > place->runCapacity) {
+        uint8_t* _grown = realloc(place->run, _size);
+        if (!_grown) {
+            pool_unpin(_frame);
+            return NULL;
+        }
+        place->run = _grown;
+        place->runCapacity = _size;
+    }
+
+    memcpy(place->run, _data, COLLECTION_PAGE_SIZE);
+    pool_unpin(_frame);
+    for (uint32_t i = 1; i < _span; i++) {
+        if (!(_frame = pool_pin(reader->pool, reader->handle, page + i, &_data))) return NULL;
+        memcpy(place->run + (size_t)i * COLLECTION_PAGE_SIZE, _data, COLLECTION_PAGE_SIZE);
+        pool_unpin(_frame);
+    }
+
+    place->page = page;
+    place->data = place->run;
+    return place->data;
+}
+
+void release_place(ReaderPlace* place) {
+    pool_unpin(place->frame);
+    place->frame = NULL;
+    place->data = NULL;
+}
+
+// Page and slot a record id names; false if it cannot name a slot
+bool split_record_id(const uint64_t recordId, uint32_t* page, uint32_t* slot) {
+    const uint64_t _page = recordId / COLLECTION_PAGE_SIZE;
+    const uint64_t _offset = recordId % COLLECTION_PAGE_SIZE;
+    if (_page == 0 || _page > UINT32_MAX || _offset < PAGE_START || (_offset - PAGE_START) % SLOT_SIZE != 0) return false;
+
+    *page = (uint32_t)_page;
+    *slot = (uint32_t)((_offset - PAGE_START) / SLOT_SIZE);
+    return true;
+}
+
+// Find or register the page state of a file. pagedLock must be held.
+PagedFile* paged_file(const char* fileName) {
+    for (PagedFile* _paged = pagedFiles; _paged; _paged = _paged->next) {
+        if (strcmp(_paged->fileName, fileName) == 0) return _paged;
+    }
+
+    PagedFile* _paged = calloc(1, sizeof(PagedFile));
+    if (!_paged) return NULL;
+    snprintf(_paged->fileName, sizeof(_paged->fileName), "%s", fileName);
+    _paged->next = pagedFiles;
+    pagedFiles = _paged;
+    return _paged;
+}
+
+// Forget everything known about a file's pages and journal
+void reset_paged(PagedFile* file) {
+    free(file->freeBytes);
+    free(file->blockFree);
+    free(file->groupFree);
+    free(file->saved);
+    file->freeBytes = file->blockFree = file->groupFree = NULL;
+    file->saved = NULL;
+    file->capacity = file->pageCount = file->tailPage = file->journalPages = 0;
+    file->freeTotal = 0;
+    file->mapped = file->journalLoaded = false;
+}
+
+// Whether a file is still the one a copy started from, with no change applied to it since
+bool copy_current(const PageCopy* copy) {
+    CollectionHeader _header;
+    FILE* _file = fopen(copy->fileName, "rb");
+    const bool _current = _file && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                          _header.generation == copy->header.generation && _header.appliedLsn == copy->header.appliedLsn;
+    if (_file) fclose(_file);
+    return _current;
+}
+
+void free_copy(PageCopy* copy) {
+    if (!copy) return;
+    free(copy->packer.page);
+    free(copy);
+}
+
+void free_writer(PageWriter* writer) {
+    if (writer->handle) fclose(writer->handle);
+    for (uint32_t i = 0; i < writer->count; i++) {
+        free(writer->pages[i]->data);
+        free(writer->pages[i]);
+    }
+    free(writer->pages);
+    free(writer->table);
+    free(writer);
+}
+
+int compare_held(const void* left, const void* right) {
+    const uint32_t _left = (*(HeldPage* const*)left)->page, _right = (*(HeldPage* const*)right)->page;
+    return (_left > _right) - (_left < _right);
+}
+
+void journal_name(char* array, const char* fileName) {
+    snprintf(array, MAX_PATH_LEN + 8, "%s%s", fileName, JOURNAL_SUFFIX);
+}
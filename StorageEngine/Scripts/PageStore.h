@@ -0,0 +1,78 @@
+#ifndef PAGE_STORE_H
+#define PAGE_STORE_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define COLLECTION_PAGE_SIZE 4096
+#define JOURNAL_MAGIC "PDBJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_SUFFIX ".jnl"
+#define COMPACT_SUFFIX ".cmp"
+
+// State of a slot. A document that outgrows its page moves elsewhere and leaves a forward
+// slot holding its new record id; the moved copy is only ever reached through the forward,
+// so the document keeps its record id and its place in collection order.
+typedef enum {
+    slotFree,
+    slotLive,
+    slotForward,
+    slotMoved
+} SlotState;
+
+// Start of every data page. Slots grow from the front and records from the back of the page.
+// A run of several pages (span > 1) holds a single document too large for one page.
+typedef struct {
+    uint32_t span;
+    uint32_t slotCount;
+    uint32_t recordStart;
+    uint32_t usedBytes;
+} PageHeader;
+
+// Slot directory entry; the offset is relative to the start of the page
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t checksum;
+    uint32_t state;
+} PageSlot;
+
+// Header of a rollback journal, followed by the pages it saved
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t generation;
+    uint64_t originalSize;
+} JournalHeader;
+
+// Precedes the image of each saved page in a journal
+typedef struct {
+    uint32_t page;
+    uint32_t checksum;
+} JournalEntry;
+
+typedef struct PageCopy PageCopy;
+typedef struct PageReader PageReader;
+typedef struct PageWriter PageWriter;
+
+void page_abort(PageWriter* writer);
+PageWriter* page_begin(const char* fileName, CollectionHeader* header, char* error);
+void page_close(PageReader* reader);
+bool page_commit(PageWriter* writer, const CollectionHeader* header, char* error);
+void page_copy_abort(PageCopy* copy);
+PageCopy* page_copy_begin(const char* fileName, char* error);
+bool page_copy_finish(PageCopy* copy, char* error);
+bool page_copy_step(PageCopy* copy, uint32_t pages, bool* done, char* error);
+bool page_delete(PageWriter* writer, uint64_t recordId);
+bool page_find(PageReader* reader, uint64_t recordId, const char** record, size_t* length);
+bool page_free_space(const char* fileName, uint64_t* freeBytes, uint64_t* dataBytes);
+bool page_insert(PageWriter* writer, const char* record, size_t length, uint64_t* recordId, bool* inOrder);
+void page_invalidate(const char* path);
+bool page_next(PageReader* reader, uint64_t* cursor, uint64_t* recordId, const char** record, size_t* length);
+PageReader* page_open(const char* fileName);
+bool page_replace(PageWriter* writer, uint64_t recordId, const char* record, size_t length);
+bool page_rollback(const char* fileName, char* error);
+bool page_sync(const char* fileName, char* error);
+bool page_write_all(FILE* file, const cJSON* data, char* error);
+
+#endif //PAGE_STORE_H
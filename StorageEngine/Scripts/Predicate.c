@@ -0,0 +1,333 @@
+// Include standard and platform headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Predicate.h"
+
+// Filters of every scan path (resident trees, mapped logs, pages and LSM runs) go through the
+// predicate compiled here. A query filters on its key, value and condition, or on a filter
+// tree given as JSON:
+//     {"key": "address.city", "condition": 4, "value": "Paris"}
+//     {"and": [<filter>, ...]}, {"or": [<filter>, ...]}, {"not": <filter>}
+// Keys are dotted paths through nested objects. Non-equal conditions only match numbers;
+// equality also matches a string spelling the value and a boolean spelling "true" or
+// "false". Numbers compare against the value as atof reads it.
+
+// Local helper functions
+bool compile_filter(const cJSON* filter, Predicate* predicate, int depth, char* error);
+bool compile_match(const char* key, const char* value, Condition condition, Predicate* predicate, char* error);
+bool compile_terms(const cJSON* terms, PredicateKind kind, Predicate* predicate, int depth, char* error);
+bool is_related(double value1, double value2, Condition condition);
+bool match_value(const Predicate* predicate, const cJSON* field);
+bool match_encoded_value(const Predicate* predicate, const DocumentValue* field);
+double match_selectivity(Condition condition);
+void order_terms(Predicate* terms, int count, bool ascending);
+bool runs_before(const Predicate* term, const Predicate* other, bool ascending);
+
+
+// Compile the filter of a query: its filter tree when it has one, otherwise its key, value
+// and condition. Release the predicate with release_predicate.
+bool compile_predicate(const QueryConfig* config, Predicate* predicate, char* error) {
+    memset(predicate, 0, sizeof(*predicate));
+    predicate->selectivity = 1.0;
+
+    bool _status = true;
+    if (config->filter) {
+        cJSON* _filter = cJSON_Parse(config->filter);
+        if (!_filter) get_error(error, "fatal: Invalid filter '%s'", config->filter);
+        _status = _filter && compile_filter(_filter, predicate, 0, error);
+        cJSON_Delete(_filter);
+    } else if (config->condition > all) {
+        get_error(error, "fatal: Invalid condition specified");
+        _status = false;
+    } else if (config->condition != all && config->key && config->value) {
+        _status = compile_match(config->key, config->value, config->condition, predicate, error);
+    }
+
+    if (!_status) release_predicate(predicate);
+    return _status;
+}
+
+// Check a parsed document against a predicate, stopping at the first term that decides
+bool predicate_matches(const Predicate* predicate, const cJSON* item) {
+    switch (predicate->kind) {
+        case predicateAll:
+            return true;
+        case predicateMatch:
+            return match_value(predicate, find_path(predicate->path, predicate->pathLength, item));
+        case predicateAnd:
+            for (int i = 0; i < predicate->termCount; i++) {
+                if (!predicate_matches(&predicate->terms[i], item)) return false;
+            }
+            return true;
+        case predicateOr:
+            for (int i = 0; i < predicate->termCount; i++) {
+                if (predicate_matches(&predicate->terms[i], item)) return true;
+            }
+            return false;
+        case predicateNot:
+            return !predicate_matches(&predicate->terms[0], item);
+        default:
+            return false;
+    }
+}
+
+// Check an encoded document against a predicate without decoding it
+bool predicate_matches_encoded(const Predicate* predicate, const uint8_t* document, const size_t length) {
+    DocumentValue _field;
+    switch (predicate->kind) {
+        case predicateAll:
+            return true;
+        case predicateMatch:
+            return find_encoded_path(predicate->path, predicate->pathLength, document, length, &_field) && match_encoded_value(predicate, &_field);
+        case predicateAnd:
+            for (int i = 0; i < predicate->termCount; i++) {
+                if (!predicate_matches_encoded(&predicate->terms[i], document, length)) return false;
+            }
+            return true;
+        case predicateOr:
+            for (int i = 0; i < predicate->termCount; i++) {
+                if (predicate_matches_encoded(&predicate->terms[i], document, length)) return true;
+            }
+            return false;
+        case predicateNot:
+            return !predicate_matches_encoded(&predicate->terms[0], document, length);
+        default:
+            return false;
+    }
+}
+
+// Free what a compiled predicate holds; the predicate itself belongs to the caller
+void release_predicate(Predicate* predicate) {
+    for (int i = 0; i < predicate->termCount; i++) release_predicate(&predicate->terms[i]);
+    free(predicate->terms);
+    free(predicate->path);
+    free(predicate->text);
+    memset(predicate, 0, sizeof(*predicate));
+}
+
+// Compile one node of a filter tree
+bool compile_filter(const cJSON* filter, Predicate* predicate, const int depth, char* error) {
+    if (depth >= MAX_PREDICATE_DEPTH || !cJSON_IsObject(filter)) {
+        get_error(error, depth >= MAX_PREDICATE_DEPTH ? "fatal: Filter nested too deeply" : "fatal: Invalid filter");
+        return false;
+    }
+
+    const cJSON* _terms;
+    if ((_terms = cJSON_GetObjectItemCaseSensitive(filter, "and"))) return compile_terms(_terms, predicateAnd, predicate, depth, error);
+    if ((_terms = cJSON_GetObjectItemCaseSensitive(filter, "or"))) return compile_terms(_terms, predicateOr, predicate, depth, error);
+    if ((_terms = cJSON_GetObjectItemCaseSensitive(filter, "not"))) return compile_terms(_terms, predicateNot, predicate, depth, error);
+
+    const cJSON* _key = cJSON_GetObjectItemCaseSensitive(filter, "key");
+    const cJSON* _value = cJSON_GetObjectItemCaseSensitive(filter, "value");
+    const cJSON* _condition = cJSON_GetObjectItemCaseSensitive(filter, "condition");
+    if (!cJSON_IsString(_key) || !cJSON_IsNumber(_condition) || _condition->valueint < 0 || _condition->valueint >= all) {
+        get_error(error, "fatal: Invalid filter term");
+        return false;
+    }
+
+    // Values may be given as JSON numbers and booleans as well as strings
+    char _number[32];
+    const char* _text = cJSON_IsString(_value) ? _value->valuestring :
+                        cJSON_IsTrue(_value) ? "true" :
+                        cJSON_IsFalse(_value) ? "false" : NULL;
+    if (cJSON_IsNumber(_value)) {
+        snprintf(_number, sizeof(_number), "%.17g", _value->valuedouble);
+        _text = _number;
+    }
+    if (!_text) {
+        get_error(error, "fatal: Invalid value in filter on '%s'", _key->valuestring);
+        return false;
+    }
+    return compile_match(_key->valuestring, _text, (Condition)_condition->valueint, predicate, error);
+}
+
+// Compile the terms of an AND or OR node (an array) or of a NOT node (a single filter), then
+// order them so the term most likely to decide the node runs first
+bool compile_terms(const cJSON* terms, const PredicateKind kind, Predicate* predicate, const int depth, char* error) {
+    const int _count = kind == predicateNot ? 1 : cJSON_IsArray(terms) ? cJSON_GetArraySize(terms) : 0;
+    if (_count == 0) {
+        get_error(error, "fatal: Invalid filter");
+        return false;
+    }
+
+    predicate->kind = kind;
+    predicate->terms = calloc((size_t)_count, sizeof(Predicate));
+    if (!predicate->terms) {
+        get_error(error, "fatal: Memory allocation failed");
+        return false;
+    }
+
+    const cJSON* _term = kind == predicateNot ? terms : terms->child;
+    for (int i = 0; i < _count; i++, _term = _term->next) {
+        predicate->terms[i].selectivity = 1.0;
+        predicate->termCount = i + 1;
+        if (!compile_filter(_term, &predicate->terms[i], depth + 1, error)) return false;
+    }
+
+    // AND fails fastest on its most selective term, OR succeeds fastest on its least selective
+    double _selectivity = 1.0;
+    switch (kind) {
+        case predicateAnd:
+            order_terms(predicate->terms, _count, true);
+            for (int i = 0; i < _count; i++) _selectivity *= predicate->terms[i].selectivity;
+            break;
+        case predicateOr:
+            order_terms(predicate->terms, _count, false);
+            for (int i = 0; i < _count; i++) _selectivity *= 1.0 - predicate->terms[i].selectivity;
+            _selectivity = 1.0 - _selectivity;
+            break;
+        default:
+            _selectivity = 1.0 - predicate->terms[0].selectivity;
+            break;
+    }
+    predicate->selectivity = _selectivity;
+    return true;
+}
+
+// Compile a single test. The key and value are copied into one block, with the key cut into
+// its path at the dots.
+bool compile_match(const char* key, const char* value, const Condition condition, Predicate* predicate, char* error) {
+    const size_t _keyLength = strlen(key), _valueLength = strlen(value);
+    int _segments = 1;
+    for (size_t i = 0; i < _keyLength; i++) _segments += key[i] == '.';
+
+    predicate->kind = predicateMatch;
+    predicate->condition = condition;
+    predicate->text = malloc(_keyLength + _valueLength + 2);
+    predicate->path = malloc((size_t)_segments * sizeof(PathSegment));
+    if (!predicate->text || !predicate->path) {
+        get_error(error, "fatal: Memory allocation failed");
+        return false;
+    }
+
+    char* _key = predicate->text;
+    memcpy(_key, key, _keyLength + 1);
+    predicate->value = _key + _keyLength + 1;
+    memcpy((char*)predicate->value, value, _valueLength + 1);
+
+    if (!split_path(_key, predicate->path, &predicate->pathLength)) {
+        get_error(error, "fatal: Invalid key path '%s'", key);
+        return false;
+    }
+
+    // The key of a single-name path stays usable on its own, for index lookups
+    predicate->key = predicate->pathLength == 1 ? _key : NULL;
+    predicate->valueLength = _valueLength;
+    predicate->number = atof(value);
+    predicate->boolean = strcmp(value, "true") == 0 ? valueTrue :
+                         strcmp(value, "false") == 0 ? valueFalse : valueNull;
+    predicate->selectivity = match_selectivity(condition);
+    return true;
+}
+
+// Share of documents a test is expected to let through, without statistics on the data:
+// equality picks few, inequality most, and a range about a third
+double match_selectivity(const Condition condition) {
+    switch (condition) {
+        case equal:    return 0.05;
+        case notEqual: return 0.95;
+        default:       return 0.33;
+    }
+}
+
+// Sort the terms of a node by selectivity, stably so that equal terms keep the order they
+// were given in. Nodes have a handful of terms, so an insertion sort does.
+void order_terms(Predicate* terms, const int count, const bool ascending) {
+    for (int i = 1; i < count; i++) {
+        const Predicate _term = terms[i];
+        int j = i;
+        for (; j > 0 && runs_before(&_term, &terms[j - 1], ascending); j--) terms[j] = terms[j - 1];
+        terms[j] = _term;
+    }
+}
+
+// Whether a term should be tested before another: by selectivity, then single tests before
+// nested nodes because they cost less
+bool runs_before(const Predicate* term, const Predicate* other, const bool ascending) {
+    if (term->selectivity != other->selectivity) {
+        return ascending ? term->selectivity < other->selectivity : term->selectivity > other->selectivity;
+    }
+    return term->kind == predicateMatch && other->kind != predicateMatch;
+}
+
+// Cut a dotted key into its path in place, one segment per name; path holds one segment per
+// dot and one more. Fails on an empty name.
+bool split_path(char* key, PathSegment* path, int* pathLength) {
+    *pathLength = 0;
+    for (char* _name = key; _name; (*pathLength)++) {
+        char* _dot = strchr(_name, '.');
+        if (_dot) *_dot = '\0';
+        const size_t _length = strlen(_name);
+        if (_length == 0) return false;
+        path[*pathLength] = (PathSegment){ _name, _length, key_hash(_name, _length) };
+        _name = _dot ? _dot + 1 : NULL;
+    }
+    return true;
+}
+
+// Follow a path through the nested objects of a parsed document
+const cJSON* find_path(const PathSegment* path, const int pathLength, const cJSON* item) {
+    const cJSON* _field = item;
+    for (int i = 0; i < pathLength && _field; i++) {
+        if (i > 0 && !cJSON_IsObject(_field)) return NULL;
+        _field = cJSON_GetObjectItem(_field, path[i].name);
+    }
+    return _field;
+}
+
+// Follow a path through the nested objects of an encoded document
+bool find_encoded_path(const PathSegment* path, const int pathLength, const uint8_t* document, const size_t length, DocumentValue* value) {
+    const uint8_t* _object = document;
+    size_t _length = length;
+    for (int i = 0; i < pathLength; i++) {
+        if (!find_hashed_field(_object, _length, path[i].name, path[i].length, path[i].hash, value)) return false;
+        if (i + 1 < pathLength) {
+            if (value->type != valueObject) return false;
+            _object = value->data;
+            _length = value->length;
+        }
+    }
+    return true;
+}
+
+bool match_value(const Predicate* predicate, const cJSON* field) {
+    if (!field) return false;
+    if (cJSON_IsNumber(field)) return is_related(field->valuedouble, predicate->number, predicate->condition);
+    if (predicate->condition != equal) return false;
+
+    if (cJSON_IsString(field)) return strcmp(field->valuestring, predicate->value) == 0;
+    if (cJSON_IsBool(field)) {
+        return (predicate->boolean == valueTrue && field->valueint == 1) ||
+               (predicate->boolean == valueFalse && field->valueint == 0);
+    }
+    return false;
+}
+
+bool match_encoded_value(const Predicate* predicate, const DocumentValue* field) {
+    if (field->type == valueNumber) return is_related(field->number, predicate->number, predicate->condition);
+    if (predicate->condition != equal) return false;
+
+    switch (field->type) {
+        case valueString:
+            return predicate->valueLength == field->length && memcmp(field->data, predicate->value, field->length) == 0;
+        case valueTrue:
+        case valueFalse:
+            return predicate->boolean == field->type;
+        default:
+            return false;
+    }
+}
+
+// Compare two numeric values based on the provided condition
+bool is_related(const double value1, const double value2, const Condition condition) {
+    switch (condition) {
+        case greaterThan:      return value1 > value2;
+        case greaterThanEqual: return value1 >= value2;
+        case lessThan:         return value1 < value2;
+        case lessThanEqual:    return value1 <= value2;
+        case equal:            return value1 == value2;
+        case notEqual:         return value1 != value2;
+        default: return false;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "DatabaseUtils.h"
+#include "DocumentCodec.h"
+
+#define MAX_PREDICATE_DEPTH 32
+
+// Node of a compiled filter: a single key/value/condition test, or AND, OR and NOT over other
+// nodes. A filter without a key or value, or with condition all, compiles to predicateAll.
+typedef enum {
+    predicateAll,
+    predicateMatch,
+    predicateAnd,
+    predicateOr,
+    predicateNot
+} PredicateKind;
+
+// One name of a dotted key path, with its length and key_hash worked out up front
+typedef struct {
+    const char* name;
+    size_t length;
+    uint32_t hash;
+} PathSegment;
+
+// A filter compiled once per query. The value of each test is parsed into the number and
+// boolean it can match and its key is split into a path of hashed names, so testing a
+// document does no parsing of its own. selectivity estimates the share of documents a node
+// lets through; the terms of AND and OR nodes are ordered by it so evaluation stops early.
+typedef struct Predicate {
+    PredicateKind kind;
+    Condition condition;
+    const char* key;
+    PathSegment* path;
+    int pathLength;
+    const char* value;
+    size_t valueLength;
+    double number;
+    ValueType boolean;
+    double selectivity;
+    struct Predicate* terms;
+    int termCount;
+    char* text;
+} Predicate;
+
+bool compile_predicate(const QueryConfig* config, Predicate* predicate, char* error);
+bool find_encoded_path(const PathSegment* path, int pathLength, const uint8_t* document, size_t length, DocumentValue* value);
+const cJSON* find_path(const PathSegment* path, int pathLength, const cJSON* item);
+bool predicate_matches(const Predicate* predicate, const cJSON* item);
+bool predicate_matches_encoded(const Predicate* predicate, const uint8_t* document, size_t length);
+void release_predicate(Predicate* predicate);
+bool split_path(char* key, PathSegment* path, int* pathLength);
+
+#endif //PREDICATE_H
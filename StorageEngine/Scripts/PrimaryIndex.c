@@ -0,0 +1,420 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PrimaryIndex.h"
+#include "DocumentCodec.h"
+
+// The id index every collection has. Entries map the "_id" of each document to its record
+// id and are kept in an open-addressing table in memory, backed by an append-only file next
+// to the collection. Like the key indexes it records the collection LSN and length it covers
+// and is rebuilt when they no longer match. Removed documents leave their entries behind and
+// their slots may be reused, so the documents found are checked against the filter like any
+// other candidates. If some document holds an id that is not a number, the index reports
+// that it cannot answer and filters on "_id" fall back to a scan. LSM collections have no
+// id index: their documents are filed by id, which is also the record id of each.
+typedef struct PrimaryIndex PrimaryIndex;
+struct PrimaryIndex {
+    char databaseName[MAX_PATH_LEN];
+    char collectionName[MAX_PATH_LEN];
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    bool exact;
+    PrimaryEntry* slots;
+    size_t capacity;
+    size_t count;
+    PrimaryIndex* next;
+};
+
+// State shared with collect_id while walking a collection
+typedef struct {
+    PrimaryIndex* index;
+    ByteBuffer* appended;
+    bool failed;
+} PrimaryBuild;
+
+static PrimaryIndex* primaries = NULL;
+static SRWLOCK primaryLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool add_id(PrimaryIndex* index, PrimaryEntry entry);
+bool append_ids(PrimaryIndex* index, const char* fileName, const uint64_t* recordIds, int count);
+bool build_ids(PrimaryIndex* index, const char* fileName);
+bool collect_id(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+void discard_ids(PrimaryIndex* index);
+int document_id(const CollectionHeader* header, const char* frame, size_t length, double* id);
+PrimaryIndex* find_ids(const char* databaseName, const char* collectionName);
+bool has_id(const PrimaryIndex* index, PrimaryEntry entry);
+size_t id_hash(double id);
+bool ids_current(const PrimaryIndex* index, const char* fileName);
+PrimaryIndex* open_ids(const char* databaseName, const char* collectionName, const char* fileName);
+bool read_ids(PrimaryIndex* index, const char* fileName);
+bool reset_ids(PrimaryIndex* index);
+bool save_ids(const PrimaryIndex* index);
+
+
+// Load the id index of a collection before a mutation, so that it can be extended in place
+void primary_prepare(const char* databaseName, const char* collectionName, const char* fileName) {
+    if (get_collection_storage(fileName) == storageLsm) return;
+
+    AcquireSRWLockExclusive(&primaryLock);
+    open_ids(databaseName, collectionName, fileName);
+    ReleaseSRWLockExclusive(&primaryLock);
+}
+
+// Index the documents a mutation stored at recordIds in the id index
+void primary_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, const int count, const uint64_t lsn) {
+    AcquireSRWLockExclusive(&primaryLock);
+    PrimaryIndex* _index = find_ids(databaseName, collectionName);
+
+    // An index that cannot be extended is rebuilt when next used
+    if (_index && !append_ids(_index, fileName, recordIds, count)) {
+        discard_ids(_index);
+    } else if (_index) {
+        _index->appliedLsn = lsn;
+    }
+    ReleaseSRWLockExclusive(&primaryLock);
+}
+
+// Rebuild a loaded id index after its collection was rewritten. One that is not loaded
+// stays on disk as it is; its LSN no longer matches, so the next lookup rebuilds it.
+void primary_rebuild(const char* databaseName, const char* collectionName, const char* fileName) {
+    AcquireSRWLockExclusive(&primaryLock);
+    PrimaryIndex* _index = find_ids(databaseName, collectionName);
+    if (_index && (!build_ids(_index, fileName) || !save_ids(_index))) discard_ids(_index);
+    ReleaseSRWLockExclusive(&primaryLock);
+}
+
+// Delete the id index of a dropped collection
+void primary_drop_collection(const char* databaseName, const char* collectionName) {
+    char _primaryFile[MAX_PATH_LEN];
+    get_primary_file(_primaryFile, databaseName, collectionName);
+    remove(_primaryFile);
+    primary_invalidate(databaseName, collectionName);
+}
+
+// Forget in-memory id indexes whose files are being deleted (all of the database if collectionName is NULL)
+void primary_invalidate(const char* databaseName, const char* collectionName) {
+    AcquireSRWLockExclusive(&primaryLock);
+    PrimaryIndex** _link = &primaries;
+    while (*_link) {
+        PrimaryIndex* _index = *_link;
+        if (strcmp(_index->databaseName, databaseName) == 0 &&
+            (!collectionName || strcmp(_index->collectionName, collectionName) == 0)) {
+            *_link = _index->next;
+            free(_index->slots);
+            free(_index);
+        } else {
+            _link = &_index->next;
+        }
+    }
+    ReleaseSRWLockExclusive(&primaryLock);
+}
+
+// Find the record ids of the documents whose "_id" may equal value, in collection order.
+// The equality filter compares numbers through atof, and so does the lookup. Returns -1
+// if the index cannot answer for this collection.
+int primary_lookup(const char* databaseName, const char* collectionName, const char* value, const char* fileName, uint64_t** recordIds) {
+    *recordIds = NULL;
+    if (!value) return -1;
+
+    // Only a whole number can equal an id handed out by the engine
+    if (get_collection_storage(fileName) == storageLsm) {
+        const double _id = atof(value);
+        if (_id < 1 || _id >= (double)MAX_DOCUMENT_ID || _id != (double)(uint64_t)_id) return 0;
+        if (!(*recordIds = malloc(sizeof(uint64_t)))) return -1;
+        **recordIds = (uint64_t)_id;
+        return 1;
+    }
+
+    AcquireSRWLockExclusive(&primaryLock);
+    const PrimaryIndex* _index = open_ids(databaseName, collectionName, fileName);
+    if (!_index || !_index->exact) {
+        ReleaseSRWLockExclusive(&primaryLock);
+        return -1;
+    }
+
+    const double _number = atof(value);
+    const double _id = _number == 0 ? 0.0 : _number;
+    const size_t _mask = _index->capacity - 1;
+    size_t _count = 0, _capacity = 0;
+    uint64_t* _ids = NULL;
+
+    for (size_t i = id_hash(_id) & _mask; _index->slots[i].recordId != 0; i = (i + 1) & _mask) {
+        if (_index->slots[i].id != _id) continue;
+        if (_count == _capacity) {
+            _capacity = _capacity ? _capacity * 2 : 4;
+            uint64_t* _grown = realloc(_ids, _capacity * sizeof(uint64_t));
+            if (!_grown) {
+                free(_ids);
+                ReleaseSRWLockExclusive(&primaryLock);
+                return -1;
+            }
+            _ids = _grown;
+        }
+        _ids[_count++] = _index->slots[i].recordId;
+    }
+    ReleaseSRWLockExclusive(&primaryLock);
+
+    *recordIds = _ids;
+    return sort_record_ids(_ids, (int)_count);
+}
+
+// Return a current in-memory id index, loading or rebuilding it as needed. primaryLock must be held.
+PrimaryIndex* open_ids(const char* databaseName, const char* collectionName, const char* fileName) {
+    PrimaryIndex* _index = find_ids(databaseName, collectionName);
+    if (_index) {
+        if (ids_current(_index, fileName)) return _index;
+        if (build_ids(_index, fileName) && save_ids(_index)) return _index;
+        discard_ids(_index);
+        return NULL;
+    }
+
+    _index = calloc(1, sizeof(PrimaryIndex));
+    if (!_index) return NULL;
+    snprintf(_index->databaseName, sizeof(_index->databaseName), "%s", databaseName);
+    snprintf(_index->collectionName, sizeof(_index->collectionName), "%s", collectionName);
+
+    if (!read_ids(_index, fileName) && !(build_ids(_index, fileName) && save_ids(_index))) {
+        free(_index->slots);
+        free(_index);
+        return NULL;
+    }
+
+    _index->next = primaries;
+    primaries = _index;
+    return _index;
+}
+
+// Load an id index file, provided it covers the collection exactly as it is now
+bool read_ids(PrimaryIndex* index, const char* fileName) {
+    char _primaryFile[MAX_PATH_LEN];
+    get_primary_file(_primaryFile, index->databaseName, index->collectionName);
+    FILE* _file = fopen(_primaryFile, "rb");
+    if (!_file) return false;
+
+    PrimaryHeader _header;
+    bool _status = fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, PRIMARY_MAGIC, sizeof(_header.magic)) == 0 &&
+                   _header.version == PRIMARY_VERSION &&
+                   _header.appliedLsn == get_applied_lsn(fileName) &&
+                   (long long)_header.coveredLength == get_file_size(fileName);
+
+    PrimaryEntry _entry;
+    _status = _status && reset_ids(index);
+    for (uint64_t i = 0; _status && i < _header.entryCount; i++) {
+        _status = fread(&_entry, sizeof(_entry), 1, _file) == 1 && _entry.recordId != 0 && add_id(index, _entry);
+    }
+    fclose(_file);
+
+    if (_status) {
+        index->appliedLsn = _header.appliedLsn;
+        index->coveredLength = _header.coveredLength;
+        index->exact = _header.exact != 0;
+    }
+    return _status;
+}
+
+// Rebuild the table from every document of the collection
+bool build_ids(PrimaryIndex* index, const char* fileName) {
+    PrimaryBuild _build = { index, NULL, false };
+    const long long _size = get_file_size(fileName);
+    index->exact = true;
+    if (!reset_ids(index) || _size < 0 ||
+        !walk_frames(fileName, collect_id, &_build) || _build.failed) return false;
+
+    index->appliedLsn = get_applied_lsn(fileName);
+    index->coveredLength = (uint64_t)_size;
+    return true;
+}
+
+// Add the documents at recordIds to the table and to the end of the index file
+bool append_ids(PrimaryIndex* index, const char* fileName, const uint64_t* recordIds, const int count) {
+    ByteBuffer _appended = { 0 };
+    PrimaryBuild _build = { index, &_appended, false };
+    const long long _size = get_file_size(fileName);
+    if (_size < 0 || !visit_records(fileName, recordIds, count, collect_id, &_build) || _build.failed) {
+        free(_appended.data);
+        return false;
+    }
+
+    char _primaryFile[MAX_PATH_LEN];
+    get_primary_file(_primaryFile, index->databaseName, index->collectionName);
+    FILE* _file = fopen(_primaryFile, "rb+");
+    PrimaryHeader _header;
+    bool _status = _file && fread(&_header, sizeof(_header), 1, _file) == 1 &&
+                   memcmp(_header.magic, PRIMARY_MAGIC, sizeof(_header.magic)) == 0;
+
+    // Entries go first; the header that makes them valid is stamped afterwards
+    if (_status && _appended.size > 0) {
+        _status = fseek(_file, 0, SEEK_END) == 0 && fwrite(_appended.data, 1, _appended.size, _file) == _appended.size;
+    }
+    if (_status) {
+        _header.appliedLsn = get_applied_lsn(fileName);
+        _header.coveredLength = (uint64_t)_size;
+        _header.entryCount += _appended.size / sizeof(PrimaryEntry);
+        _header.exact = index->exact;
+        _status = fseek(_file, 0, SEEK_SET) == 0 && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    }
+    if (_file && fclose(_file) != 0) _status = false;
+    free(_appended.data);
+
+    if (_status) index->coveredLength = (uint64_t)_size;
+    return _status;
+}
+
+// Write the whole id index to its file, replacing the previous one
+bool save_ids(const PrimaryIndex* index) {
+    char _primaryFile[MAX_PATH_LEN], _tempName[MAX_PATH_LEN + 4];
+    get_primary_file(_primaryFile, index->databaseName, index->collectionName);
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", _primaryFile);
+
+    FILE* _file = fopen(_tempName, "wb");
+    if (!_file) return false;
+
+    const PrimaryHeader _header = { PRIMARY_MAGIC, PRIMARY_VERSION, index->appliedLsn, index->coveredLength,
+                                    index->count, index->exact, 0 };
+    bool _status = fwrite(&_header, sizeof(_header), 1, _file) == 1;
+
+    for (size_t i = 0; _status && i < index->capacity; i++) {
+        if (index->slots[i].recordId != 0) _status = fwrite(&index->slots[i], sizeof(PrimaryEntry), 1, _file) == 1;
+    }
+    if (fclose(_file) != 0) _status = false;
+
+    if (!_status || !MoveFileExA(_tempName, _primaryFile, MOVEFILE_REPLACE_EXISTING)) {
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Frame visitor: index the id of one document
+bool collect_id(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    PrimaryBuild* _build = context;
+    PrimaryEntry _entry = { 0, recordId };
+    const int _found = document_id(header, frame, length, &_entry.id);
+    if (_found == 0 || (_found > 0 && _build->appended && has_id(_build->index, _entry))) return true;
+
+    // Ids the table cannot hold are only ever written by clients into older collections
+    if (_found < 0) {
+        _build->index->exact = false;
+        return true;
+    }
+
+    if (!add_id(_build->index, _entry) || (_build->appended && !buffer_reserve(_build->appended, sizeof(_entry)))) {
+        _build->failed = true;
+        return false;
+    }
+
+    if (_build->appended) {
+        memcpy(_build->appended->data + _build->appended->size, &_entry, sizeof(_entry));
+        _build->appended->size += sizeof(_entry);
+    }
+    return true;
+}
+
+// Read the "_id" of a document: 1 if it is a number, 0 if it has none, -1 for any other value
+int document_id(const CollectionHeader* header, const char* frame, const size_t length, double* id) {
+    if (header->version >= 3) {
+        DocumentValue _value;
+        if (!find_field((const uint8_t*)frame, length, ID_KEY, &_value)) return 0;
+        if (_value.type != valueNumber) return -1;
+        *id = _value.number == 0 ? 0.0 : _value.number;
+        return 1;
+    }
+
+    // Text frames predate the binary encoding and are parsed to find the field
+    cJSON* _document = cJSON_ParseWithLength(frame, length);
+    const cJSON* _field = cJSON_GetObjectItem(_document, ID_KEY);
+    const int _found = !_field ? 0 : cJSON_IsNumber(_field) ? 1 : -1;
+    if (_found > 0) *id = _field->valuedouble == 0 ? 0.0 : _field->valuedouble;
+
+    cJSON_Delete(_document);
+    return _found;
+}
+
+// Mix the bits of an id, so that consecutive ids spread over the table
+size_t id_hash(const double id) {
+    uint64_t _bits;
+    memcpy(&_bits, &id, sizeof(_bits));
+    _bits ^= _bits >> 33;
+    _bits *= 0xff51afd7ed558ccdULL;
+    _bits ^= _bits >> 33;
+    return (size_t)_bits;
+}
+
+// Empty the table, leaving room for a first batch of entries
+bool reset_ids(PrimaryIndex* index) {
+    free(index->slots);
+    index->count = 0;
+    index->capacity = 64;
+    index->slots = calloc(index->capacity, sizeof(PrimaryEntry));
+    if (!index->slots) index->capacity = 0;
+    return index->slots != NULL;
+}
+
+// Whether the table holds an entry already, as it does for every document an update rewrote
+bool has_id(const PrimaryIndex* index, const PrimaryEntry entry) {
+    const size_t _mask = index->capacity - 1;
+    for (size_t i = id_hash(entry.id) & _mask; index->slots[i].recordId != 0; i = (i + 1) & _mask) {
+        if (index->slots[i].id == entry.id && index->slots[i].recordId == entry.recordId) return true;
+    }
+    return false;
+}
+
+// Insert into the open-addressing table, growing it past 70% load. Slots with a zero
+// recordId are empty; record id 0 falls on the collection header and is never a document.
+bool add_id(PrimaryIndex* index, const PrimaryEntry entry) {
+    if ((index->count + 1) * 10 > index->capacity * 7) {
+        const size_t _capacity = index->capacity * 2;
+        PrimaryEntry* _slots = calloc(_capacity, sizeof(PrimaryEntry));
+        if (!_slots) return false;
+
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->slots[i].recordId == 0) continue;
+            size_t j = id_hash(index->slots[i].id) & (_capacity - 1);
+            while (_slots[j].recordId != 0) j = (j + 1) & (_capacity - 1);
+            _slots[j] = index->slots[i];
+        }
+
+        free(index->slots);
+        index->slots = _slots;
+        index->capacity = _capacity;
+    }
+    size_t i = id_hash(entry.id) & (index->capacity - 1);
+    while (index->slots[i].recordId != 0) i = (i + 1) & (index->capacity - 1);
+    index->slots[i] = entry;
+    index->count++;
+    return true;
+}
+
+// Whether an id index still describes the collection file as it is on disk
+bool ids_current(const PrimaryIndex* index, const char* fileName) {
+    return index->appliedLsn == get_applied_lsn(fileName) &&
+           (long long)index->coveredLength == get_file_size(fileName);
+}
+
+PrimaryIndex* find_ids(const char* databaseName, const char* collectionName) {
+    for (PrimaryIndex* _index = primaries; _index; _index = _index->next) {
+        if (strcmp(_index->collectionName, collectionName) == 0 &&
+            strcmp(_index->databaseName, databaseName) == 0) return _index;
+    }
+    return NULL;
+}
+
+// Unlink and free an id index; its file is removed so that the next use rebuilds it
+void discard_ids(PrimaryIndex* index) {
+    char _primaryFile[MAX_PATH_LEN];
+    get_primary_file(_primaryFile, index->databaseName, index->collectionName);
+    remove(_primaryFile);
+
+    for (PrimaryIndex** _link = &primaries; *_link; _link = &(*_link)->next) {
+        if (*_link == index) {
+            *_link = index->next;
+            break;
+        }
+    }
+    free(index->slots);
+    free(index);
+}
@@ -0,0 +1,34 @@
+#ifndef PRIMARY_INDEX_H
+#define PRIMARY_INDEX_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define PRIMARY_MAGIC "PDBP"
+#define PRIMARY_VERSION 1
+
+// Header at the start of every primary index file, followed by the entries
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    uint64_t entryCount;
+    uint32_t exact;
+    uint32_t reserved;
+} PrimaryHeader;
+
+// Id of one document and its record id
+typedef struct {
+    double id;
+    uint64_t recordId;
+} PrimaryEntry;
+
+void primary_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, int count, uint64_t lsn);
+void primary_drop_collection(const char* databaseName, const char* collectionName);
+void primary_invalidate(const char* databaseName, const char* collectionName);
+int primary_lookup(const char* databaseName, const char* collectionName, const char* value, const char* fileName, uint64_t** recordIds);
+void primary_prepare(const char* databaseName, const char* collectionName, const char* fileName);
+void primary_rebuild(const char* databaseName, const char* collectionName, const char* fileName);
+
+#endif //PRIMARY_INDEX_H
@@ -0,0 +1,160 @@
+// Include standard and platform headers
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Projection.h"
+
+// Printed documents hold only the fields a query asks for when it gives a projection: a
+// comma-separated list of keys, each a dotted path through nested objects, e.g.
+//     name, address.city
+// A projected document keeps the nesting of its fields, {"name": ..., "address": {"city": ...}},
+// and leaves out the fields a document does not have. Binary documents decode only the
+// projected values, so the work of printing follows the width of the projection rather than
+// the width of the documents. Keys match regardless of case, as in filters.
+
+// Local helper functions
+bool covers_field(const ProjectedField* field, const ProjectedField* other);
+bool place_field(cJSON* projected, const ProjectedField* field, cJSON* value);
+bool same_name(const PathSegment* name, const PathSegment* other);
+char* trim_field(char* field);
+
+
+// Compile the projection of a query; without one, or with an empty one, documents print
+// whole. Release the projection with release_projection.
+bool compile_projection(const QueryConfig* config, Projection* projection, char* error) {
+    memset(projection, 0, sizeof(*projection));
+    if (!config->projection) return true;
+
+    const size_t _length = strlen(config->projection);
+    int _fields = 1, _segments = 1;
+    for (size_t i = 0; i < _length; i++) {
+        _fields += config->projection[i] == ',';
+        _segments += config->projection[i] == ',' || config->projection[i] == '.';
+    }
+
+    projection->text = malloc(_length + 1);
+    projection->fields = malloc((size_t)_fields * sizeof(ProjectedField));
+    projection->segments = malloc((size_t)_segments * sizeof(PathSegment));
+    if (!projection->text || !projection->fields || !projection->segments) {
+        release_projection(projection);
+        get_error(error, "fatal: Memory allocation failed");
+        return false;
+    }
+    memcpy(projection->text, config->projection, _length + 1);
+    if (*trim_field(projection->text) == '\0') return true;
+
+    PathSegment* _segment = projection->segments;
+    for (char* _next = projection->text; _next;) {
+        char* _comma = strchr(_next, ',');
+        if (_comma) *_comma = '\0';
+        char* _key = trim_field(_next);
+        _next = _comma ? _comma + 1 : NULL;
+
+        ProjectedField _field = { _segment, 0 };
+        if (*_key == '\0' || !split_path(_key, _segment, &_field.pathLength)) {
+            get_error(error, "fatal: Invalid projection '%s'", config->projection);
+            release_projection(projection);
+            return false;
+        }
+        _segment += _field.pathLength;
+
+        // A field inside one already printed adds nothing; one around printed fields replaces them
+        bool _covered = false;
+        for (int i = 0; i < projection->fieldCount && !_covered; i++) _covered = covers_field(&projection->fields[i], &_field);
+        if (_covered) continue;
+
+        int _kept = 0;
+        for (int i = 0; i < projection->fieldCount; i++) {
+            if (!covers_field(&_field, &projection->fields[i])) projection->fields[_kept++] = projection->fields[i];
+        }
+        projection->fields[_kept] = _field;
+        projection->fieldCount = _kept + 1;
+    }
+    return true;
+}
+
+// Build a document holding the projected fields of a parsed document (NULL if out of memory)
+cJSON* project_document(const Projection* projection, const cJSON* item) {
+    cJSON* _projected = cJSON_CreateObject();
+    if (!_projected) return NULL;
+
+    for (int i = 0; i < projection->fieldCount; i++) {
+        const ProjectedField* _field = &projection->fields[i];
+        const cJSON* _value = find_path(_field->path, _field->pathLength, item);
+        if (_value && !place_field(_projected, _field, cJSON_Duplicate(_value, true))) {
+            cJSON_Delete(_projected);
+            return NULL;
+        }
+    }
+    return _projected;
+}
+
+// Build a document holding the projected fields of an encoded document, decoding only their
+// values (NULL if the document is malformed or out of memory)
+cJSON* project_encoded(const Projection* projection, const uint8_t* document, const size_t length) {
+    if (length < 1 || document[0] != valueObject) return NULL;
+    cJSON* _projected = cJSON_CreateObject();
+    if (!_projected) return NULL;
+
+    for (int i = 0; i < projection->fieldCount; i++) {
+        const ProjectedField* _field = &projection->fields[i];
+        DocumentValue _value;
+        if (find_encoded_path(_field->path, _field->pathLength, document, length, &_value) &&
+            !place_field(_projected, _field, decode_field_value(&_value))) {
+            cJSON_Delete(_projected);
+            return NULL;
+        }
+    }
+    return _projected;
+}
+
+// Free what a compiled projection holds; the projection itself belongs to the caller
+void release_projection(Projection* projection) {
+    free(projection->fields);
+    free(projection->segments);
+    free(projection->text);
+    memset(projection, 0, sizeof(*projection));
+}
+
+// Add a value under the path of its field, creating the objects around it. No field is a
+// prefix of another, so every object on the way was created here for an earlier field.
+bool place_field(cJSON* projected, const ProjectedField* field, cJSON* value) {
+    if (!value) return false;
+
+    cJSON* _object = projected;
+    for (int i = 0; i + 1 < field->pathLength; i++) {
+        cJSON* _child = cJSON_GetObjectItem(_object, field->path[i].name);
+        if (!_child) _child = cJSON_AddObjectToObject(_object, field->path[i].name);
+        if (!_child) {
+            cJSON_Delete(value);
+            return false;
+        }
+        _object = _child;
+    }
+    return cJSON_AddItemToObject(_object, field->path[field->pathLength - 1].name, value);
+}
+
+// Whether the path of field is a prefix of the path of other, or the same path
+bool covers_field(const ProjectedField* field, const ProjectedField* other) {
+    if (field->pathLength > other->pathLength) return false;
+    for (int i = 0; i < field->pathLength; i++) {
+        if (!same_name(&field->path[i], &other->path[i])) return false;
+    }
+    return true;
+}
+
+bool same_name(const PathSegment* name, const PathSegment* other) {
+    if (name->hash != other->hash || name->length != other->length) return false;
+    for (size_t i = 0; i < name->length; i++) {
+        if (tolower((unsigned char)name->name[i]) != tolower((unsigned char)other->name[i])) return false;
+    }
+    return true;
+}
+
+// Cut the spaces around a field in place
+char* trim_field(char* field) {
+    while (isspace((unsigned char)*field)) field++;
+    size_t _length = strlen(field);
+    while (_length > 0 && isspace((unsigned char)field[_length - 1])) field[--_length] = '\0';
+    return field;
+}
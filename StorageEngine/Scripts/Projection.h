@@ -0,0 +1,32 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "DatabaseUtils.h"
+#include "DocumentCodec.h"
+#include "Predicate.h"
+
+// One field a query prints, as the path of hashed names of its dotted key
+typedef struct {
+    PathSegment* path;
+    int pathLength;
+} ProjectedField;
+
+// The fields a query prints, compiled once per query. No field is a prefix of another, so
+// a projected document is built without merging values. A projection without fields prints
+// whole documents.
+typedef struct Projection {
+    ProjectedField* fields;
+    int fieldCount;
+    PathSegment* segments;
+    char* text;
+} Projection;
+
+bool compile_projection(const QueryConfig* config, Projection* projection, char* error);
+cJSON* project_document(const Projection* projection, const cJSON* item);
+cJSON* project_encoded(const Projection* projection, const uint8_t* document, size_t length);
+void release_projection(Projection* projection);
+
+#endif //PROJECTION_H
@@ -0,0 +1,559 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RangeIndex.h"
+#include "DocumentCodec.h"
+
+// An ordered index on the numeric values of one key of a collection, kept as a B+tree of
+// fixed-size pages in its own file. Leaves hold (number, record id) entries and link to
+// their right sibling, so a range condition descends once and then walks leaves in order.
+// Like the hash indexes, the header records the collection LSN and length the tree covers:
+// inserts and updates add entries page by page, removes leave theirs behind for the filter
+// check to weed out, rewrites of the collection rebuild the tree, and a tree that no longer
+// matches its collection is rebuilt when next used.
+
+_Static_assert(sizeof(TreePage) <= TREE_PAGE_SIZE, "tree nodes must fit in a page");
+_Static_assert(sizeof(TreeHeader) < TREE_PAGE_SIZE, "tree header must fit in a page");
+
+#define MAX_TREE_HEIGHT 32
+
+// State shared with collect_number while walking a collection
+typedef struct {
+    const char* key;
+    TreeEntry* entries;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} TreeBuild;
+
+static SRWLOCK treeLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool build_tree(const char* treeFile, const char* key, const char* fileName);
+bool collect_number(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+int compare_entries(const void* left, const void* right);
+bool extend_tree(const char* treeFile, const char* key, const char* fileName, const uint64_t* recordIds, int count);
+uint32_t find_leaf(FILE* file, const TreeHeader* header, const TreeEntry* bound, TreePage* node);
+bool insert_entry(FILE* file, TreeHeader* header, TreeEntry entry);
+bool insert_separator(FILE* file, TreeHeader* header, const uint32_t* path, const uint16_t* slots, int depth, TreeEntry separator, uint32_t child);
+FILE* open_tree(const char* treeFile, const char* key, const char* fileName, const char* mode, TreeHeader* header);
+bool read_page(FILE* file, uint32_t page, TreePage* node);
+bool write_header(FILE* file, const TreeHeader* header, const char* key);
+bool write_page(FILE* file, uint32_t page, const TreePage* node);
+
+
+// Register a range index on a key and build it from the collection. The database lock must be held exclusively.
+bool range_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error) {
+    if (strlen(key) > TREE_PAGE_SIZE - sizeof(TreeHeader)) {
+        get_error(error, "fatal: Key '%s' is too long to index", key);
+        return false;
+    }
+
+    if (has_key_entry(databaseName, RANGE_META, collectionName, key)) {
+        get_error(error, "warning: Range index on '%s' already exists", key);
+        return false;
+    }
+
+    char _treeFile[MAX_PATH_LEN];
+    get_key_file(_treeFile, databaseName, collectionName, key, RANGE_SUFFIX);
+
+    AcquireSRWLockExclusive(&treeLock);
+    const bool _built = build_tree(_treeFile, key, fileName);
+    ReleaseSRWLockExclusive(&treeLock);
+
+    if (!_built) {
+        get_error(error, "fatal: Could not build range index on '%s'", key);
+        return false;
+    }
+    return append_key_entry(databaseName, RANGE_META, collectionName, key, error);
+}
+
+// Unregister a range index and delete its file. The database lock must be held exclusively.
+bool range_drop(const char* databaseName, const char* collectionName, const char* key, char* error) {
+    if (!has_key_entry(databaseName, RANGE_META, collectionName, key)) {
+        get_error(error, "fatal: Range index on '%s' not found", key);
+        return false;
+    }
+    const bool _status = remove_key_entry(databaseName, RANGE_META, collectionName, key, error);
+
+    char _treeFile[MAX_PATH_LEN];
+    get_key_file(_treeFile, databaseName, collectionName, key, RANGE_SUFFIX);
+    remove(_treeFile);
+    return _status;
+}
+
+// Delete every range index of a dropped collection
+void range_drop_collection(const char* databaseName, const char* collectionName) {
+    char _treeFile[MAX_PATH_LEN], _error[MAX_ERROR_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, RANGE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_treeFile, databaseName, collectionName, _key->valuestring, RANGE_SUFFIX);
+        remove(_treeFile);
+    }
+
+    cJSON_Delete(_meta);
+    remove_key_entry(databaseName, RANGE_META, collectionName, NULL, _error);
+}
+
+// Bring every range index of a collection up to date before a mutation, so that it can be extended in place
+void range_prepare(const char* databaseName, const char* collectionName, const char* fileName) {
+    char _treeFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, RANGE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&treeLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_treeFile, databaseName, collectionName, _key->valuestring, RANGE_SUFFIX);
+
+        TreeHeader _header;
+        FILE* _file = open_tree(_treeFile, _key->valuestring, fileName, "rb", &_header);
+        if (_file) fclose(_file);
+        else if (!build_tree(_treeFile, _key->valuestring, fileName)) remove(_treeFile);
+    }
+    ReleaseSRWLockExclusive(&treeLock);
+    cJSON_Delete(_meta);
+}
+
+// Insert the documents a mutation stored at recordIds into every range index of a collection
+void range_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, const int count) {
+    char _treeFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, RANGE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&treeLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_treeFile, databaseName, collectionName, _key->valuestring, RANGE_SUFFIX);
+
+        // A tree that cannot be extended is removed and rebuilt when next used
+        if (!extend_tree(_treeFile, _key->valuestring, fileName, recordIds, count)) remove(_treeFile);
+    }
+    ReleaseSRWLockExclusive(&treeLock);
+    cJSON_Delete(_meta);
+}
+
+// Rebuild every range index of a collection after its file was rewritten
+void range_rebuild(const char* databaseName, const char* collectionName, const char* fileName) {
+    char _treeFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, RANGE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&treeLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_treeFile, databaseName, collectionName, _key->valuestring, RANGE_SUFFIX);
+        if (!build_tree(_treeFile, _key->valuestring, fileName)) remove(_treeFile);
+    }
+    ReleaseSRWLockExclusive(&treeLock);
+    cJSON_Delete(_meta);
+}
+
+// Find the record ids of documents whose number for key satisfies a range condition,
+// in ascending order of that number. Returns -1 if no range index answers the condition.
+int range_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, const Condition condition, const char* fileName, uint64_t** recordIds) {
+    *recordIds = NULL;
+    if (!key || !value || condition > lessThanEqual) return -1;
+
+    char _treeFile[MAX_PATH_LEN];
+    get_key_file(_treeFile, databaseName, collectionName, key, RANGE_SUFFIX);
+
+    TreeHeader _header;
+    bool _exclusive = false;
+    AcquireSRWLockShared(&treeLock);
+    FILE* _file = open_tree(_treeFile, key, fileName, "rb", &_header);
+
+    if (!_file) {
+        // Missing or stale: rebuild it, but only if the key is still registered
+        ReleaseSRWLockShared(&treeLock);
+        if (!has_key_entry(databaseName, RANGE_META, collectionName, key)) return -1;
+
+        AcquireSRWLockExclusive(&treeLock);
+        _exclusive = true;
+        _file = open_tree(_treeFile, key, fileName, "rb", &_header);
+        if (!_file && build_tree(_treeFile, key, fileName)) _file = open_tree(_treeFile, key, fileName, "rb", &_header);
+        if (!_file) {
+            ReleaseSRWLockExclusive(&treeLock);
+            return -1;
+        }
+    }
+
+    // Lower bounds start at the first entry that may qualify; upper bounds start at the smallest
+    const double _limit = atof(value);
+    TreeEntry _bound = { -INFINITY, 0 };
+    if (condition == greaterThan) _bound = (TreeEntry){ _limit, UINT64_MAX };
+    else if (condition == greaterThanEqual) _bound = (TreeEntry){ _limit, 0 };
+
+    TreePage _node;
+    size_t _count = 0, _capacity = 0;
+    uint64_t* _ids = NULL;
+    bool _status = !isnan(_limit);
+    uint32_t _page = _status ? find_leaf(_file, &_header, &_bound, &_node) : 0;
+    if (_page == 0) _status = false;
+
+    while (_status) {
+        bool _done = false;
+        for (uint16_t i = 0; i < _node.header.count && !_done; i++) {
+            const TreeEntry* _entry = &_node.entries[i];
+            if (compare_entries(_entry, &_bound) < 0 || (condition == greaterThan && _entry->number <= _limit)) continue;
+            if ((condition == lessThan && _entry->number >= _limit) || (condition == lessThanEqual && _entry->number > _limit)) {
+                _done = true;
+                break;
+            }
+
+            if (_count == _capacity) {
+                _capacity = _capacity ? _capacity * 2 : 64;
+                uint64_t* _grown = realloc(_ids, _capacity * sizeof(uint64_t));
+                if (!_grown) {
+                    _status = false;
+                    break;
+                }
+                _ids = _grown;
+            }
+            _ids[_count++] = _entry->recordId;
+        }
+
+        if (!_status || _done || _node.header.next == 0) break;
+        _status = read_page(_file, _node.header.next, &_node) && _node.header.leaf;
+    }
+
+    fclose(_file);
+    if (_exclusive) ReleaseSRWLockExclusive(&treeLock);
+    else ReleaseSRWLockShared(&treeLock);
+
+    if (!_status && isnan(_limit)) return 0;
+    if (!_status) {
+        free(_ids);
+        return -1;
+    }
+    *recordIds = _ids;
+    return (int)_count;
+}
+
+// Write a new tree holding every numeric value of key in the collection, replacing the old file.
+// Entries are sorted once and packed into full leaves, then each branch level is built above them.
+bool build_tree(const char* treeFile, const char* key, const char* fileName) {
+    TreeBuild _build = { key, NULL, 0, 0, false };
+    const long long _size = get_file_size(fileName);
+    if (_size < 0 || !walk_frames(fileName, collect_number, &_build) || _build.failed) {
+        free(_build.entries);
+        return false;
+    }
+    // A collection without numbers for the key leaves no entries, and qsort must not see their NULL array
+    if (_build.count > 1) qsort(_build.entries, _build.count, sizeof(TreeEntry), compare_entries);
+
+    char _tempName[MAX_PATH_LEN + 4];
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", treeFile);
+    FILE* _file = fopen(_tempName, "wb+");
+    if (!_file) {
+        free(_build.entries);
+        return false;
+    }
+
+    // Each level is a run of consecutive pages; lowest[i] is the smallest entry under page first + i
+    const size_t _leaves = _build.count ? (_build.count + LEAF_CAPACITY - 1) / LEAF_CAPACITY : 1;
+    TreeEntry* _lowest = malloc(_leaves * sizeof(TreeEntry));
+    TreePage _node;
+    uint32_t _first = 1, _pages = 1, _height = 1;
+    size_t _level = _leaves;
+    bool _status = _lowest != NULL;
+
+    for (size_t i = 0; _status && i < _leaves; i++) {
+        const size_t _start = i * LEAF_CAPACITY;
+        const size_t _end = _start + LEAF_CAPACITY < _build.count ? _start + LEAF_CAPACITY : _build.count;
+        memset(&_node, 0, sizeof(_node));
+        _node.header.leaf = 1;
+        _node.header.count = (uint16_t)(_end - _start);
+        _node.header.next = i + 1 < _leaves ? _pages + 1 : 0;
+        if (_end > _start) memcpy(_node.entries, _build.entries + _start, (_end - _start) * sizeof(TreeEntry));
+        if (_end > _start) _lowest[i] = _build.entries[_start];
+        _status = write_page(_file, _pages++, &_node);
+    }
+
+    // Spread each level's pages evenly over as few parents as will hold them
+    while (_status && _level > 1) {
+        const size_t _parents = (_level + BRANCH_CAPACITY) / (BRANCH_CAPACITY + 1);
+        const uint32_t _parentFirst = _pages;
+        size_t _child = 0;
+
+        for (size_t p = 0; _status && p < _parents; p++) {
+            const size_t _take = _level / _parents + (p < _level % _parents ? 1 : 0);
+            memset(&_node, 0, sizeof(_node));
+            _node.header.count = (uint16_t)(_take - 1);
+            for (size_t c = 0; c < _take; c++) {
+                _node.branch.children[c] = _first + (uint32_t)(_child + c);
+                if (c > 0) _node.branch.separators[c - 1] = _lowest[_child + c];
+            }
+            _lowest[p] = _lowest[_child];
+            _child += _take;
+            _status = write_page(_file, _pages++, &_node);
+        }
+
+        _first = _parentFirst;
+        _level = _parents;
+        _height++;
+    }
+
+    const TreeHeader _header = { TREE_MAGIC, TREE_VERSION, get_applied_lsn(fileName), (uint64_t)_size,
+                                 _build.count, _first, _pages, _height, (uint32_t)strlen(key) };
+    _status = _status && write_header(_file, &_header, key);
+    if (fclose(_file) != 0) _status = false;
+    free(_lowest);
+    free(_build.entries);
+
+    if (!_status || !MoveFileExA(_tempName, treeFile, MOVEFILE_REPLACE_EXISTING)) {
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Insert the documents at recordIds into a tree that range_prepare brought up to date.
+// The header is cleared first, so a tree interrupted halfway never looks current.
+bool extend_tree(const char* treeFile, const char* key, const char* fileName, const uint64_t* recordIds, const int count) {
+    TreeHeader _header;
+    FILE* _file = open_tree(treeFile, key, NULL, "rb+", &_header);
+    if (!_file) return false;
+
+    TreeBuild _build = { key, NULL, 0, 0, false };
+    const long long _size = get_file_size(fileName);
+    bool _status = _size >= 0 && visit_records(fileName, recordIds, count, collect_number, &_build) && !_build.failed;
+
+    if (_status && _build.count > 0) {
+        TreeHeader _pending = _header;
+        _pending.appliedLsn = 0;
+        _pending.coveredLength = 0;
+        _status = write_header(_file, &_pending, key);
+    }
+    for (size_t i = 0; _status && i < _build.count; i++) {
+        _status = insert_entry(_file, &_header, _build.entries[i]);
+    }
+    if (_status) {
+        _header.appliedLsn = get_applied_lsn(fileName);
+        _header.coveredLength = (uint64_t)_size;
+        _status = write_header(_file, &_header, key);
+    }
+
+    if (fclose(_file) != 0) _status = false;
+    free(_build.entries);
+    return _status;
+}
+
+// Insert one entry, splitting the leaf and then its ancestors while they overflow. An entry
+// the tree holds already, as it does for a document updated without changing its number,
+// is left alone.
+bool insert_entry(FILE* file, TreeHeader* header, const TreeEntry entry) {
+    uint32_t _path[MAX_TREE_HEIGHT];
+    uint16_t _slots[MAX_TREE_HEIGHT];
+    int _depth = 0;
+    TreePage _node;
+
+    uint32_t _page = header->root;
+    for (;;) {
+        if (!read_page(file, _page, &_node)) return false;
+        if (_node.header.leaf) break;
+        if (_depth == MAX_TREE_HEIGHT - 1) return false;
+
+        uint16_t _slot = 0;
+        while (_slot < _node.header.count && compare_entries(&_node.branch.separators[_slot], &entry) <= 0) _slot++;
+        _path[_depth] = _page;
+        _slots[_depth++] = _slot;
+        _page = _node.branch.children[_slot];
+    }
+
+    uint16_t _position = 0;
+    while (_position < _node.header.count && compare_entries(&_node.entries[_position], &entry) <= 0) _position++;
+    if (_position > 0 && compare_entries(&_node.entries[_position - 1], &entry) == 0) return true;
+    header->entryCount++;
+
+    if (_node.header.count < LEAF_CAPACITY) {
+        memmove(&_node.entries[_position + 1], &_node.entries[_position], (_node.header.count - _position) * sizeof(TreeEntry));
+        _node.entries[_position] = entry;
+        _node.header.count++;
+        return write_page(file, _page, &_node);
+    }
+
+    // Entries past the end of the last leaf start a new leaf, so ascending inserts fill pages completely
+    TreeEntry _entries[LEAF_CAPACITY + 1];
+    memcpy(_entries, _node.entries, _position * sizeof(TreeEntry));
+    _entries[_position] = entry;
+    memcpy(&_entries[_position + 1], &_node.entries[_position], (LEAF_CAPACITY - _position) * sizeof(TreeEntry));
+    const size_t _keep = _node.header.next == 0 && _position == LEAF_CAPACITY ? LEAF_CAPACITY : (LEAF_CAPACITY + 1) / 2;
+
+    TreePage _right;
+    memset(&_right, 0, sizeof(_right));
+    _right.header.leaf = 1;
+    _right.header.count = (uint16_t)(LEAF_CAPACITY + 1 - _keep);
+    _right.header.next = _node.header.next;
+    memcpy(_right.entries, &_entries[_keep], _right.header.count * sizeof(TreeEntry));
+
+    const uint32_t _rightPage = header->pageCount++;
+    _node.header.count = (uint16_t)_keep;
+    _node.header.next = _rightPage;
+    memcpy(_node.entries, _entries, _keep * sizeof(TreeEntry));
+
+    return write_page(file, _rightPage, &_right) && write_page(file, _page, &_node) &&
+           insert_separator(file, header, _path, _slots, _depth, _right.entries[0], _rightPage);
+}
+
+// Add a separator and the child to its right to the parent at the end of path, splitting upwards
+bool insert_separator(FILE* file, TreeHeader* header, const uint32_t* path, const uint16_t* slots, int depth, TreeEntry separator, uint32_t child) {
+    TreePage _node;
+
+    while (depth > 0) {
+        const uint32_t _page = path[--depth];
+        const uint16_t _slot = slots[depth];
+        if (!read_page(file, _page, &_node)) return false;
+
+        const uint16_t _count = _node.header.count;
+        TreeEntry _separators[BRANCH_CAPACITY + 1];
+        uint32_t _children[BRANCH_CAPACITY + 2];
+        memcpy(_separators, _node.branch.separators, _slot * sizeof(TreeEntry));
+        _separators[_slot] = separator;
+        memcpy(&_separators[_slot + 1], &_node.branch.separators[_slot], (_count - _slot) * sizeof(TreeEntry));
+        memcpy(_children, _node.branch.children, (_slot + 1) * sizeof(uint32_t));
+        _children[_slot + 1] = child;
+        memcpy(&_children[_slot + 2], &_node.branch.children[_slot + 1], (_count - _slot) * sizeof(uint32_t));
+
+        if (_count < BRANCH_CAPACITY) {
+            _node.header.count++;
+            memcpy(_node.branch.separators, _separators, _node.header.count * sizeof(TreeEntry));
+            memcpy(_node.branch.children, _children, (_node.header.count + 1) * sizeof(uint32_t));
+            return write_page(file, _page, &_node);
+        }
+
+        // The middle separator moves up; the branches on either side keep the rest
+        const uint16_t _middle = (BRANCH_CAPACITY + 1) / 2;
+        TreePage _right;
+        memset(&_right, 0, sizeof(_right));
+        _right.header.count = (uint16_t)(BRANCH_CAPACITY - _middle);
+        memcpy(_right.branch.separators, &_separators[_middle + 1], _right.header.count * sizeof(TreeEntry));
+        memcpy(_right.branch.children, &_children[_middle + 1], (_right.header.count + 1) * sizeof(uint32_t));
+
+        _node.header.count = _middle;
+        memcpy(_node.branch.separators, _separators, _middle * sizeof(TreeEntry));
+        memcpy(_node.branch.children, _children, (_middle + 1) * sizeof(uint32_t));
+
+        separator = _separators[_middle];
+        child = header->pageCount++;
+        if (!write_page(file, child, &_right) || !write_page(file, _page, &_node)) return false;
+    }
+
+    // The root itself split: grow the tree by one level
+    memset(&_node, 0, sizeof(_node));
+    _node.header.count = 1;
+    _node.branch.separators[0] = separator;
+    _node.branch.children[0] = header->root;
+    _node.branch.children[1] = child;
+    header->root = header->pageCount++;
+    header->height++;
+    return header->height <= MAX_TREE_HEIGHT && write_page(file, header->root, &_node);
+}
+
+// Descend to the leaf where entries not below bound begin; returns its page, or 0 on error
+uint32_t find_leaf(FILE* file, const TreeHeader* header, const TreeEntry* bound, TreePage* node) {
+    uint32_t _page = header->root;
+    for (uint32_t _level = 0; _level < header->height; _level++) {
+        if (!read_page(file, _page, node)) return 0;
+        if (node->header.leaf) return _page;
+
+        uint16_t _slot = 0;
+        while (_slot < node->header.count && compare_entries(&node->branch.separators[_slot], bound) <= 0) _slot++;
+        _page = node->branch.children[_slot];
+    }
+    return 0;
+}
+
+// Open a tree file whose header is valid for key. Unless fileName is NULL, the tree must
+// also cover that collection exactly as it is now.
+FILE* open_tree(const char* treeFile, const char* key, const char* fileName, const char* mode, TreeHeader* header) {
+    FILE* _file = fopen(treeFile, mode);
+    if (!_file) return NULL;
+
+    const size_t _keyLength = strlen(key);
+    char _key[TREE_PAGE_SIZE];
+    const bool _valid = fread(header, sizeof(*header), 1, _file) == 1 &&
+                        memcmp(header->magic, TREE_MAGIC, sizeof(header->magic)) == 0 &&
+                        header->version == TREE_VERSION && header->keyLength == _keyLength &&
+                        _keyLength <= TREE_PAGE_SIZE - sizeof(*header) &&
+                        fread(_key, 1, _keyLength, _file) == _keyLength && memcmp(_key, key, _keyLength) == 0 &&
+                        header->root > 0 && header->root < header->pageCount &&
+                        (!fileName || (header->appliedLsn == get_applied_lsn(fileName) &&
+                                       (long long)header->coveredLength == get_file_size(fileName)));
+    if (!_valid) {
+        fclose(_file);
+        return NULL;
+    }
+    return _file;
+}
+
+bool read_page(FILE* file, const uint32_t page, TreePage* node) {
+    return page > 0 && fseek(file, (long)page * TREE_PAGE_SIZE, SEEK_SET) == 0 &&
+           fread(node, sizeof(*node), 1, file) == 1 &&
+           node->header.count <= (node->header.leaf ? LEAF_CAPACITY : BRANCH_CAPACITY);
+}
+
+bool write_page(FILE* file, const uint32_t page, const TreePage* node) {
+    return fseek(file, (long)page * TREE_PAGE_SIZE, SEEK_SET) == 0 && fwrite(node, sizeof(*node), 1, file) == 1;
+}
+
+bool write_header(FILE* file, const TreeHeader* header, const char* key) {
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(header, sizeof(*header), 1, file) == 1 &&
+           fwrite(key, 1, header->keyLength, file) == header->keyLength && fflush(file) == 0;
+}
+
+// Frame visitor: collect the number a document holds for the key
+bool collect_number(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    TreeBuild* _build = context;
+    double _number;
+    if (!document_number(header, frame, length, _build->key, &_number)) return true;
+
+    if (_build->count == _build->capacity) {
+        const size_t _capacity = _build->capacity ? _build->capacity * 2 : 256;
+        TreeEntry* _grown = realloc(_build->entries, _capacity * sizeof(TreeEntry));
+        if (!_grown) {
+            _build->failed = true;
+            return false;
+        }
+        _build->entries = _grown;
+        _build->capacity = _capacity;
+    }
+    _build->entries[_build->count++] = (TreeEntry){ _number, recordId };
+    return true;
+}
+
+// Read the number a document holds for key; false if the field is missing or not a number
+bool document_number(const CollectionHeader* header, const char* frame, const size_t length, const char* key, double* number) {
+    if (header->version >= 3) {
+        DocumentValue _value;
+        if (!find_field((const uint8_t*)frame, length, key, &_value) || _value.type != valueNumber) return false;
+        *number = _value.number;
+        return true;
+    }
+
+    // Text frames predate the binary encoding and are parsed to find the field
+    cJSON* _document = cJSON_ParseWithLength(frame, length);
+    const cJSON* _field = cJSON_GetObjectItem(_document, key);
+    const bool _indexed = cJSON_IsNumber(_field);
+    if (_indexed) *number = _field->valuedouble;
+    cJSON_Delete(_document);
+    return _indexed;
+}
+
+// Order entries by number, then by record id
+int compare_entries(const void* left, const void* right) {
+    const TreeEntry* _left = left;
+    const TreeEntry* _right = right;
+    if (_left->number != _right->number) return _left->number < _right->number ? -1 : 1;
+    return (_left->recordId > _right->recordId) - (_left->recordId < _right->recordId);
+}
@@ -0,0 +1,62 @@
+#ifndef RANGE_INDEX_H
+#define RANGE_INDEX_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define TREE_MAGIC "PDBT"
+#define TREE_VERSION 1
+#define TREE_PAGE_SIZE 4096
+
+// One indexed document: the number it holds for the key and its record id.
+// Entries are ordered by number, then by record id, so equal numbers stay distinct.
+typedef struct {
+    double number;
+    uint64_t recordId;
+} TreeEntry;
+
+// Page 0 of every tree file, followed by the indexed key
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    uint64_t entryCount;
+    uint32_t root;
+    uint32_t pageCount;
+    uint32_t height;
+    uint32_t keyLength;
+} TreeHeader;
+
+// Start of every node page. Leaves link to their right sibling; page 0 means none.
+typedef struct {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t next;
+} NodeHeader;
+
+#define LEAF_CAPACITY ((TREE_PAGE_SIZE - sizeof(NodeHeader)) / sizeof(TreeEntry))
+#define BRANCH_CAPACITY ((TREE_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint32_t)) / (sizeof(TreeEntry) + sizeof(uint32_t)))
+
+// A node page. Child i of a branch holds the entries below separator i, the last child the rest.
+typedef struct {
+    NodeHeader header;
+    union {
+        TreeEntry entries[LEAF_CAPACITY];
+        struct {
+            TreeEntry separators[BRANCH_CAPACITY];
+            uint32_t children[BRANCH_CAPACITY + 1];
+        } branch;
+    };
+} TreePage;
+
+bool document_number(const CollectionHeader* header, const char* frame, size_t length, const char* key, double* number);
+void range_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, int count);
+bool range_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error);
+bool range_drop(const char* databaseName, const char* collectionName, const char* key, char* error);
+void range_drop_collection(const char* databaseName, const char* collectionName);
+int range_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, Condition condition, const char* fileName, uint64_t** recordIds);
+void range_prepare(const char* databaseName, const char* collectionName, const char* fileName);
+void range_rebuild(const char* databaseName, const char* collectionName, const char* fileName);
+
+#endif //RANGE_INDEX_H
@@ -1,13 +1,66 @@
 #include <direct.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "StorageEngine.h"
+#include "Arena.h"
+#include "BufferPool.h"
+#include "CollectionCache.h"
+#include "ColumnStore.h"
+#include "Compactor.h"
+#include "DocumentCodec.h"
+#include "HashIndex.h"
+#include "LsmStore.h"
+#include "PageStore.h"
+#include "Predicate.h"
+#include "PrimaryIndex.h"
+#include "Projection.h"
+#include "RangeIndex.h"
+#include "WriteAheadLog.h"
+#include "ZoneMap.h"
 
-// Global path buffers used across operations
-static char filePath[MAX_PATH_LEN];
-static char metaFile[MAX_PATH_LEN];
-static char databaseMeta[MAX_PATH_LEN];
-static char error[MAX_ERROR_LEN];
+// Global path buffers used across operations, one set per calling thread
+static _Thread_local char filePath[MAX_PATH_LEN];
+static _Thread_local char metaFile[MAX_PATH_LEN];
+static _Thread_local char databaseMeta[MAX_PATH_LEN];
+static _Thread_local char error[MAX_ERROR_LEN];
+
+// The structures a key of a collection can be given to speed up its filters
+typedef enum {
+    indexHash,
+    indexRange,
+    indexZone,
+    indexColumn
+} IndexKind;
+
+static const char* const indexNames[] = { "Index", "Range index", "Zone map", "Column" };
+
+// Documents of a packed print as they are gathered: their text, and the table of where each lies
+typedef struct {
+    ByteBuffer text;
+    ByteBuffer entries;
+    bool failed;
+} PackedResult;
+
+// Local helper functions
+Output apply_insert(QueryConfig config, uint64_t lsn);
+Output apply_remove(QueryConfig config, uint64_t lsn);
+Output apply_update(QueryConfig config, uint64_t lsn);
+bool by_id(QueryConfig* config, char* message);
+Output create_collection_file(QueryConfig config, CollectionStorage storage);
+Output create_key_index(QueryConfig config, IndexKind kind);
+Output drop_key_index(QueryConfig config, IndexKind kind);
+bool pack_document(const char* document, size_t length, void* context);
+Output set_bloom_filter(QueryConfig config, bool create);
+void finish_compaction(QueryConfig config);
+int filter_candidates(QueryConfig config, const Predicate* predicate, uint64_t** recordIds);
+int index_candidates(QueryConfig config, uint64_t** recordIds);
+ArrayOut query_documents(QueryConfig config, DocumentVisitor visitor, void* context);
+void rebuild_indexes(QueryConfig config);
+void replay_mutation(WalOperation operation, QueryConfig config, uint64_t lsn);
+Output run_mutation(QueryConfig config, WalOperation operation);
+bool upgrade_collection(QueryConfig config);
 
 /// @brief Creates a new database directory and registers it in the metadata.
 /// @param config QueryConfig containing databaseName
@@ -53,13 +106,30 @@ export Output drop_database(const QueryConfig config) {
         return output;
     }
 
+    // Close the write-ahead log so its file can be deleted with the database, even a log
+    // that failed and closed the database
+    WalDatabase* _wal = wal_find(config.databaseName);
+    if (_wal) {
+        wal_acquire(_wal, true);
+        wal_close(_wal);
+    }
+    cache_invalidate(config.databaseName, NULL);
+    index_invalidate(config.databaseName, NULL);
+    column_invalidate(config.databaseName, NULL);
+    primary_invalidate(config.databaseName, NULL);
+
     get_database_dir(filePath, config.databaseName);
     get_database_meta(databaseMeta);
+    page_invalidate(filePath);
+    lsm_invalidate(filePath);
 
     // Delete all files in database and remove the directory
     delete_dir_content(filePath);
 
-    if (_rmdir(filePath) != 0 || !remove_entry(databaseMeta, config.databaseName, database, error)) {
+    const bool _dropped = _rmdir(filePath) == 0 && remove_entry(databaseMeta, config.databaseName, database, error);
+    if (_wal) wal_release(_wal, true);
+
+    if (!_dropped) {
         get_message(output.message, "fatal: Failed to drop database \n%s", error);
         return output;
     }
@@ -87,10 +157,19 @@ export ArrayOut list_database() {
 }
 
 /// @brief Creates a new collection in a database.
-/// @param config QueryConfig with databaseName and collectionName
+/// @details Collections store their documents in pages unless data is "lsm", which gives the
+///          collection an LSM tree instead: inserts, updates and removes only go into memory
+///          and are written out as sorted segment files in bulk, for insert-heavy collections.
+/// @param config QueryConfig with databaseName, collectionName and optionally the storage as data
 /// @return Output with success flag and status message
 export Output create_collection(const QueryConfig config) {
     Output output = NEW_OUTPUT;
+    const bool _lsm = config.data && _stricmp(config.data, LSM_STORAGE_NAME) == 0;
+
+    if (config.data && *config.data && !_lsm) {
+        get_message(output.message, "warning: Unknown storage '%s'", config.data);
+        return output;
+    }
 
     if (!check_database(config.databaseName)) {
         get_message(output.message,"fatal: Database '%s' does not exist", config.databaseName);
@@ -103,25 +182,15 @@ export Output create_collection(const QueryConfig config) {
         return output;
     }
 
-    get_col_meta(metaFile, config.databaseName);
-    get_col_file(filePath, config.databaseName, config.collectionName);
-
-    // Append collection entry to metadata
-    if (!append_entry(metaFile, config.collectionName, filePath, collection, error)) {
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
         get_message(output.message, "fatal: Collection could not be created\n%s", error);
         return output;
     }
 
-    // Create empty JSON array and dump to file
-    cJSON* _data = cJSON_CreateArray();
-    if (!_data || !dump_binary(filePath, _data, error)) {
-        get_message(output.message, "fatal: Collection could not be created\n%s", error);
-    } else {
-        get_message(output.message,"Collection '%s' created", config.collectionName);
-        output.success = true;
-    }
-
-    cJSON_Delete(_data);
+    wal_acquire(_wal, true);
+    output = create_collection_file(config, _lsm ? storageLsm : storagePages);
+    wal_release(_wal, true);
     return output;
 }
 
@@ -136,17 +205,36 @@ export Output drop_collection(const QueryConfig config) {
         return output;
     }
 
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Could not delete collection '%s'\n %s", config.collectionName, error);
+        return output;
+    }
+
+    // Checkpoint first so that recovery never replays mutations into a dropped collection
+    wal_acquire(_wal, true);
     get_col_meta(metaFile, config.databaseName);
 
-    if (remove_entry(metaFile, config.collectionName, collection, error)) {
+    if (!wal_checkpoint(_wal, error)) {
+        get_message(output.message, "fatal: Could not delete collection '%s'\n %s", config.collectionName, error);
+    } else if (remove_entry(metaFile, config.collectionName, collection, error)) {
         get_col_file(filePath, config.databaseName, config.collectionName);
         remove(filePath);
+        page_invalidate(filePath);
+        lsm_drop(filePath);
+        cache_invalidate(config.databaseName, config.collectionName);
+        index_drop_collection(config.databaseName, config.collectionName);
+        range_drop_collection(config.databaseName, config.collectionName);
+        zone_drop_collection(config.databaseName, config.collectionName);
+        column_drop_collection(config.databaseName, config.collectionName);
+        primary_drop_collection(config.databaseName, config.collectionName);
         get_message(output.message, "Collection '%s' dropped", config.collectionName);
         output.success = true;
     } else {
         get_message(output.message, "fatal: Could not delete collection '%s'\n %s", config.collectionName, error);
     }
 
+    wal_release(_wal, true);
     return output;
 }
 
@@ -169,187 +257,921 @@ export ArrayOut list_collection(const QueryConfig config) {
 }
 
 /// @brief Inserts one or more JSON documents into a collection.
+/// @details Documents go into free space left by removed documents or onto new pages, so
+///          the cost of an insert depends only on the size of the inserted documents. Each
+///          document is given the next "_id" of the collection, replacing any id it carries.
 /// @param config QueryConfig with databaseName, collectionName, and data (JSON string)
 /// @return Output with success flag and message
 export Output insert_document(const QueryConfig config) {
+    return run_mutation(config, walInsert);
+}
+
+/// @brief Prints all documents in a collection.
+/// @param config QueryConfig with databaseName and collectionName
+/// @return ArrayOut with stringified documents or error
+export ArrayOut print_all_documents(const QueryConfig config) {
+    return print_documents(config);
+}
+
+/// @brief Prints documents that match a filter condition.
+/// @details With a limit, an offset or a resume token only one page of the matches is
+/// printed, read straight from the collection file so memory is bounded by the page. The
+/// page ends with the token the next page goes on from in resume, which is left empty
+/// once no match follows.
+/// @param config QueryConfig with filter params, the fields to print as projection, and
+/// limit, offset and resume for paging
+/// @return ArrayOut with matching documents
+export ArrayOut print_documents(const QueryConfig config) {
+    return query_documents(config, NULL, NULL);
+}
+
+/// @brief Hands each document that matches a filter to a visitor, one at a time.
+/// @details Documents are printed as compact JSON into a buffer reused for every document and
+/// passed to the visitor with their length, so no memory is allocated per document and the
+/// text is only valid during the call. Binary documents are written from their encoding
+/// without being decoded. The visitor returns false to end the query. It runs while the
+/// database is locked for reading and must not call back into the engine. Filters,
+/// projection and paging apply as in print_documents.
+/// @param config QueryConfig as for print_documents
+/// @param visitor Called with each matching document, its length and context
+/// @param context Passed through to the visitor
+/// @return ArrayOut with the number of documents visited in size, no list, and the resume
+/// token of a paged query
+export ArrayOut visit_documents(const QueryConfig config, const DocumentVisitor visitor, void* context) {
+    if (!visitor) {
+        ArrayOut arrayOut = NEW_ARRAY_OUT;
+        get_message(arrayOut.message, "fatal: No visitor given");
+        arrayOut.size = -1;
+        return arrayOut;
+    }
+    return query_documents(config, visitor, context);
+}
+
+/// @brief Prints documents that match a filter condition into a single block.
+/// @details The documents are compact JSON laid one after another in one buffer, followed by
+/// a table of the offset and length of each, so a large read costs a handful of allocations
+/// rather than one per document and is released with a single free_packed. Filters,
+/// projection and paging apply as in print_documents.
+/// @param config QueryConfig as for print_documents
+/// @return PackedOut with the block and its table of documents, or error
+export PackedOut print_packed_documents(const QueryConfig config) {
+    PackedOut packedOut = NEW_PACKED_OUT;
+    PackedResult _packed = { 0 };
+    const ArrayOut _visited = query_documents(config, pack_document, &_packed);
+
+    // The table goes after the text, aligned for its entries
+    const size_t _padding = (sizeof(uint32_t) - _packed.text.size % sizeof(uint32_t)) % sizeof(uint32_t);
+    if (!_packed.failed && _visited.size > 0 && buffer_reserve(&_packed.text, _padding + _packed.entries.size)) {
+        memset(_packed.text.data + _packed.text.size, 0, _padding);
+        _packed.text.size += _padding;
+        memcpy(_packed.text.data + _packed.text.size, _packed.entries.data, _packed.entries.size);
+
+        packedOut.size = _visited.size;
+        packedOut.block = (char*)_packed.text.data;
+        packedOut.entries = (PackedEntry*)(_packed.text.data + _packed.text.size);
+        memcpy(packedOut.resume, _visited.resume, sizeof(packedOut.resume));
+    } else {
+        free(_packed.text.data);
+        packedOut.size = _visited.size > 0 ? -1 : _visited.size;
+        if (_visited.size > 0) get_message(packedOut.message, "fatal: Failed to print document \nfatal: Memory allocation failed");
+        else memcpy(packedOut.message, _visited.message, sizeof(packedOut.message));
+    }
+    free(_packed.entries.data);
+    return packedOut;
+}
+
+/// @brief Prints the document with the given id.
+/// @details The id index locates the document, so only that document is read.
+/// @param config QueryConfig with databaseName, collectionName and the id as value
+/// @return ArrayOut with the document or error
+export ArrayOut print_document_by_id(QueryConfig config) {
+    ArrayOut arrayOut = NEW_ARRAY_OUT;
+    if (!by_id(&config, arrayOut.message)) {
+        arrayOut.size = -1;
+        return arrayOut;
+    }
+    return print_documents(config);
+}
+
+/// @brief Prints the document with the given id into a single block, as print_packed_documents.
+/// @param config QueryConfig with databaseName, collectionName and the id as value
+/// @return PackedOut with the document or error
+export PackedOut print_packed_document_by_id(QueryConfig config) {
+    PackedOut packedOut = NEW_PACKED_OUT;
+    if (!by_id(&config, packedOut.message)) {
+        packedOut.size = -1;
+        return packedOut;
+    }
+    return print_packed_documents(config);
+}
+
+/// @brief Removes documents based on a filter condition.
+/// @details The slots of removed documents are freed in place; later inserts reuse them.
+/// @param config QueryConfig with key, value, and condition
+/// @return Output with success status and removal count
+export Output remove_documents(const QueryConfig config) {
+    return run_mutation(config, walRemove);
+}
+
+/// @brief Removes all documents (alias for remove_documents).
+export Output remove_all_documents(const QueryConfig config) {
+    return remove_documents(config);
+}
+
+/// @brief Removes the document with the given id.
+/// @param config QueryConfig with databaseName, collectionName and the id as value
+/// @return Output with success status and removal count
+export Output remove_document_by_id(QueryConfig config) {
     Output output = NEW_OUTPUT;
-    get_col_file(filePath, config.databaseName, config.collectionName);
+    if (!by_id(&config, output.message)) return output;
+    return remove_documents(config);
+}
 
-    cJSON* _root = load_binary(filePath, error);
-    if (!_root) {
-        create_collection(config);
-        _root = cJSON_CreateArray();
+/// @brief Updates documents matching a filter with given data and action.
+/// @details Documents are rewritten in place when their page has room for them, so the
+///          cost of an update depends on the documents changed, not on the collection.
+/// @param config QueryConfig with update info
+/// @return Output with update count or error
+export Output update_documents(const QueryConfig config) {
+    Output output = NEW_OUTPUT;
+
+    if (!config.databaseName || !config.collectionName || !config.data) {
+        get_message(output.message,"fatal: Missing required query parameters");
+        return output;
     }
 
-    cJSON* _parsedDocument = cJSON_Parse(config.data);
-    if (!_parsedDocument) {
-        get_message(output.message, "fatal: Failed to parse document \n%s", error);
-        cJSON_Delete(_root);
+    return run_mutation(config, walUpdate);
+}
+
+/// @brief Updates all documents (alias for update_documents).
+export Output update_all_documents(const QueryConfig config) {
+    return update_documents(config);
+}
+
+/// @brief Applies an update action to the document with the given id.
+/// @details The "_id" field itself cannot be changed.
+/// @param config QueryConfig with databaseName, collectionName, the id as value, action and data
+/// @return Output with update count or error
+export Output update_document_by_id(QueryConfig config) {
+    Output output = NEW_OUTPUT;
+    if (!by_id(&config, output.message)) return output;
+    return update_documents(config);
+}
+
+/// @brief Rewrites a collection file in the current binary log format.
+/// @details Collections are also converted on their next insert; this converts one eagerly,
+///          keeping its applied LSN so the write-ahead log is not replayed into it again.
+///          An LSM collection has its segments merged into one instead.
+/// @param config QueryConfig with databaseName and collectionName
+/// @return Output with success flag and message
+export Output convert_collection(const QueryConfig config) {
+    Output output = NEW_OUTPUT;
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
         return output;
     }
 
-    int _insertedCount = 0;
+    wal_acquire(_wal, true);
+    get_col_file(filePath, config.databaseName, config.collectionName);
 
-    // Insert based on whether input is array or object
-    if (cJSON_IsArray(_parsedDocument)) {
-        cJSON* _item = NULL;
-        cJSON_ArrayForEach(_item, _parsedDocument) {
-            cJSON* _copy = cJSON_Duplicate(_item, 1);
-            if (_copy) {
-                cJSON_AddItemToArray(_root, _copy);
-                _insertedCount++;
-            }
-        }
-    } else if (cJSON_IsObject(_parsedDocument)) {
-        cJSON* _copy = cJSON_Duplicate(_parsedDocument, 1);
-        if (_copy) {
-            cJSON_AddItemToArray(_root, _copy);
-            _insertedCount++;
+    // Documents keep their ids, which are their record ids, so the indexes stay as they are
+    if (get_collection_storage(filePath) == storageLsm) {
+        if (lsm_merge(filePath, error)) {
+            get_message(output.message, "Collection '%s' converted", config.collectionName);
+            output.success = true;
+        } else {
+            get_message(output.message, "fatal: Failed to convert collection\n%s", error);
         }
+        wal_release(_wal, true);
+        return output;
+    }
+
+    cJSON* _collection = load_binary(filePath, error);
+
+    if (!_collection || !cJSON_IsArray(_collection)) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
+    } else if (!dump_binary(filePath, _collection, get_applied_lsn(filePath), error)) {
+        get_message(output.message, "fatal: Failed to convert collection\n%s", error);
     } else {
-        get_message(output.message, "fatal: Document must be a JSON object or array of objects\n%s", error);
+        rebuild_indexes(config);
+        get_message(output.message, "Collection '%s' converted", config.collectionName);
+        output.success = true;
+    }
+
+    cJSON_Delete(_collection);
+    wal_release(_wal, true);
+    return output;
+}
+
+/// @brief Creates a hash index on a document key of a collection.
+/// @details Equality filters on the key then read only the documents the index points to.
+///          The index is persisted next to the collection and kept current by every mutation.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output create_index(const QueryConfig config) {
+    return create_key_index(config, indexHash);
+}
+
+/// @brief Creates an ordered (B+tree) index on the numeric values of a document key.
+/// @details Range filters (greater/less than) on the key then walk only the matching key range.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output create_range_index(const QueryConfig config) {
+    return create_key_index(config, indexRange);
+}
+
+/// @brief Drops a hash index from a collection.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output drop_index(const QueryConfig config) {
+    return drop_key_index(config, indexHash);
+}
+
+/// @brief Drops an ordered index from a collection.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output drop_range_index(const QueryConfig config) {
+    return drop_key_index(config, indexRange);
+}
+
+/// @brief Keeps the smallest and largest number of a document key per block of a collection.
+/// @details Range filters (greater/less than) on the key that no range index answers then
+///          skip the blocks whose bounds rule every document out. Suits keys whose values
+///          follow insertion order, such as timestamps or counters.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output create_zone_map(const QueryConfig config) {
+    return create_key_index(config, indexZone);
+}
+
+/// @brief Drops a zone map from a collection.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output drop_zone_map(const QueryConfig config) {
+    return drop_key_index(config, indexZone);
+}
+
+/// @brief Keeps the numbers of a document key in a shadow column of the collection.
+/// @details Range and not-equal filters on the key then run over a contiguous array of
+///          numbers instead of the documents, and only read the documents that match. The
+///          column is held in memory and kept current by every mutation.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output create_column(const QueryConfig config) {
+    return create_key_index(config, indexColumn);
+}
+
+/// @brief Drops a shadow column from a collection.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output drop_column(const QueryConfig config) {
+    return drop_key_index(config, indexColumn);
+}
+
+/// @brief Keeps Bloom filters on the values of a document key in the segments of an LSM collection.
+/// @details Equality filters on the key then only read the segments that may hold the value.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output create_bloom_filter(const QueryConfig config) {
+    return set_bloom_filter(config, true);
+}
+
+/// @brief Drops the Bloom filters on a document key from an LSM collection.
+/// @param config QueryConfig with databaseName, collectionName and key
+/// @return Output with success flag and message
+export Output drop_bloom_filter(const QueryConfig config) {
+    return set_bloom_filter(config, false);
+}
+
+/// @brief Sets the memory cap of the parsed-collection cache.
+/// @details Least recently used collections are evicted to stay under the cap; collections
+///          larger than the cap are loaded for each call and not kept.
+/// @param limitBytes Cache size in bytes (0 disables caching)
+export void configure_cache(const long long limitBytes) {
+    cache_set_limit(limitBytes);
+}
+
+/// @brief Sets the memory cap of the page buffer pool.
+/// @details Pages are evicted in clock order to stay under the cap, writing back those
+///          changed since the last checkpoint; the cap is only exceeded while every page is in use.
+/// @param limitBytes Pool size in bytes (0 keeps no page between calls)
+export void configure_buffer_pool(const long long limitBytes) {
+    pool_set_limit(limitBytes);
+}
+
+/// @brief Turns on background compaction of collections with free space in their pages.
+/// @details Removes and updates only free space in place; a worker thread copies a collection
+///          whose free space exceeds the given share of its pages into a fresh file, without
+///          blocking readers, and swaps it in.
+/// @param freeRatio Share of free space (0 to 1) that triggers compaction (0 turns it off)
+/// @param bytesPerSecond Bandwidth the copy may use (0 for no limit)
+export void configure_compaction(const double freeRatio, const long long bytesPerSecond) {
+    compaction_configure(freeRatio, bytesPerSecond, replay_mutation, finish_compaction);
+}
+
+/// @brief Reads the counters of the page buffer pool.
+/// @return BufferPoolStats with hits, misses, evictions, write-backs and bytes in use
+export BufferPoolStats buffer_pool_stats(void) {
+    return pool_stats();
+}
+
+/// @brief Frees memory allocated to document string lists.
+/// @param list char** list to free
+/// @param size number of elements
+export void free_list(char** list, const int size) {
+    for (int i = 0; i < size; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+/// @brief Releases the block of a PackedOut.
+export void free_packed(char* block) {
+    free(block);
+}
+
+// Log a mutation, apply it to its collection and wait for the log to be durable.
+// Mutations of a database are applied in LSN order under its exclusive lock, while the
+// wait for the fsync happens outside the lock so that concurrent writers commit together.
+Output run_mutation(const QueryConfig config, const WalOperation operation) {
+    Output output = NEW_OUTPUT;
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
         return output;
     }
 
-    if (!dump_binary(filePath, _root, error)) {
-        get_message(output.message, "fatal: Failed to insert document \n%s", error);
+    wal_acquire(_wal, true);
+    const uint64_t _lsn = wal_append(_wal, operation, config, error);
+    if (_lsn == 0) {
+        wal_release(_wal, true);
+        get_message(output.message, "fatal: Failed to log mutation\n%s", error);
         return output;
     }
 
-    output.success = true;
-    get_message(output.message, "Inserted %d", _insertedCount);
-    cJSON_Delete(_parsedDocument);
-    cJSON_Delete(_root);
+    switch (operation) {
+        case walInsert: output = apply_insert(config, _lsn); break;
+        case walRemove: output = apply_remove(config, _lsn); break;
+        case walUpdate: output = apply_update(config, _lsn); break;
+    }
+    wal_release(_wal, true);
+
+    // Readers may already see the mutation, yet it may not survive a crash: its outcome is
+    // unknown, and the database stays closed until a new process recovers what reached disk
+    if (!wal_commit(_wal, _lsn, error)) {
+        output.success = false;
+        get_message(output.message, "fatal: Mutation applied but not made durable, its outcome is unknown\n%s", error);
+    }
     return output;
 }
 
-/// @brief Prints all documents in a collection.
-/// @param config QueryConfig with databaseName and collectionName
-/// @return ArrayOut with stringified documents or error
-export ArrayOut print_all_documents(const QueryConfig config) {
-    return print_documents(config);
+// Re-apply a mutation recovered from the write-ahead log
+void replay_mutation(const WalOperation operation, const QueryConfig config, const uint64_t lsn) {
+    switch (operation) {
+        case walInsert: apply_insert(config, lsn); break;
+        case walRemove: apply_remove(config, lsn); break;
+        case walUpdate: apply_update(config, lsn); break;
+    }
 }
 
-/// @brief Prints documents that match a filter condition.
-/// @param config QueryConfig with filter params
-/// @return ArrayOut with matching documents
-export ArrayOut print_documents(const QueryConfig config) {
-    ArrayOut arrayOut = NEW_ARRAY_OUT;
-    get_col_file(filePath, config.databaseName, config.collectionName);
+// Add a document to a packed print; offsets are kept to 32 bits, so a block stops short of 4 GiB
+bool pack_document(const char* document, const size_t length, void* context) {
+    PackedResult* _packed = context;
+    const PackedEntry _entry = { (uint32_t)_packed->text.size, (uint32_t)length };
+    if (length + 1 + sizeof(uint32_t) + sizeof(_entry) > UINT32_MAX - _packed->text.size - _packed->entries.size ||
+        !buffer_reserve(&_packed->text, length + 1) || !buffer_reserve(&_packed->entries, sizeof(_entry))) {
+        _packed->failed = true;
+        return false;
+    }
 
-    cJSON* _collection = load_binary(filePath, error);
-    if (!_collection) {
+    memcpy(_packed->text.data + _packed->text.size, document, length + 1);
+    _packed->text.size += length + 1;
+    memcpy(_packed->entries.data + _packed->entries.size, &_entry, sizeof(_entry));
+    _packed->entries.size += sizeof(_entry);
+    return true;
+}
+
+// Print the documents of a query, or hand them to a visitor when one is given. Filters on an
+// indexed key, pruned filters and paged queries read the collection file, others the cache.
+ArrayOut query_documents(const QueryConfig config, const DocumentVisitor visitor, void* context) {
+    ArrayOut arrayOut = NEW_ARRAY_OUT;
+    // An empty result reports the error text, which must not be left from an earlier call
+    error[0] = '\0';
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
         get_message(arrayOut.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
         arrayOut.size = -1;
         return arrayOut;
     }
 
-    if (!cJSON_IsArray(_collection)) {
-        get_message(arrayOut.message,"fatal: Malformed array in collection '%s'\n%s", config.databaseName, error);
+    ResultPage _page;
+    if (!read_result_page(&config, &_page, error)) {
+        get_message(arrayOut.message, "fatal: Failed to print document \n%s", error);
+        arrayOut.size = -1;
+        return arrayOut;
+    }
+    const bool _paged = _page.limit > 0 || _page.offset > 0 || _page.from;
+
+    Predicate _predicate;
+    if (!compile_predicate(&config, &_predicate, error)) {
+        get_message(arrayOut.message, "fatal: Failed to print document \n%s", error);
         arrayOut.size = -1;
-        cJSON_Delete(_collection);
         return arrayOut;
     }
 
+    // Only the projected fields of each matching document are built and printed
+    Projection _projection;
+    if (!compile_projection(&config, &_projection, error)) {
+        release_predicate(&_predicate);
+        get_message(arrayOut.message, "fatal: Failed to print document \n%s", error);
+        arrayOut.size = -1;
+        return arrayOut;
+    }
+
+    wal_acquire(_wal, false);
+    get_col_file(filePath, config.databaseName, config.collectionName);
     char** _list = NULL;
-    arrayOut.size = print_filtered_documents(_collection, config.key, config.value, config.condition, &_list, error);
+
+    // Filters on an indexed key only read the candidate documents
+    uint64_t* _recordIds = NULL;
+    const int _candidates = filter_candidates(config, &_predicate, &_recordIds);
+
+    // Equality filters on a key with Bloom filters only read the segments that may hold the value,
+    // range filters on a key with a zone map only the blocks that may hold a match
+    const bool _single = _predicate.kind == predicateMatch && _predicate.key;
+    const bool _pruned = _candidates < 0 && _single && _predicate.condition == equal && lsm_filtered(filePath, _predicate.key);
+    RecordSpan* _spans = NULL;
+    const int _spanCount = _candidates < 0 && _single ?
+        zone_lookup(config.databaseName, config.collectionName, _predicate.key, _predicate.value, _predicate.condition, filePath, &_spans) : -1;
+
+    // Collections too large to keep resident, and pages, are filtered straight from the file
+    cJSON* _collection = NULL;
+    CacheEntry* _entry = _candidates < 0 && !_pruned && _spanCount < 0 && !_paged ? cache_find(config.databaseName, config.collectionName, &_collection) : NULL;
+    const long long _fileSize = _entry ? 0 : get_file_size(filePath);
+
+    // The documents read are built in the arena of the thread (see Arena.c); the cache entry
+    // is acquired outside it, as its tree outlives the read
+    if (_candidates >= 0) {
+        arena_begin();
+        arrayOut.size = fetch_filtered_documents(filePath, _recordIds, _candidates, &_predicate, &_projection, &_page, visitor, context, &_list, error);
+        arena_end();
+        free(_recordIds);
+        wal_release(_wal, false);
+    } else if (_paged || _pruned || _spanCount >= 0 || (!_entry && _fileSize > 0 && !cache_admits(_fileSize))) {
+        arena_begin();
+        arrayOut.size = scan_filtered_documents(filePath, _spans, _spanCount, &_predicate, &_projection, &_page, visitor, context, &_list, error);
+        arena_end();
+        free(_spans);
+        wal_release(_wal, false);
+    } else {
+        if (!_entry) _entry = cache_acquire(config.databaseName, config.collectionName, &_collection, error);
+        if (!_entry) {
+            wal_release(_wal, false);
+            release_predicate(&_predicate);
+            release_projection(&_projection);
+            get_message(arrayOut.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
+            arrayOut.size = -1;
+            return arrayOut;
+        }
+
+        if (!cJSON_IsArray(_collection)) {
+            get_message(arrayOut.message,"fatal: Malformed array in collection '%s'\n%s", config.databaseName, error);
+            arrayOut.size = -1;
+            cache_release(_entry, false);
+            wal_release(_wal, false);
+            release_predicate(&_predicate);
+            release_projection(&_projection);
+            return arrayOut;
+        }
+
+        arena_begin();
+        arrayOut.size = print_filtered_documents(_collection, &_predicate, &_projection, visitor, context, &_list, error);
+        arena_end();
+        cache_release(_entry, false);
+        wal_release(_wal, false);
+    }
+    release_predicate(&_predicate);
+    release_projection(&_projection);
+
     if (arrayOut.size < 0) {
         get_message(arrayOut.message,"fatal: Failed to print document \n%s", error);
     } else if (arrayOut.size == 0) {
         get_message(arrayOut.message, "fatal: Collection '%s' contains no documents\n%s", config.collectionName, error);
     } else {
         arrayOut.list = _list;
+        memcpy(arrayOut.resume, _page.resume, sizeof(arrayOut.resume));
     }
 
-    cJSON_Delete(_collection);
     return arrayOut;
 }
 
-/// @brief Removes documents based on a filter condition.
-/// @param config QueryConfig with key, value, and condition
-/// @return Output with success status and removal count
-export Output remove_documents(const QueryConfig config) {
+// Register a collection and write its empty log, or the empty manifest of its LSM tree.
+// The database lock must be held exclusively.
+Output create_collection_file(const QueryConfig config, const CollectionStorage storage) {
     Output output = NEW_OUTPUT;
+    get_col_meta(metaFile, config.databaseName);
     get_col_file(filePath, config.databaseName, config.collectionName);
 
-    cJSON* _collection = load_binary(filePath, error);
-    if (!_collection || !cJSON_IsArray(_collection)) {
-        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
-        if (_collection) cJSON_Delete(_collection);
+    // Append collection entry to metadata
+    if (!append_entry(metaFile, config.collectionName, filePath, collection, error)) {
+        get_message(output.message, "fatal: Collection could not be created\n%s", error);
         return output;
     }
 
-    const int _deletedCount = remove_filtered_documents(_collection, config.key, config.value, config.condition, error);
-    if (_deletedCount > 0 && dump_binary(filePath, _collection, error)) {
-        get_message(output.message, "Document removed %d", _deletedCount);
-        output.success = true;
-    } else if (_deletedCount > 0) {
-        get_message(output.message, "fatal: Failed to delete document\n%s", error);
+    // Create empty JSON array and dump to file
+    cache_invalidate(config.databaseName, config.collectionName);
+    cJSON* _data = storage == storagePages ? cJSON_CreateArray() : NULL;
+    if (storage == storageLsm ? !lsm_create(filePath, error) : !_data || !dump_binary(filePath, _data, 0, error)) {
+        get_message(output.message, "fatal: Collection could not be created\n%s", error);
     } else {
-        get_message(output.message, "No document found for specified condition");
+        get_message(output.message,"Collection '%s' created", config.collectionName);
+        output.success = true;
     }
 
-    cJSON_Delete(_collection);
+    cJSON_Delete(_data);
     return output;
 }
 
-/// @brief Removes all documents (alias for remove_documents).
-export Output remove_all_documents(const QueryConfig config) {
-    return remove_documents(config);
+// Store documents in a collection, creating it on first insert
+Output apply_insert(const QueryConfig config, const uint64_t lsn) {
+    Output output = NEW_OUTPUT;
+    get_col_file(filePath, config.databaseName, config.collectionName);
+
+    cJSON* _parsedDocument = cJSON_Parse(config.data);
+    if (!_parsedDocument) {
+        get_message(output.message, "fatal: Failed to parse document \n%s", error);
+        return output;
+    }
+
+    int _insertedCount = 0;
+
+    // Insert based on whether input is array or object
+    if (cJSON_IsArray(_parsedDocument)) {
+        _insertedCount = cJSON_GetArraySize(_parsedDocument);
+    } else if (cJSON_IsObject(_parsedDocument)) {
+        _insertedCount = 1;
+    } else {
+        get_message(output.message, "fatal: Document must be a JSON object or array of objects\n%s", error);
+        cJSON_Delete(_parsedDocument);
+        return output;
+    }
+
+    FILE* _file = fopen(filePath, "rb");
+    if (_file) {
+        fclose(_file);
+    } else {
+        create_collection_file(config, storagePages);
+        get_col_file(filePath, config.databaseName, config.collectionName);
+    }
+
+    // Ids continue from the counter in the collection header, which older files lack
+    if (!upgrade_collection(config)) {
+        get_message(output.message, "fatal: Failed to insert document \n%s", error);
+        cJSON_Delete(_parsedDocument);
+        return output;
+    }
+
+    uint64_t* _recordIds = NULL;
+    bool _inOrder;
+    index_prepare(config.databaseName, config.collectionName, filePath);
+    range_prepare(config.databaseName, config.collectionName, filePath);
+    zone_prepare(config.databaseName, config.collectionName, filePath);
+    column_prepare(config.databaseName, config.collectionName, filePath);
+    primary_prepare(config.databaseName, config.collectionName, filePath);
+    unsigned long long _firstId = get_next_id(filePath);
+    if (_firstId == 0) _firstId = 1;
+    const unsigned long long _nextId = assign_ids(_parsedDocument, _firstId);
+    const int _stored = append_binary(filePath, _parsedDocument, lsn, &_recordIds, &_inOrder, error);
+    if (_stored < 0) {
+        get_message(output.message, "fatal: Failed to insert document \n%s", error);
+        cJSON_Delete(_parsedDocument);
+        return output;
+    }
+
+    // Documents that filled a gap would sit out of place at the end of the cached tree
+    if (_inOrder) cache_append(config.databaseName, config.collectionName, _parsedDocument);
+    else cache_invalidate(config.databaseName, config.collectionName);
+    index_append(config.databaseName, config.collectionName, filePath, _recordIds, _stored, lsn);
+    range_append(config.databaseName, config.collectionName, filePath, _recordIds, _stored);
+    zone_append(config.databaseName, config.collectionName, filePath, _recordIds, _stored);
+    column_append(config.databaseName, config.collectionName, filePath, _recordIds, _stored);
+    primary_append(config.databaseName, config.collectionName, filePath, _recordIds, _stored, lsn);
+    free(_recordIds);
+    output.success = true;
+    if (_nextId - _firstId > 1) {
+        get_message(output.message, "Inserted %d, _id %llu-%llu", _insertedCount, _firstId, _nextId - 1);
+    } else if (_nextId > _firstId) {
+        get_message(output.message, "Inserted %d, _id %llu", _insertedCount, _firstId);
+    } else {
+        get_message(output.message, "Inserted %d", _insertedCount);
+    }
+    cJSON_Delete(_parsedDocument);
+    return output;
 }
 
-/// @brief Updates documents matching a filter with given data and action.
-/// @param config QueryConfig with update info
-/// @return Output with update count or error
-export Output update_documents(const QueryConfig config) {
+// Remove the documents matching a filter, freeing their slots in the collection file
+Output apply_remove(const QueryConfig config, const uint64_t lsn) {
     Output output = NEW_OUTPUT;
+    get_col_file(filePath, config.databaseName, config.collectionName);
 
-    if (!config.databaseName || !config.collectionName || !config.data) {
-        get_message(output.message,"fatal: Missing required query parameters");
+    if (!upgrade_collection(config)) {
+        get_message(output.message, "fatal: Failed to delete document\n%s", error);
+        return output;
+    }
+
+    // Filters on an indexed key only read the candidate documents
+    uint64_t* _recordIds = NULL;
+    index_prepare(config.databaseName, config.collectionName, filePath);
+    range_prepare(config.databaseName, config.collectionName, filePath);
+    zone_prepare(config.databaseName, config.collectionName, filePath);
+    column_prepare(config.databaseName, config.collectionName, filePath);
+    primary_prepare(config.databaseName, config.collectionName, filePath);
+    Predicate _predicate;
+    if (!compile_predicate(&config, &_predicate, error)) {
+        get_message(output.message, "fatal: Failed to delete document\n%s", error);
         return output;
     }
+    const int _candidates = filter_candidates(config, &_predicate, &_recordIds);
+    const int _deletedCount = _candidates == 0 ? 0 :
+        remove_binary(filePath, _recordIds, _candidates, &_predicate, lsn, error);
+    free(_recordIds);
+
+    if (_deletedCount > 0) {
+        // Removed documents keep their index entries, which the filter check on every candidate skips
+        index_append(config.databaseName, config.collectionName, filePath, NULL, 0, lsn);
+        range_append(config.databaseName, config.collectionName, filePath, NULL, 0);
+        zone_append(config.databaseName, config.collectionName, filePath, NULL, 0);
+        column_append(config.databaseName, config.collectionName, filePath, NULL, 0);
+        primary_append(config.databaseName, config.collectionName, filePath, NULL, 0, lsn);
+
+        // A resident tree is brought along rather than parsed again
+        cJSON* _collection = NULL;
+        CacheEntry* _entry = cache_find(config.databaseName, config.collectionName, &_collection);
+        if (_entry && remove_filtered_documents(_collection, &_predicate, error) != _deletedCount) {
+            cache_invalidate(config.databaseName, config.collectionName);
+        }
+        cache_release(_entry, true);
+        compaction_note(config.databaseName, config.collectionName);
+        get_message(output.message, "Document removed %d", _deletedCount);
+        output.success = true;
+    } else if (_deletedCount < 0) {
+        cache_invalidate(config.databaseName, config.collectionName);
+        get_message(output.message, "fatal: Failed to delete document\n%s", error);
+    } else {
+        get_message(output.message, "No document found for specified condition");
+    }
+    release_predicate(&_predicate);
+    return output;
+}
 
+// Apply an update action to the documents matching a filter, rewriting each one in place
+Output apply_update(const QueryConfig config, const uint64_t lsn) {
+    Output output = NEW_OUTPUT;
     get_col_file(filePath, config.databaseName, config.collectionName);
 
-    cJSON* _collection = load_binary(filePath, error);
-    if (!_collection || !cJSON_IsArray(_collection)) {
-        get_message(output.message,"fatal: Collection '%s' not found or invalid\n%s", config.collectionName, error);
-        if (_collection) cJSON_Delete(_collection);
+    if (!upgrade_collection(config)) {
+        get_message(output.message, "fatal: Failed to update document\n%s", error);
         return output;
     }
 
-    const int _count = update_filtered_documents(_collection, config.key, config.value,
-                                                 config.condition, config.action, config.data, error);
+    // Filters on an indexed key only read the candidate documents
+    uint64_t* _recordIds = NULL;
+    uint64_t* _updated = NULL;
+    index_prepare(config.databaseName, config.collectionName, filePath);
+    range_prepare(config.databaseName, config.collectionName, filePath);
+    zone_prepare(config.databaseName, config.collectionName, filePath);
+    column_prepare(config.databaseName, config.collectionName, filePath);
+    primary_prepare(config.databaseName, config.collectionName, filePath);
+    Predicate _predicate;
+    if (!compile_predicate(&config, &_predicate, error)) {
+        get_message(output.message, "fatal: Failed to update document\n%s", error);
+        return output;
+    }
+    const int _candidates = filter_candidates(config, &_predicate, &_recordIds);
+    const int _count = _candidates == 0 ? 0 :
+        update_binary(filePath, _recordIds, _candidates, &_predicate, config.action, config.data, lsn, &_updated, error);
+    free(_recordIds);
 
     if (_count > 0) {
-        if (!dump_binary(filePath, _collection, error)) {
-            get_message(output.message, "fatal: Failed to save updated documents\n%s", error);
-            cJSON_Delete(_collection);
-            return output;
+        // Rewritten documents keep their record ids; their new values are indexed next to the old ones
+        index_append(config.databaseName, config.collectionName, filePath, _updated, _count, lsn);
+        range_append(config.databaseName, config.collectionName, filePath, _updated, _count);
+        zone_append(config.databaseName, config.collectionName, filePath, _updated, _count);
+        column_append(config.databaseName, config.collectionName, filePath, _updated, _count);
+        primary_append(config.databaseName, config.collectionName, filePath, _updated, _count, lsn);
+
+        // A resident tree is brought along rather than parsed again
+        cJSON* _collection = NULL;
+        CacheEntry* _entry = cache_find(config.databaseName, config.collectionName, &_collection);
+        if (_entry && update_filtered_documents(_collection, &_predicate, config.action, config.data, error) != _count) {
+            cache_invalidate(config.databaseName, config.collectionName);
         }
+        cache_release(_entry, true);
+        compaction_note(config.databaseName, config.collectionName);
         get_message(output.message, "Document updated %d", _count);
         output.success = true;
     } else if (_count < 0) {
+        cache_invalidate(config.databaseName, config.collectionName);
         get_message(output.message, "fatal: Failed to update document\n%s", error);
     } else {
         get_message(output.message, "No document found for given condition");
     }
 
-    cJSON_Delete(_collection);
+    free(_updated);
+    release_predicate(&_predicate);
     return output;
 }
 
-/// @brief Updates all documents (alias for update_documents).
-export Output update_all_documents(const QueryConfig config) {
-    return update_documents(config);
+// Rewrite a collection in the current format before it is changed in place, keeping its
+// applied LSN. Its indexes point at frame offsets of the old file and are rebuilt.
+bool upgrade_collection(const QueryConfig config) {
+    if (get_file_size(filePath) <= 0 || get_collection_version(filePath) == COLLECTION_VERSION) return true;
+    if (!upgrade_binary(filePath, error)) return false;
+
+    cache_invalidate(config.databaseName, config.collectionName);
+    rebuild_indexes(config);
+    return true;
 }
 
-/// @brief Frees memory allocated to document string lists.
-/// @param list char** list to free
-/// @param size number of elements
-export void free_list(char** list, const int size) {
-    for (int i = 0; i < size; i++) {
-        free(list[i]);
+// Point the indexes of a collection at the file compaction swapped in; its documents and
+// their order are unchanged, so a cached tree stays valid
+void finish_compaction(const QueryConfig config) {
+    get_col_file(filePath, config.databaseName, config.collectionName);
+    rebuild_indexes(config);
+}
+
+// Rebuild every index of a collection after its file was rewritten whole
+void rebuild_indexes(const QueryConfig config) {
+    index_rebuild(config.databaseName, config.collectionName, filePath);
+    range_rebuild(config.databaseName, config.collectionName, filePath);
+    zone_rebuild(config.databaseName, config.collectionName, filePath);
+    column_rebuild(config.databaseName, config.collectionName, filePath);
+    primary_rebuild(config.databaseName, config.collectionName, filePath);
+}
+
+// Create a hash or an ordered index, a zone map or a shadow column on a key, converting a
+// legacy collection first
+Output create_key_index(const QueryConfig config, const IndexKind kind) {
+    Output output = NEW_OUTPUT;
+
+    if (!config.databaseName || !config.collectionName || !config.key) {
+        get_message(output.message, "fatal: Missing required query parameters");
+        return output;
     }
-    free(list);
+
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
+        return output;
+    }
+
+    wal_acquire(_wal, true);
+    get_col_file(filePath, config.databaseName, config.collectionName);
+
+    // Index entries point at document frames, which legacy text collections do not have
+    bool _converted = true;
+    if (get_file_size(filePath) > 0 && get_collection_version(filePath) == 0) {
+        cJSON* _collection = load_binary(filePath, error);
+        _converted = _collection && dump_binary(filePath, _collection, get_applied_lsn(filePath), error);
+        cJSON_Delete(_collection);
+    }
+
+    if (get_file_size(filePath) <= 0) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty", config.collectionName);
+    } else if (!_converted) {
+        get_message(output.message, "fatal: Failed to convert collection\n%s", error);
+    } else if (kind == indexHash ? !index_create(config.databaseName, config.collectionName, config.key, filePath, error) :
+               kind == indexRange ? !range_create(config.databaseName, config.collectionName, config.key, filePath, error) :
+               kind == indexZone ? !zone_create(config.databaseName, config.collectionName, config.key, filePath, error)
+                                 : !column_create(config.databaseName, config.collectionName, config.key, filePath, error)) {
+        get_message(output.message, "fatal: Failed to create index\n%s", error);
+    } else {
+        get_message(output.message, "%s on '%s' created", indexNames[kind], config.key);
+        output.success = true;
+    }
+
+    wal_release(_wal, true);
+    return output;
+}
+
+// Drop a hash or an ordered index, a zone map or a shadow column from a key
+Output drop_key_index(const QueryConfig config, const IndexKind kind) {
+    Output output = NEW_OUTPUT;
+
+    if (!config.databaseName || !config.collectionName || !config.key) {
+        get_message(output.message, "fatal: Missing required query parameters");
+        return output;
+    }
+
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
+        return output;
+    }
+
+    wal_acquire(_wal, true);
+    if (kind == indexHash ? index_drop(config.databaseName, config.collectionName, config.key, error) :
+        kind == indexRange ? range_drop(config.databaseName, config.collectionName, config.key, error) :
+        kind == indexZone ? zone_drop(config.databaseName, config.collectionName, config.key, error)
+                          : column_drop(config.databaseName, config.collectionName, config.key, error)) {
+        get_message(output.message, "%s on '%s' dropped", indexNames[kind], config.key);
+        output.success = true;
+    } else {
+        get_message(output.message, "fatal: Failed to drop index\n%s", error);
+    }
+
+    wal_release(_wal, true);
+    return output;
+}
+
+// Create or drop the Bloom filters on a key of an LSM collection
+Output set_bloom_filter(const QueryConfig config, const bool create) {
+    Output output = NEW_OUTPUT;
+
+    if (!config.databaseName || !config.collectionName || !config.key) {
+        get_message(output.message, "fatal: Missing required query parameters");
+        return output;
+    }
+
+    WalDatabase* _wal = wal_open(config.databaseName, replay_mutation, error);
+    if (!_wal) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty\n%s", config.collectionName, error);
+        return output;
+    }
+
+    wal_acquire(_wal, true);
+    get_col_file(filePath, config.databaseName, config.collectionName);
+
+    if (get_file_size(filePath) <= 0) {
+        get_message(output.message, "fatal: Collection '%s' not found or empty", config.collectionName);
+    } else if (get_collection_storage(filePath) != storageLsm) {
+        get_message(output.message, "fatal: Bloom filters need a collection with '%s' storage", LSM_STORAGE_NAME);
+    } else if (create ? !lsm_create_filter(filePath, config.key, error) : !lsm_drop_filter(filePath, config.key, error)) {
+        get_message(output.message, "fatal: Failed to %s Bloom filter\n%s", create ? "create" : "drop", error);
+    } else {
+        get_message(output.message, "Bloom filter on '%s' %s", config.key, create ? "created" : "dropped");
+        output.success = true;
+    }
+
+    wal_release(_wal, true);
+    return output;
+}
+
+// Look up the candidates of a compiled filter through the indexes of its key. A filter tree
+// uses the first single-key test of its top-level AND that an index answers, as every match
+// passes that test; other trees and dotted paths read the whole collection (-1).
+int filter_candidates(const QueryConfig config, const Predicate* predicate, uint64_t** recordIds) {
+    if (predicate->kind == predicateAll) return index_candidates(config, recordIds);
+
+    const Predicate* _terms = predicate->kind == predicateAnd ? predicate->terms : predicate;
+    const int _termCount = predicate->kind == predicateAnd ? predicate->termCount : 1;
+    for (int i = 0; i < _termCount; i++) {
+        if (_terms[i].kind != predicateMatch || !_terms[i].key) continue;
+
+        QueryConfig _term = config;
+        _term.key = _terms[i].key;
+        _term.value = _terms[i].value;
+        _term.condition = _terms[i].condition;
+        const int _count = index_candidates(_term, recordIds);
+        if (_count >= 0) return _count;
+    }
+    return -1;
+}
+
+// Look up the documents an index finds for a filter, in collection order (-1 when no index
+// applies). Candidates may not match the filter, so each one is checked before it is used.
+int index_candidates(const QueryConfig config, uint64_t** recordIds) {
+    if (config.condition == equal && config.key && _stricmp(config.key, ID_KEY) == 0) {
+        const int _count = primary_lookup(config.databaseName, config.collectionName, config.value, filePath, recordIds);
+        if (_count >= 0) return _count;
+    }
+
+    const int _count = config.condition == equal ?
+        index_lookup(config.databaseName, config.collectionName, config.key, config.value, filePath, recordIds) :
+        range_lookup(config.databaseName, config.collectionName, config.key, config.value, config.condition, filePath, recordIds);
+    if (_count >= 0) return config.condition == equal || _count == 0 ? _count : sort_record_ids(*recordIds, _count);
+
+    // Filters no index answers may still run over a shadow column of the key
+    return column_lookup(config.databaseName, config.collectionName, config.key, config.value, config.condition, filePath, recordIds);
+}
+
+// Turn a by-id request into an equality filter on "_id", so that it is logged and replayed
+// like any other filtered mutation. Fails on anything but a positive whole number.
+bool by_id(QueryConfig* config, char* message) {
+    char* _end = NULL;
+    const double _id = config->value ? strtod(config->value, &_end) : 0;
+
+    if (!config->databaseName || !config->collectionName || !config->value) {
+        get_message(message, "fatal: Missing required query parameters");
+        return false;
+    }
+    if (_end == config->value || *_end != '\0' || _id < 1 || _id >= (double)MAX_DOCUMENT_ID || _id != (double)(uint64_t)_id) {
+        get_message(message, "fatal: Invalid document id '%s'", config->value);
+        return false;
+    }
+
+    config->key = ID_KEY;
+    config->condition = equal;
+    return true;
 }
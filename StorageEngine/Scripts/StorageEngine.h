@@ -17,9 +17,33 @@ export Output remove_all_documents(QueryConfig config);
 export Output remove_documents(QueryConfig config);
 export ArrayOut print_all_documents(QueryConfig config);
 export ArrayOut print_documents(QueryConfig config);
+export PackedOut print_packed_documents(QueryConfig config);
 export Output update_all_documents(QueryConfig config);
 export Output update_documents(QueryConfig config);
+export ArrayOut visit_documents(QueryConfig config, DocumentVisitor visitor, void* context);
 
+export ArrayOut print_document_by_id(QueryConfig config);
+export PackedOut print_packed_document_by_id(QueryConfig config);
+export Output remove_document_by_id(QueryConfig config);
+export Output update_document_by_id(QueryConfig config);
+
+export Output create_bloom_filter(QueryConfig config);
+export Output create_column(QueryConfig config);
+export Output create_index(QueryConfig config);
+export Output create_range_index(QueryConfig config);
+export Output create_zone_map(QueryConfig config);
+export Output drop_bloom_filter(QueryConfig config);
+export Output drop_column(QueryConfig config);
+export Output drop_index(QueryConfig config);
+export Output drop_range_index(QueryConfig config);
+export Output drop_zone_map(QueryConfig config);
+
+export Output convert_collection(QueryConfig config);
+export void configure_cache(long long limitBytes);
+export void configure_buffer_pool(long long limitBytes);
+export BufferPoolStats buffer_pool_stats(void);
+export void configure_compaction(double freeRatio, long long bytesPerSecond);
 export void free_list(char** list, int size);
+export void free_packed(char* block);
 
 #endif //STORAGE_ENGINE_H
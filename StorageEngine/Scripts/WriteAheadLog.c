@@ -0,0 +1,446 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "WriteAheadLog.h"
+
+// Log state of one database, kept for the lifetime of the process
+struct WalDatabase {
+    char name[MAX_PATH_LEN];
+    char path[MAX_PATH_LEN];
+    FILE* file;
+    long fileSize;
+    bool recovered;
+    bool broken;
+    bool flushing;
+
+    // Shared by readers, held exclusively while a mutation is logged and applied
+    SRWLOCK lock;
+    // Guards the pending buffer and the group commit state below
+    SRWLOCK flushLock;
+    CONDITION_VARIABLE flushed;
+
+    uint64_t nextLsn;
+    uint64_t bufferedLsn;
+    uint64_t durableLsn;
+    char* pending;
+    size_t pendingSize;
+    size_t pendingCapacity;
+
+    // Collections written since the last checkpoint
+    char** dirty;
+    int dirtyCount;
+    int dirtyCapacity;
+
+    WalDatabase* next;
+};
+
+static WalDatabase* databases = NULL;
+static SRWLOCK registryLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool mark_dirty(WalDatabase* wal, const char* collectionName);
+bool recover(WalDatabase* wal, WalReplay replay, char* error);
+bool repair_collections(const char* databaseName, uint64_t* highestLsn, char* error);
+void replay_record(WalDatabase* wal, const char* payload, uint64_t lsn, WalReplay replay);
+bool reset_log(WalDatabase* wal, char* error);
+bool sync_collections(WalDatabase* wal, char* error);
+
+
+// Find or create the log of a database, recovering it on first use
+WalDatabase* wal_open(const char* databaseName, const WalReplay replay, char* error) {
+    if (!databaseName) {
+        get_error(error, "fatal: Database name is missing");
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&registryLock);
+    WalDatabase* _wal = databases;
+    while (_wal && strcmp(_wal->name, databaseName) != 0) _wal = _wal->next;
+
+    if (!_wal && (_wal = calloc(1, sizeof(WalDatabase)))) {
+        snprintf(_wal->name, sizeof(_wal->name), "%s", databaseName);
+        get_wal_file(_wal->path, databaseName);
+        InitializeSRWLock(&_wal->lock);
+        InitializeSRWLock(&_wal->flushLock);
+        InitializeConditionVariable(&_wal->flushed);
+        _wal->next = databases;
+        databases = _wal;
+    }
+    ReleaseSRWLockExclusive(&registryLock);
+
+    if (!_wal) {
+        get_error(error, "fatal: Memory allocation failed for write-ahead log");
+        return NULL;
+    }
+
+    AcquireSRWLockShared(&_wal->lock);
+    bool _ready = _wal->recovered;
+    ReleaseSRWLockShared(&_wal->lock);
+
+    if (!_ready) {
+        AcquireSRWLockExclusive(&_wal->lock);
+        _ready = _wal->recovered || recover(_wal, replay, error);
+        ReleaseSRWLockExclusive(&_wal->lock);
+    }
+    if (!_ready) return NULL;
+
+    // A log that failed to sync leaves mutations applied that may not survive a crash, so the
+    // database is closed to reads and writes until a new process recovers it
+    AcquireSRWLockShared(&_wal->flushLock);
+    const bool _broken = _wal->broken;
+    ReleaseSRWLockShared(&_wal->flushLock);
+    if (_broken) {
+        get_error(error, "fatal: Write-ahead log '%s' failed, the database is closed until the process restarts", _wal->path);
+        return NULL;
+    }
+    return _wal;
+}
+
+// Find the log of a database if it has been opened, without recovering it
+WalDatabase* wal_find(const char* databaseName) {
+    AcquireSRWLockShared(&registryLock);
+    WalDatabase* _wal = databases;
+    while (_wal && strcmp(_wal->name, databaseName) != 0) _wal = _wal->next;
+    ReleaseSRWLockShared(&registryLock);
+    return _wal;
+}
+
+// Lock the database for reading (shared) or for applying a mutation (exclusive)
+void wal_acquire(WalDatabase* wal, const bool exclusive) {
+    if (exclusive) AcquireSRWLockExclusive(&wal->lock);
+    else AcquireSRWLockShared(&wal->lock);
+}
+
+void wal_release(WalDatabase* wal, const bool exclusive) {
+    if (exclusive) ReleaseSRWLockExclusive(&wal->lock);
+    else ReleaseSRWLockShared(&wal->lock);
+}
+
+// Buffer a mutation record and return its LSN (0 on failure).
+// The caller must hold the database lock exclusively until the mutation is applied,
+// so that collections see mutations in LSN order.
+uint64_t wal_append(WalDatabase* wal, const WalOperation operation, const QueryConfig config, char* error) {
+    cJSON* _record = cJSON_CreateObject();
+    cJSON_AddNumberToObject(_record, "operation", operation);
+    if (config.collectionName) cJSON_AddStringToObject(_record, "collection", config.collectionName);
+    if (config.key) cJSON_AddStringToObject(_record, "key", config.key);
+    if (config.value) cJSON_AddStringToObject(_record, "value", config.value);
+    if (config.filter) cJSON_AddStringToObject(_record, "filter", config.filter);
+    if (config.data) cJSON_AddStringToObject(_record, "data", config.data);
+    cJSON_AddNumberToObject(_record, "condition", config.condition);
+    cJSON_AddNumberToObject(_record, "action", config.action);
+
+    char* _payload = cJSON_PrintUnformatted(_record);
+    cJSON_Delete(_record);
+    if (!_payload || !mark_dirty(wal, config.collectionName)) {
+        get_error(error, "fatal: Failed to serialize write-ahead log record");
+        free(_payload);
+        return 0;
+    }
+
+    const size_t _length = strlen(_payload);
+    const WalRecordHeader _header = { (uint32_t)_length, checksum(_payload, _length), wal->nextLsn };
+    bool _status = true;
+
+    // A commit swaps the buffer out under the flush lock, so its size is only read under it
+    AcquireSRWLockExclusive(&wal->flushLock);
+    const size_t _needed = wal->pendingSize + sizeof(_header) + _length;
+    if (wal->broken) {
+        _status = false;
+    } else if (_needed > wal->pendingCapacity) {
+        char* _grown = realloc(wal->pending, _needed * 2);
+        if (_grown) {
+            wal->pending = _grown;
+            wal->pendingCapacity = _needed * 2;
+        } else {
+            _status = false;
+        }
+    }
+
+    if (_status) {
+        memcpy(wal->pending + wal->pendingSize, &_header, sizeof(_header));
+        memcpy(wal->pending + wal->pendingSize + sizeof(_header), _payload, _length);
+        wal->pendingSize = _needed;
+        wal->bufferedLsn = wal->nextLsn++;
+    }
+    ReleaseSRWLockExclusive(&wal->flushLock);
+
+    free(_payload);
+    if (!_status) {
+        get_error(error, "fatal: Write-ahead log for '%s' is unavailable", wal->name);
+        return 0;
+    }
+    return _header.lsn;
+}
+
+// Wait until the record with the given LSN is durable. The first waiter to find no flush
+// in progress writes and syncs every record buffered so far, so concurrent writers share
+// a single fsync (group commit). Fails when the record could not be made durable; the log
+// is then broken and wal_open refuses the database from then on. A checkpoint that fails
+// after the record is durable breaks the log the same way, but the commit stands.
+bool wal_commit(WalDatabase* wal, const uint64_t lsn, char* error) {
+    AcquireSRWLockExclusive(&wal->flushLock);
+    while (!wal->broken && wal->durableLsn < lsn) {
+        if (wal->flushing) {
+            SleepConditionVariableSRW(&wal->flushed, &wal->flushLock, INFINITE, 0);
+            continue;
+        }
+
+        wal->flushing = true;
+        char* _batch = wal->pending;
+        const size_t _size = wal->pendingSize;
+        const uint64_t _batchLsn = wal->bufferedLsn;
+        wal->pending = NULL;
+        wal->pendingSize = wal->pendingCapacity = 0;
+        ReleaseSRWLockExclusive(&wal->flushLock);
+
+        const bool _written = wal->file && fwrite(_batch, 1, _size, wal->file) == _size &&
+                              fflush(wal->file) == 0 && _commit(_fileno(wal->file)) == 0;
+        free(_batch);
+
+        AcquireSRWLockExclusive(&wal->flushLock);
+        wal->flushing = false;
+        if (_written) {
+            wal->durableLsn = _batchLsn;
+            wal->fileSize += (long)_size;
+        } else {
+            wal->broken = true;
+        }
+        WakeAllConditionVariable(&wal->flushed);
+    }
+
+    const bool _status = !wal->broken || wal->durableLsn >= lsn;
+    const bool _full = _status && wal->fileSize >= WAL_CHECKPOINT_SIZE;
+    ReleaseSRWLockExclusive(&wal->flushLock);
+
+    if (!_status) {
+        get_error(error, "fatal: Failed to sync write-ahead log '%s'", wal->path);
+        return false;
+    }
+    if (!_full) return true;
+
+    // Checkpoint once the log grows past its limit; another writer may have beaten us to it
+    AcquireSRWLockExclusive(&wal->lock);
+    AcquireSRWLockShared(&wal->flushLock);
+    const bool _stillFull = wal->fileSize >= WAL_CHECKPOINT_SIZE;
+    ReleaseSRWLockShared(&wal->flushLock);
+    if (_stillFull) wal_checkpoint(wal, error);
+    ReleaseSRWLockExclusive(&wal->lock);
+    return true;
+}
+
+// Sync every collection written since the last checkpoint and start an empty log.
+// The caller must hold the database lock exclusively.
+bool wal_checkpoint(WalDatabase* wal, char* error) {
+    AcquireSRWLockExclusive(&wal->flushLock);
+    while (wal->flushing) SleepConditionVariableSRW(&wal->flushed, &wal->flushLock, INFINITE, 0);
+
+    // Buffered records become durable through the synced collection files instead
+    wal->flushing = true;
+    free(wal->pending);
+    wal->pending = NULL;
+    wal->pendingSize = wal->pendingCapacity = 0;
+    ReleaseSRWLockExclusive(&wal->flushLock);
+
+    const bool _status = reset_log(wal, error);
+
+    AcquireSRWLockExclusive(&wal->flushLock);
+    wal->flushing = false;
+    if (_status) {
+        wal->durableLsn = wal->bufferedLsn;
+    } else {
+        wal->broken = true;
+    }
+    WakeAllConditionVariable(&wal->flushed);
+    ReleaseSRWLockExclusive(&wal->flushLock);
+    return _status;
+}
+
+// Close the log of a database that is being dropped. The caller must hold the database
+// lock exclusively; the log is recovered again if the database is re-created.
+void wal_close(WalDatabase* wal) {
+    AcquireSRWLockExclusive(&wal->flushLock);
+    while (wal->flushing) SleepConditionVariableSRW(&wal->flushed, &wal->flushLock, INFINITE, 0);
+
+    if (wal->file) fclose(wal->file);
+    wal->file = NULL;
+    wal->fileSize = 0;
+    wal->recovered = false;
+    free(wal->pending);
+    wal->pending = NULL;
+    wal->pendingSize = wal->pendingCapacity = 0;
+    wal->durableLsn = wal->bufferedLsn;
+
+    for (int i = 0; i < wal->dirtyCount; i++) free(wal->dirty[i]);
+    wal->dirtyCount = 0;
+
+    WakeAllConditionVariable(&wal->flushed);
+    ReleaseSRWLockExclusive(&wal->flushLock);
+}
+
+// Return every collection to a consistent state, replay every logged mutation newer than
+// its collection's applied LSN, then checkpoint
+bool recover(WalDatabase* wal, const WalReplay replay, char* error) {
+    if (!check_database(wal->name)) {
+        get_error(error, "fatal: Database '%s' does not exist", wal->name);
+        return false;
+    }
+
+    uint64_t _lastLsn;
+    if (!repair_collections(wal->name, &_lastLsn, error)) return false;
+    FILE* _file = fopen(wal->path, "rb");
+
+    if (_file) {
+        WalHeader _header;
+        if (fread(&_header, sizeof(_header), 1, _file) == 1 &&
+            memcmp(_header.magic, WAL_MAGIC, sizeof(_header.magic)) == 0 && _header.version == WAL_VERSION) {
+            if (_header.startLsn > _lastLsn + 1) _lastLsn = _header.startLsn - 1;
+
+            // A record cut short or failing its checksum ends the log
+            WalRecordHeader _record;
+            while (fread(&_record, sizeof(_record), 1, _file) == 1) {
+                char* _payload = malloc((size_t)_record.length + 1);
+                if (!_payload || fread(_payload, 1, _record.length, _file) != _record.length ||
+                    checksum(_payload, _record.length) != _record.checksum) {
+                    free(_payload);
+                    break;
+                }
+
+                _payload[_record.length] = '\0';
+                replay_record(wal, _payload, _record.lsn, replay);
+                free(_payload);
+                if (_record.lsn > _lastLsn) _lastLsn = _record.lsn;
+            }
+        }
+        fclose(_file);
+    }
+
+    wal->nextLsn = _lastLsn + 1;
+    wal->bufferedLsn = wal->durableLsn = _lastLsn;
+    wal->broken = false;
+
+    if (!reset_log(wal, error)) return false;
+    wal->recovered = true;
+    return true;
+}
+
+// Re-apply one logged mutation unless its collection already contains it
+void replay_record(WalDatabase* wal, const char* payload, const uint64_t lsn, const WalReplay replay) {
+    cJSON* _record = cJSON_Parse(payload);
+    const cJSON* _collection = cJSON_GetObjectItem(_record, "collection");
+    if (!_record || !cJSON_IsString(_collection)) {
+        cJSON_Delete(_record);
+        return;
+    }
+
+    char _filePath[MAX_PATH_LEN];
+    get_col_file(_filePath, wal->name, _collection->valuestring);
+    if (!mark_dirty(wal, _collection->valuestring)) {
+        cJSON_Delete(_record);
+        return;
+    }
+
+    if (lsn > get_applied_lsn(_filePath)) {
+        const QueryConfig _config = {
+            .databaseName = wal->name,
+            .collectionName = _collection->valuestring,
+            .key = cJSON_GetStringValue(cJSON_GetObjectItem(_record, "key")),
+            .value = cJSON_GetStringValue(cJSON_GetObjectItem(_record, "value")),
+            .filter = cJSON_GetStringValue(cJSON_GetObjectItem(_record, "filter")),
+            .data = cJSON_GetStringValue(cJSON_GetObjectItem(_record, "data")),
+            .condition = (Condition)cJSON_GetNumberValue(cJSON_GetObjectItem(_record, "condition")),
+            .action = (Action)cJSON_GetNumberValue(cJSON_GetObjectItem(_record, "action"))
+        };
+        replay((WalOperation)cJSON_GetNumberValue(cJSON_GetObjectItem(_record, "operation")), _config, lsn);
+    }
+
+    cJSON_Delete(_record);
+}
+
+// Undo what a crash left half-written in the collections of a database: pages changed since
+// the last checkpoint are rolled back, frames cut short are truncated. highestLsn receives
+// the highest applied LSN across the collections once they are repaired.
+bool repair_collections(const char* databaseName, uint64_t* highestLsn, char* error) {
+    char _metaFile[MAX_PATH_LEN];
+    char _filePath[MAX_PATH_LEN];
+    char _listError[MAX_ERROR_LEN];
+    char** _names = NULL;
+    bool _status = true;
+    *highestLsn = 0;
+
+    get_col_meta(_metaFile, databaseName);
+    const int _count = load_list(_metaFile, &_names, _listError);
+    for (int i = 0; i < _count; i++) {
+        get_col_file(_filePath, databaseName, _names[i]);
+        if (_status && !repair_binary(_filePath, error)) _status = false;
+
+        const uint64_t _lsn = get_applied_lsn(_filePath);
+        if (_lsn > *highestLsn) *highestLsn = _lsn;
+        free(_names[i]);
+    }
+
+    free(_names);
+    return _status;
+}
+
+// Remember that a collection has been written since the last checkpoint
+bool mark_dirty(WalDatabase* wal, const char* collectionName) {
+    if (!collectionName) return true;
+    for (int i = 0; i < wal->dirtyCount; i++) {
+        if (strcmp(wal->dirty[i], collectionName) == 0) return true;
+    }
+
+    if (wal->dirtyCount == wal->dirtyCapacity) {
+        const int _capacity = wal->dirtyCapacity ? wal->dirtyCapacity * 2 : 8;
+        char** _grown = realloc(wal->dirty, _capacity * sizeof(char*));
+        if (!_grown) return false;
+        wal->dirty = _grown;
+        wal->dirtyCapacity = _capacity;
+    }
+
+    char* _name = _strdup(collectionName);
+    if (!_name) return false;
+    wal->dirty[wal->dirtyCount++] = _name;
+    return true;
+}
+
+// Flush the applied mutations of every dirty collection to disk
+bool sync_collections(WalDatabase* wal, char* error) {
+    char _filePath[MAX_PATH_LEN];
+    bool _status = true;
+
+    for (int i = 0; i < wal->dirtyCount && _status; i++) {
+        get_col_file(_filePath, wal->name, wal->dirty[i]);
+        _status = sync_binary(_filePath, error);
+    }
+
+    if (!_status) return false;
+    for (int i = 0; i < wal->dirtyCount; i++) free(wal->dirty[i]);
+    wal->dirtyCount = 0;
+    return true;
+}
+
+// Sync dirty collections, then replace the log with an empty one starting at the next LSN
+bool reset_log(WalDatabase* wal, char* error) {
+    if (!sync_collections(wal, error)) return false;
+
+    if (wal->file) fclose(wal->file);
+    wal->file = fopen(wal->path, "wb");
+    if (!wal->file) {
+        get_error(error, "fatal: Could not open write-ahead log '%s'", wal->path);
+        return false;
+    }
+
+    const WalHeader _header = { WAL_MAGIC, WAL_VERSION, wal->nextLsn };
+    if (fwrite(&_header, sizeof(_header), 1, wal->file) != 1 || fflush(wal->file) != 0 ||
+        _commit(_fileno(wal->file)) != 0) {
+        get_error(error, "fatal: Could not write write-ahead log '%s'", wal->path);
+        return false;
+    }
+
+    wal->fileSize = sizeof(_header);
+    return true;
+}
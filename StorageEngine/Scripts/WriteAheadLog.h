@@ -0,0 +1,46 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define WAL_MAGIC "PDBW"
+#define WAL_VERSION 1
+#define WAL_CHECKPOINT_SIZE (4L * 1024 * 1024)
+
+typedef enum {
+    walInsert,
+    walRemove,
+    walUpdate
+} WalOperation;
+
+// Header at the start of every write-ahead log file
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t startLsn;
+} WalHeader;
+
+// Frame preceding each logged mutation
+typedef struct {
+    uint32_t length;
+    uint32_t checksum;
+    uint64_t lsn;
+} WalRecordHeader;
+
+typedef struct WalDatabase WalDatabase;
+
+// Re-applies a logged mutation to its collection during recovery
+typedef void (*WalReplay)(WalOperation operation, QueryConfig config, uint64_t lsn);
+
+void wal_acquire(WalDatabase* wal, bool exclusive);
+uint64_t wal_append(WalDatabase* wal, WalOperation operation, QueryConfig config, char* error);
+bool wal_checkpoint(WalDatabase* wal, char* error);
+void wal_close(WalDatabase* wal);
+bool wal_commit(WalDatabase* wal, uint64_t lsn, char* error);
+WalDatabase* wal_find(const char* databaseName);
+WalDatabase* wal_open(const char* databaseName, WalReplay replay, char* error);
+void wal_release(WalDatabase* wal, bool exclusive);
+
+#endif //WRITE_AHEAD_LOG_H
@@ -0,0 +1,364 @@
+// Include standard and platform headers
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ZoneMap.h"
+#include "RangeIndex.h"
+
+// Per-block statistics on the numeric values of one key of a collection, kept in a file of
+// its own. Record ids are cut into blocks of fixed width (file positions for paged and framed
+// collections, document ids for LSM ones) and each block keeps the smallest and largest
+// number its documents hold for the key. A range scan reads only the blocks whose bounds can
+// satisfy its condition. Bounds only ever widen: inserts and updates extend them, removes
+// leave them as they are, and rewrites of the collection rebuild the map. Like the range
+// indexes, the header records the collection LSN and length the map covers, and a map that
+// no longer matches its collection is rebuilt when next used.
+
+// Zones being built or extended, shared with widen_zone while walking a collection.
+// changed is the lowest block that was widened, or count when none was.
+typedef struct {
+    const char* key;
+    uint32_t shift;
+    Zone* zones;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t changed;
+    bool failed;
+} ZoneBuild;
+
+static SRWLOCK zoneLock = SRWLOCK_INIT;
+
+// Local helper functions
+bool build_zones(const char* zoneFile, const char* key, const char* fileName);
+bool extend_zones(const char* zoneFile, const char* key, const char* fileName, const uint64_t* recordIds, int count);
+bool grow_zones(ZoneBuild* build, uint32_t count);
+FILE* load_zones(const char* zoneFile, const char* key, const char* fileName, const char* mode, ZoneHeader* header, ZoneBuild* build);
+bool widen_zone(void* context, const CollectionHeader* header, uint64_t recordId, const char* frame, size_t length);
+bool write_zone_header(FILE* file, const ZoneHeader* header, const char* key);
+bool write_zones(FILE* file, const ZoneHeader* header, const Zone* zones, uint32_t from);
+bool zone_possible(const Zone* zone, double limit, Condition condition);
+
+
+// Register a zone map on a key and build it from the collection. The database lock must be held exclusively.
+bool zone_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error) {
+    if (strlen(key) > MAX_ZONE_KEY) {
+        get_error(error, "fatal: Key '%s' is too long to index", key);
+        return false;
+    }
+
+    if (has_key_entry(databaseName, ZONE_META, collectionName, key)) {
+        get_error(error, "warning: Zone map on '%s' already exists", key);
+        return false;
+    }
+
+    char _zoneFile[MAX_PATH_LEN];
+    get_key_file(_zoneFile, databaseName, collectionName, key, ZONE_SUFFIX);
+
+    AcquireSRWLockExclusive(&zoneLock);
+    const bool _built = build_zones(_zoneFile, key, fileName);
+    ReleaseSRWLockExclusive(&zoneLock);
+
+    if (!_built) {
+        get_error(error, "fatal: Could not build zone map on '%s'", key);
+        return false;
+    }
+    return append_key_entry(databaseName, ZONE_META, collectionName, key, error);
+}
+
+// Unregister a zone map and delete its file. The database lock must be held exclusively.
+bool zone_drop(const char* databaseName, const char* collectionName, const char* key, char* error) {
+    if (!has_key_entry(databaseName, ZONE_META, collectionName, key)) {
+        get_error(error, "fatal: Zone map on '%s' not found", key);
+        return false;
+    }
+    const bool _status = remove_key_entry(databaseName, ZONE_META, collectionName, key, error);
+
+    char _zoneFile[MAX_PATH_LEN];
+    get_key_file(_zoneFile, databaseName, collectionName, key, ZONE_SUFFIX);
+    remove(_zoneFile);
+    return _status;
+}
+
+// Delete every zone map of a dropped collection
+void zone_drop_collection(const char* databaseName, const char* collectionName) {
+    char _zoneFile[MAX_PATH_LEN], _error[MAX_ERROR_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, ZONE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_zoneFile, databaseName, collectionName, _key->valuestring, ZONE_SUFFIX);
+        remove(_zoneFile);
+    }
+
+    cJSON_Delete(_meta);
+    remove_key_entry(databaseName, ZONE_META, collectionName, NULL, _error);
+}
+
+// Bring every zone map of a collection up to date before a mutation, so that it can be widened in place
+void zone_prepare(const char* databaseName, const char* collectionName, const char* fileName) {
+    char _zoneFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, ZONE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&zoneLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_zoneFile, databaseName, collectionName, _key->valuestring, ZONE_SUFFIX);
+
+        ZoneHeader _header;
+        ZoneBuild _build;
+        FILE* _file = load_zones(_zoneFile, _key->valuestring, fileName, "rb", &_header, &_build);
+        if (_file) {
+            fclose(_file);
+            free(_build.zones);
+        } else if (!build_zones(_zoneFile, _key->valuestring, fileName)) {
+            remove(_zoneFile);
+        }
+    }
+    ReleaseSRWLockExclusive(&zoneLock);
+    cJSON_Delete(_meta);
+}
+
+// Widen the zones of every zone map of a collection by the documents a mutation stored at recordIds
+void zone_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, const int count) {
+    char _zoneFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, ZONE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&zoneLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_zoneFile, databaseName, collectionName, _key->valuestring, ZONE_SUFFIX);
+
+        // A map that cannot be extended is removed and rebuilt when next used
+        if (!extend_zones(_zoneFile, _key->valuestring, fileName, recordIds, count)) remove(_zoneFile);
+    }
+    ReleaseSRWLockExclusive(&zoneLock);
+    cJSON_Delete(_meta);
+}
+
+// Rebuild every zone map of a collection after its file was rewritten
+void zone_rebuild(const char* databaseName, const char* collectionName, const char* fileName) {
+    char _zoneFile[MAX_PATH_LEN];
+    cJSON* _meta = NULL;
+    const cJSON* _keys = load_key_entries(databaseName, ZONE_META, collectionName, &_meta);
+    const cJSON* _key = NULL;
+
+    AcquireSRWLockExclusive(&zoneLock);
+    cJSON_ArrayForEach(_key, _keys) {
+        if (!cJSON_IsString(_key)) continue;
+        get_key_file(_zoneFile, databaseName, collectionName, _key->valuestring, ZONE_SUFFIX);
+        if (!build_zones(_zoneFile, _key->valuestring, fileName)) remove(_zoneFile);
+    }
+    ReleaseSRWLockExclusive(&zoneLock);
+    cJSON_Delete(_meta);
+}
+
+// Find the spans of record ids a scan for a range condition on key has to read: the runs of
+// blocks whose bounds can satisfy it, each starting at the first document holding a number.
+// Returns -1 if no zone map answers the condition.
+int zone_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, const Condition condition, const char* fileName, RecordSpan** spans) {
+    *spans = NULL;
+    if (!key || !value || condition > lessThanEqual) return -1;
+
+    char _zoneFile[MAX_PATH_LEN];
+    get_key_file(_zoneFile, databaseName, collectionName, key, ZONE_SUFFIX);
+
+    ZoneHeader _header;
+    ZoneBuild _build;
+    AcquireSRWLockShared(&zoneLock);
+    FILE* _file = load_zones(_zoneFile, key, fileName, "rb", &_header, &_build);
+    ReleaseSRWLockShared(&zoneLock);
+
+    if (!_file) {
+        // Missing or stale: rebuild it, but only if the key is still registered
+        if (!has_key_entry(databaseName, ZONE_META, collectionName, key)) return -1;
+
+        AcquireSRWLockExclusive(&zoneLock);
+        _file = load_zones(_zoneFile, key, fileName, "rb", &_header, &_build);
+        if (!_file && build_zones(_zoneFile, key, fileName)) _file = load_zones(_zoneFile, key, fileName, "rb", &_header, &_build);
+        ReleaseSRWLockExclusive(&zoneLock);
+        if (!_file) return -1;
+    }
+    fclose(_file);
+
+    // Neighbouring blocks that may match are read as one span
+    const double _limit = atof(value);
+    RecordSpan* _spans = malloc((_build.count ? _build.count : 1) * sizeof(RecordSpan));
+    int _count = 0;
+    for (uint32_t i = 0; _spans && i < _build.count; i++) {
+        if (!zone_possible(&_build.zones[i], _limit, condition)) continue;
+
+        const uint64_t _start = (uint64_t)i << _build.shift;
+        const uint64_t _end = (uint64_t)(i + 1) << _build.shift;
+        if (_count > 0 && _spans[_count - 1].end == _start) _spans[_count - 1].end = _end;
+        else _spans[_count++] = (RecordSpan){ _build.zones[i].firstRecord, _end };
+    }
+
+    free(_build.zones);
+    if (!_spans) return -1;
+    *spans = _spans;
+    return _count;
+}
+
+// Write a new map from every numeric value of key in the collection, replacing the old file
+bool build_zones(const char* zoneFile, const char* key, const char* fileName) {
+    const uint32_t _shift = get_collection_storage(fileName) == storageLsm ? LSM_ZONE_SHIFT : FILE_ZONE_SHIFT;
+    ZoneBuild _build = { key, _shift, NULL, 0, 0, 0, false };
+    const long long _size = get_file_size(fileName);
+    if (_size < 0 || !walk_frames(fileName, widen_zone, &_build) || _build.failed) {
+        free(_build.zones);
+        return false;
+    }
+
+    char _tempName[MAX_PATH_LEN + 4];
+    snprintf(_tempName, sizeof(_tempName), "%s.tmp", zoneFile);
+    FILE* _file = fopen(_tempName, "wb");
+    if (!_file) {
+        free(_build.zones);
+        return false;
+    }
+
+    const ZoneHeader _header = { ZONE_MAGIC, ZONE_VERSION, get_applied_lsn(fileName), (uint64_t)_size,
+                                 _shift, _build.count, (uint32_t)strlen(key), 0 };
+    bool _status = write_zone_header(_file, &_header, key) && write_zones(_file, &_header, _build.zones, 0);
+    if (fclose(_file) != 0) _status = false;
+    free(_build.zones);
+
+    if (!_status || !MoveFileExA(_tempName, zoneFile, MOVEFILE_REPLACE_EXISTING)) {
+        remove(_tempName);
+        return false;
+    }
+    return true;
+}
+
+// Widen the zones of a map that zone_prepare brought up to date by the documents at recordIds,
+// writing back the blocks from the first one that changed. The header is cleared first, so a
+// map interrupted halfway never looks current.
+bool extend_zones(const char* zoneFile, const char* key, const char* fileName, const uint64_t* recordIds, const int count) {
+    ZoneHeader _header;
+    ZoneBuild _build;
+    FILE* _file = load_zones(zoneFile, key, NULL, "rb+", &_header, &_build);
+    if (!_file) return false;
+
+    const long long _size = get_file_size(fileName);
+    bool _status = _size >= 0 && visit_records(fileName, recordIds, count, widen_zone, &_build) && !_build.failed;
+
+    if (_status && _build.changed < _build.count) {
+        ZoneHeader _pending = _header;
+        _pending.appliedLsn = 0;
+        _pending.coveredLength = 0;
+        _header.blockCount = _build.count;
+        _status = write_zone_header(_file, &_pending, key) && write_zones(_file, &_header, _build.zones, _build.changed);
+    }
+    if (_status) {
+        _header.appliedLsn = get_applied_lsn(fileName);
+        _header.coveredLength = (uint64_t)_size;
+        _status = write_zone_header(_file, &_header, key);
+    }
+
+    if (fclose(_file) != 0) _status = false;
+    free(_build.zones);
+    return _status;
+}
+
+// Open a zone map file whose header is valid for key and read its zones into build. Unless
+// fileName is NULL, the map must also cover that collection exactly as it is now.
+FILE* load_zones(const char* zoneFile, const char* key, const char* fileName, const char* mode, ZoneHeader* header, ZoneBuild* build) {
+    *build = (ZoneBuild){ key, 0, NULL, 0, 0, 0, false };
+    FILE* _file = fopen(zoneFile, mode);
+    if (!_file) return NULL;
+
+    const size_t _keyLength = strlen(key);
+    char _key[MAX_ZONE_KEY];
+    bool _valid = fread(header, sizeof(*header), 1, _file) == 1 &&
+                  memcmp(header->magic, ZONE_MAGIC, sizeof(header->magic)) == 0 &&
+                  header->version == ZONE_VERSION && header->keyLength == _keyLength && _keyLength <= MAX_ZONE_KEY &&
+                  fread(_key, 1, _keyLength, _file) == _keyLength && memcmp(_key, key, _keyLength) == 0 &&
+                  header->blockShift < 64 && header->blockCount <= MAX_ZONE_BLOCKS &&
+                  (!fileName || (header->appliedLsn == get_applied_lsn(fileName) &&
+                                 (long long)header->coveredLength == get_file_size(fileName)));
+
+    if (_valid && header->blockCount > 0) {
+        build->zones = malloc(header->blockCount * sizeof(Zone));
+        _valid = build->zones && fread(build->zones, sizeof(Zone), header->blockCount, _file) == header->blockCount;
+    }
+    if (!_valid) {
+        free(build->zones);
+        build->zones = NULL;
+        fclose(_file);
+        return NULL;
+    }
+
+    build->shift = header->blockShift;
+    build->count = build->capacity = build->changed = header->blockCount;
+    return _file;
+}
+
+// Add empty blocks until the map has count of them
+bool grow_zones(ZoneBuild* build, const uint32_t count) {
+    if (count > build->capacity) {
+        uint32_t _capacity = build->capacity ? build->capacity : 64;
+        while (_capacity < count) _capacity *= 2;
+        Zone* _grown = realloc(build->zones, _capacity * sizeof(Zone));
+        if (!_grown) return false;
+        build->zones = _grown;
+        build->capacity = _capacity;
+    }
+
+    while (build->count < count) build->zones[build->count++] = (Zone){ INFINITY, -INFINITY, UINT64_MAX };
+    return true;
+}
+
+// Frame visitor: widen the block of a document by the number it holds for the key
+bool widen_zone(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    ZoneBuild* _build = context;
+    double _number;
+    if (!document_number(header, frame, length, _build->key, &_number)) return true;
+
+    const uint64_t _block = recordId >> _build->shift;
+    if (_block >= MAX_ZONE_BLOCKS || (_block >= _build->count && !grow_zones(_build, (uint32_t)_block + 1))) {
+        _build->failed = true;
+        return false;
+    }
+
+    Zone* _zone = &_build->zones[_block];
+    if (_number >= _zone->min && _number <= _zone->max && recordId >= _zone->firstRecord) return true;
+    if (_number < _zone->min) _zone->min = _number;
+    if (_number > _zone->max) _zone->max = _number;
+    if (recordId < _zone->firstRecord) _zone->firstRecord = recordId;
+    if (_block < _build->changed) _build->changed = (uint32_t)_block;
+    return true;
+}
+
+// Whether a block may hold a number satisfying a range condition
+bool zone_possible(const Zone* zone, const double limit, const Condition condition) {
+    if (zone->min > zone->max) return false;
+
+    switch (condition) {
+        case greaterThan:      return zone->max > limit;
+        case greaterThanEqual: return zone->max >= limit;
+        case lessThan:         return zone->min < limit;
+        case lessThanEqual:    return zone->min <= limit;
+        default: return true;
+    }
+}
+
+bool write_zone_header(FILE* file, const ZoneHeader* header, const char* key) {
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(header, sizeof(*header), 1, file) == 1 &&
+           fwrite(key, 1, header->keyLength, file) == header->keyLength && fflush(file) == 0;
+}
+
+// Write the zones from block from up to the block count of header
+bool write_zones(FILE* file, const ZoneHeader* header, const Zone* zones, const uint32_t from) {
+    const uint32_t _count = header->blockCount - from;
+    const long _offset = (long)(sizeof(*header) + header->keyLength + (size_t)from * sizeof(Zone));
+    return _count == 0 || (fseek(file, _offset, SEEK_SET) == 0 && fwrite(zones + from, sizeof(Zone), _count, file) == _count &&
+                           fflush(file) == 0);
+}
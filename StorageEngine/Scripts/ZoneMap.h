@@ -0,0 +1,43 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <stdint.h>
+#include "DatabaseUtils.h"
+
+#define ZONE_MAGIC "PDBZ"
+#define ZONE_VERSION 1
+#define FILE_ZONE_SHIFT 15 // 32 KB of a paged or framed collection per block
+#define LSM_ZONE_SHIFT 8   // 256 document ids of an LSM collection per block
+#define MAX_ZONE_BLOCKS (1u << 20)
+#define MAX_ZONE_KEY 1024
+
+// Start of every zone map file, followed by the key and then one Zone per block
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t appliedLsn;
+    uint64_t coveredLength;
+    uint32_t blockShift;
+    uint32_t blockCount;
+    uint32_t keyLength;
+    uint32_t reserved;
+} ZoneHeader;
+
+// The record ids recordId >> blockShift maps to one block. Its bounds hold every number the
+// documents of the block have for the key, and firstRecord is the lowest record id of those
+// documents. A block without numbers has min above max.
+typedef struct {
+    double min;
+    double max;
+    uint64_t firstRecord;
+} Zone;
+
+void zone_append(const char* databaseName, const char* collectionName, const char* fileName, const uint64_t* recordIds, int count);
+bool zone_create(const char* databaseName, const char* collectionName, const char* key, const char* fileName, char* error);
+bool zone_drop(const char* databaseName, const char* collectionName, const char* key, char* error);
+void zone_drop_collection(const char* databaseName, const char* collectionName);
+int zone_lookup(const char* databaseName, const char* collectionName, const char* key, const char* value, Condition condition, const char* fileName, RecordSpan** spans);
+void zone_prepare(const char* databaseName, const char* collectionName, const char* fileName);
+void zone_rebuild(const char* databaseName, const char* collectionName, const char* fileName);
+
+#endif //ZONE_MAP_H
@@ -0,0 +1,49 @@
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <direct.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "StorageEngine.h"
+
+// Benchmarks keep their databases under bench-data in the working directory, in place of the
+// user's %APPDATA%, and start from an empty database every run
+
+#define BENCH_RUNS 3
+
+static inline double now_ms(void) {
+    struct timespec _time;
+    timespec_get(&_time, TIME_UTC);
+    return (double)_time.tv_sec * 1e3 + (double)_time.tv_nsec / 1e6;
+}
+
+static inline void use_bench_directory(void) {
+    static char _directory[1024];
+    if (!_getcwd(_directory, sizeof(_directory) - 32)) exit(1);
+    strcat(_directory, "/bench-data");
+    _putenv_s("APPDATA", _directory);
+
+    char _path[1100];
+    _mkdir(_directory);
+    snprintf(_path, sizeof(_path), "%s/ProtonDB", _directory);
+    _mkdir(_path);
+    snprintf(_path, sizeof(_path), "%s/ProtonDB/db", _directory);
+    _mkdir(_path);
+}
+
+// Drop what an earlier run left behind and start with an empty database
+static inline void fresh_database(const char* databaseName) {
+    QueryConfig config = { 0 };
+    config.databaseName = databaseName;
+    drop_database(config);
+    create_database(config);
+}
+
+// Number of documents a document count argument asks for, or a default
+static inline int document_count(const int argc, char** argv, const int fallback) {
+    return argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : fallback;
+}
+
+#endif //BENCH_SUPPORT_H
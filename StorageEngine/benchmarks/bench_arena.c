@@ -0,0 +1,122 @@
+#include "BenchSupport.h"
+#include "Arena.h"
+
+// Reads with their trees built in a per-thread arena against reads that build them on the heap,
+// and the cost the arena's cJSON hooks put on prints outside a read.
+// Usage: bench_arena [documents, default 100000]
+
+#define BATCH 10000
+
+static char batch[BATCH * 256];
+
+// Documents of about ten fields, with a nested object and arrays
+static void load_collection(const char* collectionName, const char* storage, const int count) {
+    QueryConfig config = { 0 };
+    config.databaseName = "arena";
+    config.collectionName = collectionName;
+    config.data = storage;
+    create_collection(config);
+
+    for (int start = 0; start < count; start += BATCH) {
+        char* _cursor = batch;
+        _cursor += sprintf(_cursor, "[");
+        for (int i = start; i < start + BATCH && i < count; i++) {
+            _cursor += sprintf(_cursor,
+                               "%s{\"n\":%d,\"age\":%d,\"name\":\"user%d\",\"tags\":[\"a\",\"b\",%d],"
+                               "\"address\":{\"city\":\"c%d\",\"zip\":%d,\"geo\":[%d.5,%d.25]},\"score\":%d.125}",
+                               i > start ? "," : "", i, i % 90, i, i % 7, i % 100, 10000 + i, i % 180, i % 90, i);
+        }
+        sprintf(_cursor, "]");
+        config.data = batch;
+        insert_document(config);
+    }
+}
+
+// Best time of a print from the file over BENCH_RUNS runs
+static double time_print(const char* collectionName, const char* projection) {
+    QueryConfig config = { 0 };
+    config.databaseName = "arena";
+    config.collectionName = collectionName;
+    config.projection = projection;
+
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        const double _start = now_ms();
+        const ArrayOut _output = print_documents(config);
+        const double _spent = now_ms() - _start;
+        if (_output.size > 0) free_list(_output.list, _output.size);
+        if (_spent < _best) _best = _spent;
+    }
+    return _best;
+}
+
+// Microseconds per compact print of a tree, best of BENCH_RUNS rounds
+static double time_json_print(cJSON* item, const int times) {
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        const double _start = now_ms();
+        for (int i = 0; i < times; i++) cJSON_free(cJSON_PrintUnformatted(item));
+        const double _spent = (now_ms() - _start) * 1e3 / times;
+        if (_spent < _best) _best = _spent;
+    }
+    return _best;
+}
+
+int main(int argc, char** argv) {
+    const int _count = document_count(argc, argv, 100000);
+    use_bench_directory();
+    fresh_database("arena");
+    load_collection("paged", NULL, _count);
+    load_collection("lsm", "lsm", _count);
+    configure_cache(0);
+
+    printf("%d documents read from the file, best of %d runs\n", _count, BENCH_RUNS);
+    printf("%-32s %12s %12s\n", "", "heap ms", "arena ms");
+    const char* _collections[] = { "paged", "lsm" };
+    for (int c = 0; c < 2; c++) {
+        for (int p = 0; p < 2; p++) {
+            const char* _projection = p ? "name,address.city" : NULL;
+            arena_enable(false);
+            const double _heap = time_print(_collections[c], _projection);
+            arena_enable(true);
+            const double _arena = time_print(_collections[c], _projection);
+            printf("%-6s %-25s %12.1f %12.1f\n", _collections[c], p ? "two-field projection" : "whole documents", _heap, _arena);
+        }
+    }
+
+    // A record the size of a write-ahead log entry, and a meta file of about 1 MB
+    cJSON* _record = cJSON_Parse("{\"operation\":0,\"collection\":\"users\",\"data\":\"{\\\"name\\\":\\\"user1\\\","
+                                 "\\\"age\\\":31,\\\"city\\\":\\\"Paris\\\"}\",\"condition\":6,\"action\":0}");
+    cJSON* _meta = cJSON_CreateObject();
+    for (int i = 0; i < 20000; i++) {
+        char _name[32];
+        snprintf(_name, sizeof(_name), "collection%d", i);
+        cJSON_AddStringToObject(_meta, _name, "C:/Users/user/AppData/Roaming/ProtonDB/db/bench");
+    }
+
+    // Reads above installed the arena's hooks; cJSON_InitHooks(NULL) puts back malloc, free and
+    // realloc, after which no read may run in this process
+    const double _hookedRecord = time_json_print(_record, 200000);
+    const double _hookedMeta = time_json_print(_meta, 50);
+    cJSON_InitHooks(NULL);
+    const double _plainRecord = time_json_print(_record, 200000);
+    const double _plainMeta = time_json_print(_meta, 50);
+
+    char* _text = cJSON_PrintUnformatted(_record);
+    const size_t _recordSize = strlen(_text);
+    cJSON_free(_text);
+    _text = cJSON_PrintUnformatted(_meta);
+    const size_t _metaSize = strlen(_text);
+    cJSON_free(_text);
+
+    char _label[64];
+    printf("\n%-32s %12s %12s\n", "compact print outside a read", "realloc us", "hooks us");
+    snprintf(_label, sizeof(_label), "log record, %zu bytes", _recordSize);
+    printf("%-32s %12.3f %12.3f\n", _label, _plainRecord, _hookedRecord);
+    snprintf(_label, sizeof(_label), "meta file, %zu bytes", _metaSize);
+    printf("%-32s %12.1f %12.1f\n", _label, _plainMeta, _hookedMeta);
+
+    cJSON_Delete(_record);
+    cJSON_Delete(_meta);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "BenchSupport.h"
+#include "Predicate.h"
+
+// Collection files with documents stored as JSON text frames (a version 2 log) against the
+// binary encoding with field offset tables, for a full load and for filtered scans. The
+// binary file is written by dump_binary, so it has the layout of a current collection.
+// Usage: bench_document_codec [documents, default 100000]
+
+static char error[MAX_ERROR_LEN];
+
+// Documents of six fields; one in seven lives in Tokyo
+static cJSON* make_documents(const int count) {
+    cJSON* _documents = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        char _name[32];
+        snprintf(_name, sizeof(_name), "user%d", i);
+        cJSON* _item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(_item, "id", i);
+        cJSON_AddStringToObject(_item, "name", _name);
+        cJSON_AddNumberToObject(_item, "age", i % 90);
+        cJSON_AddStringToObject(_item, "city", i % 7 ? "Paris" : "Tokyo");
+        cJSON_AddBoolToObject(_item, "active", i % 2);
+        cJSON* _tags = cJSON_AddArrayToObject(_item, "tags");
+        cJSON_AddItemToArray(_tags, cJSON_CreateString("a"));
+        cJSON_AddItemToArray(_tags, cJSON_CreateString("b"));
+        cJSON_AddItemToArray(_documents, _item);
+    }
+    return _documents;
+}
+
+// A version 2 log: the header up to its applied LSN, then one JSON text frame per document
+static void write_text_log(const char* fileName, const cJSON* documents) {
+    FILE* _file = fopen(fileName, "wb");
+    const CollectionHeader _header = { COLLECTION_MAGIC, 2, 0 };
+    fwrite(&_header, offsetof(CollectionHeader, nextId), 1, _file);
+
+    const cJSON* _item = NULL;
+    cJSON_ArrayForEach(_item, documents) {
+        char* _text = cJSON_PrintUnformatted(_item);
+        const RecordHeader _frame = { (uint32_t)strlen(_text), checksum(_text, strlen(_text)) };
+        fwrite(&_frame, sizeof(_frame), 1, _file);
+        fwrite(_text, 1, _frame.length, _file);
+        cJSON_free(_text);
+    }
+    fclose(_file);
+}
+
+// Best time of a full load over BENCH_RUNS runs
+static double time_load(const char* fileName) {
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        const double _start = now_ms();
+        cJSON* _documents = load_binary(fileName, error);
+        const double _spent = now_ms() - _start;
+        cJSON_Delete(_documents);
+        if (_spent < _best) _best = _spent;
+    }
+    return _best;
+}
+
+// Best time of a filtered scan over BENCH_RUNS runs, and the number of matches
+static double time_scan(const char* fileName, const char* key, const char* value, int* matches) {
+    QueryConfig config = { 0 };
+    config.key = key;
+    config.value = value;
+    config.condition = equal;
+    Predicate _predicate;
+    if (!compile_predicate(&config, &_predicate, error)) exit(1);
+
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        char** _list = NULL;
+        const double _start = now_ms();
+        *matches = scan_filtered_documents(fileName, NULL, 0, &_predicate, NULL, NULL, NULL, NULL, &_list, error);
+        const double _spent = now_ms() - _start;
+        for (int i = 0; i < *matches; i++) free(_list[i]);
+        free(_list);
+        if (_spent < _best) _best = _spent;
+    }
+    release_predicate(&_predicate);
+    return _best;
+}
+
+int main(int argc, char** argv) {
+    const int _count = document_count(argc, argv, 100000);
+    use_bench_directory();
+
+    char _textName[1100];
+    char _binaryName[1100];
+    snprintf(_textName, sizeof(_textName), "%s/text.col", getenv("APPDATA"));
+    snprintf(_binaryName, sizeof(_binaryName), "%s/binary.col", getenv("APPDATA"));
+    cJSON* _documents = make_documents(_count);
+    write_text_log(_textName, _documents);
+    remove(_binaryName);
+    if (!dump_binary(_binaryName, _documents, 0, error)) {
+        printf("%s\n", error);
+        return 1;
+    }
+    cJSON_Delete(_documents);
+
+    const char* _files[] = { _textName, _binaryName };
+    double _load[2], _city[2], _id[2];
+    int _cityMatches = 0, _idMatches = 0;
+    for (int f = 0; f < 2; f++) {
+        _load[f] = time_load(_files[f]);
+        _city[f] = time_scan(_files[f], "city", "Tokyo", &_cityMatches);
+        _id[f] = time_scan(_files[f], "id", "5", &_idMatches);
+    }
+
+    char _label[64];
+    printf("%d documents of six fields, best of %d runs\n", _count, BENCH_RUNS);
+    printf("%-28s %12s %12s\n", "", "text", "binary");
+    printf("%-28s %9.1f MB %9.1f MB\n", "file size", get_file_size(_textName) / 1e6, get_file_size(_binaryName) / 1e6);
+    printf("%-28s %9.1f ms %9.1f ms\n", "load_binary", _load[0], _load[1]);
+    snprintf(_label, sizeof(_label), "scan city == Tokyo (%d)", _cityMatches);
+    printf("%-28s %9.1f ms %9.1f ms\n", _label, _city[0], _city[1]);
+    snprintf(_label, sizeof(_label), "scan id == 5 (%d)", _idMatches);
+    printf("%-28s %9.1f ms %9.1f ms\n", _label, _id[0], _id[1]);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <math.h>
+#include "BenchSupport.h"
+#include "FilterKernels.h"
+
+// The comparison kernels against a test of one number at a time, on an array of numbers and
+// on a filter that runs over a shadow column instead of the documents.
+// Usage: bench_filter_kernels [documents, default 200000]
+
+#define NUMBERS 1000000
+#define PASSES 20
+#define BATCH 10000
+
+// The word kernel without SIMD, from FilterKernels.c
+uint64_t select_word_scalar(const double* numbers, size_t count, double limit, Condition condition);
+
+static double numbers[NUMBERS];
+static uint64_t selection[NUMBERS / SELECTION_BITS + 1];
+static char batch[BATCH * 64];
+
+// How column_lookup compared before the kernels: the condition is switched on per number
+static bool number_passes(const double number, const double limit, const Condition condition) {
+    switch (condition) {
+        case greaterThan: return number > limit;
+        case greaterThanEqual: return number >= limit;
+        case lessThan: return number < limit;
+        case lessThanEqual: return number <= limit;
+        case equal: return number == limit;
+        case notEqual: return number != limit;
+        default: return false;
+    }
+}
+
+static void select_per_number(const double limit, const Condition condition) {
+    memset(selection, 0, sizeof(selection));
+    for (size_t i = 0; i < NUMBERS; i++) {
+        if (number_passes(numbers[i], limit, condition)) selection[i / SELECTION_BITS] |= 1ULL << (i % SELECTION_BITS);
+    }
+}
+
+static void select_scalar_words(const double limit, const Condition condition) {
+    for (size_t i = 0; i < NUMBERS; i += SELECTION_BITS) {
+        const size_t _take = NUMBERS - i < SELECTION_BITS ? NUMBERS - i : SELECTION_BITS;
+        selection[i / SELECTION_BITS] = select_word_scalar(numbers + i, _take, limit, condition);
+    }
+}
+
+static void select_kernel(const double limit, const Condition condition) {
+    select_numbers(numbers, NUMBERS, limit, condition, selection);
+}
+
+// Milliseconds per pass over the numbers, best of BENCH_RUNS rounds
+static double time_selection(void (*select)(double, Condition)) {
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        const double _start = now_ms();
+        for (int p = 0; p < PASSES; p++) select(500.0, lessThan);
+        const double _spent = (now_ms() - _start) / PASSES;
+        if (_spent < _best) _best = _spent;
+    }
+    return _best;
+}
+
+// Best time of a filtered print over BENCH_RUNS runs, and the number of matches
+static double time_filter(const char* value, int* matches) {
+    QueryConfig config = { 0 };
+    config.databaseName = "kernels";
+    config.collectionName = "docs";
+    config.key = "v";
+    config.value = value;
+    config.condition = lessThan;
+
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        const double _start = now_ms();
+        const ArrayOut _output = print_documents(config);
+        const double _spent = now_ms() - _start;
+        *matches = _output.size;
+        if (_output.size > 0) free_list(_output.list, _output.size);
+        if (_spent < _best) _best = _spent;
+    }
+    return _best;
+}
+
+int main(int argc, char** argv) {
+    const int _count = document_count(argc, argv, 200000);
+    const char* _kernels[] = { "scalar", "SSE2", "AVX" };
+
+    // Numbers 0 to 999, with a NaN now and then for a row without the key
+    srand(7);
+    for (int i = 0; i < NUMBERS; i++) numbers[i] = i % 97 == 0 ? NAN : (double)(rand() % 1000);
+
+    printf("%d numbers < 500, ms per pass, best of %d runs\n", NUMBERS, BENCH_RUNS);
+    printf("%-28s %8.2f\n", "per-number switch", time_selection(select_per_number));
+    printf("%-28s %8.2f\n", "scalar words", time_selection(select_scalar_words));
+    char _label[64];
+    snprintf(_label, sizeof(_label), "select_numbers (%s)", _kernels[filter_kernel()]);
+    printf("%-28s %8.2f\n", _label, time_selection(select_kernel));
+
+    use_bench_directory();
+    fresh_database("kernels");
+    QueryConfig config = { 0 };
+    config.databaseName = "kernels";
+    config.collectionName = "docs";
+    create_collection(config);
+    for (int start = 0; start < _count; start += BATCH) {
+        char* _cursor = batch;
+        _cursor += sprintf(_cursor, "[");
+        for (int i = start; i < start + BATCH && i < _count; i++) {
+            _cursor += sprintf(_cursor, "%s{\"n\":%d,\"v\":%d,\"name\":\"user%d\"}", i > start ? "," : "", i, rand() % 1000, i);
+        }
+        sprintf(_cursor, "]");
+        config.data = batch;
+        insert_document(config);
+    }
+
+    // Filters on v test the documents one by one until v has a shadow column
+    const char* _values[] = { "5", "500" };
+    double _documents[2], _column[2];
+    int _matches[2];
+    for (int v = 0; v < 2; v++) _documents[v] = time_filter(_values[v], &_matches[v]);
+    config.key = "v";
+    config.data = NULL;
+    create_column(config);
+    for (int v = 0; v < 2; v++) _column[v] = time_filter(_values[v], &_matches[v]);
+
+    printf("\n%d documents, print of v < limit, best of %d runs\n", _count, BENCH_RUNS);
+    printf("%-28s %12s %12s\n", "", "documents ms", "column ms");
+    for (int v = 0; v < 2; v++) {
+        snprintf(_label, sizeof(_label), "v < %s (%d matches)", _values[v], _matches[v]);
+        printf("%-28s %12.1f %12.1f\n", _label, _documents[v], _column[v]);
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "BenchSupport.h"
+#include "Predicate.h"
+
+// Update and remove passes over a collection held in memory, at growing sizes. A pass that
+// walked the array from its head for every document would grow with the square of the size.
+// Usage: bench_filtered_passes [largest size, default 1000000]
+
+static char error[MAX_ERROR_LEN];
+
+static cJSON* make_documents(const int count) {
+    cJSON* _documents = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        cJSON* _item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(_item, "id", i);
+        cJSON_AddStringToObject(_item, "name", "x");
+        cJSON_AddNumberToObject(_item, "age", i % 90);
+        cJSON_AddItemToArray(_documents, _item);
+    }
+    return _documents;
+}
+
+// Best time of a pass over fresh documents over BENCH_RUNS runs; update adds a field to
+// every document, remove drops those aged 45 and over, half of them
+static double time_pass(const int count, const bool update) {
+    QueryConfig config = { 0 };
+    config.key = update ? NULL : "age";
+    config.value = update ? NULL : "45";
+    config.condition = update ? all : greaterThanEqual;
+    Predicate _predicate;
+    if (!compile_predicate(&config, &_predicate, error)) exit(1);
+
+    double _best = 1e18;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        cJSON* _documents = make_documents(count);
+        const double _start = now_ms();
+        if (update) update_filtered_documents(_documents, &_predicate, add, "{\"flag\":true}", error);
+        else remove_filtered_documents(_documents, &_predicate, error);
+        const double _spent = now_ms() - _start;
+        cJSON_Delete(_documents);
+        if (_spent < _best) _best = _spent;
+    }
+    release_predicate(&_predicate);
+    return _best;
+}
+
+int main(int argc, char** argv) {
+    const int _largest = document_count(argc, argv, 1000000);
+
+    printf("Passes over documents of three fields, best of %d runs\n", BENCH_RUNS);
+    printf("%-10s %14s %14s\n", "documents", "update all ms", "remove half ms");
+    for (int _count = 10000; _count <= _largest; _count *= 10) {
+        printf("%-10d %14.1f %14.1f\n", _count, time_pass(_count, true), time_pass(_count, false));
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "StorageEngine.h"
+
+// Each test runs against a data directory of its own: CMake points APPDATA at it (see
+// CMakeLists.txt), so the engine never touches the user's databases.
+
+static int failures = 0;
+
+// Assertion macros
+#define ASSERT_TRUE_LOG(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "[FAIL] %s: %s\n", __func__, #cond); \
+            ++failures; return; \
+        } \
+    } while (0)
+
+#define ASSERT_FALSE_LOG(cond) ASSERT_TRUE_LOG(!(cond))
+
+// Like ASSERT_TRUE_LOG, printing the message an engine call returned
+#define ASSERT_OUTPUT_LOG(cond, output) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "[FAIL] %s: %s\n", __func__, #cond); \
+            fprintf(stderr, "   message = %s\n", (output).message); \
+            ++failures; return; \
+        } \
+    } while (0)
+
+// A query on one collection of a database
+static inline QueryConfig collection_config(const char* databaseName, const char* collectionName) {
+    QueryConfig config = { 0 };
+    config.databaseName = databaseName;
+    config.collectionName = collectionName;
+    return config;
+}
+
+// Drop what an earlier run left behind and start with an empty collection
+static inline bool fresh_collection(const char* databaseName, const char* collectionName, const char* storage) {
+    QueryConfig config = collection_config(databaseName, collectionName);
+    drop_database(config);
+    if (!create_database(config).success) return false;
+    config.data = storage;
+    return create_collection(config).success;
+}
+
+// Number of documents a print returns, or -1 when it fails
+static inline int count_documents(QueryConfig config) {
+    const ArrayOut output = config.key || config.filter ? print_documents(config) : print_all_documents(config);
+    if (output.size > 0) free_list(output.list, output.size);
+    return output.size;
+}
+
+static inline void id_text(char* array, const int id) {
+    snprintf(array, 24, "%d", id);
+}
+
+// The "_id" of a printed document, or -1 when it has none
+static inline int document_id(const char* document) {
+    const char* _key = strstr(document, "\"_id\"");
+    if (!_key) return -1;
+    _key += 5;
+    while (*_key == ':' || *_key == ' ' || *_key == '\t') _key++;
+    return atoi(_key);
+}
+
+// Path of a collection file, as the engine composes it
+static inline void collection_file(char* array, const size_t size, const char* databaseName, const char* collectionName) {
+    snprintf(array, size, "%s/ProtonDB/db/%s/%s.col", getenv("APPDATA"), databaseName, collectionName);
+}
+
+// Run this test binary again with a phase argument, as a process of its own. Used to end a
+// process without a checkpoint and then recover in a fresh one.
+static inline int run_phase(const char* self, const char* phase) {
+    char command[1024];
+    snprintf(command, sizeof(command), "\"%s\" %s", self, phase);
+    return system(command);
+}
+
+#endif //TEST_SUPPORT_H
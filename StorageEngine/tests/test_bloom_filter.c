@@ -0,0 +1,192 @@
+#include "TestSupport.h"
+#include "LsmStore.h"
+
+#define DATABASE "blooms"
+// Recovery runs on the first use of a database in a process, so the damaged filter test keeps its own
+#define DAMAGED_DATABASE "damaged"
+#define DOCUMENTS 80
+#define TAGS 8
+
+// Checkpoint a database, which flushes the memtable of every LSM collection written since the
+// last one into a new segment. Dropping a collection checkpoints first.
+static bool checkpoint(const char* databaseName) {
+    const QueryConfig config = collection_config(databaseName, "scratch");
+    return create_collection(config).success && drop_collection(config).success;
+}
+
+// Documents from to from+count-1, tagged by their number, in one batch
+static bool insert_tagged(const char* databaseName, const int from, const int count) {
+    char _batch[DOCUMENTS * 32] = "[";
+    for (int i = from; i < from + count; i++) {
+        const size_t _length = strlen(_batch);
+        snprintf(_batch + _length, sizeof(_batch) - _length, "%s{\"tag\":\"t%d\",\"n\":%d}", i > from ? "," : "", i % TAGS, i);
+    }
+    strcat(_batch, "]");
+    QueryConfig config = collection_config(databaseName, "events");
+    config.data = _batch;
+    return insert_document(config).success;
+}
+
+static bool alter_tag(const char* databaseName, const char* id, const char* data) {
+    QueryConfig config = collection_config(databaseName, "events");
+    config.value = id;
+    config.action = alter;
+    config.data = data;
+    return update_document_by_id(config).success;
+}
+
+// A collection in four runs: two segments of inserts, a segment that moves id 5 to another
+// tag, removes id 13 and moves id 21, and a memtable that moves id 29. Ids 5, 13, 21 and 29
+// were tagged "t5" in the oldest segment. Without flushMoves the third segment stays in the
+// memtable too.
+static bool build_segments(const char* databaseName, const bool flushMoves) {
+    if (!fresh_collection(databaseName, "events", LSM_STORAGE_NAME) || !insert_tagged(databaseName, 1, DOCUMENTS / 2) ||
+        !checkpoint(databaseName)) return false;
+
+    QueryConfig config = collection_config(databaseName, "events");
+    config.key = "tag";
+    if (!create_bloom_filter(config).success) return false;
+
+    if (!insert_tagged(databaseName, DOCUMENTS / 2 + 1, DOCUMENTS / 2) || !checkpoint(databaseName)) return false;
+
+    config.value = "13";
+    if (!alter_tag(databaseName, "5", "{\"tag\":\"moved\"}") || !remove_document_by_id(config).success ||
+        !alter_tag(databaseName, "21", "{\"tag\":\"t6\"}") || (flushMoves && !checkpoint(databaseName))) return false;
+    return alter_tag(databaseName, "29", "{\"tag\":\"t1\"}");
+}
+
+// Mark in ids the documents an equality filter on "tag" prints; returns how many, or -1
+static int filtered_ids(const char* databaseName, const char* tag, bool* ids) {
+    QueryConfig config = collection_config(databaseName, "events");
+    config.key = "tag";
+    config.value = tag;
+    config.condition = equal;
+    const ArrayOut output = print_documents(config);
+    for (int i = 0; i < output.size; i++) {
+        const int _id = document_id(output.list[i]);
+        if (_id > 0 && _id <= DOCUMENTS) ids[_id] = true;
+    }
+    if (output.size > 0) free_list(output.list, output.size);
+    return output.size;
+}
+
+// The same as filtered_ids, from a plain scan of every document
+static int scanned_ids(const char* databaseName, const char* tag, bool* ids) {
+    const ArrayOut output = print_all_documents(collection_config(databaseName, "events"));
+    int _count = 0;
+    for (int i = 0; i < output.size; i++) {
+        cJSON* _document = cJSON_Parse(output.list[i]);
+        const cJSON* _tag = cJSON_GetObjectItemCaseSensitive(_document, "tag");
+        const int _id = document_id(output.list[i]);
+        if (cJSON_IsString(_tag) && strcmp(_tag->valuestring, tag) == 0 && _id > 0 && _id <= DOCUMENTS) {
+            ids[_id] = true;
+            _count++;
+        }
+        cJSON_Delete(_document);
+    }
+    if (output.size > 0) free_list(output.list, output.size);
+    return output.size < 0 ? -1 : _count;
+}
+
+// Whether every tag prints the same documents through the filters as a plain scan finds
+static bool filters_match_scan(const char* databaseName) {
+    const char* _tags[] = { "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", "moved", "absent" };
+    for (int t = 0; t < 10; t++) {
+        bool _filtered[DOCUMENTS + 1] = { false }, _scanned[DOCUMENTS + 1] = { false };
+        const int _expected = scanned_ids(databaseName, _tags[t], _scanned);
+        const int _printed = filtered_ids(databaseName, _tags[t], _filtered);
+        if (_expected < 0 || (_printed < 0 ? 0 : _printed) != _expected ||
+            memcmp(_filtered, _scanned, sizeof(_filtered)) != 0) {
+            fprintf(stderr, "   tag %s: %d printed, %d scanned\n", _tags[t], _printed, _expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Phase run in a process of its own: a filtered collection for the parent to damage the
+// filter files of before it first reads it. Recovery flushes what the log holds into a third
+// segment, short of the merge that would rewrite the damaged ones.
+static int build_and_stop(void) {
+    if (!build_segments(DAMAGED_DATABASE, false)) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Test case: Equality filters through the Bloom filters print what a scan finds, including
+// documents whose newer version or removal is in a segment the filters leave out
+void testFilteredMatchesScan(void) {
+    ASSERT_TRUE_LOG(build_segments(DATABASE, true));
+    ASSERT_TRUE_LOG(filters_match_scan(DATABASE));
+
+    bool _ids[DOCUMENTS + 1] = { false };
+    ASSERT_TRUE_LOG(filtered_ids(DATABASE, "t5", _ids) == 6);
+    ASSERT_FALSE_LOG(_ids[5] || _ids[13] || _ids[21] || _ids[29]);
+    memset(_ids, 0, sizeof(_ids));
+    ASSERT_TRUE_LOG(filtered_ids(DATABASE, "moved", _ids) == 1 && _ids[5]);
+
+    QueryConfig config = collection_config(DATABASE, "events");
+    config.key = "tag";
+    ASSERT_FALSE_LOG(create_bloom_filter(config).success);
+
+    // A fourth segment merges the tier into one segment, which gets the filter too
+    ASSERT_TRUE_LOG(checkpoint(DATABASE));
+    ASSERT_TRUE_LOG(filters_match_scan(DATABASE));
+
+    Output output = drop_bloom_filter(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    ASSERT_TRUE_LOG(filters_match_scan(DATABASE));
+}
+
+// Test case: Bloom filters need an LSM collection
+void testPagedCollectionRefused(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "paged", NULL));
+    QueryConfig config = collection_config(DATABASE, "paged");
+    config.key = "tag";
+    ASSERT_FALSE_LOG(create_bloom_filter(config).success);
+}
+
+// Test case: A segment whose filter file is missing or damaged is scanned as if it had none
+void testDamagedFiltersScanned(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "build") == 0);
+
+    char _path[1024], _filterName[1024 + 32];
+    collection_file(_path, sizeof(_path), DAMAGED_DATABASE, "events");
+    snprintf(_filterName, sizeof(_filterName), "%s.1%s", _path, FILTER_SUFFIX);
+    ASSERT_TRUE_LOG(remove(_filterName) == 0);
+
+    // Clear the bits of the second segment's filter, which would rule out every value if its
+    // checksum did not catch it
+    snprintf(_filterName, sizeof(_filterName), "%s.2%s", _path, FILTER_SUFFIX);
+    FILE* _file = fopen(_filterName, "rb+");
+    ASSERT_TRUE_LOG(_file != NULL);
+    FilterRecord _record;
+    const bool _read = fseek(_file, sizeof(FilterHeader), SEEK_SET) == 0 && fread(&_record, sizeof(_record), 1, _file) == 1;
+    bool _written = _read && fseek(_file, (long)(sizeof(FilterHeader) + sizeof(FilterRecord)), SEEK_SET) == 0;
+    const uint64_t _zero = 0;
+    for (uint32_t i = 0; _written && i < _record.wordCount; i++) _written = fwrite(&_zero, sizeof(_zero), 1, _file) == 1;
+    fclose(_file);
+    ASSERT_TRUE_LOG(_written);
+
+    ASSERT_TRUE_LOG(filters_match_scan(DAMAGED_DATABASE));
+    bool _ids[DOCUMENTS + 1] = { false };
+    ASSERT_TRUE_LOG(filtered_ids(DAMAGED_DATABASE, "t5", _ids) == 6);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "build") == 0) return build_and_stop();
+
+    printf("Running Bloom filter tests...\n");
+
+    testFilteredMatchesScan();
+    testPagedCollectionRefused();
+    testDamagedFiltersScanned(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All Bloom filter tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
@@ -0,0 +1,138 @@
+#include "TestSupport.h"
+
+#define DATABASE "pool"
+// Recovery runs on the first use of a database in a process, so the crash test keeps its own
+#define CRASH_DATABASE "poolcrash"
+#define POOL_LIMIT (64 * 1024)
+#define DOCUMENTS 400
+
+static char document[8192];
+static int lengths[DOCUMENTS + 1];
+
+// A document with a padding field of length bytes
+static const char* padded(const int length, const char fill) {
+    int _size = snprintf(document, sizeof(document), "{\"pad\":\"");
+    memset(document + _size, fill, length);
+    snprintf(document + _size + length, sizeof(document) - _size - length, "\",\"n\":1}");
+    return document;
+}
+
+// Length of the padding of the document with an id, or -1 when there is none
+static int stored_length(const char* databaseName, const int id) {
+    char _id[24];
+    id_text(_id, id);
+    QueryConfig config = collection_config(databaseName, "docs");
+    config.value = _id;
+    const ArrayOut output = print_document_by_id(config);
+    if (output.size != 1) {
+        if (output.size > 0) free_list(output.list, output.size);
+        return -1;
+    }
+    const char* _pad = strstr(output.list[0], "\"pad\"");
+    const char* _start = _pad ? strchr(_pad + 5, '"') : NULL;
+    const char* _end = _start ? strchr(_start + 1, '"') : NULL;
+    const int _length = _end ? (int)(_end - _start - 1) : -1;
+    free_list(output.list, output.size);
+    return _length;
+}
+
+// Fill a collection many times the size of the pool, then update and remove across all of
+// it, the same on every call. Without apply only the model of the result is rebuilt.
+static bool churn_documents(const char* databaseName, const bool apply) {
+    QueryConfig config = collection_config(databaseName, "docs");
+    srand(31);
+    for (int id = 1; id <= DOCUMENTS; id++) {
+        lengths[id] = 400 + id % 200;
+        config.data = padded(lengths[id], 'a');
+        if (apply && !insert_document(config).success) return false;
+    }
+
+    config.action = alter;
+    for (int op = 0; op < 1500; op++) {
+        const int _id = 1 + rand() % DOCUMENTS;
+        const int _length = rand() % 4 == 0 ? 1000 + rand() % 3000 : rand() % 600;
+        const bool _remove = rand() % 10 == 0;
+        if (lengths[_id] < 0) continue;
+
+        char _value[24];
+        id_text(_value, _id);
+        config.value = _value;
+        config.data = padded(_length, 'b' + op % 20);
+        if (apply && !(_remove ? remove_document_by_id(config) : update_document_by_id(config)).success) return false;
+        lengths[_id] = _remove ? -1 : _length;
+    }
+    return true;
+}
+
+// Phase run in a process of its own: churn under a small pool, so that some changed pages are
+// evicted to the file and others are still in the pool when the process ends
+static int churn_and_stop(void) {
+    configure_buffer_pool(POOL_LIMIT);
+    if (!fresh_collection(CRASH_DATABASE, "docs", NULL)) return 1;
+    if (!churn_documents(CRASH_DATABASE, true)) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Test case: The pool reports the limit it was configured with and never holds more
+void testLimitFollowsConfiguration(void) {
+    configure_buffer_pool(1024 * 1024);
+    ASSERT_TRUE_LOG(buffer_pool_stats().limitBytes == 1024 * 1024);
+
+    configure_buffer_pool(POOL_LIMIT);
+    const BufferPoolStats _stats = buffer_pool_stats();
+    ASSERT_TRUE_LOG(_stats.limitBytes == POOL_LIMIT);
+    ASSERT_TRUE_LOG(_stats.usedBytes <= POOL_LIMIT);
+}
+
+// Test case: A collection many times larger than the pool reads back as written, with pages
+// evicted and changed ones written back on the way
+void testChurnUnderSmallPool(void) {
+    configure_buffer_pool(POOL_LIMIT);
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", NULL));
+    const BufferPoolStats _before = buffer_pool_stats();
+    ASSERT_TRUE_LOG(churn_documents(DATABASE, true));
+
+    int _live = 0;
+    for (int id = 1; id <= DOCUMENTS; id++) {
+        ASSERT_TRUE_LOG(stored_length(DATABASE, id) == lengths[id]);
+        _live += lengths[id] >= 0;
+    }
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == _live);
+
+    const BufferPoolStats _after = buffer_pool_stats();
+    ASSERT_TRUE_LOG(_after.hits > _before.hits);
+    ASSERT_TRUE_LOG(_after.misses > _before.misses);
+    ASSERT_TRUE_LOG(_after.evictions > _before.evictions);
+    ASSERT_TRUE_LOG(_after.writeBacks > _before.writeBacks);
+    ASSERT_TRUE_LOG(_after.usedBytes <= _after.limitBytes);
+}
+
+// Test case: Changed pages lost with the pool in a crash are recovered from the log, over
+// those that eviction had already written to the file
+void testPooledPagesRecoveredAfterCrash(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "churn") == 0);
+
+    churn_documents(CRASH_DATABASE, false);
+    for (int id = 1; id <= DOCUMENTS; id++) ASSERT_TRUE_LOG(stored_length(CRASH_DATABASE, id) == lengths[id]);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "churn") == 0) return churn_and_stop();
+
+    printf("Running BufferPool tests...\n");
+
+    testLimitFollowsConfiguration();
+    testChurnUnderSmallPool();
+    testPooledPagesRecoveredAfterCrash(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All BufferPool tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
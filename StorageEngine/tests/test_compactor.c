@@ -0,0 +1,160 @@
+#include <windows.h>
+#include "TestSupport.h"
+#include "PageStore.h"
+
+#define DATABASE "compact"
+// Recovery runs on the first use of a database in a process, so the stale copy test keeps its own
+#define STALE_DATABASE "stale"
+#define DOCUMENTS 20000
+#define BATCH 1000
+
+static char batch[BATCH * 300];
+
+static long file_size(const char* databaseName) {
+    char _path[1024];
+    collection_file(_path, sizeof(_path), databaseName, "docs");
+    FILE* _file = fopen(_path, "rb");
+    if (!_file) return -1;
+    fseek(_file, 0, SEEK_END);
+    const long _size = ftell(_file);
+    fclose(_file);
+    return _size;
+}
+
+// Documents with a sequence number n, a group g of seven and some padding
+static bool load_documents(const char* databaseName, const int count) {
+    QueryConfig config = collection_config(databaseName, "docs");
+    for (int start = 0; start < count; start += BATCH) {
+        char* _cursor = batch;
+        _cursor += sprintf(_cursor, "[");
+        for (int i = start; i < start + BATCH && i < count; i++) {
+            _cursor += sprintf(_cursor, "%s{\"n\":%d,\"g\":%d,\"pad\":\"%0*d\"}", i > start ? "," : "", i, i % 7, (i % 5) * 40 + 10, 0);
+        }
+        sprintf(_cursor, "]");
+        config.data = batch;
+        if (!insert_document(config).success) return false;
+    }
+    return true;
+}
+
+static int count_matches(const char* databaseName, const char* key, const char* value, const Condition condition) {
+    QueryConfig config = collection_config(databaseName, "docs");
+    config.key = key;
+    config.value = value;
+    config.condition = condition;
+    return count_documents(config);
+}
+
+// Phase run in a process of its own: a collection left with the copy of a compaction that
+// never finished
+static int leave_stale_copy(void) {
+    if (!fresh_collection(STALE_DATABASE, "docs", NULL) || !load_documents(STALE_DATABASE, 500)) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Test case: A collection with most of its pages free is compacted in the background, keeping
+// its documents, their ids and order, and its indexes
+void testCompactionShrinksFile(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", NULL));
+    ASSERT_TRUE_LOG(load_documents(DATABASE, DOCUMENTS));
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.key = "g";
+    ASSERT_TRUE_LOG(create_index(config).success);
+    ASSERT_TRUE_LOG(create_range_index(config).success);
+    config.key = "n";
+    ASSERT_TRUE_LOG(create_range_index(config).success);
+
+    const long _before = file_size(DATABASE);
+    configure_compaction(0.4, 0);
+    config.value = "14000";
+    config.condition = lessThan;
+    const Output output = remove_documents(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+
+    // Documents are kept in the order of the pages they were placed in, which compaction keeps
+    static int _order[DOCUMENTS];
+    config = collection_config(DATABASE, "docs");
+    config.condition = all;
+    ArrayOut _documents = print_all_documents(config);
+    ASSERT_TRUE_LOG(_documents.size == DOCUMENTS - 14000);
+    static bool _seen[DOCUMENTS + 1];
+    bool _kept = true;
+    for (int i = 0; i < _documents.size; i++) {
+        _order[i] = document_id(_documents.list[i]);
+        _kept = _kept && _order[i] > 14000 && _order[i] <= DOCUMENTS && !_seen[_order[i]];
+        if (_kept) _seen[_order[i]] = true;
+    }
+    free_list(_documents.list, _documents.size);
+    ASSERT_TRUE_LOG(_kept);
+
+    long _after = file_size(DATABASE);
+    for (int i = 0; i < 300 && _after >= _before; i++) {
+        Sleep(100);
+        _after = file_size(DATABASE);
+    }
+    configure_compaction(0, 0);
+    ASSERT_TRUE_LOG(_after < _before / 2);
+
+    _documents = print_all_documents(config);
+    ASSERT_TRUE_LOG(_documents.size == DOCUMENTS - 14000);
+    bool _ordered = true;
+    for (int i = 0; i < _documents.size; i++) _ordered = _ordered && document_id(_documents.list[i]) == _order[i];
+    free_list(_documents.list, _documents.size);
+    ASSERT_TRUE_LOG(_ordered);
+
+    int _group = 0;
+    int _last = 0;
+    for (int i = 14000; i < DOCUMENTS; i++) {
+        _group += i % 7 == 3;
+        _last += i % 7 == 6;
+    }
+    ASSERT_TRUE_LOG(count_matches(DATABASE, "g", "3", equal) == _group);
+    ASSERT_TRUE_LOG(count_matches(DATABASE, "g", "5", greaterThan) == _last);
+    ASSERT_TRUE_LOG(count_matches(DATABASE, "n", "19000", greaterThanEqual) == 1000);
+    ASSERT_TRUE_LOG(count_matches(DATABASE, "n", "14000", lessThan) == 0);
+
+    // The compacted file takes new documents after the old ids
+    config = collection_config(DATABASE, "docs");
+    config.data = "{\"n\":-1}";
+    const Output _inserted = insert_document(config);
+    ASSERT_OUTPUT_LOG(strcmp(_inserted.message, "Inserted 1, _id 20001") == 0, _inserted);
+}
+
+// Test case: Recovery deletes the copy of a compaction cut short and keeps the old file
+void testStaleCopyRemoved(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "stale") == 0);
+
+    char _path[1024];
+    char _copyName[1024 + 8];
+    collection_file(_path, sizeof(_path), STALE_DATABASE, "docs");
+    snprintf(_copyName, sizeof(_copyName), "%s%s", _path, COMPACT_SUFFIX);
+    FILE* _copy = fopen(_copyName, "wb");
+    ASSERT_TRUE_LOG(_copy != NULL);
+    fputs("unfinished", _copy);
+    fclose(_copy);
+
+    QueryConfig config = collection_config(STALE_DATABASE, "docs");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == 500);
+    _copy = fopen(_copyName, "rb");
+    if (_copy) fclose(_copy);
+    ASSERT_TRUE_LOG(_copy == NULL);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "stale") == 0) return leave_stale_copy();
+
+    printf("Running Compactor tests...\n");
+
+    testCompactionShrinksFile();
+    testStaleCopyRemoved(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All Compactor tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
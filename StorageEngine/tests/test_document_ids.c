@@ -0,0 +1,145 @@
+#include "TestSupport.h"
+
+#define DATABASE "ids"
+// Recovery runs on the first use of a database in a process, so the crash test keeps its own
+#define REPLAY_DATABASE "replayed"
+
+// The document with an id printed as compact JSON into array, or an empty string
+static int print_by_id(const char* databaseName, const char* collectionName, const char* id, char* array, const size_t size) {
+    QueryConfig config = collection_config(databaseName, collectionName);
+    config.value = id;
+    const ArrayOut output = print_document_by_id(config);
+    array[0] = '\0';
+    if (output.size > 0) {
+        cJSON* _document = cJSON_Parse(output.list[0]);
+        char* _text = cJSON_PrintUnformatted(_document);
+        snprintf(array, size, "%s", _text ? _text : "");
+        cJSON_free(_text);
+        cJSON_Delete(_document);
+        free_list(output.list, output.size);
+    }
+    return output.size;
+}
+
+// Phase run in a process of its own: inserts and a remove that the process ends without
+// checkpointing, so only the log has them
+static int write_and_stop(void) {
+    if (!fresh_collection(REPLAY_DATABASE, "replayed", NULL)) return 1;
+    QueryConfig config = collection_config(REPLAY_DATABASE, "replayed");
+    config.data = "[{\"name\":\"a\"},{\"name\":\"b\"},{\"name\":\"c\"}]";
+    if (strcmp(insert_document(config).message, "Inserted 3, _id 1-3") != 0) return 1;
+
+    config.value = "2";
+    if (!remove_document_by_id(config).success) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Test case: Inserts get ids from a counter in order, replacing any id a client gives
+void testIdsAssignedInOrder(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "assigned", NULL));
+    QueryConfig config = collection_config(DATABASE, "assigned");
+
+    config.data = "[{\"name\":\"a\"},{\"name\":\"b\"}]";
+    Output output = insert_document(config);
+    ASSERT_OUTPUT_LOG(strcmp(output.message, "Inserted 2, _id 1-2") == 0, output);
+    config.data = "{\"name\":\"c\",\"_id\":99}";
+    output = insert_document(config);
+    ASSERT_OUTPUT_LOG(strcmp(output.message, "Inserted 1, _id 3") == 0, output);
+
+    char _document[256];
+    ASSERT_TRUE_LOG(print_by_id(DATABASE, "assigned", "3", _document, sizeof(_document)) == 1);
+    ASSERT_TRUE_LOG(strcmp(_document, "{\"_id\":3,\"name\":\"c\"}") == 0);
+    ASSERT_TRUE_LOG(print_by_id(DATABASE, "assigned", "99", _document, sizeof(_document)) == 0);
+}
+
+// Test case: The id of a removed document is never given out again
+void testIdsNotReused(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "removed", NULL));
+    QueryConfig config = collection_config(DATABASE, "removed");
+    config.data = "[{\"name\":\"a\"},{\"name\":\"b\"}]";
+    ASSERT_TRUE_LOG(insert_document(config).success);
+
+    config.value = "2";
+    Output output = remove_document_by_id(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    output = remove_document_by_id(config);
+    ASSERT_FALSE_LOG(output.success);
+
+    config.value = NULL;
+    config.data = "{\"name\":\"c\"}";
+    output = insert_document(config);
+    ASSERT_OUTPUT_LOG(strcmp(output.message, "Inserted 1, _id 3") == 0, output);
+}
+
+// Test case: Updates by id change the document, but never its id
+void testUpdateById(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "updated", NULL));
+    QueryConfig config = collection_config(DATABASE, "updated");
+    config.data = "[{\"price\":5},{\"price\":7}]";
+    ASSERT_TRUE_LOG(insert_document(config).success);
+
+    config.value = "2";
+    config.action = alter;
+    config.data = "{\"price\":9}";
+    Output output = update_document_by_id(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    char _document[256];
+    ASSERT_TRUE_LOG(print_by_id(DATABASE, "updated", "2", _document, sizeof(_document)) == 1);
+    ASSERT_TRUE_LOG(strcmp(_document, "{\"_id\":2,\"price\":9}") == 0);
+
+    config.data = "{\"_id\":7}";
+    output = update_document_by_id(config);
+    ASSERT_FALSE_LOG(output.success);
+    config.action = drop;
+    config.data = "\"_id\"";
+    output = update_document_by_id(config);
+    ASSERT_FALSE_LOG(output.success);
+    ASSERT_TRUE_LOG(print_by_id(DATABASE, "updated", "2", _document, sizeof(_document)) == 1);
+}
+
+// Test case: Ids that are not positive integers are rejected rather than matched
+void testInvalidIdsRejected(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "invalid", NULL));
+    const char* _invalid[] = { "abc", "0", "1.5", "", "-1" };
+    char _document[256];
+    for (int i = 0; i < 5; i++) ASSERT_TRUE_LOG(print_by_id(DATABASE, "invalid", _invalid[i], _document, sizeof(_document)) < 0);
+}
+
+// Test case: Replaying the log after a crash gives the documents the ids they were acknowledged
+// with, and the counter goes on after them
+void testReplayKeepsIds(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "write") == 0);
+
+    char _document[256];
+    ASSERT_TRUE_LOG(print_by_id(REPLAY_DATABASE, "replayed", "1", _document, sizeof(_document)) == 1);
+    ASSERT_TRUE_LOG(strcmp(_document, "{\"_id\":1,\"name\":\"a\"}") == 0);
+    ASSERT_TRUE_LOG(print_by_id(REPLAY_DATABASE, "replayed", "2", _document, sizeof(_document)) == 0);
+    ASSERT_TRUE_LOG(print_by_id(REPLAY_DATABASE, "replayed", "3", _document, sizeof(_document)) == 1);
+    ASSERT_TRUE_LOG(strcmp(_document, "{\"_id\":3,\"name\":\"c\"}") == 0);
+
+    QueryConfig config = collection_config(REPLAY_DATABASE, "replayed");
+    config.data = "{\"name\":\"d\"}";
+    const Output output = insert_document(config);
+    ASSERT_OUTPUT_LOG(strcmp(output.message, "Inserted 1, _id 4") == 0, output);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "write") == 0) return write_and_stop();
+
+    printf("Running document id tests...\n");
+
+    testIdsAssignedInOrder();
+    testIdsNotReused();
+    testUpdateById();
+    testInvalidIdsRejected();
+    testReplayKeepsIds(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All document id tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
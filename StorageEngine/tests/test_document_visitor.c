@@ -0,0 +1,289 @@
+#include <limits.h>
+#include <math.h>
+#include "TestSupport.h"
+#include "DocumentCodec.h"
+
+#define DATABASE "visits"
+#define DOCUMENTS 50
+#define RANDOM_TREES 500
+
+// Documents a visitor was handed, copied out of the buffer the engine reuses
+typedef struct {
+    char* texts[DOCUMENTS];
+    int count;
+    int stopAfter;
+    bool terminated;
+} Visits;
+
+static bool collect_document(const char* document, const size_t length, void* context) {
+    Visits* _visits = context;
+    _visits->terminated = _visits->terminated && document[length] == '\0' && strlen(document) == length;
+    if (_visits->count < DOCUMENTS) _visits->texts[_visits->count] = _strdup(document);
+    _visits->count++;
+    return _visits->stopAfter == 0 || _visits->count < _visits->stopAfter;
+}
+
+static void free_visits(Visits* visits) {
+    for (int i = 0; i < visits->count && i < DOCUMENTS; i++) free(visits->texts[i]);
+}
+
+// Whether write_json prints the encoding of a tree as cJSON_PrintUnformatted prints the tree
+static bool prints_as_cjson(const cJSON* item) {
+    ByteBuffer _encoded = { 0 }, _written = { 0 };
+    char* _expected = cJSON_PrintUnformatted(item);
+    const bool _same = _expected && encode_value(&_encoded, item) && write_json(&_written, _encoded.data, _encoded.size) &&
+                       _written.size == strlen(_expected) && memcmp(_written.data, _expected, _written.size) == 0;
+    if (!_same) fprintf(stderr, "   expected %s, written %.*s\n", _expected, (int)_written.size, (const char*)_written.data);
+    cJSON_free(_expected);
+    free(_encoded.data);
+    free(_written.data);
+    return _same;
+}
+
+// A double from random bits, so that every exponent and the ones cJSON prints with 17 digits
+// turn up; NaN and the infinities included
+static double random_number(void) {
+    uint64_t _bits = 0;
+    for (int i = 0; i < 4; i++) _bits = _bits << 16 | (uint64_t)(rand() & 0xFFFF);
+    double _number;
+    memcpy(&_number, &_bits, sizeof(_number));
+    switch (rand() % 6) {
+        case 0: return (double)(rand() % 2001 - 1000);
+        case 1: return (rand() % 2001 - 1000) / 8.0;
+        case 2: return rand() % 2 ? INT_MAX + (double)(rand() % 3) : INT_MIN - (double)(rand() % 3);
+        default: return _number;
+    }
+}
+
+static cJSON* random_tree(const int depth) {
+    const int _kind = depth > 3 ? rand() % 5 : rand() % 7;
+    switch (_kind) {
+        case 0: return cJSON_CreateNull();
+        case 1: return cJSON_CreateBool(rand() % 2);
+        case 2: return cJSON_CreateNumber(random_number());
+        case 3:
+        case 4: {
+            // Every byte but NUL, so that each escape turns up
+            char _text[16];
+            const int _length = rand() % (int)sizeof(_text);
+            for (int i = 0; i < _length; i++) _text[i] = (char)(rand() % 255 + 1);
+            _text[_length] = '\0';
+            return cJSON_CreateString(_text);
+        }
+        case 5: {
+            cJSON* _array = cJSON_CreateArray();
+            for (int i = rand() % 4; i > 0; i--) cJSON_AddItemToArray(_array, random_tree(depth + 1));
+            return _array;
+        }
+        default: {
+            cJSON* _object = cJSON_CreateObject();
+            for (int i = rand() % 4; i > 0; i--) {
+                char _key[8];
+                snprintf(_key, sizeof(_key), "k%d", rand() % 6);
+                cJSON_AddItemToObject(_object, _key, random_tree(depth + 1));
+            }
+            return _object;
+        }
+    }
+}
+
+// Documents with strings that need escapes and numbers of every print form
+static bool insert_documents(const char* collectionName) {
+    static char _batch[DOCUMENTS * 160];
+    char* _cursor = _batch;
+    _cursor += sprintf(_cursor, "[");
+    for (int i = 0; i < DOCUMENTS; i++) {
+        _cursor += sprintf(_cursor, "%s{\"n\":%d,\"half\":%.1f,\"third\":%.17g,\"big\":%d.5e12,\"text\":\"line %d\\n\\t\\\"q\\\" \\\\ \\u0001\","
+                           "\"nested\":{\"list\":[%d,true,null,{\"deep\":\"\\u00e9\"}],\"empty\":{}}}",
+                           i > 0 ? "," : "", i, i / 2.0, i / 3.0, i, i, i);
+    }
+    sprintf(_cursor, "]");
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.data = _batch;
+    return insert_document(config).success;
+}
+
+// A query on the documents with n below 40, in pages of limit documents when limit is set
+static QueryConfig filtered_config(const char* collectionName, const int limit) {
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.key = "n";
+    config.value = "40";
+    config.condition = lessThan;
+    config.limit = limit;
+    return config;
+}
+
+// The compact text cJSON_PrintUnformatted gives for a printed document
+static char* compact(const char* document) {
+    cJSON* _document = cJSON_Parse(document);
+    char* _text = _document ? cJSON_PrintUnformatted(_document) : NULL;
+    cJSON_Delete(_document);
+    return _text;
+}
+
+// Whether a visitor and a packed print are handed the documents print_documents prints, as
+// the compact text cJSON gives for them byte for byte
+static bool exports_match_print(const QueryConfig config) {
+    const ArrayOut _printed = print_documents(config);
+    Visits _visits = { .terminated = true };
+    const ArrayOut _visited = visit_documents(config, collect_document, &_visits);
+    const PackedOut _packed = print_packed_documents(config);
+
+    bool _same = _printed.size > 0 && _visited.size == _printed.size && _visits.count == _printed.size &&
+                 _visits.terminated && _packed.size == _printed.size &&
+                 strcmp(_visited.resume, _printed.resume) == 0 && strcmp(_packed.resume, _printed.resume) == 0;
+    for (int i = 0; _same && i < _printed.size; i++) {
+        char* _expected = compact(_printed.list[i]);
+        _same = _expected && strcmp(_visits.texts[i], _expected) == 0 && strcmp(_packed.block + _packed.entries[i].offset, _expected) == 0;
+        cJSON_free(_expected);
+    }
+    if (!_same) fprintf(stderr, "   %d printed, %d visited, %d packed\n", _printed.size, _visited.size, _packed.size);
+
+    free_visits(&_visits);
+    if (_printed.size > 0) free_list(_printed.list, _printed.size);
+    if (_packed.size > 0) free_packed(_packed.block);
+    return _same;
+}
+
+// Test case: Encoded values print as cJSON_PrintUnformatted prints their trees, escapes,
+// whole numbers at the edges of an int and numbers needing 17 digits included
+void testJsonMatchesCjson(void) {
+    const char* _texts[] = {
+        "{}", "[]", "null", "true", "false", "0", "-0.0", "2147483647", "2147483648", "-2147483648", "-2147483649",
+        "0.1", "0.30000000000000004", "1e300", "-1e-300", "123456789012345678", "9007199254740993", "5e-324",
+        "\"\"", "\"\\\"\\\\\\b\\f\\n\\r\\t\\u0001\\u001f/\"", "\"\\u00e9\\u2028\\ud83d\\ude00\"",
+        "{\"a\":[1,[2,[3,{}]],{\"b\":null}],\"c\":{\"d\":{\"e\":[]}},\"f\":\"g\"}",
+        "{\"dup\":1,\"dup\":2}",
+    };
+    for (size_t t = 0; t < sizeof(_texts) / sizeof(_texts[0]); t++) {
+        cJSON* _item = cJSON_Parse(_texts[t]);
+        ASSERT_TRUE_LOG(_item != NULL);
+        const bool _same = prints_as_cjson(_item);
+        cJSON_Delete(_item);
+        ASSERT_TRUE_LOG(_same);
+    }
+
+    srand(24);
+    for (int t = 0; t < RANDOM_TREES; t++) {
+        cJSON* _tree = random_tree(0);
+        const bool _same = prints_as_cjson(_tree);
+        cJSON_Delete(_tree);
+        ASSERT_TRUE_LOG(_same);
+    }
+}
+
+// Test case: A visitor and a packed print get the documents print_documents prints, for a
+// scan, an index lookup and every page of a paged query, from a paged and an LSM collection
+void testExportsMatchPrint(void) {
+    const char* _storages[] = { NULL, "lsm" };
+    for (int s = 0; s < 2; s++) {
+        ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", _storages[s]));
+        ASSERT_TRUE_LOG(insert_documents("docs"));
+
+        QueryConfig config = collection_config(DATABASE, "docs");
+        config.condition = all;
+        ASSERT_TRUE_LOG(exports_match_print(config));
+        ASSERT_TRUE_LOG(exports_match_print(filtered_config("docs", 0)));
+
+        // Whichever export reads a page, its token leads to the same next page
+        char _resume[MAX_RESUME_LEN] = "";
+        int _pages = 0, _seen = 0;
+        config = filtered_config("docs", 7);
+        do {
+            config.resume = _resume[0] ? _resume : NULL;
+            ASSERT_TRUE_LOG(exports_match_print(config));
+            Visits _visits = { .terminated = true };
+            const ArrayOut _visited = visit_documents(config, collect_document, &_visits);
+            ASSERT_TRUE_LOG(_visits.count > 0 && document_id(_visits.texts[0]) == _seen + 1);
+            free_visits(&_visits);
+            _seen += _visited.size;
+            _pages++;
+            memcpy(_resume, _visited.resume, sizeof(_resume));
+        } while (_resume[0] && _pages < DOCUMENTS);
+        ASSERT_TRUE_LOG(_seen == 40 && _pages == 6);
+
+        config = filtered_config("docs", 0);
+        ASSERT_TRUE_LOG(create_index(config).success);
+        ASSERT_TRUE_LOG(exports_match_print(config));
+        config.value = "7";
+        config.condition = equal;
+        ASSERT_TRUE_LOG(exports_match_print(config));
+    }
+}
+
+// Test case: A visitor that returns false ends the query at that document
+void testVisitorStopsQuery(void) {
+    const char* _storages[] = { NULL, "lsm" };
+    for (int s = 0; s < 2; s++) {
+        ASSERT_TRUE_LOG(fresh_collection(DATABASE, "stopped", _storages[s]));
+        ASSERT_TRUE_LOG(insert_documents("stopped"));
+
+        QueryConfig config = collection_config(DATABASE, "stopped");
+        config.condition = all;
+        Visits _visits = { .stopAfter = 3, .terminated = true };
+        ArrayOut output = visit_documents(config, collect_document, &_visits);
+        ASSERT_TRUE_LOG(_visits.count == 3 && output.size == 3);
+        ASSERT_TRUE_LOG(document_id(_visits.texts[2]) == 3);
+        free_visits(&_visits);
+
+        // Through an index as well
+        config = filtered_config("stopped", 0);
+        ASSERT_TRUE_LOG(create_range_index(config).success);
+        _visits = (Visits){ .stopAfter = 5, .terminated = true };
+        output = visit_documents(config, collect_document, &_visits);
+        ASSERT_TRUE_LOG(_visits.count == 5 && output.size == 5);
+        free_visits(&_visits);
+
+        ASSERT_TRUE_LOG(visit_documents(config, NULL, NULL).size < 0);
+    }
+}
+
+// Test case: The table of a packed print holds the offset and length of each document, laid
+// one after another with a NUL each, and ends the block aligned for its entries
+void testPackedTable(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "packed", NULL));
+    ASSERT_TRUE_LOG(insert_documents("packed"));
+
+    QueryConfig config = collection_config(DATABASE, "packed");
+    config.condition = all;
+    const PackedOut output = print_packed_documents(config);
+    ASSERT_OUTPUT_LOG(output.size == DOCUMENTS, output);
+
+    uint32_t _offset = 0;
+    bool _laid = (uintptr_t)output.entries % sizeof(uint32_t) == 0 && (char*)output.entries >= output.block;
+    for (int i = 0; _laid && i < output.size; i++) {
+        const PackedEntry _entry = output.entries[i];
+        _laid = _entry.offset == _offset && output.block[_entry.offset + _entry.length] == '\0' &&
+                strlen(output.block + _entry.offset) == _entry.length && document_id(output.block + _entry.offset) == i + 1;
+        _offset += _entry.length + 1;
+    }
+    _laid = _laid && (char*)output.entries - output.block == (_offset + 3) / 4 * 4;
+    free_packed(output.block);
+    ASSERT_TRUE_LOG(_laid);
+
+    // Nothing to print leaves no block, and an error its message
+    config = filtered_config("packed", 0);
+    config.value = "-1";
+    const PackedOut _empty = print_packed_documents(config);
+    ASSERT_TRUE_LOG(_empty.size == 0 && _empty.block == NULL && _empty.entries == NULL);
+    config.condition = all + 1;
+    const PackedOut _failed = print_packed_documents(config);
+    ASSERT_TRUE_LOG(_failed.size < 0 && _failed.block == NULL && strncmp(_failed.message, "fatal:", 6) == 0);
+}
+
+int main(void) {
+    printf("Running document visitor tests...\n");
+
+    testJsonMatchesCjson();
+    testExportsMatchPrint();
+    testVisitorStopsQuery();
+    testPackedTable();
+
+    if (failures == 0) {
+        printf("[PASS] All document visitor tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
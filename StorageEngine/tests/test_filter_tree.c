@@ -0,0 +1,251 @@
+#include "TestSupport.h"
+#include "Predicate.h"
+
+#define DATABASE "filters"
+// Recovery runs on the first use of a database in a process, so the crash test keeps its own
+#define REPLAY_DATABASE "replayed"
+#define DOCUMENTS 120
+
+// Internal to StorageEngine.c
+int filter_candidates(QueryConfig config, const Predicate* predicate, uint64_t** recordIds);
+
+// A filter tree and the documents it should print, by their number i (the "_id" less one)
+typedef struct {
+    const char* filter;
+    bool (*expected)(int i);
+} FilterCase;
+
+static const char* cities[] = { "Paris", "Oslo", "Rome", "Lima" };
+
+static bool and_terms(const int i) { return i % 5 == 2 && i > 50; }
+static bool or_terms(const int i) { return i % 3 == 1 || i < 10; }
+static bool not_term(const int i) { return i % 5 != 0; }
+static bool dotted_key(const int i) { return i % 4 == 0; }
+static bool dotted_number(const int i) { return i % 10 < 5; }
+static bool boolean_value(const int i) { return i % 2 == 1; }
+static bool nested_nodes(const int i) { return i % 10 <= 3 && !(i % 2 == 0 || i % 4 == 1); }
+static bool unindexed_first(const int i) { return i % 3 == 1 && i < 30; }
+static bool no_document(const int i) { (void)i; return false; }
+
+static const FilterCase cases[] = {
+    { "{\"and\":[{\"key\":\"g\",\"condition\":4,\"value\":2},{\"key\":\"n\",\"condition\":0,\"value\":50}]}", and_terms },
+    { "{\"or\":[{\"key\":\"tag\",\"condition\":4,\"value\":\"t1\"},{\"key\":\"n\",\"condition\":2,\"value\":\"10\"}]}", or_terms },
+    { "{\"not\":{\"key\":\"g\",\"condition\":4,\"value\":0}}", not_term },
+    { "{\"key\":\"address.city\",\"condition\":4,\"value\":\"Paris\"}", dotted_key },
+    { "{\"not\":{\"key\":\"address.zip\",\"condition\":1,\"value\":5}}", dotted_number },
+    { "{\"key\":\"flag\",\"condition\":4,\"value\":false}", boolean_value },
+    { "{\"and\":[{\"key\":\"address.zip\",\"condition\":3,\"value\":3},{\"not\":{\"or\":[{\"key\":\"flag\",\"condition\":4,\"value\":true},"
+      "{\"key\":\"address.city\",\"condition\":4,\"value\":\"Oslo\"}]}}]}", nested_nodes },
+    { "{\"and\":[{\"key\":\"tag\",\"condition\":4,\"value\":\"t1\"},{\"key\":\"n\",\"condition\":2,\"value\":30}]}", unindexed_first },
+    { "{\"key\":\"address.city.name\",\"condition\":4,\"value\":\"Paris\"}", no_document },
+};
+
+static char batch[DOCUMENTS * 128];
+
+static bool load_documents(const char* databaseName) {
+    char* _cursor = batch;
+    _cursor += sprintf(_cursor, "[");
+    for (int i = 0; i < DOCUMENTS; i++) {
+        _cursor += sprintf(_cursor, "%s{\"n\":%d,\"g\":%d,\"tag\":\"t%d\",\"address\":{\"city\":\"%s\",\"zip\":%d},\"flag\":%s}",
+                           i > 0 ? "," : "", i, i % 5, i % 3, cities[i % 4], i % 10, i % 2 == 0 ? "true" : "false");
+    }
+    sprintf(_cursor, "]");
+    QueryConfig config = collection_config(databaseName, "docs");
+    config.data = batch;
+    return insert_document(config).success;
+}
+
+// Whether a filter tree prints exactly the documents a case expects
+static bool filter_prints(const FilterCase* filterCase) {
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.filter = filterCase->filter;
+    const ArrayOut output = print_documents(config);
+    bool _printed[DOCUMENTS] = { false };
+    bool _same = output.size >= 0;
+    for (int i = 0; i < output.size; i++) {
+        const int _id = document_id(output.list[i]);
+        _same = _same && _id > 0 && _id <= DOCUMENTS && !_printed[_id - 1];
+        if (_same) _printed[_id - 1] = true;
+    }
+    if (output.size > 0) free_list(output.list, output.size);
+
+    for (int i = 0; i < DOCUMENTS; i++) _same = _same && _printed[i] == filterCase->expected(i);
+    if (!_same) fprintf(stderr, "   filter %s: %d printed\n", filterCase->filter, output.size);
+    return _same;
+}
+
+static bool filters_print(void) {
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        if (!filter_prints(&cases[c])) return false;
+    }
+    return true;
+}
+
+// Number of candidates the indexes find for a filter tree, or -1 when the whole collection is
+// read. filter_candidates works on the collection file of the last query, so one is run first.
+static int candidate_count(const char* filter) {
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.filter = filter;
+    count_documents(config);
+
+    Predicate _predicate;
+    char _error[1024];
+    if (!compile_predicate(&config, &_predicate, _error)) return -2;
+    uint64_t* _recordIds = NULL;
+    const int _count = filter_candidates(config, &_predicate, &_recordIds);
+    free(_recordIds);
+    release_predicate(&_predicate);
+    return _count;
+}
+
+// A filter of depth NOT nodes around a test on "n"
+static void nested_filter(char* array, const size_t size, const int depth) {
+    size_t _length = 0;
+    for (int i = 0; i < depth; i++) _length += snprintf(array + _length, size - _length, "{\"not\":");
+    _length += snprintf(array + _length, size - _length, "{\"key\":\"n\",\"condition\":2,\"value\":10}");
+    for (int i = 0; i < depth; i++) _length += snprintf(array + _length, size - _length, "}");
+}
+
+// Phase run in a process of its own: an update and a remove through filter trees that the
+// process ends without checkpointing, so only the log has them
+static int mutate_and_stop(void) {
+    if (!fresh_collection(REPLAY_DATABASE, "docs", NULL) || !load_documents(REPLAY_DATABASE)) return 1;
+
+    QueryConfig config = collection_config(REPLAY_DATABASE, "docs");
+    config.filter = "{\"and\":[{\"key\":\"address.city\",\"condition\":4,\"value\":\"Rome\"},{\"not\":{\"key\":\"g\",\"condition\":4,\"value\":0}}]}";
+    config.action = alter;
+    config.data = "{\"tag\":\"hit\"}";
+    if (!update_documents(config).success) return 1;
+
+    config = collection_config(REPLAY_DATABASE, "docs");
+    config.filter = "{\"or\":[{\"key\":\"n\",\"condition\":2,\"value\":5},{\"key\":\"address.zip\",\"condition\":4,\"value\":9}]}";
+    if (!remove_documents(config).success) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Test case: AND, OR and NOT nodes over plain keys, dotted paths, numbers, strings and
+// booleans print what the tree describes
+void testTreesMatchDocuments(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", NULL));
+    ASSERT_TRUE_LOG(load_documents(DATABASE));
+    ASSERT_TRUE_LOG(filters_print());
+
+    // NOT nodes to the deepest a tree may go
+    char _filter[4096];
+    nested_filter(_filter, sizeof(_filter), MAX_PREDICATE_DEPTH - 1);
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.filter = _filter;
+    ASSERT_TRUE_LOG(count_documents(config) == DOCUMENTS - 10);
+}
+
+// Test case: A top-level AND reads the candidates of the first of its tests an index answers,
+// and prints the same documents as without indexes
+void testIndexedAndTerms(void) {
+    ASSERT_TRUE_LOG(candidate_count(cases[0].filter) == -1);
+
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.key = "g";
+    ASSERT_TRUE_LOG(create_index(config).success);
+    config.key = "n";
+    ASSERT_TRUE_LOG(create_range_index(config).success);
+
+    // The equality on "g" is the most selective test, so its hash index is used
+    ASSERT_TRUE_LOG(candidate_count(cases[0].filter) == DOCUMENTS / 5);
+    // "tag" has no index, so the range index of the test after it is used
+    ASSERT_TRUE_LOG(candidate_count(cases[7].filter) == 30);
+    // OR and NOT nodes and dotted paths read the whole collection
+    ASSERT_TRUE_LOG(candidate_count(cases[1].filter) == -1);
+    ASSERT_TRUE_LOG(candidate_count(cases[2].filter) == -1);
+    ASSERT_TRUE_LOG(candidate_count(cases[6].filter) == -1);
+    ASSERT_TRUE_LOG(filters_print());
+}
+
+// Test case: Malformed trees, empty node lists and trees nested too deeply are refused by
+// prints and mutations alike, leaving the documents as they were
+void testInvalidTreesRefused(void) {
+    char _tooDeep[4096];
+    nested_filter(_tooDeep, sizeof(_tooDeep), MAX_PREDICATE_DEPTH);
+    const char* _filters[] = {
+        "{\"and\":[]}",
+        "{\"or\":[]}",
+        "{\"and\":{\"key\":\"n\",\"condition\":4,\"value\":1}}",
+        _tooDeep,
+        "{\"and\":[{\"key\":\"n\",\"condition\":4,\"value\":1}",
+        "[]",
+        "{\"key\":\"n\",\"value\":1}",
+        "{\"key\":\"n\",\"condition\":6,\"value\":1}",
+        "{\"key\":\"n\",\"condition\":4,\"value\":null}",
+        "{\"key\":\"n..zip\",\"condition\":4,\"value\":1}",
+        "{\"or\":[{\"key\":\"n\",\"condition\":4,\"value\":1},{\"key\":7,\"condition\":4,\"value\":1}]}",
+    };
+
+    for (size_t f = 0; f < sizeof(_filters) / sizeof(_filters[0]); f++) {
+        QueryConfig config = collection_config(DATABASE, "docs");
+        config.filter = _filters[f];
+        const ArrayOut printed = print_documents(config);
+        if (printed.size > 0) free_list(printed.list, printed.size);
+        if (printed.size >= 0) fprintf(stderr, "   filter %s printed %d\n", _filters[f], printed.size);
+        ASSERT_TRUE_LOG(printed.size < 0 && strncmp(printed.message, "fatal:", 6) == 0);
+
+        config.action = alter;
+        config.data = "{\"tag\":\"refused\"}";
+        ASSERT_FALSE_LOG(update_documents(config).success);
+        ASSERT_FALSE_LOG(remove_documents(config).success);
+    }
+
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == DOCUMENTS);
+    config.key = "tag";
+    config.value = "refused";
+    config.condition = equal;
+    ASSERT_TRUE_LOG(count_documents(config) == 0);
+}
+
+// Test case: Mutations through filter trees are replayed from the log after a crash
+void testTreeMutationsReplayed(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "mutate") == 0);
+
+    const ArrayOut output = print_all_documents(collection_config(REPLAY_DATABASE, "docs"));
+    bool _seen[DOCUMENTS] = { false };
+    bool _same = output.size >= 0;
+    for (int i = 0; i < output.size; i++) {
+        cJSON* _document = cJSON_Parse(output.list[i]);
+        const int _id = document_id(output.list[i]);
+        const cJSON* _tag = cJSON_GetObjectItemCaseSensitive(_document, "tag");
+        _same = _same && _id > 0 && _id <= DOCUMENTS && cJSON_IsString(_tag);
+        if (_same) {
+            const int _n = _id - 1;
+            _seen[_n] = true;
+            char _expected[8];
+            if (_n % 4 == 2 && _n % 5 != 0) snprintf(_expected, sizeof(_expected), "hit");
+            else snprintf(_expected, sizeof(_expected), "t%d", _n % 3);
+            _same = strcmp(_tag->valuestring, _expected) == 0;
+        }
+        cJSON_Delete(_document);
+    }
+    if (output.size > 0) free_list(output.list, output.size);
+    ASSERT_TRUE_LOG(_same);
+
+    for (int i = 0; i < DOCUMENTS; i++) ASSERT_TRUE_LOG(_seen[i] == !(i < 5 || i % 10 == 9));
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "mutate") == 0) return mutate_and_stop();
+
+    printf("Running filter tree tests...\n");
+
+    testTreesMatchDocuments();
+    testIndexedAndTerms();
+    testInvalidTreesRefused();
+    testTreeMutationsReplayed(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All filter tree tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
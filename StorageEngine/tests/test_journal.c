@@ -0,0 +1,153 @@
+#include "TestSupport.h"
+#include "PageStore.h"
+
+#define DATABASE "journal"
+#define DOCUMENTS 200
+
+static char document[8192];
+static int lengths[DOCUMENTS + 1];
+
+// A document with a padding field of length bytes
+static const char* padded(const int length, const char fill) {
+    int _size = snprintf(document, sizeof(document), "{\"pad\":\"");
+    memset(document + _size, fill, length);
+    snprintf(document + _size + length, sizeof(document) - _size - length, "\",\"n\":1}");
+    return document;
+}
+
+// Length of the padding of the document with an id, or -1 when there is none
+static int stored_length(const int id) {
+    char _id[24];
+    id_text(_id, id);
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.value = _id;
+    const ArrayOut output = print_document_by_id(config);
+    if (output.size != 1) {
+        if (output.size > 0) free_list(output.list, output.size);
+        return -1;
+    }
+    const char* _pad = strstr(output.list[0], "\"pad\"");
+    const char* _start = _pad ? strchr(_pad + 5, '"') : NULL;
+    const char* _end = _start ? strchr(_start + 1, '"') : NULL;
+    const int _length = _end ? (int)(_end - _start - 1) : -1;
+    free_list(output.list, output.size);
+    return _length;
+}
+
+// The updates and removes made after the checkpoint, the same on every call. Without apply
+// only the model of their result is rebuilt.
+static bool change_documents(const bool apply) {
+    QueryConfig config = collection_config(DATABASE, "docs");
+    srand(23);
+    for (int id = 1; id <= DOCUMENTS; id++) lengths[id] = 100;
+
+    for (int op = 0; op < 300; op++) {
+        const int _id = 1 + rand() % DOCUMENTS;
+        const int _length = rand() % 3 == 0 ? 1500 + rand() % 2000 : rand() % 200;
+        const bool _remove = rand() % 8 == 0;
+        if (lengths[_id] < 0) continue;
+
+        char _value[24];
+        id_text(_value, _id);
+        config.value = _value;
+        config.action = alter;
+        config.data = padded(_length, 'a' + op % 26);
+        if (apply && !(_remove ? remove_document_by_id(config) : update_document_by_id(config)).success) return false;
+        lengths[_id] = _remove ? -1 : _length;
+    }
+    return true;
+}
+
+// Phase run in a process of its own: with pages written straight through to the file, change
+// documents after a checkpoint and end the process before the next one
+static int change_and_stop(void) {
+    configure_buffer_pool(0);
+    if (!fresh_collection(DATABASE, "docs", NULL)) return 1;
+    QueryConfig config = collection_config(DATABASE, "docs");
+    for (int i = 0; i < DOCUMENTS; i++) {
+        config.data = padded(100, 'a');
+        if (!insert_document(config).success) return 1;
+    }
+
+    // Dropping a collection checkpoints the database
+    config.collectionName = "scratch";
+    config.data = NULL;
+    if (!create_collection(config).success || !drop_collection(config).success) return 1;
+
+    if (!change_documents(true)) return 1;
+    fflush(stdout);
+    _Exit(0);
+}
+
+// Overwrite part of every page the journal saved, as a crash in the middle of writing them
+// back would. Returns the number of pages torn.
+static int tear_journaled_pages(void) {
+    char _fileName[1024];
+    char _journalName[1024 + 8];
+    collection_file(_fileName, sizeof(_fileName), DATABASE, "docs");
+    snprintf(_journalName, sizeof(_journalName), "%s%s", _fileName, JOURNAL_SUFFIX);
+
+    FILE* _journal = fopen(_journalName, "rb");
+    FILE* _file = fopen(_fileName, "rb+");
+    static char _image[COLLECTION_PAGE_SIZE];
+    char _garbage[2000];
+    memset(_garbage, 0xAA, sizeof(_garbage));
+    JournalHeader _header;
+    JournalEntry _entry;
+    int _torn = 0;
+
+    if (_journal && _file && fread(&_header, sizeof(_header), 1, _journal) == 1) {
+        while (fread(&_entry, sizeof(_entry), 1, _journal) == 1 && fread(_image, COLLECTION_PAGE_SIZE, 1, _journal) == 1) {
+            // The header page holds the applied LSN and is written at once, never torn
+            if (_entry.page == 0) continue;
+            fseek(_file, (long)_entry.page * COLLECTION_PAGE_SIZE + 100, SEEK_SET);
+            fwrite(_garbage, 1, sizeof(_garbage), _file);
+            _torn++;
+        }
+    }
+    if (_journal) fclose(_journal);
+    if (_file) fclose(_file);
+    return _torn;
+}
+
+// Test case: Pages torn by a crash are copied back from the journal, and the log then replays
+// the changes made since the checkpoint over them
+void testTornPagesRolledBack(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "change") == 0);
+    ASSERT_TRUE_LOG(tear_journaled_pages() > 0);
+
+    change_documents(false);
+    int _live = 0;
+    for (int id = 1; id <= DOCUMENTS; id++) {
+        ASSERT_TRUE_LOG(stored_length(id) == lengths[id]);
+        _live += lengths[id] >= 0;
+    }
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == _live);
+
+    // The journal is gone once the file is whole again
+    char _fileName[1024];
+    char _journalName[1024 + 8];
+    collection_file(_fileName, sizeof(_fileName), DATABASE, "docs");
+    snprintf(_journalName, sizeof(_journalName), "%s%s", _fileName, JOURNAL_SUFFIX);
+    FILE* _journal = fopen(_journalName, "rb");
+    if (_journal) fclose(_journal);
+    ASSERT_TRUE_LOG(_journal == NULL);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "change") == 0) return change_and_stop();
+
+    printf("Running rollback journal tests...\n");
+
+    testTornPagesRolledBack(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All rollback journal tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
@@ -0,0 +1,209 @@
+#include "TestSupport.h"
+
+#define DATABASE "pages"
+
+static char document[8192];
+
+// A document with a padding field of length bytes. Updates alter the first field of their
+// data, so they replace the padding alone.
+static const char* padded(const int length, const char fill) {
+    int _size = snprintf(document, sizeof(document), "{\"pad\":\"");
+    memset(document + _size, fill, length);
+    snprintf(document + _size + length, sizeof(document) - _size - length, "\",\"n\":1}");
+    return document;
+}
+
+static Output update_by_id(const char* collectionName, const int id, const char* data) {
+    char _id[24];
+    id_text(_id, id);
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.value = _id;
+    config.action = alter;
+    config.data = data;
+    return update_document_by_id(config);
+}
+
+static Output remove_by_id(const char* collectionName, const int id) {
+    char _id[24];
+    id_text(_id, id);
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.value = _id;
+    return remove_document_by_id(config);
+}
+
+// Length of the padding of the document with an id, or -1 when there is none
+static int stored_length(const char* collectionName, const int id) {
+    char _id[24];
+    id_text(_id, id);
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.value = _id;
+    const ArrayOut output = print_document_by_id(config);
+    if (output.size != 1) {
+        if (output.size > 0) free_list(output.list, output.size);
+        return -1;
+    }
+    const char* _pad = strstr(output.list[0], "\"pad\"");
+    const char* _start = _pad ? strchr(_pad + 5, '"') : NULL;
+    const char* _end = _start ? strchr(_start + 1, '"') : NULL;
+    const int _length = _end ? (int)(_end - _start - 1) : -1;
+    free_list(output.list, output.size);
+    return _length;
+}
+
+// Test case: A document overwritten no larger than before, or grown within its page, keeps its place
+void testRewriteInPlace(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "inplace", NULL));
+    QueryConfig config = collection_config(DATABASE, "inplace");
+    for (int i = 0; i < 40; i++) {
+        config.data = padded(60, 'a');
+        ASSERT_TRUE_LOG(insert_document(config).success);
+    }
+
+    for (int id = 1; id <= 40; id += 2) ASSERT_TRUE_LOG(update_by_id("inplace", id, padded(10, 'b')).success);
+    for (int id = 2; id <= 40; id += 2) ASSERT_TRUE_LOG(update_by_id("inplace", id, padded(120, 'c')).success);
+
+    for (int id = 1; id <= 40; id++) ASSERT_TRUE_LOG(stored_length("inplace", id) == (id % 2 ? 10 : 120));
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == 40);
+}
+
+// Test case: A document that outgrows its page moves behind a forward, and keeps its id and order
+void testOutgrownDocumentMoves(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "moved", NULL));
+    QueryConfig config = collection_config(DATABASE, "moved");
+    for (int i = 0; i < 30; i++) {
+        config.data = padded(480, 'a');
+        ASSERT_TRUE_LOG(insert_document(config).success);
+    }
+
+    for (int id = 1; id <= 30; id += 3) ASSERT_TRUE_LOG(update_by_id("moved", id, padded(1500, 'b')).success);
+    for (int id = 1; id <= 30; id += 3) ASSERT_TRUE_LOG(update_by_id("moved", id, padded(3000, 'c')).success);
+    for (int id = 1; id <= 30; id += 3) ASSERT_TRUE_LOG(update_by_id("moved", id, padded(20, 'd')).success);
+
+    config.condition = all;
+    const ArrayOut output = print_all_documents(config);
+    ASSERT_TRUE_LOG(output.size == 30);
+    bool _ordered = true;
+    for (int i = 0; i < output.size; i++) _ordered = _ordered && document_id(output.list[i]) == i + 1;
+    free_list(output.list, output.size);
+    ASSERT_TRUE_LOG(_ordered);
+    for (int id = 1; id <= 30; id++) ASSERT_TRUE_LOG(stored_length("moved", id) == (id % 3 == 1 ? 20 : 480));
+}
+
+// Test case: A forwarded document that grows again while its own page has room is not moved
+// into that page behind its own forward, so later removes and updates still reach it
+void testGrowForwardedDocumentTwiceThenRemove(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "regrown", NULL));
+    QueryConfig config = collection_config(DATABASE, "regrown");
+
+    // Two full pages of small documents
+    for (int i = 0; i < 16; i++) {
+        config.data = padded(480, 'a');
+        ASSERT_TRUE_LOG(insert_document(config).success);
+    }
+    // Document 1 outgrows the first page and moves to a new one, which two more documents fill
+    ASSERT_TRUE_LOG(update_by_id("regrown", 1, padded(1500, 'b')).success);
+    for (int i = 0; i < 2; i++) {
+        config.data = padded(1000, 'c');
+        ASSERT_TRUE_LOG(insert_document(config).success);
+    }
+    // Its first page empties, then it outgrows the page it moved to
+    for (int id = 2; id <= 7; id++) ASSERT_TRUE_LOG(remove_by_id("regrown", id).success);
+    ASSERT_TRUE_LOG(update_by_id("regrown", 1, padded(2500, 'd')).success);
+    ASSERT_TRUE_LOG(stored_length("regrown", 1) == 2500);
+
+    ASSERT_TRUE_LOG(update_by_id("regrown", 1, padded(3500, 'e')).success);
+    ASSERT_TRUE_LOG(stored_length("regrown", 1) == 3500);
+
+    config.key = "n";
+    config.value = "1";
+    config.condition = equal;
+    const Output _removed = remove_documents(config);
+    ASSERT_OUTPUT_LOG(_removed.success, _removed);
+    ASSERT_TRUE_LOG(stored_length("regrown", 1) == -1);
+
+    config = collection_config(DATABASE, "regrown");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == 0);
+}
+
+// Test case: Documents larger than a page live in runs of pages, and shrink back into one
+void testLargeDocuments(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "large", NULL));
+    QueryConfig config = collection_config(DATABASE, "large");
+    config.data = padded(100, 'a');
+    ASSERT_TRUE_LOG(insert_document(config).success);
+    config.data = padded(7000, 'b');
+    ASSERT_TRUE_LOG(insert_document(config).success);
+
+    ASSERT_TRUE_LOG(stored_length("large", 2) == 7000);
+    ASSERT_TRUE_LOG(update_by_id("large", 1, padded(6000, 'c')).success);
+    ASSERT_TRUE_LOG(update_by_id("large", 2, padded(50, 'd')).success);
+    ASSERT_TRUE_LOG(stored_length("large", 1) == 6000);
+    ASSERT_TRUE_LOG(stored_length("large", 2) == 50);
+
+    ASSERT_TRUE_LOG(remove_by_id("large", 1).success);
+    ASSERT_TRUE_LOG(remove_by_id("large", 2).success);
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == 0);
+}
+
+// Test case: Random inserts, updates and removes agree with a model of the collection, for
+// both a paged and an LSM collection
+void testRandomChurnMatchesModel(void) {
+    const char* _storages[] = { NULL, "lsm" };
+    for (int s = 0; s < 2; s++) {
+        enum { MAX_DOCUMENTS = 600 };
+        static int _lengths[MAX_DOCUMENTS + 1];
+        int _count = 0;
+        ASSERT_TRUE_LOG(fresh_collection(DATABASE, "churn", _storages[s]));
+        QueryConfig config = collection_config(DATABASE, "churn");
+        srand(11);
+
+        for (int op = 0; op < 2500; op++) {
+            const int _roll = rand() % 10;
+            const int _id = 1 + rand() % (_count ? _count : 1);
+            const int _length = rand() % 4 == 0 ? 1000 + rand() % 3000 : rand() % 300;
+            if ((_roll < 3 || _count == 0) && _count < MAX_DOCUMENTS) {
+                config.data = padded(_length, 'a');
+                ASSERT_TRUE_LOG(insert_document(config).success);
+                _lengths[++_count] = _length;
+            } else if (_roll < 5) {
+                ASSERT_TRUE_LOG(remove_by_id("churn", _id).success == (_lengths[_id] >= 0));
+                _lengths[_id] = -1;
+            } else {
+                ASSERT_TRUE_LOG(update_by_id("churn", _id, padded(_length, 'b')).success == (_lengths[_id] >= 0));
+                if (_lengths[_id] >= 0) _lengths[_id] = _length;
+            }
+        }
+        for (int id = 1; id <= _count; id++) ASSERT_TRUE_LOG(stored_length("churn", id) == _lengths[id]);
+
+        // A filtered remove reaches every document, wherever it moved to
+        config.key = "n";
+        config.value = "1";
+        config.condition = equal;
+        const Output _removed = remove_documents(config);
+        ASSERT_OUTPUT_LOG(_removed.success, _removed);
+        config = collection_config(DATABASE, "churn");
+        config.condition = all;
+        ASSERT_TRUE_LOG(count_documents(config) == 0);
+    }
+}
+
+int main() {
+    printf("Running PageStore tests...\n");
+
+    testRewriteInPlace();
+    testOutgrownDocumentMoves();
+    testGrowForwardedDocumentTwiceThenRemove();
+    testLargeDocuments();
+    testRandomChurnMatchesModel();
+
+    if (failures == 0) {
+        printf("[PASS] All PageStore tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
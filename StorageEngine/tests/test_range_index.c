@@ -0,0 +1,72 @@
+#include "TestSupport.h"
+
+#define DATABASE "ranges"
+
+static int count_range(const char* collectionName, const char* value, const Condition condition) {
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    config.key = "n";
+    config.value = value;
+    config.condition = condition;
+    return count_documents(config);
+}
+
+// Test case: A range index built over no numbers for its key is empty, and takes the numbers
+// inserted after it
+void testIndexWithoutNumbers(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "empty", NULL));
+    QueryConfig config = collection_config(DATABASE, "empty");
+    config.key = "n";
+    Output output = create_range_index(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    ASSERT_TRUE_LOG(count_range("empty", "0", greaterThan) == 0);
+
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "text", NULL));
+    config = collection_config(DATABASE, "text");
+    config.data = "[{\"n\":\"one\"},{\"m\":2}]";
+    ASSERT_TRUE_LOG(insert_document(config).success);
+    config.key = "n";
+    output = create_range_index(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    ASSERT_TRUE_LOG(count_range("text", "0", greaterThan) == 0);
+
+    config = collection_config(DATABASE, "text");
+    config.data = "[{\"n\":5},{\"n\":9}]";
+    ASSERT_TRUE_LOG(insert_document(config).success);
+    ASSERT_TRUE_LOG(count_range("text", "5", greaterThanEqual) == 2);
+    ASSERT_TRUE_LOG(count_range("text", "6", lessThan) == 1);
+}
+
+// Test case: Range filters through the index match a scan of the documents
+void testRangesMatchScan(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "numbers", NULL));
+    QueryConfig config = collection_config(DATABASE, "numbers");
+    for (int i = 0; i < 500; i++) {
+        char _data[32];
+        snprintf(_data, sizeof(_data), "{\"n\":%d}", (i * 37) % 500);
+        config.data = _data;
+        ASSERT_TRUE_LOG(insert_document(config).success);
+    }
+    config.key = "n";
+    ASSERT_TRUE_LOG(create_range_index(config).success);
+
+    ASSERT_TRUE_LOG(count_range("numbers", "100", lessThan) == 100);
+    ASSERT_TRUE_LOG(count_range("numbers", "100", lessThanEqual) == 101);
+    ASSERT_TRUE_LOG(count_range("numbers", "450", greaterThan) == 49);
+    ASSERT_TRUE_LOG(count_range("numbers", "450", greaterThanEqual) == 50);
+    ASSERT_TRUE_LOG(count_range("numbers", "-1", lessThan) == 0);
+}
+
+int main() {
+    printf("Running RangeIndex tests...\n");
+
+    testIndexWithoutNumbers();
+    testRangesMatchScan();
+
+    if (failures == 0) {
+        printf("[PASS] All RangeIndex tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
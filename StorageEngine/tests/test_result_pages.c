@@ -0,0 +1,112 @@
+#include "TestSupport.h"
+
+#define DATABASE "paging"
+
+// Read a query page by page, limit documents at a time, and check each page holds ids in
+// order. Returns the number of pages, or -1 when a page is wrong or a read fails.
+static int read_pages(QueryConfig config, const int limit, const int expected) {
+    char _resume[MAX_RESUME_LEN] = "";
+    int _pages = 0, _seen = 0, _last = 0;
+    config.limit = limit;
+    do {
+        config.resume = _resume[0] ? _resume : NULL;
+        const ArrayOut output = config.key ? print_documents(config) : print_all_documents(config);
+        if (output.size <= 0 || output.size > limit) return -1;
+        for (int i = 0; i < output.size; i++) {
+            const int _id = document_id(output.list[i]);
+            if (_id <= _last) return -1;
+            _last = _id;
+        }
+        _seen += output.size;
+        _pages++;
+        memcpy(_resume, output.resume, sizeof(_resume));
+        free_list(output.list, output.size);
+    } while (_resume[0]);
+    return _seen == expected ? _pages : -1;
+}
+
+static bool insert_numbers(const char* collectionName, const int count) {
+    QueryConfig config = collection_config(DATABASE, collectionName);
+    for (int i = 1; i <= count; i++) {
+        char _data[32];
+        snprintf(_data, sizeof(_data), "{\"n\":%d}", i);
+        config.data = _data;
+        if (!insert_document(config).success) return false;
+    }
+    return true;
+}
+
+// Test case: A page that ends on the last document carries no resume token, for a paged
+// collection, an LSM collection and a key read through an index
+void testLastPageHasNoToken(void) {
+    const char* _storages[] = { NULL, "lsm" };
+    for (int s = 0; s < 2; s++) {
+        ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", _storages[s]));
+        ASSERT_TRUE_LOG(insert_numbers("docs", 10));
+        QueryConfig config = collection_config(DATABASE, "docs");
+        config.condition = all;
+
+        ASSERT_TRUE_LOG(read_pages(config, 5, 10) == 2);
+        ASSERT_TRUE_LOG(read_pages(config, 10, 10) == 1);
+        ASSERT_TRUE_LOG(read_pages(config, 4, 10) == 3);
+
+        // Six matches, the last of them followed by documents that do not match
+        config.key = "n";
+        config.value = "6";
+        config.condition = lessThanEqual;
+        ASSERT_TRUE_LOG(read_pages(config, 3, 6) == 2);
+        ASSERT_TRUE_LOG(create_index(config).success);
+        config.value = "4";
+        config.condition = greaterThan;
+        ASSERT_TRUE_LOG(read_pages(config, 3, 6) == 2);
+        ASSERT_TRUE_LOG(read_pages(config, 5, 6) == 2);
+    }
+}
+
+// Test case: A token whose documents were removed since gives an empty result, with no error
+// text left from an earlier call
+void testEmptyResultMessage(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "emptied", NULL));
+    ASSERT_TRUE_LOG(insert_numbers("emptied", 4));
+    QueryConfig config = collection_config(DATABASE, "emptied");
+    config.condition = all;
+    config.limit = 2;
+    const ArrayOut _first = print_all_documents(config);
+    ASSERT_TRUE_LOG(_first.size == 2 && _first.resume[0]);
+    char _resume[MAX_RESUME_LEN];
+    memcpy(_resume, _first.resume, sizeof(_resume));
+    free_list(_first.list, _first.size);
+
+    config.resume = "bad";
+    ASSERT_TRUE_LOG(print_all_documents(config).size < 0);
+
+    config.resume = NULL;
+    config.limit = 0;
+    config.key = "n";
+    config.value = "2";
+    config.condition = greaterThan;
+    ASSERT_TRUE_LOG(remove_documents(config).success);
+
+    config = collection_config(DATABASE, "emptied");
+    config.condition = all;
+    config.limit = 2;
+    config.resume = _resume;
+    const ArrayOut output = print_all_documents(config);
+    ASSERT_TRUE_LOG(output.size == 0);
+    ASSERT_TRUE_LOG(strcmp(output.message, "fatal: Collection 'emptied' contains no documents\n") == 0);
+}
+
+int main() {
+    printf("Running result page tests...\n");
+
+    testLastPageHasNoToken();
+    testEmptyResultMessage();
+
+    if (failures == 0) {
+        printf("[PASS] All result page tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
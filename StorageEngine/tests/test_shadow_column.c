@@ -0,0 +1,273 @@
+#include <math.h>
+#include "TestSupport.h"
+#include "ColumnStore.h"
+#include "DocumentCodec.h"
+#include "FilterKernels.h"
+
+#define DATABASE "columns"
+#define DOCUMENTS 5000
+#define BATCH 1000
+#define NUMBERS (3 * SELECTION_BITS + 17)
+
+static const Condition conditions[] = { greaterThan, greaterThanEqual, lessThan, lessThanEqual, equal, notEqual };
+static const char* limits[] = { "12", "0", "-3.25", "1e300", "-1e300", "nan", "abc" };
+
+// A document as a plain scan of the collection frames finds it
+typedef struct {
+    uint64_t recordId;
+    int id;
+    bool number;
+    double value;
+} ScannedRow;
+
+typedef struct {
+    ScannedRow* rows;
+    int count;
+} Scan;
+
+static char batch[BATCH * 64];
+static ScannedRow scanned[DOCUMENTS];
+
+static bool compare(const double number, const double limit, const Condition condition) {
+    switch (condition) {
+        case greaterThan: return number > limit;
+        case greaterThanEqual: return number >= limit;
+        case lessThan: return number < limit;
+        case lessThanEqual: return number <= limit;
+        case equal: return number == limit;
+        case notEqual: return number != limit;
+        default: return false;
+    }
+}
+
+// "n" cycles through nulls, strings, booleans, a missing key, objects, negative zero, huge
+// numbers and fractions around the limits, so that every selection word mixes them
+static void document(char* array, const size_t size, const int i, const int sign) {
+    switch (i % 12) {
+        case 0: snprintf(array, size, "{\"n\":null}"); break;
+        case 1: snprintf(array, size, "{\"n\":\"12\"}"); break;
+        case 2: snprintf(array, size, "{\"n\":true}"); break;
+        case 3: snprintf(array, size, "{\"m\":%d}", i); break;
+        case 4: snprintf(array, size, "{\"n\":-0.0}"); break;
+        case 5: snprintf(array, size, "{\"n\":{\"x\":1}}"); break;
+        case 6: snprintf(array, size, "{\"n\":%d}", 12 * sign); break;
+        case 7: snprintf(array, size, "{\"n\":%de300}", sign); break;
+        case 8: snprintf(array, size, "{\"n\":%de300}", -sign); break;
+        default: snprintf(array, size, "{\"n\":%.2f}", sign * ((i * 37 % 200) - 100) / 4.0); break;
+    }
+}
+
+static bool load_documents(void) {
+    QueryConfig config = collection_config(DATABASE, "docs");
+    char _document[64];
+    for (int start = 0; start < DOCUMENTS; start += BATCH) {
+        char* _cursor = batch;
+        _cursor += sprintf(_cursor, "[");
+        for (int i = start; i < start + BATCH; i++) {
+            document(_document, sizeof(_document), i, 1);
+            _cursor += sprintf(_cursor, "%s%s", i > start ? "," : "", _document);
+        }
+        sprintf(_cursor, "]");
+        config.data = batch;
+        if (!insert_document(config).success) return false;
+    }
+    return true;
+}
+
+// Frame visitor: note the record id, "_id" and number of "n" of a document
+static bool scan_row(void* context, const CollectionHeader* header, const uint64_t recordId, const char* frame, const size_t length) {
+    Scan* _scan = context;
+    if (_scan->count == DOCUMENTS) return false;
+    cJSON* _document = header->version >= 3 ? decode_value((const uint8_t*)frame, length) : cJSON_ParseWithLength(frame, length);
+    const cJSON* _id = cJSON_GetObjectItemCaseSensitive(_document, "_id");
+    const cJSON* _number = cJSON_GetObjectItemCaseSensitive(_document, "n");
+
+    ScannedRow* _row = &_scan->rows[_scan->count++];
+    _row->recordId = recordId;
+    _row->id = cJSON_IsNumber(_id) ? _id->valueint : -1;
+    _row->number = cJSON_IsNumber(_number);
+    _row->value = _row->number ? _number->valuedouble : 0;
+    cJSON_Delete(_document);
+    return true;
+}
+
+static int compare_records(const void* left, const void* right) {
+    const uint64_t _left = *(const uint64_t*)left, _right = *(const uint64_t*)right;
+    return (_left > _right) - (_left < _right);
+}
+
+// Whether the shadow column selects the record ids a plain scan finds for a condition, and a
+// filtered print through it prints the same documents
+static bool column_matches_scan(const Condition condition, const char* limit) {
+    char _path[1024];
+    collection_file(_path, sizeof(_path), DATABASE, "docs");
+    Scan _scan = { scanned, 0 };
+    if (!walk_frames(_path, scan_row, &_scan)) return false;
+
+    uint64_t* _ids = NULL;
+    const int _count = column_lookup(DATABASE, "docs", "n", limit, condition, _path, &_ids);
+
+    // Equality also matches strings and booleans, so the column leaves it to a scan
+    if (condition == equal) {
+        free(_ids);
+        return _count == -1;
+    }
+
+    static uint64_t _expected[DOCUMENTS];
+    static bool _printed[DOCUMENTS + 1], _matched[DOCUMENTS + 1];
+    memset(_matched, 0, sizeof(_matched));
+    int _matches = 0;
+    for (int i = 0; i < _scan.count; i++) {
+        if (!_scan.rows[i].number || !compare(_scan.rows[i].value, atof(limit), condition)) continue;
+        _expected[_matches++] = _scan.rows[i].recordId;
+        if (_scan.rows[i].id > 0 && _scan.rows[i].id <= DOCUMENTS) _matched[_scan.rows[i].id] = true;
+    }
+    qsort(_expected, (size_t)_matches, sizeof(uint64_t), compare_records);
+
+    const bool _selected = _count == _matches && (_matches == 0 || memcmp(_ids, _expected, _matches * sizeof(uint64_t)) == 0);
+    free(_ids);
+
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.key = "n";
+    config.value = limit;
+    config.condition = condition;
+    const ArrayOut output = print_documents(config);
+    memset(_printed, 0, sizeof(_printed));
+    for (int i = 0; i < output.size; i++) {
+        const int _id = document_id(output.list[i]);
+        if (_id > 0 && _id <= DOCUMENTS) _printed[_id] = true;
+    }
+    if (output.size > 0) free_list(output.list, output.size);
+
+    const bool _same = (output.size < 0 ? 0 : output.size) == _matches && memcmp(_printed, _matched, sizeof(_printed)) == 0;
+    if (!_selected || !_same) {
+        fprintf(stderr, "   condition %d, limit %s: %d selected, %d printed, %d scanned\n", condition, limit, _count, output.size, _matches);
+    }
+    return _selected && _same;
+}
+
+static bool columns_match_scan(void) {
+    for (size_t c = 0; c < sizeof(conditions) / sizeof(conditions[0]); c++) {
+        for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+            if (!column_matches_scan(conditions[c], limits[l])) return false;
+        }
+    }
+    return true;
+}
+
+// Test case: Every kernel selects what the C comparisons do, over whole and partial words,
+// NaN, infinities and signed zeros included
+void testKernelMatchesComparisons(void) {
+    double _numbers[NUMBERS];
+    const double _specials[] = { NAN, INFINITY, -INFINITY, 0.0, -0.0, 12, -12, 0.5, 1e300, -1e300 };
+    for (int i = 0; i < NUMBERS; i++) {
+        _numbers[i] = i % 3 == 0 ? _specials[i / 3 % 10] : (i * 7 % 50) / 2.0 - 12;
+    }
+    const double _limits[] = { 0.0, -0.0, 12, -3.5, NAN, INFINITY, -INFINITY };
+
+    for (size_t c = 0; c < sizeof(conditions) / sizeof(conditions[0]); c++) {
+        for (size_t l = 0; l < sizeof(_limits) / sizeof(_limits[0]); l++) {
+            // Every length up to a few words, so that each kernel ends on a partial word
+            for (size_t _count = 1; _count <= NUMBERS; _count += 5) {
+                uint64_t _selection[NUMBERS / SELECTION_BITS + 1];
+                select_numbers(_numbers, _count, _limits[l], conditions[c], _selection);
+                bool _same = true;
+                for (size_t i = 0; i < _count; i++) {
+                    _same = _same && (bool)(_selection[i / SELECTION_BITS] >> (i % SELECTION_BITS) & 1) ==
+                                     compare(_numbers[i], _limits[l], conditions[c]);
+                }
+                if (!_same) fprintf(stderr, "   kernel %d, condition %d, limit %g, %zu numbers\n", filter_kernel(), conditions[c], _limits[l], _count);
+                ASSERT_TRUE_LOG(_same);
+            }
+        }
+    }
+}
+
+// Test case: A shadow column selects the numbers a plain scan finds for every condition,
+// leaving out nulls, strings, booleans, objects and documents without the key
+void testLookupMatchesScan(void) {
+    ASSERT_TRUE_LOG(fresh_collection(DATABASE, "docs", NULL));
+    ASSERT_TRUE_LOG(load_documents());
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.key = "n";
+    const Output output = create_column(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    ASSERT_TRUE_LOG(columns_match_scan());
+
+    // Updates extend the column in place
+    config.key = "_id";
+    config.value = "2500";
+    config.condition = lessThanEqual;
+    config.action = alter;
+    config.data = "{\"n\":7.5}";
+    ASSERT_TRUE_LOG(update_documents(config).success);
+    ASSERT_TRUE_LOG(columns_match_scan());
+}
+
+// Test case: A column file left behind by a mutation is rebuilt rather than read, and a
+// rewrite of the collection rebuilds its columns
+void testStaleColumnRebuilt(void) {
+    // Keep the column file as it is, change the collection, then put the old file back for a
+    // column loaded afresh to find
+    char _columnFile[MAX_PATH_LEN];
+    get_key_file(_columnFile, DATABASE, "docs", "n", COLUMN_SUFFIX);
+    FILE* _file = fopen(_columnFile, "rb");
+    ASSERT_TRUE_LOG(_file != NULL);
+    static char _saved[DOCUMENTS * 64];
+    const size_t _length = fread(_saved, 1, sizeof(_saved), _file);
+    fclose(_file);
+    ASSERT_TRUE_LOG(_length > 0 && _length < sizeof(_saved));
+
+    QueryConfig config = collection_config(DATABASE, "docs");
+    config.key = "n";
+    config.value = "0";
+    config.condition = lessThan;
+    config.action = alter;
+    config.data = "{\"n\":100}";
+    ASSERT_TRUE_LOG(update_documents(config).success);
+
+    _file = fopen(_columnFile, "wb");
+    ASSERT_TRUE_LOG(_file != NULL);
+    const bool _restored = fwrite(_saved, 1, _length, _file) == _length;
+    fclose(_file);
+    ASSERT_TRUE_LOG(_restored);
+    column_invalidate(DATABASE, "docs");
+    ASSERT_TRUE_LOG(columns_match_scan());
+    ASSERT_TRUE_LOG(count_documents(config) == 0);
+
+    // Removed documents leave their rows behind until the collection is rewritten, which
+    // also moves the documents that are left to other record ids
+    config.value = "100";
+    config.condition = greaterThanEqual;
+    const Output output = remove_documents(config);
+    ASSERT_OUTPUT_LOG(output.success, output);
+    ASSERT_TRUE_LOG(convert_collection(collection_config(DATABASE, "docs")).success);
+
+    // The rewrite leaves a column file that describes the new collection file
+    char _path[1024];
+    collection_file(_path, sizeof(_path), DATABASE, "docs");
+    ColumnHeader _header;
+    _file = fopen(_columnFile, "rb");
+    ASSERT_TRUE_LOG(_file != NULL);
+    const bool _read = fread(&_header, sizeof(_header), 1, _file) == 1;
+    fclose(_file);
+    ASSERT_TRUE_LOG(_read && _header.appliedLsn == get_applied_lsn(_path) && (long long)_header.coveredLength == get_file_size(_path));
+    ASSERT_TRUE_LOG(columns_match_scan());
+    ASSERT_TRUE_LOG(count_documents(config) == 0);
+}
+
+int main(void) {
+    printf("Running shadow column tests...\n");
+
+    testKernelMatchesComparisons();
+    testLookupMatchesScan();
+    testStaleColumnRebuilt();
+
+    if (failures == 0) {
+        printf("[PASS] All shadow column tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
@@ -0,0 +1,104 @@
+#include <windows.h>
+#include "TestSupport.h"
+
+#define WRITERS 6
+#define INSERTS 200
+
+static const char* writeDatabase;
+static bool writerFailed[WRITERS];
+
+// Path of the write-ahead log of a database
+static void wal_file(char* array, const size_t size, const char* databaseName) {
+    snprintf(array, size, "%s/ProtonDB/db/%s/.wal", getenv("APPDATA"), databaseName);
+}
+
+static DWORD WINAPI insert_worker(void* context) {
+    const int _writer = (int)(intptr_t)context;
+    char _collection[16];
+    snprintf(_collection, sizeof(_collection), "c%d", _writer);
+    QueryConfig config = collection_config(writeDatabase, _collection);
+    for (int i = 0; i < INSERTS; i++) {
+        char _data[64];
+        snprintf(_data, sizeof(_data), "{\"writer\":%d,\"n\":%d}", _writer, i);
+        config.data = _data;
+        if (!insert_document(config).success) writerFailed[_writer] = true;
+    }
+    return 0;
+}
+
+// Phase run in a process of its own: concurrent writers share group commits, and the process
+// then ends without a checkpoint, so their documents only survive through the log
+static int write_concurrently(const char* databaseName) {
+    writeDatabase = databaseName;
+    QueryConfig config = collection_config(databaseName, "c0");
+    drop_database(config);
+    if (!create_database(config).success) return 1;
+    for (int w = 0; w < WRITERS; w++) {
+        char _collection[16];
+        snprintf(_collection, sizeof(_collection), "c%d", w);
+        config.collectionName = _collection;
+        if (!create_collection(config).success) return 1;
+    }
+
+    HANDLE _threads[WRITERS];
+    for (int w = 0; w < WRITERS; w++) _threads[w] = CreateThread(NULL, 0, insert_worker, (void*)(intptr_t)w, 0, NULL);
+    bool _failed = false;
+    for (int w = 0; w < WRITERS; w++) {
+        WaitForSingleObject(_threads[w], INFINITE);
+        CloseHandle(_threads[w]);
+        _failed = _failed || writerFailed[w];
+    }
+    fflush(stdout);
+    _Exit(_failed ? 1 : 0);
+}
+
+// Test case: Every acknowledged insert of concurrent writers is recovered from the log
+void testConcurrentWritersRecoverAfterCrash(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "write concurrent") == 0);
+
+    for (int w = 0; w < WRITERS; w++) {
+        char _collection[16];
+        snprintf(_collection, sizeof(_collection), "c%d", w);
+        QueryConfig config = collection_config("concurrent", _collection);
+        config.condition = all;
+        ASSERT_TRUE_LOG(count_documents(config) == INSERTS);
+    }
+}
+
+// Test case: A frame torn at the end of the log is trimmed, and the log takes new records after it
+void testTornTailIsTrimmed(const char* self) {
+    ASSERT_TRUE_LOG(run_phase(self, "write torn") == 0);
+
+    char _path[1024];
+    wal_file(_path, sizeof(_path), "torn");
+    FILE* _file = fopen(_path, "ab");
+    ASSERT_TRUE_LOG(_file != NULL);
+    const char _torn[] = { 40, 0, 0, 0, 1, 2, 3, 4, 'x', 'y' };
+    fwrite(_torn, 1, sizeof(_torn), _file);
+    fclose(_file);
+
+    QueryConfig config = collection_config("torn", "c0");
+    config.condition = all;
+    ASSERT_TRUE_LOG(count_documents(config) == INSERTS);
+
+    config.data = "{\"after\":1}";
+    ASSERT_TRUE_LOG(insert_document(config).success);
+    ASSERT_TRUE_LOG(count_documents(config) == INSERTS + 1);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && strcmp(argv[1], "write") == 0) return write_concurrently(argv[2]);
+
+    printf("Running WriteAheadLog tests...\n");
+
+    testConcurrentWritersRecoverAfterCrash(argv[0]);
+    testTornTailIsTrimmed(argv[0]);
+
+    if (failures == 0) {
+        printf("[PASS] All WriteAheadLog tests passed.\n");
+        return 0;
+    } else {
+        printf("[FAIL] %d test(s) failed.\n", failures);
+        return 1;
+    }
+}
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "protondb/Connection.hpp"
 #include "protondb/Exception.hpp"
 #include "protondb/Config.hpp"
@@ -31,6 +32,13 @@ public:
     /// Execute a raw JSON string (must conform to protocol)
     std::string executeRaw(const std::string& rawJson);
 
+    /// Print documents of a collection with only the given fields (dotted keys such as
+    /// "address.city"), optionally filtered by a condition. The server builds and sends only
+    /// those fields; an empty field list prints whole documents.
+    std::string print(const std::string& collection,
+                      const std::vector<std::string>& fields,
+                      const std::string& condition = "");
+
     /// Send a FETCH command to retrieve next result batch
     std::string fetch();
 
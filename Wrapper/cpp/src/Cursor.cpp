@@ -69,6 +69,35 @@ std::string Cursor::executeRaw(const std::string& rawJson) {
     return lastResponse_;
 }
 
+//------------------------------------------------------------------------------
+// Prints documents with only the given fields: <collection>.print([a, b], condition)
+//------------------------------------------------------------------------------
+
+std::string Cursor::print(const std::string& collection,
+                          const std::vector<std::string>& fields,
+                          const std::string& condition) {
+    if (collection.empty()) {
+        throw ProtocolError("print: collection is empty", "");
+    }
+
+    std::ostringstream command;
+    command << collection << ".print(";
+    if (!fields.empty()) {
+        command << '[';
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i].empty() || fields[i].find_first_of(",[]") != std::string::npos) {
+                throw ProtocolError("print: invalid field '" + fields[i] + "'", "");
+            }
+            command << (i ? ", " : "") << fields[i];
+        }
+        command << ']';
+        if (!condition.empty()) command << ", ";
+    }
+    command << condition << ')';
+
+    return execute(command.str());
+}
+
 //------------------------------------------------------------------------------
 // Issues FETCH command for incremental data
 //------------------------------------------------------------------------------
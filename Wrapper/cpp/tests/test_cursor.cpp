@@ -171,12 +171,34 @@ void testAutoReconnectOnConnectionFailure() {
     }
 }
 
+// Test case: Verifies that printing from an empty collection name throws a `ProtocolError` before anything is sent.
+void testPrintEmptyCollectionThrowsProtocolError() {
+    Connection conn;
+    Cursor cursor(conn);
+    ASSERT_THROW_LOG(cursor.print("", {"name"}), ProtocolError);
+    ASSERT_THROW_LOG(cursor.print("", {}), ProtocolError);
+    ASSERT_FALSE_LOG(conn.isConnected());
+}
+
+// Test case: Verifies that a field which would break the print command results in a `ProtocolError`.
+void testPrintInvalidFieldThrowsProtocolError() {
+    Connection conn;
+    Cursor cursor(conn);
+    ASSERT_THROW_LOG(cursor.print("users", {"name,age"}), ProtocolError);
+    ASSERT_THROW_LOG(cursor.print("users", {"tags[0]"}), ProtocolError);
+    ASSERT_THROW_LOG(cursor.print("users", {"name", "address]"}), ProtocolError);
+    ASSERT_THROW_LOG(cursor.print("users", {"name", ""}, "age > 30"), ProtocolError);
+    ASSERT_FALSE_LOG(conn.isConnected());
+}
+
 int main() {
     std::cout << "Running Connection tests...\n";
 
     testDefaultConstructorNotConnected();
     testCloseOnDefaultDoesNotThrow();
     testSetOptionsOnDefaultDoesNotThrow();
+    testPrintEmptyCollectionThrowsProtocolError();
+    testPrintInvalidFieldThrowsProtocolError();
     testConnectInvalidHostThrowsConnectionError();
     testConnectInvalidPortThrowsConnectionError();
     testConnectEmptyCredentialsThrowsProtocolError();